@@ -25,6 +25,15 @@ public abstract class AbstractAudioPlayer implements LibAndrudio.NativeCallbacks
     LibAndrudio.setListener(handle, this);
   }
 
+  /**
+   * @param engineHandle run the player on this engine, see {@link LibAndrudio#createEngine(int)}
+   */
+  public AbstractAudioPlayer(long engineHandle) {
+    super();
+    handle = LibAndrudio.createInEngine(engineHandle);
+    LibAndrudio.setListener(handle, this);
+  }
+
   protected void onStateChange(State oldState, State state) {
     this.state = state;
 
@@ -92,6 +101,15 @@ public abstract class AbstractAudioPlayer implements LibAndrudio.NativeCallbacks
       case EVENT_STATE_CHANGE:
         onStateChange(stateValues[arg1], stateValues[arg2]);
         break;
+      case EVENT_BUFFERING_START:
+        onBufferingStart(arg1 != 0);
+        break;
+      case EVENT_BUFFERING_END:
+        onBufferingEnd(arg1);
+        break;
+      case EVENT_DURATION_UPDATED:
+        onDurationUpdated(arg1);
+        break;
     }
   }
 
@@ -123,6 +141,24 @@ public abstract class AbstractAudioPlayer implements LibAndrudio.NativeCallbacks
 
   protected abstract void onSeekComplete();
 
+  /**
+   * @param underrun true if the buffer ran empty during playback
+   */
+  protected void onBufferingStart(boolean underrun) {
+  }
+
+  /**
+   * @param millis time spent buffering
+   */
+  protected void onBufferingEnd(int millis) {
+  }
+
+  /**
+   * @param millis the exact duration, see {@link #setExactDuration(boolean)}
+   */
+  protected void onDurationUpdated(int millis) {
+  }
+
   /**
    * @return playback position in millis or -1 if track is invalid
    */
@@ -143,10 +179,117 @@ public abstract class AbstractAudioPlayer implements LibAndrudio.NativeCallbacks
     LibAndrudio.setDataSource(handle, url);
   }
 
+  /**
+   * sets mirrors of one source, prepare plays whichever opens first
+   */
+  public void setDataSources(String... urls) {
+    LibAndrudio.setDataSources(handle, urls);
+  }
+
+  /**
+   * resets the player and prepares a source returned by {@link LibAndrudio#preload(String)}
+   *
+   * @param preloadHandle the preload, owned by the player after this call
+   */
+  public void playPreloaded(long preloadHandle) {
+    reset();
+    LibAndrudio.setDataSourcePreloaded(handle, preloadHandle);
+  }
+
   public boolean isLooping() {
     return LibAndrudio.isLooping(handle);
   }
 
+  public void setGain(double gainDb) {
+    LibAndrudio.setGain(handle, gainDb);
+  }
+
+  /**
+   * @see LibAndrudio#setTempo(long, double)
+   */
+  public void setTempo(double tempo) {
+    LibAndrudio.setTempo(handle, tempo);
+  }
+
+  /**
+   * @see LibAndrudio#setEq(long, double[], double[], double[])
+   */
+  public int setEq(double[] freqsHz, double[] gainsDb, double[] qs) {
+    return LibAndrudio.setEq(handle, freqsHz, gainsDb, qs);
+  }
+
+  /**
+   * @see LibAndrudio#setGraphicEq(long, double[])
+   */
+  public int setGraphicEq(double[] gainsDb) {
+    return LibAndrudio.setGraphicEq(handle, gainsDb);
+  }
+
+  /**
+   * @see LibAndrudio#setNormalization(long, double, double, double)
+   */
+  public void setNormalization(double integratedLufs, double truePeakDbtp,
+                               double targetLufs) {
+    LibAndrudio.setNormalization(handle, integratedLufs, truePeakDbtp, targetLufs);
+  }
+
+  /**
+   * @see LibAndrudio#startSpectrumAnalyzer(long, int, int)
+   */
+  public boolean startSpectrumAnalyzer(int bands, int rateHz) {
+    return LibAndrudio.startSpectrumAnalyzer(handle, bands, rateHz);
+  }
+
+  public void stopSpectrumAnalyzer() {
+    LibAndrudio.stopAnalyzer(handle);
+  }
+
+  /**
+   * @see LibAndrudio#readSpectrum(long, float[])
+   */
+  public int readSpectrum(float[] bands) {
+    return LibAndrudio.readSpectrum(handle, bands);
+  }
+
+  public void setJitterBuffer(int minMillis, int maxMillis) {
+    LibAndrudio.setJitterBuffer(handle, minMillis, maxMillis);
+  }
+
+  /**
+   * @see LibAndrudio#setSilenceTrim(long, boolean, double, int, boolean)
+   */
+  public void setSilenceTrim(boolean enabled, double thresholdDb, int minMillis,
+                             boolean trimEnd) {
+    LibAndrudio.setSilenceTrim(handle, enabled, thresholdDb, minMillis, trimEnd);
+  }
+
+  /**
+   * @see LibAndrudio#setSeekIndex(long, int)
+   */
+  public void setSeekIndex(int mode) {
+    LibAndrudio.setSeekIndex(handle, mode);
+  }
+
+  /**
+   * @see LibAndrudio#setExactDuration(long, boolean)
+   */
+  public void setExactDuration(boolean enabled) {
+    LibAndrudio.setExactDuration(handle, enabled);
+  }
+
+  public LibAndrudio.Stats getStats(LibAndrudio.Stats stats) {
+    LibAndrudio.getStats(handle, stats);
+    return stats;
+  }
+
+  public void setEarlyStart(boolean earlyStart) {
+    LibAndrudio.setEarlyStart(handle, earlyStart);
+  }
+
+  public void setRenderMode(boolean render) {
+    LibAndrudio.setRenderMode(handle, render);
+  }
+
   public boolean isPaused() {
     return state == State.PAUSED;
   }
@@ -155,6 +298,13 @@ public abstract class AbstractAudioPlayer implements LibAndrudio.NativeCallbacks
     return state == State.STARTED;
   }
 
+  /**
+   * @see LibAndrudio#getCoverArt(long)
+   */
+  public long getCoverArt() {
+    return LibAndrudio.getCoverArt(handle);
+  }
+
   public void getMetaData(Map<String, String> map) {
     LibAndrudio.getMetaData(handle, map);
   }
@@ -1,5 +1,8 @@
 package danbroid.andrudio;
 
+import java.nio.ByteBuffer;
+import java.util.Arrays;
+import java.util.HashMap;
 import java.util.Map;
 
 /**
@@ -36,6 +39,41 @@ public class LibAndrudio {
 
   private static native long _create();
 
+  /**
+   * Create a player that is run by an engine instead of its own thread
+   *
+   * @param engineHandle from {@link #createEngine(int)}
+   */
+  public static long createInEngine(long engineHandle) {
+    return _createInEngine(engineHandle);
+  }
+
+  private static native long _createInEngine(long engineHandle);
+
+  /**
+   * Start a pool of threads shared by all players created with
+   * {@link #createInEngine(long)}
+   *
+   * @param threads number of worker threads, 0 for the default
+   * @return an engine handle or 0 on failure
+   */
+  public static long createEngine(int threads) {
+    if (!initialized) {
+      synchronized (LibAndrudio.class) {
+        if (!initialized)
+          initialize();
+      }
+    }
+    return _createEngine(threads);
+  }
+
+  private static native long _createEngine(int threads);
+
+  /**
+   * All players of the engine must have been destroyed first
+   */
+  public static native void destroyEngine(long engineHandle);
+
   public static native void setListener(long handle, NativeCallbacks listener);
 
   public static native void destroy(long handle);
@@ -81,14 +119,371 @@ public class LibAndrudio {
 
   private static native void _setDataSource(long handle, String dataSource);
 
+  /**
+   * Set several mirrors of the same source. Prepare opens them all at once,
+   * plays the first with a decodable audio stream and cancels the rest.
+   * Only the first 8 are used.
+   *
+   * @return 0 if successful
+   */
+  public static int setDataSources(long handle, String[] dataSources) {
+    if (dataSources == null || dataSources.length == 0)
+      throw new IllegalArgumentException("no datasources");
+    String[] urls = new String[dataSources.length];
+    for (int i = 0; i < urls.length; i++) {
+      if (dataSources[i] == null)
+        throw new IllegalArgumentException("datasource is null");
+      urls[i] = dataSources[i].startsWith("mms:")
+          ? dataSources[i].replace("mms:", "mmsh:") : dataSources[i];
+    }
+    return _setDataSources(handle, urls);
+  }
+
+  private static native int _setDataSources(long handle, String[] dataSources);
+
+  /**
+   * Open and probe a source in the background and buffer its first seconds so
+   * that a later {@link #setDataSourcePreloaded(long, long)} is prepared
+   * immediately.
+   *
+   * @return a preload handle or 0 on failure
+   */
+  public static long preload(String dataSource) {
+    if (dataSource == null)
+      throw new IllegalArgumentException("datasource is null");
+    if (dataSource.startsWith("mms:"))
+      dataSource = dataSource.replace("mms:", "mmsh:");
+    if (!initialized) {
+      synchronized (LibAndrudio.class) {
+        if (!initialized)
+          initialize();
+      }
+    }
+    return _preload(dataSource);
+  }
+
+  private static native long _preload(String dataSource);
+
+  /**
+   * Release a preload that was not passed to {@link #setDataSourcePreloaded(long, long)}
+   */
+  public static native void releasePreload(long preloadHandle);
+
+  /**
+   * @param maxSources   number of sources kept open, the least recently
+   *                     requested is evicted first
+   * @param bufferMillis audio buffered per source
+   */
+  public static native void setPreloadLimits(int maxSources, int bufferMillis);
+
+  /**
+   * Set the datasource to a preloaded source and prepare it. Takes over the
+   * preload handle.
+   *
+   * @return 0 if successful
+   */
+  public static native int setDataSourcePreloaded(long handle, long preloadHandle);
+
   public static native boolean isLooping(long handle);
 
   public static native void setLooping(long handle, boolean looping);
 
+  /**
+   * Start playback from the first packet instead of waiting for the full
+   * stream analysis. Takes effect on the next prepare.
+   *
+   * @param handle
+   * @param earlyStart
+   */
+  public static native void setEarlyStart(long handle, boolean earlyStart);
+
+  /**
+   * Keep between minMillis and maxMillis of audio buffered ahead of the
+   * decoder, depending on the observed network jitter. Takes effect on the
+   * next prepare.
+   *
+   * @param handle
+   * @param minMillis 0 to disable the buffer
+   * @param maxMillis
+   */
+  public static native void setJitterBuffer(long handle, int minMillis, int maxMillis);
+
+  /**
+   * Skip the silence before the first audible sample and, if trimEnd, end the
+   * track where the silence after the last one starts. Runs of silence shorter
+   * than minMillis are played. With {@link #setCacheDir(String)} set, the next
+   * play of a local file seeks straight past its silence. Takes effect on the
+   * next prepare.
+   *
+   * @param handle
+   * @param enabled
+   * @param thresholdDb samples at or below this level in dBFS are silent, e.g. -60
+   * @param minMillis
+   * @param trimEnd
+   */
+  public static native void setSilenceTrim(long handle, boolean enabled, double thresholdDb,
+                                           int minMillis, boolean trimEnd);
+
+  /**
+   * Record the byte offsets of the stream while playing from the start
+   */
+  public static final int SEEK_INDEX_RECORD = 1;
+  /**
+   * Also read the whole file ahead of playback, on a thread of its own
+   */
+  public static final int SEEK_INDEX_SCAN = 2;
+
+  /**
+   * Index the byte offsets of the audio stream so seeks go straight to them,
+   * for VBR mp3 without a TOC and long ogg files. A complete index is cached
+   * with {@link #setCacheDir(String)}. Takes effect on the next prepare.
+   *
+   * @param handle
+   * @param mode 0, or SEEK_INDEX_RECORD optionally with SEEK_INDEX_SCAN
+   */
+  public static native void setSeekIndex(long handle, int mode);
+
+  /**
+   * Find the exact duration of VBR and streamed files by reading the whole
+   * file ahead of playback on a thread of its own, without decoding.
+   * getDuration() returns it and EVENT_DURATION_UPDATED is sent once it is
+   * known. Takes effect on the next prepare.
+   */
+  public static native void setExactDuration(long handle, boolean enabled);
+
+  /**
+   * Decode as fast as possible instead of at the pace of the output, e.g. to
+   * export a clip. writePCM() is called back to back and the jitter buffer is
+   * not used. Takes effect on the next prepare.
+   *
+   * @param handle
+   * @param render
+   */
+  public static native void setRenderMode(long handle, boolean render);
+
+  /**
+   * EBU R128 loudness of files, decoded at full speed on a pool of threads,
+   * one per core if threads <= 0. Blocks until all are scanned, call it off
+   * the UI thread.
+   *
+   * @return the integrated loudness in LUFS, loudness range in LU and true
+   * peak in dBTP of each file, one after the other. A file that failed or is
+   * silent has a loudness and peak of -Infinity
+   */
+  public static native double[] scanLoudness(String[] urls, int threads);
+
+  /**
+   * Scale the output of the player by gainDb, from the next decoded frame on
+   */
+  public static native void setGain(long handle, double gainDb);
+
+  /**
+   * Play tempo times faster, from 0.5 to 3, without changing the pitch.
+   * Takes effect at once, the position and duration stay those of the track
+   */
+  public static native void setTempo(long handle, double tempo);
+
+  /**
+   * most bands of {@link #setEq(long, double[], double[], double[])}
+   */
+  public static final int EQ_MAX_BANDS = 10;
+
+  /**
+   * centre frequencies of the bands of {@link #setGraphicEq(long, double[])}
+   */
+  public static final double[] EQ_FREQUENCIES = {
+      31.25, 62.5, 125, 250, 500, 1000, 2000, 4000, 8000, 16000};
+
+  public static final double EQ_GRAPHIC_Q = 1.41;
+
+  /**
+   * gains in dB of {@link #setGraphicEq(long, double[])}
+   */
+  public static final double[] EQ_PRESET_FLAT = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+  public static final double[] EQ_PRESET_BASS = {6, 5, 4, 2, 0, 0, 0, 0, 0, 0};
+  public static final double[] EQ_PRESET_TREBLE = {0, 0, 0, 0, 0, 0, 2, 4, 5, 6};
+  public static final double[] EQ_PRESET_VOCAL = {-2, -2, -1, 0, 2, 3, 3, 2, 0, -1};
+  public static final double[] EQ_PRESET_LOUDNESS = {5, 4, 2, 0, -1, 0, 0, 1, 3, 4};
+
+  /**
+   * Equalize the output with up to {@link #EQ_MAX_BANDS} peaking filters, the
+   * band i at freqsHz[i] with gainsDb[i] and quality qs[i]. Changed bands move
+   * to their new setting without a click. Null arrays turn the equalizer off.
+   * Returns a negative error if the arrays differ in length or hold too many
+   * bands
+   */
+  public static native int setEq(long handle, double[] freqsHz, double[] gainsDb,
+                                 double[] qs);
+
+  /**
+   * {@link #setEq(long, double[], double[], double[])} with the octave bands of
+   * {@link #EQ_FREQUENCIES} at gainsDb, e.g. one of the EQ_PRESET arrays
+   */
+  public static int setGraphicEq(long handle, double[] gainsDb) {
+    double[] qs = new double[EQ_FREQUENCIES.length];
+    Arrays.fill(qs, EQ_GRAPHIC_Q);
+    return setEq(handle, EQ_FREQUENCIES, gainsDb, qs);
+  }
+
+  /**
+   * Set the gain that brings a track scanned by {@link #scanLoudness(String[], int)}
+   * to targetLufs, lowered to keep its true peak at or below -1 dBTP
+   */
+  public static native void setNormalization(long handle, double integratedLufs,
+                                             double truePeakDbtp, double targetLufs);
+
+  /**
+   * Cache what is computed from whole local files, waveform overviews and
+   * trimmed silence, in dir, e.g. Context.getCacheDir(). null disables the
+   * cache.
+   */
+  public static native void setCacheDir(String dir);
+
+  /**
+   * Waveform overview of a file, decoded at full speed on the calling thread
+   * unless cached, see {@link #setCacheDir(String)}. Call it off the UI
+   * thread.
+   *
+   * @return the min, max and rms of each of buckets equal parts of the file,
+   * one after the other, or null on failure
+   */
+  public static native float[] computePeaks(String url, int buckets);
+
+  /**
+   * Analyze the spectrum of what the player plays on a native thread, rateHz
+   * times a second, into at most 64 log spaced bands. Calling it again
+   * changes the bands and rate.
+   *
+   * @return false on failure
+   * @see #readSpectrum(long, float[])
+   */
+  public static native boolean startSpectrumAnalyzer(long handle, int bands, int rateHz);
+
+  public static native void stopAnalyzer(long handle);
+
+  /**
+   * Copy the band powers of the latest spectrum, in dBFS from the lowest band
+   * up, into bands. Cheap enough to call every frame from any thread.
+   *
+   * @return the number of bands read, 0 if nothing has been analyzed yet
+   */
+  public static native int readSpectrum(long handle, float[] bands);
+
+  /**
+   * Fill stats with the current playback statistics
+   *
+   * @return 0 if successful
+   */
+  public static native int getStats(long handle, Stats stats);
+
+  /**
+   * Configure the decode threads of players and engines created from now on.
+   *
+   * @param priority  nice value, or the SCHED_FIFO priority if fifo is set
+   * @param fifo      use SCHED_FIFO, ignored with a warning if not permitted
+   * @param cpuMask   bit n allows cpu n, 0 for any cpu
+   * @param stackSize in bytes, 0 for the default
+   */
+  public static native void setThreadConfig(int priority, boolean fifo, long cpuMask,
+                                            int stackSize);
+
+  /**
+   * Deliver the events of players created from now on from one dedicated
+   * thread instead of their player threads, so a slow listener does not
+   * delay decoding.
+   *
+   * @return 0 if successful
+   */
+  public static int setEventDispatcher(boolean enabled) {
+    if (!initialized) {
+      synchronized (LibAndrudio.class) {
+        if (!initialized)
+          initialize();
+      }
+    }
+    return _setEventDispatcher(enabled);
+  }
+
+  private static native int _setEventDispatcher(boolean enabled);
+
+  /**
+   * @return 0 if successful, -1 if the event dispatcher was never enabled
+   */
+  public static native int getDispatcherStats(DispatcherStats stats);
+
   public static native boolean isPlaying(long handle);
 
   public static native int getMetaData(long handle, Map<String, String> data);
 
+  /**
+   * Stream info and tags of a file, see {@link #probe(String, ProbeInfo)}
+   */
+  public static class ProbeInfo {
+    /**
+     * 0 on success, otherwise an ffmpeg error and the other fields are not set
+     */
+    public int result;
+    /**
+     * 0 if unknown
+     */
+    public long durationMicros;
+    public long bitRate;
+    public int sampleRate;
+    public int channels;
+    public String codec;
+    /**
+     * container and audio stream tags
+     */
+    public final Map<String, String> tags = new HashMap<>();
+    /**
+     * a cover art handle, 0 without a picture. Release it with
+     * {@link #releaseCoverArt(long)}
+     */
+    public long coverArt;
+  }
+
+  /**
+   * Stream info and tags of url from the container alone where it has them,
+   * without a player or decoder. Much cheaper than a player per file for
+   * library scanning. Blocks, call it off the UI thread.
+   *
+   * @return 0 or an ffmpeg error
+   */
+  public static native int probe(String url, ProbeInfo info);
+
+  /**
+   * {@link #probe(String, ProbeInfo)} of urls into infos on a pool of
+   * threads, one per core if threads <= 0, with at most 32 files open at once.
+   *
+   * @return 0, or -1 if any file failed, see ProbeInfo.result
+   */
+  public static native int probeFiles(String[] urls, ProbeInfo[] infos, int threads);
+
+  /**
+   * The picture embedded in the prepared track, the front cover if there are
+   * several. Read with the header, nothing is decoded.
+   *
+   * @return a cover art handle, valid after the track is reset until
+   * {@link #releaseCoverArt(long)}, or 0 without a picture
+   */
+  public static native long getCoverArt(long handle);
+
+  /**
+   * The encoded image of a cover art, e.g. for BitmapFactory, read in place
+   * from native memory.
+   *
+   * @return a direct buffer that must not be used after
+   * {@link #releaseCoverArt(long)}
+   */
+  public static native ByteBuffer coverArtData(long coverArtHandle);
+
+  /**
+   * @return "image/jpeg", "image/png" and so on, empty if unknown
+   */
+  public static native String coverArtMimeType(long coverArtHandle);
+
+  public static native void releaseCoverArt(long coverArtHandle);
+
   /**
    * Callback interface for the native code. The native code calls these java
    * methods only.
@@ -98,6 +493,18 @@ public class LibAndrudio {
     public static final int EVENT_THREAD_START = 1;
     public static final int EVENT_STATE_CHANGE = 2;
     public static final int EVENT_SEEK_COMPLETE = 3;
+    /**
+     * arg1 is 1 if the jitter buffer ran empty during playback
+     */
+    public static final int EVENT_BUFFERING_START = 4;
+    /**
+     * arg1 is the time spent buffering in millis
+     */
+    public static final int EVENT_BUFFERING_END = 5;
+    /**
+     * arg1 is the exact duration in millis, see setExactDuration()
+     */
+    public static final int EVENT_DURATION_UPDATED = 6;
 
     /**
      * Initialise the audio output
@@ -120,6 +527,50 @@ public class LibAndrudio {
     void writePCM(byte data[], int offset, int length);
   }
 
+  /**
+   * Playback statistics, see {@link #getStats(long, Stats)}
+   */
+  public static class Stats {
+    public int buffering;
+    public int bufferedMillis;
+    public int bufferTargetMillis;
+    public int arrivalJitterMillis;
+    /**
+     * number of times the jitter buffer ran empty since the track was prepared
+     */
+    public int underruns;
+    public int underrunMillis;
+    /**
+     * media time played per second spent started since the track was
+     * prepared, about 1 when paced by the output
+     */
+    public double realtimeFactor;
+    /**
+     * bands of the equalizer and the processor time each costs in
+     * microseconds per second of audio, since the track was prepared
+     */
+    public int eqBands;
+    public final double[] eqBandCostMicros = new double[EQ_MAX_BANDS];
+  }
+
+  /**
+   * Event dispatcher statistics, see {@link #getDispatcherStats(DispatcherStats)}
+   */
+  public static class DispatcherStats {
+    /**
+     * events waiting to be delivered
+     */
+    public int queueDepth;
+    public int maxQueueDepth;
+    public long events;
+    public long batches;
+    /**
+     * time from an event being queued to the listener being called
+     */
+    public int avgLatencyMicros;
+    public int maxLatencyMicros;
+  }
+
   // public static native int setUserAgent(long handle, String userAgent);
 
 }
@@ -0,0 +1,306 @@
+#include "audioplayer.h"
+#include <math.h>
+#include <libavcodec/avfft.h>
+#include "analyzer.h"
+#include "logging.h"
+
+/*
+ * Spectrum analysis tap. The thread running the player copies the PCM it
+ * plays into a ring that it overwrites without waiting for anyone. The
+ * analysis thread wakes rate_hz times a second, copies the latest
+ * ANALYZER_FFT_SIZE frames out of the ring, and gives up on that pass if the
+ * decoder lapped it meanwhile. The frames are mixed down, Hann windowed and
+ * transformed with av_rdft, and the power of each log spaced band is published
+ * in dBFS to an ap_spectrum_t with the seqlock of clock_snapshot_t.
+ */
+
+//bands start here and end at the Nyquist frequency
+#define ANALYZER_MIN_HZ 20.0
+#define ANALYZER_FLOOR_DB -120.0f
+
+struct ap_analyzer_t {
+  //ring of s16 PCM, head counts the bytes ever written
+  uint8_t ring[ANALYZER_RING_BYTES];
+  _Atomic uint64_t head;
+  //channels | sample_rate << 8 of the PCM written since format_start
+  atomic_int format;
+  _Atomic uint64_t format_start;
+  atomic_int running;
+
+  //analysis side, guarded by mutex
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  pthread_t thread;
+  int started;
+  int quit;
+  int nb_bands;
+  int rate_hz;
+
+  //only used by the analysis thread
+  uint64_t last_head;
+  int16_t pcm[ANALYZER_FFT_SIZE * ANALYZER_MAX_CHANNELS];
+  float window[ANALYZER_FFT_SIZE];
+  FFTSample *data;
+  RDFTContext *rdft;
+
+  ap_spectrum_t spectrum;
+};
+
+ap_analyzer_t *analyzer_create() {
+  ap_analyzer_t *a;
+  int i;
+
+  if (!(a = av_mallocz(sizeof(ap_analyzer_t))))
+    return NULL;
+
+  if (!(a->data = av_malloc_array(ANALYZER_FFT_SIZE, sizeof(FFTSample)))
+      || !(a->rdft = av_rdft_init(ANALYZER_FFT_BITS, DFT_R2C))) {
+    log_error("analyzer_create::failed to set up the transform");
+    av_free(a->data);
+    av_free(a);
+    return NULL;
+  }
+
+  for (i = 0; i < ANALYZER_FFT_SIZE; i++)
+    a->window[i] = 0.5f - 0.5f * cosf(2 * M_PI * i / (ANALYZER_FFT_SIZE - 1));
+
+  atomic_init(&a->head, 0);
+  atomic_init(&a->format, 0);
+  atomic_init(&a->format_start, 0);
+  atomic_init(&a->running, 0);
+  atomic_init(&a->spectrum.seq, 0);
+  pthread_mutex_init(&a->mutex, NULL);
+  pthread_cond_init(&a->cond, NULL);
+  return a;
+}
+
+void analyzer_free(ap_analyzer_t *a) {
+  if (!a)
+    return;
+  analyzer_stop(a);
+  av_rdft_end(a->rdft);
+  av_free(a->data);
+  pthread_mutex_destroy(&a->mutex);
+  pthread_cond_destroy(&a->cond);
+  av_free(a);
+}
+
+void analyzer_write(ap_analyzer_t *a, const uint8_t *data, int len,
+                    int channels, int sample_rate) {
+  uint64_t head;
+  int format, offset, n;
+
+  if (!atomic_load_explicit(&a->running, memory_order_relaxed)
+      || channels <= 0 || channels > ANALYZER_MAX_CHANNELS)
+    return;
+
+  head = atomic_load_explicit(&a->head, memory_order_relaxed);
+  format = channels | sample_rate << 8;
+  if (format != atomic_load_explicit(&a->format, memory_order_relaxed)) {
+    atomic_store_explicit(&a->format_start, head, memory_order_relaxed);
+    atomic_store_explicit(&a->format, format, memory_order_release);
+  }
+
+  //only the end of a chunk longer than the ring survives
+  if (len > ANALYZER_RING_BYTES) {
+    head += len - ANALYZER_RING_BYTES;
+    data += len - ANALYZER_RING_BYTES;
+    len = ANALYZER_RING_BYTES;
+  }
+  offset = (int) (head & (ANALYZER_RING_BYTES - 1));
+  n = FFMIN(len, ANALYZER_RING_BYTES - offset);
+  memcpy(a->ring + offset, data, n);
+  memcpy(a->ring, data + n, len - n);
+
+  atomic_store_explicit(&a->head, head + len, memory_order_release);
+}
+
+/* copy the latest window out of the ring, FAILURE if there is not enough of
+ * it in one format or the writer overwrote it while it was copied */
+static int read_window(ap_analyzer_t *a, int *channels, int *sample_rate) {
+  uint64_t head, start;
+  int format, size, offset, n;
+
+  head = atomic_load_explicit(&a->head, memory_order_acquire);
+  format = atomic_load_explicit(&a->format, memory_order_acquire);
+  if (head == a->last_head)
+    return FAILURE;
+
+  *channels = format & 0xff;
+  *sample_rate = format >> 8;
+  size = ANALYZER_FFT_SIZE * *channels * 2;
+  if (!*channels || head < size
+      || head - size < atomic_load_explicit(&a->format_start,
+                                            memory_order_relaxed))
+    return FAILURE;
+
+  start = head - size;
+  offset = (int) (start & (ANALYZER_RING_BYTES - 1));
+  n = FFMIN(size, ANALYZER_RING_BYTES - offset);
+  memcpy(a->pcm, a->ring + offset, n);
+  memcpy((uint8_t *) a->pcm + n, a->ring, size - n);
+
+  atomic_thread_fence(memory_order_acquire);
+  if (atomic_load_explicit(&a->head, memory_order_relaxed) - start
+      > ANALYZER_RING_BYTES
+      || atomic_load_explicit(&a->format, memory_order_relaxed) != format)
+    return FAILURE;
+
+  a->last_head = head;
+  return SUCCESS;
+}
+
+static void publish(ap_spectrum_t *s, const float *bands, int nb_bands,
+                    int sample_rate) {
+  unsigned seq = atomic_load_explicit(&s->seq, memory_order_relaxed);
+
+  atomic_store_explicit(&s->seq, seq + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+
+  s->nb_bands = nb_bands;
+  s->sample_rate = sample_rate;
+  memcpy(s->bands, bands, nb_bands * sizeof(float));
+
+  atomic_store_explicit(&s->seq, seq + 2, memory_order_release);
+}
+
+static void analyze(ap_analyzer_t *a, int nb_bands) {
+  float bands[AP_SPECTRUM_MAX_BANDS];
+  //power of a full scale sine through the Hann window
+  const double full_scale = (ANALYZER_FFT_SIZE / 4.0) * (ANALYZER_FFT_SIZE / 4.0);
+  double bin_hz, ratio, lo, hi, power;
+  int channels, sample_rate, i, c, b, k, first, last;
+
+  if (read_window(a, &channels, &sample_rate) < 0)
+    return;
+
+  for (i = 0; i < ANALYZER_FFT_SIZE; i++) {
+    int sum = 0;
+    for (c = 0; c < channels; c++)
+      sum += a->pcm[i * channels + c];
+    a->data[i] = a->window[i] * sum / (32768.0f * channels);
+  }
+  av_rdft_calc(a->rdft, a->data);
+
+  bin_hz = (double) sample_rate / ANALYZER_FFT_SIZE;
+  ratio = pow(sample_rate / 2.0 / ANALYZER_MIN_HZ, 1.0 / nb_bands);
+  lo = ANALYZER_MIN_HZ;
+  for (b = 0; b < nb_bands; b++, lo = hi) {
+    hi = lo * ratio;
+    first = (int) ceil(lo / bin_hz);
+    last = (int) floor(hi / bin_hz);
+    //narrow low bands fall between two bins, take the nearest
+    if (last < first)
+      first = last = (int) lround(sqrt(lo * hi) / bin_hz);
+    first = av_clip(first, 1, ANALYZER_FFT_SIZE / 2 - 1);
+    last = av_clip(last, first, ANALYZER_FFT_SIZE / 2 - 1);
+
+    //data[1] is the Nyquist bin, the others are re, im pairs
+    power = 0;
+    for (k = first; k <= last; k++)
+      power += a->data[2 * k] * a->data[2 * k]
+               + a->data[2 * k + 1] * a->data[2 * k + 1];
+    power /= last - first + 1;
+    bands[b] = power > 0 ? (float) (10 * log10(power / full_scale))
+                         : ANALYZER_FLOOR_DB;
+    if (bands[b] < ANALYZER_FLOOR_DB)
+      bands[b] = ANALYZER_FLOOR_DB;
+  }
+  publish(&a->spectrum, bands, nb_bands, sample_rate);
+}
+
+static void *analyzer_thread(ap_analyzer_t *a) {
+  struct timespec deadline;
+  int64_t period_ns;
+  int nb_bands;
+
+  log_debug("[%"PRIXPTR"] analyzer_thread()", (intptr_t) pthread_self());
+
+  pthread_mutex_lock(&a->mutex);
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  while (!a->quit) {
+    period_ns = 1000000000LL / a->rate_hz;
+    deadline.tv_nsec += period_ns;
+    while (deadline.tv_nsec >= 1000000000) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000;
+    }
+    if (pthread_cond_timedwait(&a->cond, &a->mutex, &deadline) != ETIMEDOUT)
+      continue;
+
+    nb_bands = a->nb_bands;
+    pthread_mutex_unlock(&a->mutex);
+    analyze(a, nb_bands);
+    pthread_mutex_lock(&a->mutex);
+  }
+  pthread_mutex_unlock(&a->mutex);
+
+  log_debug("[%"PRIXPTR"] analyzer_thread::done", (intptr_t) pthread_self());
+  return NULL;
+}
+
+int analyzer_start(ap_analyzer_t *a, int bands, int rate_hz) {
+  int ret = SUCCESS;
+
+  if (bands <= 0 || rate_hz <= 0)
+    return FAILURE;
+
+  pthread_mutex_lock(&a->mutex);
+  a->nb_bands = FFMIN(bands, AP_SPECTRUM_MAX_BANDS);
+  a->rate_hz = FFMIN(rate_hz, 1000);
+  if (!a->started) {
+    a->quit = 0;
+    a->last_head = 0;
+    if ((ret = pthread_create(&a->thread, NULL, (void *) analyzer_thread, a))
+        != SUCCESS) {
+      log_error("analyzer_start::failed to start thread: %s", strerror(ret));
+      ret = FAILURE;
+    } else {
+      a->started = 1;
+      atomic_store(&a->running, 1);
+    }
+  }
+  pthread_mutex_unlock(&a->mutex);
+  return ret;
+}
+
+void analyzer_stop(ap_analyzer_t *a) {
+  pthread_mutex_lock(&a->mutex);
+  if (!a->started) {
+    pthread_mutex_unlock(&a->mutex);
+    return;
+  }
+  atomic_store(&a->running, 0);
+  a->quit = 1;
+  a->started = 0;
+  pthread_cond_signal(&a->cond);
+  pthread_mutex_unlock(&a->mutex);
+
+  pthread_join(a->thread, NULL);
+}
+
+ap_spectrum_t *analyzer_spectrum(ap_analyzer_t *a) {
+  return &a->spectrum;
+}
+
+int analyzer_read(ap_analyzer_t *a, float *bands, int max) {
+  const ap_spectrum_t *spectrum = &a->spectrum;
+  unsigned seq;
+  int n;
+
+  if (max > AP_SPECTRUM_MAX_BANDS)
+    max = AP_SPECTRUM_MAX_BANDS;
+  for (;;) {
+    seq = atomic_load_explicit(&spectrum->seq, memory_order_acquire);
+    if (seq & 1)
+      continue;
+
+    n = FFMIN(spectrum->nb_bands, max);
+    if (n > 0)
+      memcpy(bands, spectrum->bands, n * sizeof(float));
+
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&spectrum->seq, memory_order_relaxed) == seq)
+      return FFMAX(n, 0);
+  }
+}
@@ -0,0 +1,34 @@
+#ifndef _ANALYZER_H_
+#define _ANALYZER_H_
+
+#include "audioplayer.h"
+
+//samples per analysis window, 2^ANALYZER_FFT_BITS
+#define ANALYZER_FFT_BITS 11
+#define ANALYZER_FFT_SIZE (1 << ANALYZER_FFT_BITS)
+//PCM kept for the analysis thread, a power of two
+#define ANALYZER_RING_BYTES (128 * 1024)
+#define ANALYZER_MAX_CHANNELS 8
+
+ap_analyzer_t *analyzer_create();
+
+//stops the analysis first. The decoder must no longer be writing
+void analyzer_free(ap_analyzer_t *a);
+
+/* called by the thread running the player with the s16 PCM it hands to
+ * on_play. Only copies it into the ring, never blocks or allocates, and does
+ * nothing while the analysis is stopped */
+void analyzer_write(ap_analyzer_t *a, const uint8_t *data, int len,
+                    int channels, int sample_rate);
+
+//(re)start the analysis thread, see ap_start_analyzer()
+int analyzer_start(ap_analyzer_t *a, int bands, int rate_hz);
+
+void analyzer_stop(ap_analyzer_t *a);
+
+ap_spectrum_t *analyzer_spectrum(ap_analyzer_t *a);
+
+//see ap_read_spectrum()
+int analyzer_read(ap_analyzer_t *a, float *bands, int max);
+
+#endif //_ANALYZER_H_
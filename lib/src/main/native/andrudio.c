@@ -29,6 +29,12 @@ static fields_t fields;
 static JavaVM *jvm;
 static pthread_key_t current_jni_env;
 
+//see setEventDispatcher()
+static ap_dispatcher_t *dispatcher;
+static int use_dispatcher;
+static JNIEnv *dispatcher_env;
+static pthread_t dispatcher_thread;
+
 static void detach_current_thread(void *env) {
   log_info("detach_current_thread() %"
                PRIX32, (uint32_t) pthread_self());
@@ -56,6 +62,12 @@ static JNIEnv *get_jni_env(void) {
   return env;
 }
 
+//the dispatcher thread stays attached for the life of the process
+static void dispatcher_thread_init(void) {
+  dispatcher_env = get_jni_env();
+  dispatcher_thread = pthread_self();
+}
+
 JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM *vm, void *pvt) {
   log_info("JNI_OnLoad()");
   jvm = vm;
@@ -143,13 +155,16 @@ static void callback_on_event(struct player_t *player, audio_event_t event,
     default:
       assert(info);
       assert(info->listener);
-      env = get_jni_env();
+      if (dispatcher_env && pthread_equal(pthread_self(), dispatcher_thread))
+        env = dispatcher_env;
+      else
+        env = get_jni_env();
       (*env)->CallVoidMethod(env, info->listener, fields.handleEvent, event,
                              arg1, arg2);
       break;
   }
 
-  if (event == EVENT_STATE_CHANGE && player->state == STATE_END) {
+  if (event == EVENT_STATE_CHANGE && arg2 == STATE_END) {
 
     log_info("callback_on_event::cleaning up JNI");
     JavaInfo *info = (JavaInfo*) player->extra;
@@ -175,19 +190,19 @@ static void callback_on_event(struct player_t *player, audio_event_t event,
   }
 }
 
-JNIEXPORT jlong JNICALL
-Java_danbroid_andrudio_LibAndrudio__1create(JNIEnv *env, jclass type) {
+static jlong create_player(ap_engine_t *engine) {
   player_callbacks_t callbacks;
 
-  log_info("Java_danbroid_andrudio_LibAndrudio__1create()");
-
   memset(&callbacks, 0, sizeof(player_callbacks_t));
 
   callbacks.on_play = callback_on_play;
   callbacks.on_prepare = callback_prepare_audio;
   callbacks.on_event = callback_on_event;
+  if (use_dispatcher)
+    callbacks.dispatcher = dispatcher;
 
-  player_t *audio = ap_create(callbacks);
+  player_t *audio = engine ? ap_create_in_engine(engine, callbacks)
+                           : ap_create(callbacks);
 
   if (!audio) {
     log_error("failed to create player");
@@ -201,6 +216,36 @@ Java_danbroid_andrudio_LibAndrudio__1create(JNIEnv *env, jclass type) {
 
 }
 
+JNIEXPORT jlong JNICALL
+Java_danbroid_andrudio_LibAndrudio__1create(JNIEnv *env, jclass type) {
+  log_info("Java_danbroid_andrudio_LibAndrudio__1create()");
+  return create_player(NULL);
+}
+
+JNIEXPORT jlong JNICALL
+Java_danbroid_andrudio_LibAndrudio__1createInEngine(JNIEnv *env, jclass type,
+                                                     jlong engineHandle) {
+  log_info("Java_danbroid_andrudio_LibAndrudio__1createInEngine()");
+  ap_engine_t *engine = (ap_engine_t *) (intptr_t) engineHandle;
+  if (!engine) {
+    log_error("invalid engine handle");
+    return 0;
+  }
+  return create_player(engine);
+}
+
+JNIEXPORT jlong JNICALL
+Java_danbroid_andrudio_LibAndrudio__1createEngine(JNIEnv *env, jclass type,
+                                                   jint threads) {
+  return (jlong) (intptr_t) ap_engine_create(threads);
+}
+
+JNIEXPORT void JNICALL
+Java_danbroid_andrudio_LibAndrudio_destroyEngine(JNIEnv *env, jclass type,
+                                                 jlong engineHandle) {
+  ap_engine_delete((ap_engine_t *) (intptr_t) engineHandle);
+}
+
 JNIEXPORT void JNICALL
 Java_danbroid_andrudio_LibAndrudio_setListener(JNIEnv *env, jclass type, jlong handle,
                                                jobject listener) {
@@ -355,6 +400,71 @@ Java_danbroid_andrudio_LibAndrudio__1setDataSource(JNIEnv *env, jclass type, jlo
   (*env)->ReleaseStringUTFChars(env, jdatasource, dataSource);
 }
 
+JNIEXPORT jint JNICALL
+Java_danbroid_andrudio_LibAndrudio__1setDataSources(JNIEnv *env, jclass type, jlong handle,
+                                                    jobjectArray jurls) {
+  player_t* player = JLONG_TO_PLAYER(handle);
+  if (!player) {
+    log_error("invalid handle");
+    return -1;
+  }
+
+  const char *urls[AP_MAX_SOURCES];
+  jstring jstrings[AP_MAX_SOURCES];
+  int i, n = (*env)->GetArrayLength(env, jurls);
+  if (n > AP_MAX_SOURCES)
+    n = AP_MAX_SOURCES;
+
+  for (i = 0; i < n; i++) {
+    jstrings[i] = (*env)->GetObjectArrayElement(env, jurls, i);
+    urls[i] = (*env)->GetStringUTFChars(env, jstrings[i], 0);
+    assert(urls[i]);
+  }
+
+  int ret = ap_set_datasources(player, urls, n);
+
+  for (i = 0; i < n; i++) {
+    (*env)->ReleaseStringUTFChars(env, jstrings[i], urls[i]);
+    (*env)->DeleteLocalRef(env, jstrings[i]);
+  }
+  return ret;
+}
+
+JNIEXPORT jlong JNICALL
+Java_danbroid_andrudio_LibAndrudio__1preload(JNIEnv *env, jclass type, jstring jurl) {
+  const char *url = (*env)->GetStringUTFChars(env, jurl, 0);
+  assert(url);
+
+  ap_preload_t *preload = ap_preload(url);
+
+  (*env)->ReleaseStringUTFChars(env, jurl, url);
+  return (jlong) (intptr_t) preload;
+}
+
+JNIEXPORT void JNICALL
+Java_danbroid_andrudio_LibAndrudio_releasePreload(JNIEnv *env, jclass type,
+                                                  jlong preloadHandle) {
+  ap_preload_release((ap_preload_t *) (intptr_t) preloadHandle);
+}
+
+JNIEXPORT void JNICALL
+Java_danbroid_andrudio_LibAndrudio_setPreloadLimits(JNIEnv *env, jclass type,
+                                                    jint maxSources, jint bufferMillis) {
+  ap_preload_set_limits(maxSources, bufferMillis);
+}
+
+JNIEXPORT jint JNICALL
+Java_danbroid_andrudio_LibAndrudio_setDataSourcePreloaded(JNIEnv *env, jclass type,
+                                                          jlong handle,
+                                                          jlong preloadHandle) {
+  player_t* player = JLONG_TO_PLAYER(handle);
+  if (!player) {
+    log_error("invalid handle");
+    return -1;
+  }
+  return ap_set_datasource_preloaded(player, (ap_preload_t *) (intptr_t) preloadHandle);
+}
+
 JNIEXPORT jboolean JNICALL
 Java_danbroid_andrudio_LibAndrudio_isLooping(JNIEnv *env, jclass type, jlong handle) {
 
@@ -381,41 +491,553 @@ Java_danbroid_andrudio_LibAndrudio_setLooping(JNIEnv *env, jclass type, jlong ha
 
 }
 
-JNIEXPORT jboolean JNICALL
-Java_danbroid_andrudio_LibAndrudio_isPlaying(JNIEnv *env, jclass type, jlong handle) {
+JNIEXPORT void JNICALL
+Java_danbroid_andrudio_LibAndrudio_setEarlyStart(JNIEnv *env, jclass type, jlong handle,
+                                                 jboolean earlyStart) {
+
+  player_t* player = JLONG_TO_PLAYER(handle);
+  if (!player) {
+    log_error("invalid handle");
+    return;
+  }
+  ap_set_early_start(player, earlyStart);
+
+}
+
+JNIEXPORT void JNICALL
+Java_danbroid_andrudio_LibAndrudio_setRenderMode(JNIEnv *env, jclass type, jlong handle,
+                                                 jboolean render) {
+
+  player_t* player = JLONG_TO_PLAYER(handle);
+  if (!player) {
+    log_error("invalid handle");
+    return;
+  }
+  ap_set_render_mode(player, render);
+
+}
+
+static void free_urls(char **urls, int n) {
+  int i;
+
+  for (i = 0; urls && i < n; i++)
+    av_free(urls[i]);
+  av_free(urls);
+}
+
+/* copies of the n strings of jurls, for batches too large to keep a local
+ * reference and the chars of each string until they are done. NULL without
+ * memory */
+static char **copy_urls(JNIEnv *env, jobjectArray jurls, int n) {
+  char **urls = av_mallocz_array(n, sizeof(char *));
+  const char *chars;
+  jstring jurl;
+  int i;
+
+  for (i = 0; urls && i < n; i++) {
+    jurl = (*env)->GetObjectArrayElement(env, jurls, i);
+    if ((chars = jurl ? (*env)->GetStringUTFChars(env, jurl, 0) : NULL)) {
+      urls[i] = av_strdup(chars);
+      (*env)->ReleaseStringUTFChars(env, jurl, chars);
+    }
+    if (jurl)
+      (*env)->DeleteLocalRef(env, jurl);
+    if (!urls[i]) {
+      free_urls(urls, i);
+      urls = NULL;
+    }
+  }
+  return urls;
+}
+
+JNIEXPORT jdoubleArray JNICALL
+Java_danbroid_andrudio_LibAndrudio_scanLoudness(JNIEnv *env, jclass type, jobjectArray jurls,
+                                                jint threads) {
+  int n = (*env)->GetArrayLength(env, jurls);
+  if (n <= 0)
+    return NULL;
+
+  char **urls = copy_urls(env, jurls, n);
+  ap_loudness_t *loudness = av_malloc_array(n, sizeof(ap_loudness_t));
+  jdoubleArray result = NULL;
+  if (!urls || !loudness)
+    goto end;
+
+  //failed files come back silent, see ap_scan_loudness()
+  ap_scan_loudness((const char **) urls, n, loudness, threads, NULL);
 
+  //integrated, range and true peak of each file, ap_loudness_t is three doubles
+  if ((result = (*env)->NewDoubleArray(env, n * 3)))
+    (*env)->SetDoubleArrayRegion(env, result, 0, n * 3, (jdouble *) loudness);
+
+  end:
+  free_urls(urls, n);
+  av_free(loudness);
+  return result;
+}
+
+JNIEXPORT void JNICALL
+Java_danbroid_andrudio_LibAndrudio_setGain(JNIEnv *env, jclass type, jlong handle,
+                                           jdouble gainDb) {
+  player_t* player = JLONG_TO_PLAYER(handle);
+  if (!player) {
+    log_error("invalid handle");
+    return;
+  }
+  ap_set_gain(player, gainDb);
+}
+
+JNIEXPORT void JNICALL
+Java_danbroid_andrudio_LibAndrudio_setTempo(JNIEnv *env, jclass type, jlong handle,
+                                            jdouble tempo) {
+  player_t* player = JLONG_TO_PLAYER(handle);
+  if (!player) {
+    log_error("invalid handle");
+    return;
+  }
+  ap_set_tempo(player, tempo);
+}
+
+JNIEXPORT jint JNICALL
+Java_danbroid_andrudio_LibAndrudio_setEq(JNIEnv *env, jclass type, jlong handle,
+                                         jdoubleArray jfreqs, jdoubleArray jgains,
+                                         jdoubleArray jqs) {
+  ap_eq_band_t bands[AP_EQ_MAX_BANDS];
+  jdouble values[AP_EQ_MAX_BANDS];
+  int i, nb_bands;
+
+  player_t* player = JLONG_TO_PLAYER(handle);
+  if (!player) {
+    log_error("invalid handle");
+    return -1;
+  }
+  if (!jfreqs)
+    return ap_set_eq(player, NULL, 0);
+
+  nb_bands = (*env)->GetArrayLength(env, jfreqs);
+  if (nb_bands > AP_EQ_MAX_BANDS || !jgains || !jqs
+      || (*env)->GetArrayLength(env, jgains) != nb_bands
+      || (*env)->GetArrayLength(env, jqs) != nb_bands)
+    return AVERROR(EINVAL);
+
+  (*env)->GetDoubleArrayRegion(env, jfreqs, 0, nb_bands, values);
+  for (i = 0; i < nb_bands; i++)
+    bands[i].freq_hz = values[i];
+  (*env)->GetDoubleArrayRegion(env, jgains, 0, nb_bands, values);
+  for (i = 0; i < nb_bands; i++)
+    bands[i].gain_db = values[i];
+  (*env)->GetDoubleArrayRegion(env, jqs, 0, nb_bands, values);
+  for (i = 0; i < nb_bands; i++)
+    bands[i].q = values[i];
+  return ap_set_eq(player, bands, nb_bands);
+}
+
+JNIEXPORT void JNICALL
+Java_danbroid_andrudio_LibAndrudio_setNormalization(JNIEnv *env, jclass type, jlong handle,
+                                                    jdouble integratedLufs,
+                                                    jdouble truePeakDbtp,
+                                                    jdouble targetLufs) {
+  player_t* player = JLONG_TO_PLAYER(handle);
+  if (!player) {
+    log_error("invalid handle");
+    return;
+  }
+  ap_loudness_t loudness = {integratedLufs, 0, truePeakDbtp};
+  ap_set_normalization(player, &loudness, targetLufs);
+}
+
+JNIEXPORT void JNICALL
+Java_danbroid_andrudio_LibAndrudio_setCacheDir(JNIEnv *env, jclass type, jstring jdir) {
+  const char *dir = jdir ? (*env)->GetStringUTFChars(env, jdir, 0) : NULL;
+
+  ap_set_cache_dir(dir);
+
+  if (dir)
+    (*env)->ReleaseStringUTFChars(env, jdir, dir);
+}
+
+JNIEXPORT jfloatArray JNICALL
+Java_danbroid_andrudio_LibAndrudio_computePeaks(JNIEnv *env, jclass type, jstring jurl,
+                                                jint buckets) {
+  if (buckets <= 0)
+    return NULL;
+
+  ap_peak_t *peaks = av_malloc_array(buckets, sizeof(ap_peak_t));
+  if (!peaks)
+    return NULL;
+
+  const char *url = (*env)->GetStringUTFChars(env, jurl, 0);
+  assert(url);
+  int ret = ap_compute_peaks(url, buckets, peaks);
+  (*env)->ReleaseStringUTFChars(env, jurl, url);
+
+  //min, max and rms of each bucket, ap_peak_t is three packed floats
+  jfloatArray result = NULL;
+  if (ret >= 0 && (result = (*env)->NewFloatArray(env, buckets * 3)))
+    (*env)->SetFloatArrayRegion(env, result, 0, buckets * 3, (jfloat *) peaks);
+  av_free(peaks);
+  return result;
+}
+
+JNIEXPORT jboolean JNICALL
+Java_danbroid_andrudio_LibAndrudio_startSpectrumAnalyzer(JNIEnv *env, jclass type, jlong handle,
+                                                         jint bands, jint rateHz) {
   player_t* player = JLONG_TO_PLAYER(handle);
   if (!player) {
     log_error("invalid handle");
     return JNI_FALSE;
   }
 
-  return ap_is_playing(player);
+  return ap_start_analyzer(player, bands, rateHz) ? JNI_TRUE : JNI_FALSE;
+}
+
+JNIEXPORT jint JNICALL
+Java_danbroid_andrudio_LibAndrudio_readSpectrum(JNIEnv *env, jclass type, jlong handle,
+                                                jfloatArray jbands) {
+  float bands[AP_SPECTRUM_MAX_BANDS];
+  int n;
+
+  player_t* player = JLONG_TO_PLAYER(handle);
+  if (!player) {
+    log_error("invalid handle");
+    return 0;
+  }
+
+  //read natively, the seqlock needs acquire loads ByteBuffer does not have
+  n = ap_read_spectrum(player, bands, (*env)->GetArrayLength(env, jbands));
+  if (n > 0)
+    (*env)->SetFloatArrayRegion(env, jbands, 0, n, bands);
+  return n;
+}
+
+JNIEXPORT void JNICALL
+Java_danbroid_andrudio_LibAndrudio_stopAnalyzer(JNIEnv *env, jclass type, jlong handle) {
+  player_t* player = JLONG_TO_PLAYER(handle);
+  if (!player) {
+    log_error("invalid handle");
+    return;
+  }
+  ap_stop_analyzer(player);
+}
+
+JNIEXPORT void JNICALL
+Java_danbroid_andrudio_LibAndrudio_setJitterBuffer(JNIEnv *env, jclass type, jlong handle,
+                                                   jint minMillis, jint maxMillis) {
+
+  player_t* player = JLONG_TO_PLAYER(handle);
+  if (!player) {
+    log_error("invalid handle");
+    return;
+  }
+  ap_set_jitter_buffer(player, minMillis, maxMillis);
 
 }
 
+JNIEXPORT void JNICALL
+Java_danbroid_andrudio_LibAndrudio_setSilenceTrim(JNIEnv *env, jclass type, jlong handle,
+                                                  jboolean enabled, jdouble thresholdDb,
+                                                  jint minMillis, jboolean trimEnd) {
+  player_t* player = JLONG_TO_PLAYER(handle);
+  if (!player) {
+    log_error("invalid handle");
+    return;
+  }
+  ap_set_silence_trim(player, enabled, thresholdDb, minMillis, trimEnd);
+}
+
+JNIEXPORT void JNICALL
+Java_danbroid_andrudio_LibAndrudio_setSeekIndex(JNIEnv *env, jclass type, jlong handle,
+                                                jint mode) {
+  player_t* player = JLONG_TO_PLAYER(handle);
+  if (!player) {
+    log_error("invalid handle");
+    return;
+  }
+  ap_set_seek_index(player, mode);
+}
+
+JNIEXPORT void JNICALL
+Java_danbroid_andrudio_LibAndrudio_setExactDuration(JNIEnv *env, jclass type, jlong handle,
+                                                    jboolean enabled) {
+  player_t* player = JLONG_TO_PLAYER(handle);
+  if (!player) {
+    log_error("invalid handle");
+    return;
+  }
+  ap_set_exact_duration(player, enabled);
+}
+
+static void set_int_field(JNIEnv *env, jobject obj, jclass cls, const char *name,
+                          jint value) {
+  jfieldID field = (*env)->GetFieldID(env, cls, name, "I");
+  if (field)
+    (*env)->SetIntField(env, obj, field, value);
+}
+
+static void set_double_field(JNIEnv *env, jobject obj, jclass cls,
+                             const char *name, jdouble value) {
+  jfieldID field = (*env)->GetFieldID(env, cls, name, "D");
+  if (field)
+    (*env)->SetDoubleField(env, obj, field, value);
+}
+
 JNIEXPORT jint JNICALL
-Java_danbroid_andrudio_LibAndrudio_getMetaData(JNIEnv *env, jclass type, jlong handle,
-                                               jobject map) {
+Java_danbroid_andrudio_LibAndrudio_getStats(JNIEnv *env, jclass type, jlong handle,
+                                            jobject jstats) {
   player_t* player = JLONG_TO_PLAYER(handle);
   if (!player) {
     log_error("invalid handle");
     return -1;
   }
-  if (!player->ic)
+
+  ap_stats_t stats;
+  int ret = ap_get_stats(player, &stats);
+  if (ret < 0)
+    return ret;
+
+  jclass cls = (*env)->GetObjectClass(env, jstats);
+  set_int_field(env, jstats, cls, "buffering", stats.buffering);
+  set_int_field(env, jstats, cls, "bufferedMillis", stats.buffered_ms);
+  set_int_field(env, jstats, cls, "bufferTargetMillis", stats.buffer_target_ms);
+  set_int_field(env, jstats, cls, "arrivalJitterMillis", stats.arrival_jitter_ms);
+  set_int_field(env, jstats, cls, "underruns", stats.underruns);
+  set_int_field(env, jstats, cls, "underrunMillis", stats.underrun_ms);
+  set_double_field(env, jstats, cls, "realtimeFactor", stats.realtime_factor);
+  set_int_field(env, jstats, cls, "eqBands", stats.eq_bands);
+
+  jfieldID field = (*env)->GetFieldID(env, cls, "eqBandCostMicros", "[D");
+  jobject costs;
+  if (field && (costs = (*env)->GetObjectField(env, jstats, field))
+      && (*env)->GetArrayLength(env, costs) >= AP_EQ_MAX_BANDS)
+    (*env)->SetDoubleArrayRegion(env, costs, 0, AP_EQ_MAX_BANDS,
+                                 stats.eq_band_cost_us);
+  return 0;
+}
+
+JNIEXPORT void JNICALL
+Java_danbroid_andrudio_LibAndrudio_setThreadConfig(JNIEnv *env, jclass type,
+                                                   jint priority, jboolean fifo,
+                                                   jlong cpuMask, jint stackSize) {
+  ap_thread_config_t config;
+  memset(&config, 0, sizeof(config));
+  config.priority = priority;
+  config.fifo = fifo;
+  config.cpu_mask = (uint64_t) cpuMask;
+  config.stack_size = stackSize > 0 ? (size_t) stackSize : 0;
+  ap_set_thread_config(&config);
+}
+
+JNIEXPORT jint JNICALL
+Java_danbroid_andrudio_LibAndrudio__1setEventDispatcher(JNIEnv *env, jclass type,
+                                                      jboolean enabled) {
+  if (enabled && !dispatcher) {
+    dispatcher = ap_dispatcher_create(dispatcher_thread_init);
+    if (!dispatcher) {
+      log_error("failed to create the event dispatcher");
+      return -1;
+    }
+  }
+  use_dispatcher = enabled;
+  return 0;
+}
+
+static void set_long_field(JNIEnv *env, jobject obj, jclass cls,
+                           const char *name, jlong value) {
+  jfieldID field = (*env)->GetFieldID(env, cls, name, "J");
+  if (field)
+    (*env)->SetLongField(env, obj, field, value);
+}
+
+JNIEXPORT jint JNICALL
+Java_danbroid_andrudio_LibAndrudio_getDispatcherStats(JNIEnv *env, jclass type,
+                                                      jobject jstats) {
+  if (!dispatcher)
     return -1;
 
+  ap_dispatcher_stats_t stats;
+  ap_dispatcher_get_stats(dispatcher, &stats);
+
+  jclass cls = (*env)->GetObjectClass(env, jstats);
+  set_int_field(env, jstats, cls, "queueDepth", stats.queue_depth);
+  set_int_field(env, jstats, cls, "maxQueueDepth", stats.max_queue_depth);
+  set_long_field(env, jstats, cls, "events", stats.events);
+  set_long_field(env, jstats, cls, "batches", stats.batches);
+  set_int_field(env, jstats, cls, "avgLatencyMicros", stats.avg_latency_us);
+  set_int_field(env, jstats, cls, "maxLatencyMicros", stats.max_latency_us);
+  return 0;
+}
+
+JNIEXPORT jboolean JNICALL
+Java_danbroid_andrudio_LibAndrudio_isPlaying(JNIEnv *env, jclass type, jlong handle) {
+
+  player_t* player = JLONG_TO_PLAYER(handle);
+  if (!player) {
+    log_error("invalid handle");
+    return JNI_FALSE;
+  }
+
+  return ap_is_playing(player);
+
+}
+
+static void put_tags(JNIEnv *env, jobject map, AVDictionary *tags) {
   jclass map_clazz = (*env)->GetObjectClass(env, map);
   jmethodID put_method = (*env)->GetMethodID(env, map_clazz, "put",
                                              "(Ljava/lang/Object;Ljava/lang/Object;)Ljava/lang/Object;");
   AVDictionaryEntry *entry = NULL;
-  while ((entry = av_dict_get(player->ic->metadata, "", entry,
-                              AV_DICT_IGNORE_SUFFIX))) {
+  while ((entry = av_dict_get(tags, "", entry, AV_DICT_IGNORE_SUFFIX))) {
     //log_trace("metadata:\t%s:%s", entry->key, entry->value);
     jstring key = (*env)->NewStringUTF(env, entry->key);
     jstring value = (*env)->NewStringUTF(env, entry->value);
-    (*env)->CallObjectMethod(env, map, put_method, key, value);
+    jobject previous = (*env)->CallObjectMethod(env, map, put_method, key, value);
+    if (previous)
+      (*env)->DeleteLocalRef(env, previous);
+    (*env)->DeleteLocalRef(env, key);
+    (*env)->DeleteLocalRef(env, value);
+  }
+  (*env)->DeleteLocalRef(env, map_clazz);
+}
+
+JNIEXPORT jint JNICALL
+Java_danbroid_andrudio_LibAndrudio_getMetaData(JNIEnv *env, jclass type, jlong handle,
+                                               jobject map) {
+  player_t* player = JLONG_TO_PLAYER(handle);
+  if (!player) {
+    log_error("invalid handle");
+    return -1;
   }
+  if (!player->ic)
+    return -1;
+
+  put_tags(env, map, player->ic->metadata);
   return 0;
 
+}
+
+/* a handle for Java to a cover art, taking over its reference. 0 without a
+ * picture */
+static jlong cover_art_handle(ap_cover_art_t *art) {
+  ap_cover_art_t *handle;
+
+  if (!art->buf || !(handle = av_malloc(sizeof(ap_cover_art_t))))
+    return 0;
+  *handle = *art;
+  memset(art, 0, sizeof(*art));
+  return (jlong) (intptr_t) handle;
+}
+
+JNIEXPORT jlong JNICALL
+Java_danbroid_andrudio_LibAndrudio_getCoverArt(JNIEnv *env, jclass type, jlong handle) {
+  player_t* player = JLONG_TO_PLAYER(handle);
+  ap_cover_art_t art;
+  jlong ret;
+
+  if (!player) {
+    log_error("invalid handle");
+    return 0;
+  }
+  if (ap_get_cover_art(player, &art) < 0)
+    return 0;
+  ret = cover_art_handle(&art);
+  ap_cover_art_free(&art);
+  return ret;
+}
+
+JNIEXPORT jobject JNICALL
+Java_danbroid_andrudio_LibAndrudio_coverArtData(JNIEnv *env, jclass type,
+                                                jlong coverArtHandle) {
+  ap_cover_art_t *art = (ap_cover_art_t *) (intptr_t) coverArtHandle;
+  if (!art)
+    return NULL;
+  //the demuxer's packet, read in place until the handle is released
+  return (*env)->NewDirectByteBuffer(env, (void *) art->data, art->size);
+}
+
+JNIEXPORT jstring JNICALL
+Java_danbroid_andrudio_LibAndrudio_coverArtMimeType(JNIEnv *env, jclass type,
+                                                    jlong coverArtHandle) {
+  ap_cover_art_t *art = (ap_cover_art_t *) (intptr_t) coverArtHandle;
+  return art ? (*env)->NewStringUTF(env, art->mime_type) : NULL;
+}
+
+JNIEXPORT void JNICALL
+Java_danbroid_andrudio_LibAndrudio_releaseCoverArt(JNIEnv *env, jclass type,
+                                                   jlong coverArtHandle) {
+  ap_cover_art_t *art = (ap_cover_art_t *) (intptr_t) coverArtHandle;
+  if (!art)
+    return;
+  ap_cover_art_free(art);
+  av_free(art);
+}
+
+static void set_probe_info(JNIEnv *env, jobject jinfo, ap_probe_info_t *info,
+                           int result) {
+  jclass cls = (*env)->GetObjectClass(env, jinfo);
+  jfieldID field;
+  jobject obj;
+
+  //called once per file of probeFiles(), every local reference is deleted
+  set_int_field(env, jinfo, cls, "result", result);
+  if (result < 0) {
+    (*env)->DeleteLocalRef(env, cls);
+    return;
+  }
+  set_long_field(env, jinfo, cls, "durationMicros", info->duration_us);
+  set_long_field(env, jinfo, cls, "bitRate", info->bit_rate);
+  set_int_field(env, jinfo, cls, "sampleRate", info->sample_rate);
+  set_int_field(env, jinfo, cls, "channels", info->channels);
+  if ((field = (*env)->GetFieldID(env, cls, "codec", "Ljava/lang/String;"))
+      && (obj = (*env)->NewStringUTF(env, info->codec))) {
+    (*env)->SetObjectField(env, jinfo, field, obj);
+    (*env)->DeleteLocalRef(env, obj);
+  }
+  if ((field = (*env)->GetFieldID(env, cls, "tags", "Ljava/util/Map;"))
+      && (obj = (*env)->GetObjectField(env, jinfo, field))) {
+    put_tags(env, obj, info->tags);
+    (*env)->DeleteLocalRef(env, obj);
+  }
+  set_long_field(env, jinfo, cls, "coverArt", cover_art_handle(&info->cover_art));
+  (*env)->DeleteLocalRef(env, cls);
+}
+
+JNIEXPORT jint JNICALL
+Java_danbroid_andrudio_LibAndrudio_probe(JNIEnv *env, jclass type, jstring jurl,
+                                         jobject jinfo) {
+  const char *url = (*env)->GetStringUTFChars(env, jurl, 0);
+  ap_probe_info_t info;
+  int ret = ap_probe(url, &info);
+  (*env)->ReleaseStringUTFChars(env, jurl, url);
+
+  set_probe_info(env, jinfo, &info, ret);
+  ap_probe_free(&info);
+  return ret;
+}
+
+JNIEXPORT jint JNICALL
+Java_danbroid_andrudio_LibAndrudio_probeFiles(JNIEnv *env, jclass type, jobjectArray jurls,
+                                              jobjectArray jinfos, jint threads) {
+  int i, ret = -1, n = (*env)->GetArrayLength(env, jurls);
+  if (n <= 0 || (*env)->GetArrayLength(env, jinfos) < n)
+    return -1;
+
+  char **urls = copy_urls(env, jurls, n);
+  ap_probe_info_t *infos = av_mallocz_array(n, sizeof(ap_probe_info_t));
+  int *results = av_malloc_array(n, sizeof(int));
+  if (!urls || !infos || !results)
+    goto end;
+
+  ret = ap_probe_files((const char **) urls, n, infos, threads, results);
+
+  for (i = 0; i < n; i++) {
+    jobject jinfo = (*env)->GetObjectArrayElement(env, jinfos, i);
+    set_probe_info(env, jinfo, &infos[i], results[i]);
+    (*env)->DeleteLocalRef(env, jinfo);
+    ap_probe_free(&infos[i]);
+  }
+
+  end:
+  free_urls(urls, n);
+  av_free(infos);
+  av_free(results);
+  return ret;
 }
\ No newline at end of file
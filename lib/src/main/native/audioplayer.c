@@ -32,6 +32,12 @@
 
 
 #include "audioplayer.h"
+#include "preload.h"
+#include "player_thread.h"
+#include "engine.h"
+#include "dispatcher.h"
+#include "thread_config.h"
+#include "analyzer.h"
 
 const char * ap_get_state_name(audio_state_t state) {
 	switch (state) {
@@ -76,13 +82,24 @@ const char* ap_get_cmd_name(audio_cmd_t cmd) {
 		return "CMD_EXIT";
 	case CMD_SET_DATASOURCE:
 		return "CMD_SET_DATASOURCE";
+	case CMD_SCAN_DONE:
+		return "CMD_SCAN_DONE";
 	}
 	return "CMD_UNKNOWN";
 }
 
+/* a reset or exit cancels whatever the player is waiting for: its generation
+ * moves on, so every blocking call made for an earlier command is
+ * interrupted */
 int ap_send_cmd(player_t *player, audio_cmd_t cmd) {
+	player_cmd_t msg;
 	log_trace("ap_send_cmd::%s", ap_get_cmd_name(cmd));
-	return write(player->pipe[1], &cmd, sizeof(cmd));
+	msg.cmd = cmd;
+	if (cmd == CMD_RESET || cmd == CMD_EXIT)
+		msg.generation = atomic_fetch_add(&player->io_generation, 1) + 1;
+	else
+		msg.generation = atomic_load(&player->io_generation);
+	return write(player->pipe[1], &msg, sizeof(msg));
 }
 
 void ap_print_error(const char* msg, int err) {
@@ -94,23 +111,10 @@ void ap_print_error(const char* msg, int err) {
 	}
 }
 
-/* get the current audio clock value */
+/* get the current audio clock value in seconds, safe to call from any thread
+ * and never blocks the decoder */
 double ap_get_audio_clock(player_t *player) {
-	double pts = 0;
-	int hw_buf_size, bytes_per_sec;
-	pts = player->audio_clock;
-
-	hw_buf_size = player->audio_buf_size - player->audio_buf_index;
-
-	bytes_per_sec = 0;
-	if (player->audio_st) {
-		bytes_per_sec = player->sdl_sample_rate * player->sdl_channels
-				* av_get_bytes_per_sample(player->sdl_sample_fmt);
-	}
-
-	if (bytes_per_sec)
-		pts -= (double) hw_buf_size / bytes_per_sec;
-	return pts;
+	return clock_snapshot_get(&player->clock) / 1000000.0;
 }
 
 /* pause or resume the video */
@@ -145,10 +149,37 @@ int ap_init() {
 
 void ap_uninit() {
 	log_info("ap_uninit()");
+	preload_shutdown();
 	avformat_network_deinit();
 }
 
-extern int player_thread(player_t *player);
+
+static pthread_mutex_t thread_config_mutex = PTHREAD_MUTEX_INITIALIZER;
+static ap_thread_config_t thread_config;
+
+#ifdef AP_DEBUG_ALLOC
+atomic_llong ap_own_alloc_count;
+#endif
+
+void ap_set_thread_config(const ap_thread_config_t *config) {
+	pthread_mutex_lock(&thread_config_mutex);
+	thread_config = *config;
+	pthread_mutex_unlock(&thread_config_mutex);
+}
+
+void ap_get_thread_config(ap_thread_config_t *config) {
+	pthread_mutex_lock(&thread_config_mutex);
+	*config = thread_config;
+	pthread_mutex_unlock(&thread_config_mutex);
+}
+
+int64_t ap_get_own_alloc_count() {
+#ifdef AP_DEBUG_ALLOC
+	return atomic_load(&ap_own_alloc_count);
+#else
+	return -1;
+#endif
+}
 
 static int start_thread(player_t *player) {
 	int ret = 0;
@@ -156,23 +187,38 @@ static int start_thread(player_t *player) {
 	log_info("start_thread()");
 	pthread_attr_t attr;
 	pthread_attr_init(&attr);
-	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
-	if ((ret = pthread_create(&player->player_thread, NULL,
+	//joinable, ap_delete() joins it
+	thread_config_init_attr(&player->thread_config, &attr);
+	if ((ret = pthread_create(&player->player_thread, &attr,
 			(void*) player_thread, player)) != SUCCESS) {
-		log_error("failed to start decode thread: %s", strerror(errno));
+		log_error("failed to start decode thread: %s", strerror(ret));
 	}
 	pthread_attr_destroy(&attr);
 	END_LOCK(player);
 	return ret;
 }
 
-player_t* ap_create(player_callbacks_t callbacks) {
-	log_info("ap_create()");
+player_t* alloc_player(player_callbacks_t callbacks) {
 	player_t *player = av_mallocz(sizeof(player_t));
 	if (!player)
 		return NULL;
 
 	player->callbacks = callbacks;
+	player->sink_fd = -1;
+	player->demux_fd = -1;
+	player->output_sample_fmt = AV_SAMPLE_FMT_S16;
+	ap_get_thread_config(&player->thread_config);
+	atomic_init(&player->state, STATE_IDLE);
+	atomic_init(&player->analyzer, NULL);
+	atomic_init(&player->gain_q16, AP_GAIN_UNITY);
+	atomic_init(&player->tempo_q16, AP_TEMPO_UNITY);
+	atomic_init(&player->stats_sample_rate, 0);
+	atomic_init(&player->eq_next, NULL);
+	eq_init(&player->eq);
+	seek_index_init(&player->seek_index);
+	atomic_init(&player->io_generation, 0);
+	event_queue_init(&player->events);
+	clock_snapshot_init(&player->clock);
 	pthread_mutexattr_t attr;
 
 	pthread_mutexattr_init(&attr);
@@ -180,11 +226,24 @@ player_t* ap_create(player_callbacks_t callbacks) {
 	pthread_mutex_init(&player->mutex, &attr);
 	pthread_mutexattr_destroy(&attr);
 
+	packet_queue_init(&player->audioq);
+
 	if (pipe2(player->pipe, O_NONBLOCK) != 0) {
 		log_error("pipe failed");
-		ap_delete(player);
+		packet_queue_end(&player->audioq);
+		event_queue_free(&player->events);
+		pthread_mutex_destroy(&player->mutex);
+		av_free(player);
 		return NULL;
 	}
+	return player;
+}
+
+player_t* ap_create(player_callbacks_t callbacks) {
+	log_info("ap_create()");
+	player_t *player = alloc_player(callbacks);
+	if (!player)
+		return NULL;
 
 	if (start_thread(player) != SUCCESS) {
 		log_error("ap_create::failed to start thread");
@@ -196,14 +255,53 @@ player_t* ap_create(player_callbacks_t callbacks) {
 	return player;
 }
 
+player_t* ap_create_in_engine(ap_engine_t *engine,
+		player_callbacks_t callbacks) {
+	log_info("ap_create_in_engine()");
+	player_t *player = alloc_player(callbacks);
+	if (!player)
+		return NULL;
+
+	if (engine_add_player(engine, player) != SUCCESS) {
+		log_error("ap_create_in_engine::failed to add player");
+		if (player->callbacks.dispatcher)
+			dispatcher_remove_player(player->callbacks.dispatcher, player);
+		av_free(player);
+		return NULL;
+	}
+	return player;
+}
+
+void ap_set_sink_fd(player_t *player, int fd) {
+	player->sink_fd = fd;
+}
+
+static void clear_sources(player_t *player) {
+	int i;
+	for (i = 0; i < player->nb_sources; i++)
+		av_freep(&player->sources[i]);
+	player->nb_sources = 0;
+}
+
 void ap_delete(player_t* player) {
 	if (!player)
 		return;
 	player->abort_call = 1;
 	ap_send_cmd(player, CMD_EXIT);
-	log_info("ap_delete::calling join on %"PRIXPTR,
-			(intptr_t )player->player_thread);
-	pthread_join(player->player_thread, NULL);
+	if (player->engine) {
+		log_info("ap_delete::waiting for the engine");
+		engine_remove_player(player->engine, player);
+	} else {
+		log_info("ap_delete::calling join on %"PRIXPTR,
+				(intptr_t )player->player_thread);
+		pthread_join(player->player_thread, NULL);
+	}
+	if (player->callbacks.dispatcher)
+		dispatcher_remove_player(player->callbacks.dispatcher, player);
+	clear_sources(player);
+	event_queue_free(&player->events);
+	analyzer_free(player->analyzer);
+	av_free(atomic_load(&player->eq_next));
 	log_info("ap_delete::done");
 	av_freep(&player);
 }
@@ -212,11 +310,141 @@ int ap_reset(player_t *player) {
 	return ap_send_cmd(player, CMD_RESET);
 }
 
+static void set_next_preload(player_t *player, ap_preload_t *preload) {
+	BEGIN_LOCK(player);
+	if (player->next_preload)
+		ap_preload_release(player->next_preload);
+	player->next_preload = preload;
+	END_LOCK(player);
+}
+
+static int set_sources(player_t *player, const char **urls, int nb_urls) {
+	int i, ret = SUCCESS;
+
+	BEGIN_LOCK(player);
+	clear_sources(player);
+	for (i = 0; i < FFMIN(nb_urls, AP_MAX_SOURCES); i++) {
+		if (!(player->sources[i] = av_strdup(urls[i]))) {
+			ret = AVERROR(ENOMEM);
+			break;
+		}
+		player->nb_sources++;
+	}
+	av_strlcpy(player->url, urls[0], sizeof(player->url));
+	END_LOCK(player);
+	return ret;
+}
+
 int ap_set_datasource(player_t *player, const char *url) {
 	log_info("ap_set_datasource() url:%s", url);
-	av_strlcpy(player->url, url, sizeof(player->url));
+	set_next_preload(player, NULL);
+	set_sources(player, &url, 1);
+	return ap_send_cmd(player, CMD_SET_DATASOURCE);
+
+}
+
+int ap_set_datasource_preloaded(player_t *player, ap_preload_t *preload) {
+	const char *url;
+	int ret;
+	if (!preload)
+		return FAILURE;
+	url = preload_get_url(preload);
+	log_info("ap_set_datasource_preloaded() url:%s", url);
+	set_next_preload(player, preload);
+	set_sources(player, &url, 1);
+	if ((ret = ap_send_cmd(player, CMD_SET_DATASOURCE)) < 0)
+		return ret;
+	return ap_send_cmd(player, CMD_PREPARE);
+}
+
+int ap_set_datasources(player_t *player, const char **urls, int nb_urls) {
+	int ret;
+	if (nb_urls <= 0)
+		return FAILURE;
+	if (nb_urls > AP_MAX_SOURCES)
+		log_warn("ap_set_datasources::only racing the first %d of %d urls",
+				AP_MAX_SOURCES, nb_urls);
+	log_info("ap_set_datasources() url:%s mirrors: %d", urls[0], nb_urls);
+	set_next_preload(player, NULL);
+	if ((ret = set_sources(player, urls, nb_urls)) < 0)
+		return ret;
 	return ap_send_cmd(player, CMD_SET_DATASOURCE);
+}
+
+void ap_set_gain(player_t *player, double gain_db) {
+	double gain = pow(10.0, gain_db / 20.0) * AP_GAIN_UNITY;
+	log_info("ap_set_gain() %.2f dB", gain_db);
+	atomic_store(&player->gain_q16, (int) FFMIN(gain + 0.5, INT_MAX));
+}
+
+void ap_set_tempo(player_t *player, double tempo) {
+	log_info("ap_set_tempo() %.2f", tempo);
+	tempo = av_clipd(tempo, AP_TEMPO_MIN, AP_TEMPO_MAX);
+	atomic_store(&player->tempo_q16, (int) (tempo * AP_TEMPO_UNITY + 0.5));
+}
+
+int ap_set_eq(player_t *player, const ap_eq_band_t *bands, int nb_bands) {
+	eq_settings_t *settings;
+
+	log_info("ap_set_eq() bands: %d", nb_bands);
+	if (nb_bands < 0 || nb_bands > AP_EQ_MAX_BANDS || (nb_bands && !bands))
+		return AVERROR(EINVAL);
+	if (!(settings = av_mallocz(sizeof(eq_settings_t))))
+		return AVERROR(ENOMEM);
+	settings->nb_bands = nb_bands;
+	if (nb_bands)
+		memcpy(settings->bands, bands, nb_bands * sizeof(ap_eq_band_t));
+
+	//settings the player thread has not taken yet are replaced
+	av_free(atomic_exchange(&player->eq_next, settings));
+	return SUCCESS;
+}
+
+int ap_set_graphic_eq(player_t *player, const double *gains_db) {
+	ap_eq_band_t bands[AP_EQ_GRAPHIC_BANDS];
+	int i;
+
+	for (i = 0; i < AP_EQ_GRAPHIC_BANDS; i++) {
+		bands[i].freq_hz = 31.25 * (1 << i);
+		bands[i].gain_db = gains_db[i];
+		bands[i].q = AP_EQ_GRAPHIC_Q;
+	}
+	return ap_set_eq(player, bands, AP_EQ_GRAPHIC_BANDS);
+}
+
+void ap_set_normalization(player_t *player, const ap_loudness_t *loudness,
+		double target_lufs) {
+	ap_set_gain(player, ap_normalization_gain(loudness, target_lufs));
+}
+
+ap_spectrum_t *ap_start_analyzer(player_t *player, int bands, int rate_hz) {
+	ap_analyzer_t *analyzer;
+	log_info("ap_start_analyzer() bands: %d rate: %d", bands, rate_hz);
+
+	BEGIN_LOCK(player);
+	if (!(analyzer = player->analyzer)) {
+		if ((analyzer = analyzer_create()))
+			atomic_store_explicit(&player->analyzer, analyzer,
+					memory_order_release);
+	}
+	if (analyzer && analyzer_start(analyzer, bands, rate_hz) < 0)
+		analyzer = NULL;
+	END_LOCK(player);
+	return analyzer ? analyzer_spectrum(analyzer) : NULL;
+}
 
+void ap_stop_analyzer(player_t *player) {
+	BEGIN_LOCK(player);
+	if (player->analyzer)
+		analyzer_stop(player->analyzer);
+	END_LOCK(player);
+}
+
+int ap_read_spectrum(player_t *player, float *bands, int max) {
+	ap_analyzer_t *analyzer = atomic_load_explicit(&player->analyzer,
+			memory_order_acquire);
+
+	return analyzer ? analyzer_read(analyzer, bands, max) : 0;
 }
 
 int ap_prepare_async(player_t *player) {
@@ -272,16 +500,20 @@ void ap_print_metadata(player_t *player) {
 
 //duration of current track in ms
 int32_t ap_get_duration(player_t *player) {
-	if (player->state == STATE_PREPARED || player->state == STATE_STARTED
-			|| player->state == STATE_PAUSED || player->state == STATE_STOPPED
-			|| player->state == STATE_COMPLETED) {
+	audio_state_t state = player->state;
+	if (state == STATE_PREPARED || state == STATE_STARTED
+			|| state == STATE_PAUSED || state == STATE_STOPPED
+			|| state == STATE_COMPLETED) {
+		int64_t duration = atomic_load(&player->duration_us);
+		if (duration > 0)
+			return (int32_t) (duration / 1000);
 		if (player && player->ic
 				&& player->ic->duration
 						> 0&& player->ic->duration != AV_NOPTS_VALUE)
 			return (int32_t) (player->ic->duration / 1000);
 	} else {
 		log_error("ap_get_duration() called in illegal state: %s",
-				ap_get_state_name(player->state));
+				ap_get_state_name(state));
 	}
 	return -1;
 }
@@ -302,3 +534,89 @@ int ap_is_looping(player_t *player) {
 void ap_set_looping(player_t *player, int looping) {
 	player->looping = looping;
 }
+
+int ap_is_early_start(player_t *player) {
+	return player->early_start;
+}
+
+void ap_set_early_start(player_t *player, int early_start) {
+	player->early_start = early_start;
+}
+
+void ap_set_render_mode(player_t *player, int render) {
+	BEGIN_LOCK(player);
+	player->render_next = render;
+	END_LOCK(player);
+}
+
+void ap_set_jitter_buffer(player_t *player, int min_ms, int max_ms) {
+	BEGIN_LOCK(player);
+	player->jitter_min_ms = min_ms;
+	player->jitter_max_ms = max_ms;
+	END_LOCK(player);
+}
+
+void ap_set_silence_trim(player_t *player, int enabled, double threshold_db,
+		int min_ms, int trim_end) {
+	log_info("ap_set_silence_trim() enabled: %d threshold: %.1f dB min: %d ms end: %d",
+			enabled, threshold_db, min_ms, trim_end);
+	BEGIN_LOCK(player);
+	player->silence_next.enabled = enabled;
+	player->silence_next.threshold_db = threshold_db;
+	player->silence_next.min_ms = FFMAX(min_ms, 0);
+	player->silence_next.trim_end = trim_end;
+	END_LOCK(player);
+}
+
+void ap_set_seek_index(player_t *player, int mode) {
+	log_info("ap_set_seek_index() mode: %d", mode);
+	BEGIN_LOCK(player);
+	player->seek_index_next = mode;
+	END_LOCK(player);
+}
+
+void ap_set_exact_duration(player_t *player, int enabled) {
+	log_info("ap_set_exact_duration() %d", enabled);
+	BEGIN_LOCK(player);
+	player->exact_duration_next = enabled;
+	END_LOCK(player);
+}
+
+int ap_get_stats(player_t *player, ap_stats_t *stats) {
+	jitter_buffer_t *jb = &player->jitter;
+	int64_t buffered = 0, frames;
+	int i, sample_rate;
+
+	memset(stats, 0, sizeof(ap_stats_t));
+
+	/* the demux thread updates the jitter buffer under the queue mutex. The
+	 * stream itself is not touched, the player thread closes it unlocked */
+	pthread_mutex_lock(&player->audioq.mutex);
+	if (player->audioq.time_base.num)
+		buffered = av_rescale_q(player->audioq.duration,
+				player->audioq.time_base, (AVRational ) { 1, 1000 });
+	stats->buffering = jb->buffering;
+	stats->buffer_target_ms = (int) (jb->target / 1000);
+	stats->arrival_jitter_ms = (int) (jb->jitter / 1000);
+	stats->underruns = jb->underruns;
+	stats->underrun_ms = (int) (jb->underrun_time / 1000);
+	pthread_mutex_unlock(&player->audioq.mutex);
+
+	sample_rate = atomic_load(&player->stats_sample_rate);
+	stats->buffered_ms = (int) buffered;
+
+	stats->eq_bands = atomic_load(&player->eq.nb_bands);
+	frames = atomic_load(&player->eq.frames);
+	for (i = 0; i < AP_EQ_MAX_BANDS && frames > 0; i++)
+		stats->eq_band_cost_us[i] = (double) atomic_load(&player->eq.band_ns[i])
+				* sample_rate / frames / 1000;
+
+	int64_t started = atomic_load(&player->started_us);
+	int64_t since = atomic_load(&player->started_at);
+	if (since)
+		started += jitter_buffer_now() - since;
+	if (started > 0)
+		stats->realtime_factor = (double) atomic_load(&player->played_us)
+				/ started;
+	return SUCCESS;
+}
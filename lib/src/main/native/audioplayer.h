@@ -4,9 +4,20 @@
 #include <string.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
 #include <libavresample/avresample.h>
+#include "packet_queue.h"
+#include "jitter_buffer.h"
+#include "silence.h"
+#include "seek_index.h"
+#include "scan.h"
+#include "stretch.h"
+#include "eq.h"
+#include "event_queue.h"
+#include "clock_snapshot.h"
+#include "buffer_pool.h"
 
 
 
@@ -19,12 +30,31 @@
 #define OUTPUT_SAMPLE_FMT AV_SAMPLE_FMT_S16
 
 
-#define MAX_QUEUE_SIZE (15  * 1024)
+#define MAX_QUEUE_SIZE (15 * 1024 * 1024)
 #define MIN_AUDIOQ_SIZE (20 * 16 * 1024)
 #define SDL_AUDIO_BUFFER_SIZE 1024
 
-/* NOTE: the size must be big enough to compensate the hardware audio buffersize size */
-#define SAMPLE_ARRAY_SIZE (2 * 65536)
+//player_t.gain_q16 of 0 dB
+#define AP_GAIN_UNITY 65536
+
+//player_t.tempo_q16 of normal speed, see ap_set_tempo()
+#define AP_TEMPO_UNITY 65536
+#define AP_TEMPO_MIN 0.5
+#define AP_TEMPO_MAX 3.0
+
+//bands of ap_set_graphic_eq(), an octave apart from 31.25Hz
+#define AP_EQ_GRAPHIC_BANDS 10
+#define AP_EQ_GRAPHIC_Q 1.41
+
+//mirrors of a source raced by prepare, see ap_set_datasources()
+#define AP_MAX_SOURCES 8
+
+//files ap_probe_files() has open at once
+#define AP_PROBE_MAX_OPEN 32
+
+//modes of ap_set_seek_index()
+#define AP_SEEK_INDEX_RECORD 1
+#define AP_SEEK_INDEX_SCAN 2
 
 typedef enum {
 	STATE_IDLE,
@@ -40,7 +70,15 @@ typedef enum {
 } audio_state_t;
 
 typedef enum {
-	EVENT_THREAD_START = 1, EVENT_STATE_CHANGE, EVENT_SEEK_COMPLETE
+	EVENT_THREAD_START = 1,
+	EVENT_STATE_CHANGE,
+	EVENT_SEEK_COMPLETE,
+	//the jitter buffer ran empty (arg1 == 1) or is filling for the first time
+	EVENT_BUFFERING_START,
+	//arg1 is the time spent buffering in ms
+	EVENT_BUFFERING_END,
+	//arg1 is the exact duration in ms found by ap_set_exact_duration()
+	EVENT_DURATION_UPDATED
 } audio_event_t;
 
 typedef enum {
@@ -51,19 +89,94 @@ typedef enum {
 	CMD_STOP,
 	CMD_SEEK,
 	CMD_RESET,
-	CMD_EXIT
+	CMD_EXIT,
+	//sent by the background scan of the track, see scan.c
+	CMD_SCAN_DONE
 } audio_cmd_t;
 
+//what is written to player->pipe
+typedef struct {
+	audio_cmd_t cmd;
+	//player->io_generation when the command was sent
+	unsigned int generation;
+} player_cmd_t;
+
 const char* ap_get_state_name(audio_state_t state);
 
+//a source opened in the background by ap_preload()
+typedef struct ap_preload_t ap_preload_t;
+
+//a pool of worker threads shared by players, see ap_engine_create()
+typedef struct ap_engine_t ap_engine_t;
+
+//a thread that delivers player events, see ap_dispatcher_create()
+typedef struct ap_dispatcher_t ap_dispatcher_t;
+
+//spectrum analysis of what a player plays, see ap_start_analyzer()
+typedef struct ap_analyzer_t ap_analyzer_t;
+
+#define AP_SPECTRUM_MAX_BANDS 64
+
+/* the latest spectrum, shared with readers on any thread. A seqlock like
+ * clock_snapshot_t: seq is odd while the analyzer writes, readers retry if it
+ * was odd or changed while they read, see ap_read_spectrum() */
+typedef struct ap_spectrum_t {
+	atomic_uint seq;
+	int32_t nb_bands;
+	int32_t sample_rate;
+	int32_t reserved;
+	//power in dBFS of log spaced bands from 20 Hz to sample_rate / 2
+	float bands[AP_SPECTRUM_MAX_BANDS];
+} ap_spectrum_t;
+
+//an embedded picture, see ap_get_cover_art()
+typedef struct ap_cover_art_t {
+	//the encoded image, in the packet read by the demuxer
+	const uint8_t *data;
+	int size;
+	//"image/jpeg", "image/png", empty if unknown
+	char mime_type[16];
+	//holds data, released by ap_cover_art_free()
+	AVBufferRef *buf;
+} ap_cover_art_t;
+
+typedef struct ap_thread_config_t {
+	//the nice value of the thread, or its SCHED_FIFO priority if fifo is set
+	int priority;
+	//SCHED_FIFO usually needs privileges, the thread falls back to the default
+	//policy when it is refused
+	int fifo;
+	//bit n allows the thread on cpu n, 0 for any cpu
+	uint64_t cpu_mask;
+	//0 for the default
+	size_t stack_size;
+} ap_thread_config_t;
+
 typedef struct player_t {
 	int looping;
+	//decode as fast as possible, see ap_set_render_mode(). render_next is
+	//copied to render by the next prepare
+	int render;
+	int render_next;
+	//open the codec from the first packet instead of avformat_find_stream_info(),
+	//the duration may be unknown for files without a header that records it
+	int early_start;
+	//output parameters came from the first packet and may still change
+	int provisional_params;
 	int abort_call;
-	audio_state_t state;
+	//only changed by the thread running the player, never under the mutex
+	_Atomic(audio_state_t) state;
+	//events are delivered from here after any lock has been released
+	event_queue_t events;
 	pthread_mutex_t mutex;
 	pthread_t player_thread;
+	ap_thread_config_t thread_config;
 	int seek_req;
 	int seek_flags;
+	//advanced by commands that cancel the blocking call the player is making
+	atomic_uint io_generation;
+	//the generation of the command being handled, see decode_interrupt_cb()
+	unsigned int io_token;
 
 	int64_t seek_pos;
 	int64_t seek_rel;
@@ -72,7 +185,98 @@ typedef struct player_t {
 	int audio_stream;
 	int pipe[2];
 
+	//NULL if the player has its own thread
+	ap_engine_t *engine;
+	void *engine_node;
+	//engine players: the open a prepare is waiting for, see source_open.h
+	struct source_open_t *opening;
+	//see ap_set_sink_fd()
+	int sink_fd;
+
+	//reads ahead of the decoder, see demux_thread.c
+	pthread_t demux_thread;
+	int demux_running;
+	atomic_int demux_quit;
+	//engine players read in the engine's pool instead of on a thread of their
+	//own, the rest is guarded by the pool's mutex
+	struct demux_pool_t *demux_pool;
+	struct player_t *demux_next;
+	int demux_queued;
+	int demux_busy;
+	//waiting in the pool for room in audioq, see demux_room()
+	atomic_int demux_parked;
+	//consecutive read errors and the wait before the next read
+	int demux_errors;
+	int64_t demux_retry_us;
+	//the stream was paused with av_read_pause(), only used by the demux thread
+	int demux_paused;
+	//eventfd the demux thread signals when demux_wake is set
+	int demux_fd;
+	atomic_int demux_wake;
+	//the read error the demux thread gave up on, reported once the queue is empty
+	atomic_int demux_error;
+
+	//decoder state, only used by the thread running the player
+	//(and set by the demux thread)
+	atomic_int eof;
+	//feeding empty packets to the decoder for its delayed frames
+	int draining;
+	int epoll_timeout;
+	int st_index[AVMEDIA_TYPE_NB];
+	AVAudioResampleContext *avr;
+	AVFrame *frame;
+	AVPacket pkt;
+	//media time handed to on_play and wall clock time spent started since
+	//the last prepare, for the real-time factor of ap_get_stats()
+	atomic_llong played_us;
+	atomic_llong started_us;
+	atomic_llong started_at;
+	//sdl_sample_rate for ap_get_stats(), which runs on other threads
+	atomic_int stats_sample_rate;
+	//frames and the output buffer, kept across tracks
+	buffer_pool_t pool;
+	//linear output gain in 1/65536, see ap_set_gain()
+	atomic_int gain_q16;
+	//content played per second of output in 1/65536, see ap_set_tempo()
+	atomic_int tempo_q16;
+	time_stretch_t stretch;
+	//settings of the last ap_set_eq() until the player thread takes them
+	_Atomic(eq_settings_t *) eq_next;
+	eq_t eq;
+	//created by the first ap_start_analyzer() and kept until ap_delete()
+	_Atomic(ap_analyzer_t *) analyzer;
+
+	//packets read ahead of the decoder
+	PacketQueue audioq;
+	jitter_buffer_t jitter;
+	int jitter_min_ms;
+	int jitter_max_ms;
+	//see ap_set_silence_trim(), silence_next is copied by the next prepare
+	silence_settings_t silence_next;
+	silence_trim_t silence;
+	//see ap_set_seek_index(), seek_index_next is copied by the next prepare
+	int seek_index_next;
+	seek_index_t seek_index;
+	//see ap_set_exact_duration(), exact_duration_next is copied by the next
+	//prepare
+	int exact_duration_next;
+	int exact_duration;
+	//reads the track ahead of playback for the seek index and the duration
+	track_scan_t scan;
+	//exact duration in us, 0 until known
+	atomic_llong duration_us;
+	//of the prepared track, set and read under the lock
+	ap_cover_art_t cover_art;
+
+	//set by ap_set_datasource_preloaded(), owned by the player thread once
+	//CMD_SET_DATASOURCE has been handled
+	ap_preload_t *next_preload;
+	ap_preload_t *preload;
+
+	//decoder side clock in seconds, only used by the thread running the player
 	double audio_clock;
+	//published copy of the clock for ap_get_audio_clock()
+	clock_snapshot_t clock;
 
 	AVStream *audio_st;
 
@@ -83,6 +287,8 @@ typedef struct player_t {
 	int audio_buf_index; /* in bytes */
 
 	enum AVSampleFormat sdl_sample_fmt;
+	//passed to on_prepare, AV_SAMPLE_FMT_S16 unless decoding offline
+	enum AVSampleFormat output_sample_fmt;
 
 	uint64_t sdl_channel_layout;
 	int sdl_channels;
@@ -92,10 +298,11 @@ typedef struct player_t {
 	uint64_t resample_channel_layout;
 	int resample_sample_rate;
 
-	int16_t *sample_array[SAMPLE_ARRAY_SIZE];
-	int sample_array_index;
-
 	char url[1024];
+	//the candidates for url, guarded by mutex. The prepare that wins the race
+	//copies its url in
+	char *sources[AP_MAX_SOURCES];
+	int nb_sources;
 
 	struct _player_callbacks_t {
 
@@ -107,14 +314,83 @@ typedef struct player_t {
 		int (*on_prepare)(struct player_t *player, int sampleFormat,
 				int sampleRate, int channelFormat);
 
+		//deliver on_event from this thread instead of the player thread,
+		//NULL to deliver inline
+		ap_dispatcher_t *dispatcher;
+
 	} callbacks;
 
+	//see dispatcher.c
+	struct player_t *dispatch_next;
+	int dispatch_queued;
+
 	void *extra;
 
 } player_t;
 
 typedef struct _player_callbacks_t player_callbacks_t;
 
+typedef struct ap_stats_t {
+	int buffering;
+	int buffered_ms;
+	int buffer_target_ms;
+	int arrival_jitter_ms;
+	//underruns since the source was prepared
+	int underruns;
+	int underrun_ms;
+	//media time played per second spent started, about 1 when paced by the
+	//output and higher in render mode
+	double realtime_factor;
+	//bands of ap_set_eq() and the processor time each costs in µs per second
+	//of audio, since the source was prepared
+	int eq_bands;
+	double eq_band_cost_us[AP_EQ_MAX_BANDS];
+} ap_stats_t;
+
+//loudness of a track, see ap_scan_loudness()
+typedef struct ap_loudness_t {
+	//gated integrated loudness, -INFINITY if the track is silent
+	double integrated_lufs;
+	double range_lu;
+	//of the 4x oversampled signal
+	double true_peak_dbtp;
+} ap_loudness_t;
+
+//ap_normalization_gain() keeps the true peak at or below this
+#define AP_TRUE_PEAK_CEILING_DB -1.0
+
+//one bucket of a waveform overview, see ap_compute_peaks()
+typedef struct ap_peak_t {
+	float min;
+	float max;
+	float rms;
+} ap_peak_t;
+
+//stream info and tags of a file, see ap_probe()
+typedef struct ap_probe_info_t {
+	//0 if unknown
+	int64_t duration_us;
+	int64_t bit_rate;
+	int32_t sample_rate;
+	int32_t channels;
+	char codec[16];
+	//container and audio stream tags, released by ap_probe_free()
+	AVDictionary *tags;
+	//size 0 without one, released by ap_probe_free()
+	ap_cover_art_t cover_art;
+} ap_probe_info_t;
+
+typedef struct ap_dispatcher_stats_t {
+	//events waiting to be delivered
+	int queue_depth;
+	int max_queue_depth;
+	int64_t events;
+	int64_t batches;
+	//from the event being queued to on_event being called
+	int avg_latency_us;
+	int max_latency_us;
+} ap_dispatcher_stats_t;
+
 typedef void (*on_state_change_t)(player_t *player, audio_state_t old_state,
 		audio_state_t new_state);
 
@@ -125,6 +401,11 @@ typedef void (*callback_t)(player_t *player);
 typedef int (*on_prepare_t)(struct player_t *player, int sampleFormat,
 		int sampleRate, int channelFormat);
 
+//receives the decoded pcm of the file at index of an offline decode.
+//return < 0 to stop decoding the file
+typedef int (*ap_sink_fn)(void *opaque, int index, int sample_rate,
+		int channels, const char *data, int len);
+
 //one off initialization of the library
 int ap_init();
 
@@ -135,6 +416,100 @@ player_t* ap_create(player_callbacks_t callbacks);
 
 void ap_delete(player_t* player);
 
+//the thread configuration of player threads and engine workers created from
+//now on
+void ap_set_thread_config(const ap_thread_config_t *config);
+
+void ap_get_thread_config(ap_thread_config_t *config);
+
+//heap allocations made by the library's own code so far, -1 unless built
+//with AP_DEBUG_ALLOC. Allocations made inside ffmpeg, such as the buffer of
+//every packet av_read_frame() returns, are not counted: steady state playback
+//makes none of its own, not none at all
+int64_t ap_get_own_alloc_count();
+
+//start a pool of threads that runs any number of players created with
+//ap_create_in_engine(). Opens happen on other threads and reads on as many
+//threads again, shared by the players. on_play is called on a worker and
+//must not block; pace it with ap_set_sink_fd()
+ap_engine_t *ap_engine_create(int threads);
+
+//all players of the engine must have been deleted
+void ap_engine_delete(ap_engine_t *engine);
+
+//create a player that is run by the engine instead of its own thread
+player_t* ap_create_in_engine(ap_engine_t *engine, player_callbacks_t callbacks);
+
+//start a thread that delivers the events of every player created with it in
+//player_callbacks_t.dispatcher, in order and in batches. One can be shared by
+//a whole process or by the players of an engine. thread_init, if not NULL, is
+//run first on the new thread
+ap_dispatcher_t *ap_dispatcher_create(void (*thread_init)(void));
+
+//all players using the dispatcher must have been deleted
+void ap_dispatcher_delete(ap_dispatcher_t *dispatcher);
+
+void ap_dispatcher_get_stats(ap_dispatcher_t *dispatcher,
+		ap_dispatcher_stats_t *stats);
+
+//decode url to the end on the calling thread as fast as possible, converted
+//to format (packed formats only). The sink is called with index 0. Returns
+//SUCCESS, the sink's error or an ffmpeg error
+int ap_decode_file(const char *url, enum AVSampleFormat format, ap_sink_fn sink,
+		void *opaque);
+
+//decode nb_urls files on a pool of threads, one per core if threads <= 0.
+//The sink is called concurrently from the pool with the index of the file.
+//results, if not NULL, receives the return value of each file. Returns
+//FAILURE if any file failed
+int ap_decode_files(const char **urls, int nb_urls, enum AVSampleFormat format,
+		ap_sink_fn sink, void *opaque, int threads, int *results);
+
+//EBU R128 loudness of nb_urls files into loudness, on a pool of threads, one
+//per core if threads <= 0. Multichannel files are measured after the stereo
+//downmix of playback. results, if not NULL, receives the return value of
+//each file. Returns FAILURE if any file failed
+int ap_scan_loudness(const char **urls, int nb_urls, ap_loudness_t *loudness,
+		int threads, int *results);
+
+//the gain in dB that brings a track to target_lufs, lowered so its true peak
+//stays at or below AP_TRUE_PEAK_CEILING_DB. 0 for a silent track
+double ap_normalization_gain(const ap_loudness_t *loudness, double target_lufs);
+
+//cache what is computed from whole local files in dir, keyed by url, size
+//and mtime: the blocks of ap_compute_peaks(), the silence trimmed by
+//ap_set_silence_trim(), the seek index and the exact duration. NULL or ""
+//disables the cache
+void ap_set_cache_dir(const char *dir);
+
+//waveform overview of url: the min, max and rms of all channels in each of
+//buckets equal parts, into peaks. Decoded at full speed unless cached.
+//Returns SUCCESS or an ffmpeg error
+int ap_compute_peaks(const char *url, int buckets, ap_peak_t *peaks);
+
+//ap_compute_peaks() for nb_urls files on a pool of threads, one per core if
+//threads <= 0, peaks[i] receiving the overview of urls[i]. results, if not
+//NULL, receives the return value of each file
+int ap_compute_peaks_files(const char **urls, int nb_urls, int buckets,
+		ap_peak_t **peaks, int threads, int *results);
+
+//stream info and tags of the audio stream of url, from the container alone
+//where it has them, without a player or decoder. Returns SUCCESS or an ffmpeg
+//error. Release info with ap_probe_free()
+int ap_probe(const char *url, ap_probe_info_t *info);
+
+void ap_probe_free(ap_probe_info_t *info);
+
+//ap_probe() nb_urls files into infos on a pool of threads, one per core if
+//threads <= 0 and never more than AP_PROBE_MAX_OPEN. results, if not NULL,
+//receives the return value of each file. Returns FAILURE if any file failed
+int ap_probe_files(const char **urls, int nb_urls, ap_probe_info_t *infos,
+		int threads, int *results);
+
+//for engine players whose output is a file descriptor: decode only when fd is
+//writable instead of scheduling the player round robin. -1 to unset
+void ap_set_sink_fd(player_t *player, int fd);
+
 double ap_get_audio_clock(player_t *player);
 
 int ap_start(player_t *player);
@@ -145,14 +520,42 @@ int ap_pause(player_t *player);
 
 int ap_set_datasource(player_t *player, const char* url);
 
+//set up to AP_MAX_SOURCES mirrors of one source. Prepare opens all of them at
+//once, plays the first that has a decodable audio stream and cancels the rest
+int ap_set_datasources(player_t *player, const char **urls, int nb_urls);
+
 int ap_prepare_async(player_t *player);
 
+//open and probe url in the background and buffer the first seconds of it.
+//returns NULL on failure
+ap_preload_t *ap_preload(const char *url);
+
+//release a preload that was not passed to ap_set_datasource_preloaded()
+void ap_preload_release(ap_preload_t *preload);
+
+//at most max_sources preloads hold open sources, the least recently requested
+//is evicted to make room. Each buffers at most buffer_ms of packets
+void ap_preload_set_limits(int max_sources, int buffer_ms);
+
+//use a preloaded source and prepare it. The player goes straight to
+//STATE_PREPARED when the preload has finished and falls back to a normal
+//prepare if it failed or was evicted. Takes over the reference to preload
+int ap_set_datasource_preloaded(player_t *player, ap_preload_t *preload);
+
 int ap_reset(player_t *player);
 
 void ap_seek(player_t *player, int64_t pos, int relative);
 
 void ap_print_metadata(player_t *player);
 
+//the picture embedded in the prepared track, the front cover if there are
+//several. art refers to the demuxer's packet without copying it, and stays
+//valid after the track is reset until ap_cover_art_free(). Returns SUCCESS or
+//AVERROR_STREAM_NOT_FOUND
+int ap_get_cover_art(player_t *player, ap_cover_art_t *art);
+
+void ap_cover_art_free(ap_cover_art_t *art);
+
 //duration of current track in ms
 int32_t ap_get_duration(player_t *player);
 
@@ -165,13 +568,97 @@ int ap_is_looping(player_t *player);
 
 void ap_set_looping(player_t *player, int looping);
 
+int ap_is_early_start(player_t *player);
+
+//only takes effect on the next prepare
+void ap_set_early_start(player_t *player, int early_start);
+
+//render faster than realtime: on_play is called as fast as decoding allows,
+//ignoring the sink fd and the jitter buffer, and the audio clock is not
+//interpolated. Only takes effect on the next prepare
+void ap_set_render_mode(player_t *player, int render);
+
+//buffer between min_ms and max_ms of packets ahead of the decoder depending
+//on the observed network jitter. min_ms == 0 disables the buffer.
+//only takes effect on the next prepare
+void ap_set_jitter_buffer(player_t *player, int min_ms, int max_ms);
+
+//skip the silence before the first audible sample and, if trim_end, end the
+//track where the silence after the last one starts. Samples at or below
+//threshold_db are silent, runs shorter than min_ms are played. What a
+//complete play finds is cached, see ap_set_cache_dir(), so the next play of
+//the same file seeks past it. Only takes effect on the next prepare
+void ap_set_silence_trim(player_t *player, int enabled, double threshold_db,
+		int min_ms, int trim_end);
+
+//index the byte offsets of the audio stream so seeks go straight to them,
+//for VBR mp3 without a TOC and long ogg files. AP_SEEK_INDEX_RECORD records
+//them while playing from the start, AP_SEEK_INDEX_SCAN also reads the whole
+//file ahead of playback on a thread of its own, if it is a seekable source of
+//known size. A complete index is cached,
+//see ap_set_cache_dir(). 0 disables it. Only takes effect on the next prepare
+void ap_set_seek_index(player_t *player, int mode);
+
+//find the exact duration by reading the whole track ahead of playback on a
+//thread of its own, without decoding, if it is a seekable source of known
+//size. ap_get_duration() returns it and
+//EVENT_DURATION_UPDATED is sent once it is known. The duration of a local
+//file is cached, see ap_set_cache_dir(). Only takes effect on the next prepare
+void ap_set_exact_duration(player_t *player, int enabled);
+
+int ap_get_stats(player_t *player, ap_stats_t *stats);
+
+//scale what the player plays by gain_db, from the next decoded frame on.
+//0 leaves the output untouched
+void ap_set_gain(player_t *player, double gain_db);
+
+//play tempo times faster without changing the pitch, from AP_TEMPO_MIN to
+//AP_TEMPO_MAX. Takes effect at once. The position and the duration stay in
+//content time
+void ap_set_tempo(player_t *player, double tempo);
+
+//equalize the output with nb_bands peaking filters, up to AP_EQ_MAX_BANDS.
+//Changed bands move to their new setting without a click. No bands turn the
+//equalizer off. Returns AVERROR(EINVAL) for too many bands
+int ap_set_eq(player_t *player, const ap_eq_band_t *bands, int nb_bands);
+
+//ap_set_eq() with the AP_EQ_GRAPHIC_BANDS octave bands at gains_db
+int ap_set_graphic_eq(player_t *player, const double *gains_db);
+
+//ap_set_gain() with the normalization gain of a track scanned by
+//ap_scan_loudness()
+void ap_set_normalization(player_t *player, const ap_loudness_t *loudness,
+		double target_lufs);
+
+//analyze the spectrum of what the player plays into bands log spaced bands,
+//rate_hz times a second, on a thread of its own. Calling it again changes the
+//bands and rate. Returns the spectrum, valid until ap_delete(), or NULL
+ap_spectrum_t *ap_start_analyzer(player_t *player, int bands, int rate_hz);
+
+void ap_stop_analyzer(player_t *player);
+
+//copy at most max bands of the latest spectrum, all from the same analysis,
+//from any thread. Returns the number copied, 0 before the first analysis
+int ap_read_spectrum(player_t *player, float *bands, int max);
+
 void ap_print_error(const char* msg, int err);
 
 #define BEGIN_LOCK(player) pthread_mutex_lock(&player->mutex)
 
 #define END_LOCK(player) pthread_mutex_unlock(&player->mutex)
 
-#define AP_EVENT(player,event,arg1,arg2) if (player->callbacks.on_event)\
-		player->callbacks.on_event(player,event,arg1,arg2)
+//queue an event, it is delivered to on_event by player_dispatch_events()
+#define AP_EVENT(player,event,arg1,arg2) \
+		event_queue_put(&player->events,event,arg1,arg2)
+
+//count a heap allocation made by the library itself, see
+//ap_get_own_alloc_count()
+#ifdef AP_DEBUG_ALLOC
+extern atomic_llong ap_own_alloc_count;
+#define AP_COUNT_OWN_ALLOC() \
+		atomic_fetch_add_explicit(&ap_own_alloc_count, 1, memory_order_relaxed)
+#else
+#define AP_COUNT_OWN_ALLOC() do {} while (0)
+#endif
 
 #endif //_AUDIOPLAYER_H_
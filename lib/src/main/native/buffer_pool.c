@@ -0,0 +1,48 @@
+#include "audioplayer.h"
+#include "buffer_pool.h"
+#include "logging.h"
+
+AVFrame *buffer_pool_get_frame(buffer_pool_t *pool) {
+  if (pool->nb_frames > 0)
+    return pool->frames[--pool->nb_frames];
+
+  AP_COUNT_OWN_ALLOC();
+  return av_frame_alloc();
+}
+
+void buffer_pool_put_frame(buffer_pool_t *pool, AVFrame **frame) {
+  if (!*frame)
+    return;
+
+  if (pool->nb_frames < FRAME_POOL_SIZE) {
+    av_frame_unref(*frame);
+    pool->frames[pool->nb_frames++] = *frame;
+    *frame = NULL;
+  } else {
+    av_frame_free(frame);
+  }
+}
+
+uint8_t *buffer_pool_get_output(buffer_pool_t *pool, int size) {
+  if (size > pool->output_size) {
+    int new_size = FFMAX(size, OUTPUT_BUFFER_MIN_SIZE);
+    uint8_t *output;
+
+    AP_COUNT_OWN_ALLOC();
+    //the old contents are not needed, av_realloc would copy them
+    if (!(output = av_malloc(new_size)))
+      return NULL;
+    av_free(pool->output);
+    pool->output = output;
+    pool->output_size = new_size;
+    log_debug("buffer_pool::output buffer size: %d", new_size);
+  }
+  return pool->output;
+}
+
+void buffer_pool_free(buffer_pool_t *pool) {
+  while (pool->nb_frames > 0)
+    av_frame_free(&pool->frames[--pool->nb_frames]);
+  av_freep(&pool->output);
+  pool->output_size = 0;
+}
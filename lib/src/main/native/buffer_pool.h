@@ -0,0 +1,33 @@
+#ifndef _BUFFER_POOL_H_
+#define _BUFFER_POOL_H_
+
+#include <libavutil/frame.h>
+
+#define FRAME_POOL_SIZE 4
+
+/* one second of 48kHz stereo S16, larger than any decoded frame of the
+ * supported codecs so the output buffer is only allocated once */
+#define OUTPUT_BUFFER_MIN_SIZE 192000
+
+/* per player buffers that are recycled across tracks instead of being freed
+ * on reset. Only used by the thread running the player */
+typedef struct buffer_pool_t {
+  AVFrame *frames[FRAME_POOL_SIZE];
+  int nb_frames;
+
+  uint8_t *output;
+  int output_size;
+} buffer_pool_t;
+
+//a reset frame, NULL if out of memory
+AVFrame *buffer_pool_get_frame(buffer_pool_t *pool);
+
+//unreferences the frame and keeps it for reuse, *frame is set to NULL
+void buffer_pool_put_frame(buffer_pool_t *pool, AVFrame **frame);
+
+//the output buffer grown to at least size bytes, NULL if out of memory
+uint8_t *buffer_pool_get_output(buffer_pool_t *pool, int size);
+
+void buffer_pool_free(buffer_pool_t *pool);
+
+#endif //_BUFFER_POOL_H_
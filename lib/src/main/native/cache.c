@@ -0,0 +1,129 @@
+#include "audioplayer.h"
+#include <stdio.h>
+#include <sys/stat.h>
+#include <libavutil/avstring.h>
+#include "cache.h"
+#include "logging.h"
+
+#define CACHE_MAGIC 0x48434141 //"AACH"
+#define CACHE_VERSION 1
+//no entry is anywhere near this, anything larger is corrupt
+#define CACHE_MAX_PAYLOAD (64 * 1024 * 1024)
+
+typedef struct cache_header_t {
+  uint32_t magic;
+  uint32_t version;
+  int64_t size;
+  int64_t mtime;
+  int32_t url_len;
+  int32_t payload;
+} cache_header_t;
+
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static char cache_dir[1024];
+
+void ap_set_cache_dir(const char *dir) {
+  log_info("ap_set_cache_dir() %s", dir ? dir : "none");
+  pthread_mutex_lock(&cache_mutex);
+  av_strlcpy(cache_dir, dir ? dir : "", sizeof(cache_dir));
+  pthread_mutex_unlock(&cache_mutex);
+}
+
+/* the entry file of url, FAILURE if there is no cache dir */
+static int cache_path(const char *url, const char *ext, char *path, int size) {
+  uint64_t hash = 14695981039346656037ULL;
+  const char *c;
+  int ret = SUCCESS;
+
+  //FNV-1a, the url itself is stored in the entry to catch collisions
+  for (c = url; *c; c++)
+    hash = (hash ^ (uint8_t) *c) * 1099511628211ULL;
+
+  pthread_mutex_lock(&cache_mutex);
+  if (!cache_dir[0])
+    ret = FAILURE;
+  else
+    snprintf(path, size, "%s/%016"PRIx64".%s", cache_dir, hash, ext);
+  pthread_mutex_unlock(&cache_mutex);
+  return ret;
+}
+
+int cache_key(const char *url, cache_key_t *key) {
+  const char *path = url;
+  struct stat st;
+
+  pthread_mutex_lock(&cache_mutex);
+  if (!cache_dir[0]) {
+    pthread_mutex_unlock(&cache_mutex);
+    return FAILURE;
+  }
+  pthread_mutex_unlock(&cache_mutex);
+
+  av_strstart(path, "file:", &path);
+  if (strstr(path, "://") || stat(path, &st) < 0 || !S_ISREG(st.st_mode))
+    return FAILURE;
+  key->url = url;
+  key->size = st.st_size;
+  key->mtime = (int64_t) st.st_mtime * 1000000000 + st.st_mtim.tv_nsec;
+  return SUCCESS;
+}
+
+void *cache_read(const cache_key_t *key, const char *ext, int *size) {
+  cache_header_t h;
+  char path[1100], url[1024];
+  void *data = NULL;
+  FILE *file;
+
+  if (cache_path(key->url, ext, path, sizeof(path)) < 0
+      || !(file = fopen(path, "rb")))
+    return NULL;
+
+  if (fread(&h, sizeof(h), 1, file) == 1 && h.magic == CACHE_MAGIC
+      && h.version == CACHE_VERSION && h.size == key->size
+      && h.mtime == key->mtime && h.url_len == (int) strlen(key->url)
+      && h.url_len < sizeof(url) && h.payload >= 0
+      && h.payload <= CACHE_MAX_PAYLOAD
+      && fread(url, 1, h.url_len, file) == h.url_len
+      && !memcmp(url, key->url, h.url_len)
+      && (data = av_malloc(FFMAX(h.payload, 1)))
+      && fread(data, 1, h.payload, file) == h.payload) {
+    *size = h.payload;
+  } else {
+    av_freep(&data);
+  }
+  fclose(file);
+  return data;
+}
+
+void cache_write(const cache_key_t *key, const char *ext, const void *data,
+                 int size) {
+  cache_header_t h;
+  char path[1100], tmp[1120];
+  FILE *file;
+  int ok;
+
+  if (cache_path(key->url, ext, path, sizeof(path)) < 0)
+    return;
+
+  memset(&h, 0, sizeof(h));
+  h.magic = CACHE_MAGIC;
+  h.version = CACHE_VERSION;
+  h.size = key->size;
+  h.mtime = key->mtime;
+  h.url_len = (int) strlen(key->url);
+  h.payload = size;
+
+  //written aside and renamed so readers never see half an entry
+  snprintf(tmp, sizeof(tmp), "%s.%"PRIxPTR, path, (uintptr_t) pthread_self());
+  if (!(file = fopen(tmp, "wb"))) {
+    log_warn("cache::cannot write %s: %s", tmp, strerror(errno));
+    return;
+  }
+  ok = fwrite(&h, sizeof(h), 1, file) == 1
+       && fwrite(key->url, 1, h.url_len, file) == h.url_len
+       && fwrite(data, 1, size, file) == size;
+  if (fclose(file) != 0 || !ok || rename(tmp, path) < 0) {
+    log_warn("cache::cannot write %s", path);
+    unlink(tmp);
+  }
+}
@@ -0,0 +1,28 @@
+#ifndef _CACHE_H_
+#define _CACHE_H_
+
+#include "audioplayer.h"
+
+/* results computed from a whole file, cached on disk in the directory set
+ * with ap_set_cache_dir(). An entry is keyed by url, checked against the url
+ * stored in it, and by the size and mtime of the file, so only local files
+ * are cached */
+
+typedef struct cache_key_t {
+  const char *url;
+  int64_t size;
+  int64_t mtime;
+} cache_key_t;
+
+//FAILURE if url is not a local file or there is no cache dir
+int cache_key(const char *url, cache_key_t *key);
+
+/* the payload of the entry of key with extension ext, allocated with
+ * av_malloc() and its length in *size. NULL on a miss */
+void *cache_read(const cache_key_t *key, const char *ext, int *size);
+
+//replace the entry of key, readers see either the old or the new one
+void cache_write(const cache_key_t *key, const char *ext, const void *data,
+                 int size);
+
+#endif //_CACHE_H_
@@ -0,0 +1,111 @@
+#include "clock_snapshot.h"
+#include "jitter_buffer.h"
+
+typedef struct {
+  int64_t pts;
+  int64_t time;
+  int frames;
+  int sample_rate;
+  int tempo_q16;
+  int running;
+} clock_values_t;
+
+static void write_values(clock_snapshot_t *c, const clock_values_t *v) {
+  unsigned seq = atomic_load_explicit(&c->seq, memory_order_relaxed);
+
+  atomic_store_explicit(&c->seq, seq + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+
+  atomic_store_explicit(&c->pts, v->pts, memory_order_relaxed);
+  atomic_store_explicit(&c->time, v->time, memory_order_relaxed);
+  atomic_store_explicit(&c->frames, v->frames, memory_order_relaxed);
+  atomic_store_explicit(&c->sample_rate, v->sample_rate, memory_order_relaxed);
+  atomic_store_explicit(&c->tempo_q16, v->tempo_q16, memory_order_relaxed);
+  atomic_store_explicit(&c->running, v->running, memory_order_relaxed);
+
+  atomic_store_explicit(&c->seq, seq + 2, memory_order_release);
+}
+
+static void read_values(clock_snapshot_t *c, clock_values_t *v) {
+  unsigned seq;
+
+  for (;;) {
+    seq = atomic_load_explicit(&c->seq, memory_order_acquire);
+    if (seq & 1)
+      continue;
+
+    v->pts = atomic_load_explicit(&c->pts, memory_order_relaxed);
+    v->time = atomic_load_explicit(&c->time, memory_order_relaxed);
+    v->frames = atomic_load_explicit(&c->frames, memory_order_relaxed);
+    v->sample_rate = atomic_load_explicit(&c->sample_rate, memory_order_relaxed);
+    v->tempo_q16 = atomic_load_explicit(&c->tempo_q16, memory_order_relaxed);
+    v->running = atomic_load_explicit(&c->running, memory_order_relaxed);
+
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&c->seq, memory_order_relaxed) == seq)
+      return;
+  }
+}
+
+static int64_t position(const clock_values_t *v, int64_t now) {
+  int64_t elapsed, length;
+
+  if (!v->running || v->sample_rate <= 0)
+    return v->pts;
+
+  elapsed = now - v->time;
+  length = (int64_t) v->frames * 1000000 / v->sample_rate;
+  if (elapsed < 0)
+    elapsed = 0;
+  else if (elapsed > length)
+    elapsed = length;
+  return v->pts + (elapsed * v->tempo_q16 >> 16);
+}
+
+void clock_snapshot_init(clock_snapshot_t *c) {
+  atomic_init(&c->seq, 0);
+  atomic_init(&c->pts, 0);
+  atomic_init(&c->time, 0);
+  atomic_init(&c->frames, 0);
+  atomic_init(&c->sample_rate, 0);
+  atomic_init(&c->tempo_q16, 65536);
+  atomic_init(&c->running, 0);
+}
+
+void clock_snapshot_update(clock_snapshot_t *c, int64_t pts, int frames,
+                           int sample_rate, int tempo_q16) {
+  clock_values_t v;
+  v.pts = pts;
+  v.time = jitter_buffer_now();
+  v.frames = frames;
+  v.sample_rate = sample_rate;
+  v.tempo_q16 = tempo_q16;
+  v.running = atomic_load_explicit(&c->running, memory_order_relaxed);
+  write_values(c, &v);
+}
+
+void clock_snapshot_set_running(clock_snapshot_t *c, int running) {
+  clock_values_t v;
+  int64_t now = jitter_buffer_now();
+  int64_t pts;
+
+  read_values(c, &v);
+  if (v.running == running)
+    return;
+
+  //restart from the current position with what is left of the chunk
+  pts = position(&v, now);
+  if (v.sample_rate > 0 && v.tempo_q16 > 0)
+    v.frames -= (int) (((pts - v.pts) << 16) / v.tempo_q16 * v.sample_rate
+                       / 1000000);
+  v.pts = pts;
+  v.time = now;
+  v.running = running;
+  write_values(c, &v);
+}
+
+int64_t clock_snapshot_get(clock_snapshot_t *c) {
+  clock_values_t v;
+  read_values(c, &v);
+  return position(&v, jitter_buffer_now());
+}
@@ -0,0 +1,37 @@
+#ifndef _CLOCK_SNAPSHOT_H_
+#define _CLOCK_SNAPSHOT_H_
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+/* the playback position published by the thread running the player and read
+ * from any thread without locking. A seqlock: the writer makes seq odd while
+ * it updates the fields, readers retry if seq was odd or changed.
+ *
+ * pts is the media time in microseconds of the last chunk handed to on_play,
+ * frames its length. Readers interpolate from time (CLOCK_MONOTONIC us)
+ * while running, never past the end of that chunk. tempo_q16 is the media
+ * time played per second in 1/65536, see ap_set_tempo() */
+typedef struct {
+  atomic_uint seq;
+  _Atomic int64_t pts;
+  _Atomic int64_t time;
+  atomic_int frames;
+  atomic_int sample_rate;
+  atomic_int tempo_q16;
+  atomic_int running;
+} clock_snapshot_t;
+
+void clock_snapshot_init(clock_snapshot_t *c);
+
+//writer only
+void clock_snapshot_update(clock_snapshot_t *c, int64_t pts, int frames,
+                           int sample_rate, int tempo_q16);
+
+//freeze or resume the interpolation at the current position, writer only
+void clock_snapshot_set_running(clock_snapshot_t *c, int running);
+
+//the current position in microseconds, never blocks
+int64_t clock_snapshot_get(clock_snapshot_t *c);
+
+#endif //_CLOCK_SNAPSHOT_H_
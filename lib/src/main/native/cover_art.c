@@ -0,0 +1,106 @@
+#include "audioplayer.h"
+#include <libavutil/avstring.h>
+#include "cover_art.h"
+#include "logging.h"
+
+/*
+ * Embedded pictures: the APIC frame of id3v2, the covr atom of mp4, the
+ * PICTURE block of flac and METADATA_BLOCK_PICTURE of vorbis comments. The
+ * demuxer reads each into st->attached_pic of a stream of its own, marked
+ * AV_DISPOSITION_ATTACHED_PIC, while the file is opened, so no packets are
+ * read and nothing is decoded. A cover art holds a reference to the buffer of
+ * that packet, which outlives the demuxer.
+ */
+
+static const char *mime_type(enum AVCodecID id) {
+  switch (id) {
+    case AV_CODEC_ID_MJPEG:
+      return "image/jpeg";
+    case AV_CODEC_ID_PNG:
+      return "image/png";
+    case AV_CODEC_ID_GIF:
+      return "image/gif";
+    case AV_CODEC_ID_BMP:
+      return "image/bmp";
+    case AV_CODEC_ID_WEBP:
+      return "image/webp";
+    case AV_CODEC_ID_TIFF:
+      return "image/tiff";
+    default:
+      return "";
+  }
+}
+
+static AVStream *find_picture(AVFormatContext *ic) {
+  AVDictionaryEntry *type;
+  AVStream *st, *found = NULL;
+  int i;
+
+  for (i = 0; i < ic->nb_streams; i++) {
+    st = ic->streams[i];
+    if (!(st->disposition & AV_DISPOSITION_ATTACHED_PIC)
+        || st->attached_pic.size <= 0)
+      continue;
+    //id3v2 and flac name the picture type in the comment
+    type = av_dict_get(st->metadata, "comment", NULL, 0);
+    if (type && !strcmp(type->value, "Cover (front)"))
+      return st;
+    if (!found)
+      found = st;
+  }
+  return found;
+}
+
+int cover_art_find(AVFormatContext *ic, ap_cover_art_t *art) {
+  AVStream *st;
+  AVPacket *pkt;
+
+  memset(art, 0, sizeof(*art));
+  if (!(st = find_picture(ic)))
+    return AVERROR_STREAM_NOT_FOUND;
+
+  pkt = &st->attached_pic;
+  if (pkt->buf) {
+    if (!(art->buf = av_buffer_ref(pkt->buf)))
+      return AVERROR(ENOMEM);
+    art->data = pkt->data;
+  } else {
+    //only a demuxer that does not reference count the packet needs a copy
+    if (!(art->buf = av_buffer_alloc(pkt->size)))
+      return AVERROR(ENOMEM);
+    memcpy(art->buf->data, pkt->data, pkt->size);
+    art->data = art->buf->data;
+  }
+  art->size = pkt->size;
+  av_strlcpy(art->mime_type, mime_type(st->codecpar->codec_id),
+             sizeof(art->mime_type));
+  log_debug("cover_art_find::%s %d bytes", art->mime_type, art->size);
+  return SUCCESS;
+}
+
+int cover_art_ref(ap_cover_art_t *dst, const ap_cover_art_t *src) {
+  memset(dst, 0, sizeof(*dst));
+  if (!src->buf)
+    return AVERROR_STREAM_NOT_FOUND;
+  if (!(dst->buf = av_buffer_ref(src->buf)))
+    return AVERROR(ENOMEM);
+  dst->data = src->data;
+  dst->size = src->size;
+  memcpy(dst->mime_type, src->mime_type, sizeof(dst->mime_type));
+  return SUCCESS;
+}
+
+int ap_get_cover_art(player_t *player, ap_cover_art_t *art) {
+  int ret;
+
+  BEGIN_LOCK(player);
+  ret = cover_art_ref(art, &player->cover_art);
+  END_LOCK(player);
+  return ret;
+}
+
+void ap_cover_art_free(ap_cover_art_t *art) {
+  av_buffer_unref(&art->buf);
+  art->data = NULL;
+  art->size = 0;
+}
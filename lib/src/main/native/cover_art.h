@@ -0,0 +1,13 @@
+#ifndef _COVER_ART_H_
+#define _COVER_ART_H_
+
+#include "audioplayer.h"
+
+/* a reference to the picture embedded in ic, the front cover if there are
+ * several. AVERROR_STREAM_NOT_FOUND without one */
+int cover_art_find(AVFormatContext *ic, ap_cover_art_t *art);
+
+//a new reference to the picture of src
+int cover_art_ref(ap_cover_art_t *dst, const ap_cover_art_t *src);
+
+#endif //_COVER_ART_H_
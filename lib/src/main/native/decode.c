@@ -0,0 +1,158 @@
+#include "audioplayer.h"
+#include <libavutil/avstring.h>
+#include "player_thread.h"
+#include "logging.h"
+
+/*
+ * Offline decoding for pre-processing libraries. Each file is decoded by a
+ * player that has no thread, commands or pacing, see player_decode(), so the
+ * output is produced by the same stream_component_open() and
+ * audio_decode_frame() as playback.
+ *
+ * ap_decode_files() hands the files out one at a time to a pool of workers,
+ * so a slow file does not hold up the others.
+ */
+
+typedef struct decode_job_t {
+  ap_sink_fn sink;
+  void *opaque;
+  int index;
+  int sample_rate;
+  int channels;
+  int ret;
+} decode_job_t;
+
+typedef struct decode_pool_t {
+  const char **urls;
+  int nb_urls;
+  enum AVSampleFormat format;
+  ap_sink_fn sink;
+  void *opaque;
+  int *results;
+  atomic_int next;
+  atomic_int failed;
+} decode_pool_t;
+
+static int on_prepare(player_t *player, int sample_fmt, int sample_rate,
+                      int channels) {
+  decode_job_t *job = player->extra;
+  job->sample_rate = sample_rate;
+  job->channels = channels;
+  return SUCCESS;
+}
+
+static void on_play(player_t *player, char *data, int len) {
+  decode_job_t *job = player->extra;
+  job->ret = job->sink(job->opaque, job->index, job->sample_rate,
+                       job->channels, data, len);
+  if (job->ret < 0)
+    player->abort_call = 1;
+}
+
+static int decode_file(const char *url, int index, enum AVSampleFormat format,
+                       ap_sink_fn sink, void *opaque) {
+  player_callbacks_t callbacks;
+  decode_job_t job;
+  player_t *player;
+  int ret;
+
+  log_debug("decode_file() %s", url);
+
+  if (av_sample_fmt_is_planar(format)) {
+    log_error("decode_file::planar output is not supported");
+    return AVERROR(EINVAL);
+  }
+
+  memset(&callbacks, 0, sizeof(callbacks));
+  callbacks.on_prepare = on_prepare;
+  callbacks.on_play = on_play;
+
+  memset(&job, 0, sizeof(job));
+  job.sink = sink;
+  job.opaque = opaque;
+  job.index = index;
+
+  if (!(player = alloc_player(callbacks)))
+    return AVERROR(ENOMEM);
+  player->extra = &job;
+  player->output_sample_fmt = format;
+  av_strlcpy(player->url, url, sizeof(player->url));
+
+  ret = player_decode(player);
+  if (ret == AVERROR_EXIT && job.ret < 0)
+    ret = job.ret;
+
+  player_loop_cleanup(player);
+  av_free(player);
+  return ret;
+}
+
+int ap_decode_file(const char *url, enum AVSampleFormat format, ap_sink_fn sink,
+                   void *opaque) {
+  log_info("ap_decode_file() %s", url);
+  return decode_file(url, 0, format, sink, opaque);
+}
+
+static void *decode_worker(decode_pool_t *pool) {
+  int i, ret;
+
+  while ((i = atomic_fetch_add(&pool->next, 1)) < pool->nb_urls) {
+    ret = decode_file(pool->urls[i], i, pool->format, pool->sink, pool->opaque);
+    if (pool->results)
+      pool->results[i] = ret;
+    if (ret < 0) {
+      log_error("decode_worker::%s failed", pool->urls[i]);
+      atomic_fetch_add(&pool->failed, 1);
+    }
+  }
+  return NULL;
+}
+
+int ap_decode_files(const char **urls, int nb_urls, enum AVSampleFormat format,
+                    ap_sink_fn sink, void *opaque, int threads, int *results) {
+  decode_pool_t pool;
+  pthread_t *workers;
+  int i, ret, started = 0;
+
+  if (threads <= 0)
+    threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+  if (threads > nb_urls)
+    threads = nb_urls;
+  if (threads <= 0)
+    threads = 1;
+
+  log_info("ap_decode_files() files: %d threads: %d", nb_urls, threads);
+
+  memset(&pool, 0, sizeof(pool));
+  pool.urls = urls;
+  pool.nb_urls = nb_urls;
+  pool.format = format;
+  pool.sink = sink;
+  pool.opaque = opaque;
+  pool.results = results;
+  atomic_init(&pool.next, 0);
+  atomic_init(&pool.failed, 0);
+
+  workers = av_malloc_array(threads, sizeof(pthread_t));
+  if (!workers)
+    return FAILURE;
+
+  for (i = 0; i < threads; i++) {
+    if ((ret = pthread_create(&workers[started], NULL, (void *) decode_worker,
+                              &pool)) != SUCCESS) {
+      log_error("ap_decode_files::failed to start worker: %s", strerror(ret));
+      break;
+    }
+    started++;
+  }
+
+  //without any worker the files are decoded here
+  if (!started)
+    decode_worker(&pool);
+
+  for (i = 0; i < started; i++)
+    pthread_join(workers[i], NULL);
+  av_free(workers);
+
+  return pool.failed ? FAILURE : SUCCESS;
+}
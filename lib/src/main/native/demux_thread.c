@@ -0,0 +1,457 @@
+#include "audioplayer.h"
+#include "demux_thread.h"
+#include "thread_config.h"
+#include "logging.h"
+
+/*
+ * Reads packets ahead of the decoder so network latency and decode time
+ * overlap, see avplay.c read_thread().
+ *
+ * The queue is bounded by MAX_QUEUE_SIZE bytes and by a duration: the jitter
+ * buffer target when it is enabled, AUDIOQ_MAX_DURATION_MS otherwise.
+ * MIN_AUDIOQ_SIZE bytes bound it when the packets carry no durations.
+ *
+ * Seek and reset stop the thread before they touch player->ic and start it
+ * again afterwards, so no stale packet can be queued after a flush.
+ *
+ * Engine players share the engine's demux_pool_t instead: its threads take
+ * turns reading one packet for each player with room in its queue. A player
+ * whose queue is full is parked, not waited for, until the decoder makes room
+ * and demux_room() puts it back in turn. A blocked read only holds up the
+ * pool thread doing it.
+ */
+
+//how long to wait before reading again after an error, doubled after each
+//consecutive one up to DEMUX_RETRY_MAX_US
+#define DEMUX_RETRY_US 10000
+#define DEMUX_RETRY_MAX_US 1000000
+//consecutive read errors before the stream is given up as failed
+#define DEMUX_MAX_ERRORS 10
+
+static void wake_player(player_t *player) {
+  uint64_t one = 1;
+  if (atomic_exchange(&player->demux_wake, 0)
+      && write(player->demux_fd, &one, sizeof(one)) < 0)
+    log_error("demux::wakeup failed: %s", strerror(errno));
+}
+
+//give up on the stream, the player fails once it has played what is queued
+static void give_up(player_t *player, int err) {
+  player->demux_error = err;
+  player->eof = 1;
+  atomic_store(&player->demux_wake, 1);
+  wake_player(player);
+}
+
+int demux_queue_full(player_t *player) {
+  PacketQueue *q = &player->audioq;
+  int64_t max_duration = player->jitter.enabled ? player->jitter.target :
+                         AUDIOQ_MAX_DURATION_MS * 1000;
+  int64_t duration = player->audio_st ?
+                     av_rescale_q(q->duration, player->audio_st->time_base,
+                                  AV_TIME_BASE_Q) : 0;
+
+  return q->size >= MAX_QUEUE_SIZE
+         || (duration > 0 && duration >= max_duration)
+         || (duration <= 0 && q->size >= MIN_AUDIOQ_SIZE);
+}
+
+int demux_queue_packet(player_t *player, AVPacket *packet) {
+  jitter_buffer_t *jb = &player->jitter;
+  PacketQueue *q = &player->audioq;
+  int ret;
+
+  if (jb->enabled) {
+    pthread_mutex_lock(&q->mutex);
+    int64_t media_time = packet->pts != AV_NOPTS_VALUE ?
+                         av_rescale_q(packet->pts, player->audio_st->time_base,
+                                      AV_TIME_BASE_Q) :
+                         jb->last_media_time
+                         + av_rescale_q(packet->duration,
+                                        player->audio_st->time_base,
+                                        AV_TIME_BASE_Q);
+    jitter_buffer_arrival(jb, jitter_buffer_now(), media_time);
+    pthread_mutex_unlock(&q->mutex);
+  }
+
+  seek_index_add(&player->seek_index, packet);
+  ret = packet_queue_put(q, packet);
+  wake_player(player);
+  return ret;
+}
+
+typedef enum {
+  DEMUX_MORE,
+  //audioq is full, read again once the decoder has made room
+  DEMUX_FULL,
+  //end of stream, failure or demux_stop()
+  DEMUX_DONE
+} demux_step_t;
+
+struct demux_pool_t {
+  pthread_mutex_t mutex;
+  //a player to read for, or quit
+  pthread_cond_t cond;
+  //a read has finished, for demux_stop()
+  pthread_cond_t idle;
+  player_t *head, *tail;
+  int quit;
+
+  pthread_t *threads;
+  int nb_threads;
+  ap_thread_config_t thread_config;
+};
+
+/* wait before reading again after an error, cut short by demux_stop() */
+static void retry_wait(player_t *player) {
+  PacketQueue *q = &player->audioq;
+  struct timespec deadline;
+  int64_t ns;
+
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  ns = deadline.tv_nsec + player->demux_retry_us * 1000;
+  deadline.tv_sec += ns / 1000000000;
+  deadline.tv_nsec = ns % 1000000000;
+
+  pthread_mutex_lock(&q->mutex);
+  //room made by the decoder signals space too
+  while (!player->demux_quit
+         && pthread_cond_timedwait(&q->space, &q->mutex, &deadline) == 0);
+  pthread_mutex_unlock(&q->mutex);
+
+  player->demux_retry_us = FFMIN(player->demux_retry_us * 2,
+                                 DEMUX_RETRY_MAX_US);
+}
+
+/* read one packet ahead, on whichever thread reads for the player */
+static demux_step_t demux_step(player_t *player) {
+  PacketQueue *q = &player->audioq;
+  AVPacket packet;
+  int ret, full;
+
+  //pause and resume network streams from the thread that reads them
+  if ((player->state == STATE_PAUSED) != player->demux_paused) {
+    player->demux_paused = !player->demux_paused;
+    if (player->demux_paused)
+      av_read_pause(player->ic);
+    else
+      av_read_play(player->ic);
+  }
+
+  pthread_mutex_lock(&q->mutex);
+  full = demux_queue_full(player);
+  pthread_mutex_unlock(&q->mutex);
+  if (full)
+    return DEMUX_FULL;
+
+  av_init_packet(&packet);
+  ret = av_read_frame(player->ic, &packet);
+  if (ret < 0) {
+    //interrupted by demux_stop(), anything else is reported to the player
+    if (player->demux_quit)
+      return DEMUX_DONE;
+    //the interrupt fires on every retry too, pb->error would pass it as eof
+    if (ret == AVERROR_EXIT) {
+      log_error("demux_thread::interrupted");
+      give_up(player, ret);
+      return DEMUX_DONE;
+    }
+    if (ret == AVERROR_EOF || (player->ic->pb && player->ic->pb->eof_reached)
+        || (player->ic->pb && player->ic->pb->error)) {
+      log_trace("demux_thread::eof");
+      player->eof = 1;
+      atomic_store(&player->demux_wake, 1);
+      wake_player(player);
+      return DEMUX_DONE;
+    }
+    ap_print_error("demux_thread::av_read_frame failed", ret);
+    if (++player->demux_errors >= DEMUX_MAX_ERRORS) {
+      log_error("demux_thread::giving up after %d errors", player->demux_errors);
+      give_up(player, ret);
+      return DEMUX_DONE;
+    }
+    retry_wait(player);
+    return DEMUX_MORE;
+  }
+  player->demux_errors = 0;
+  player->demux_retry_us = DEMUX_RETRY_US;
+
+  if (packet.stream_index != player->audio_stream) {
+    av_packet_unref(&packet);
+    return DEMUX_MORE;
+  }
+
+  demux_queue_packet(player, &packet);
+  return DEMUX_MORE;
+}
+
+static void *demux_thread(player_t *player) {
+  PacketQueue *q = &player->audioq;
+
+  log_debug("[%"PRIXPTR"] demux_thread()", (intptr_t) pthread_self());
+
+  thread_config_apply(&player->thread_config);
+
+  while (!player->demux_quit) {
+    pthread_mutex_lock(&q->mutex);
+    while (!player->demux_quit && demux_queue_full(player))
+      pthread_cond_wait(&q->space, &q->mutex);
+    pthread_mutex_unlock(&q->mutex);
+    if (player->demux_quit || demux_step(player) == DEMUX_DONE)
+      break;
+  }
+
+  log_debug("[%"PRIXPTR"] demux_thread::done", (intptr_t) pthread_self());
+  return NULL;
+}
+
+//call with pool->mutex held
+static void pool_enqueue(demux_pool_t *pool, player_t *player) {
+  player->demux_queued = 1;
+  player->demux_next = NULL;
+  if (pool->tail)
+    pool->tail->demux_next = player;
+  else
+    pool->head = player;
+  pool->tail = player;
+  pthread_cond_signal(&pool->cond);
+}
+
+//call with pool->mutex held
+static player_t *pool_dequeue(demux_pool_t *pool) {
+  player_t *player = pool->head;
+  if (player) {
+    pool->head = player->demux_next;
+    if (!pool->head)
+      pool->tail = NULL;
+    player->demux_queued = 0;
+  }
+  return player;
+}
+
+//call with pool->mutex held
+static void pool_unqueue(demux_pool_t *pool, player_t *player) {
+  player_t **p, *prev = NULL;
+  for (p = &pool->head; *p; prev = *p, p = &(*p)->demux_next) {
+    if (*p == player) {
+      *p = player->demux_next;
+      if (pool->tail == player)
+        pool->tail = prev;
+      break;
+    }
+  }
+  player->demux_queued = 0;
+}
+
+/* audioq is still full: wait for demux_room() instead of a thread.
+ * call with pool->mutex held */
+static int park(player_t *player) {
+  PacketQueue *q = &player->audioq;
+  int full;
+
+  pthread_mutex_lock(&q->mutex);
+  if ((full = demux_queue_full(player)))
+    atomic_store(&player->demux_parked, 1);
+  pthread_mutex_unlock(&q->mutex);
+  return full;
+}
+
+static void *demux_pool_thread(demux_pool_t *pool) {
+  player_t *player;
+  demux_step_t step;
+
+  log_debug("[%"PRIXPTR"] demux_pool_thread()", (intptr_t) pthread_self());
+
+  thread_config_apply(&pool->thread_config);
+
+  pthread_mutex_lock(&pool->mutex);
+  for (;;) {
+    while (!pool->quit && !pool->head)
+      pthread_cond_wait(&pool->cond, &pool->mutex);
+    if (pool->quit)
+      break;
+    player = pool_dequeue(pool);
+    player->demux_busy = 1;
+    pthread_mutex_unlock(&pool->mutex);
+
+    step = player->demux_quit ? DEMUX_DONE : demux_step(player);
+
+    //round robin, a player at the end of its stream is left alone
+    pthread_mutex_lock(&pool->mutex);
+    player->demux_busy = 0;
+    if (!player->demux_quit
+        && (step == DEMUX_MORE || (step == DEMUX_FULL && !park(player))))
+      pool_enqueue(pool, player);
+    pthread_cond_broadcast(&pool->idle);
+  }
+  pthread_mutex_unlock(&pool->mutex);
+
+  log_debug("[%"PRIXPTR"] demux_pool_thread::done", (intptr_t) pthread_self());
+  return NULL;
+}
+
+demux_pool_t *demux_pool_create(int threads, const ap_thread_config_t *config) {
+  demux_pool_t *pool;
+  pthread_attr_t attr;
+  int i, ret;
+
+  if (!(pool = av_mallocz(sizeof(demux_pool_t))))
+    return NULL;
+  if (!(pool->threads = av_mallocz_array(threads, sizeof(pthread_t)))) {
+    av_free(pool);
+    return NULL;
+  }
+  pthread_mutex_init(&pool->mutex, NULL);
+  pthread_cond_init(&pool->cond, NULL);
+  pthread_cond_init(&pool->idle, NULL);
+  pool->thread_config = *config;
+
+  pthread_attr_init(&attr);
+  thread_config_init_attr(&pool->thread_config, &attr);
+  for (i = 0; i < threads; i++) {
+    if ((ret = pthread_create(&pool->threads[i], &attr,
+                              (void *) demux_pool_thread, pool)) != SUCCESS) {
+      log_error("demux_pool_create::failed to start thread: %s", strerror(ret));
+      break;
+    }
+    pool->nb_threads++;
+  }
+  pthread_attr_destroy(&attr);
+
+  if (!pool->nb_threads) {
+    demux_pool_free(pool);
+    return NULL;
+  }
+  return pool;
+}
+
+void demux_pool_free(demux_pool_t *pool) {
+  int i;
+
+  if (!pool)
+    return;
+
+  pthread_mutex_lock(&pool->mutex);
+  pool->quit = 1;
+  pthread_cond_broadcast(&pool->cond);
+  pthread_mutex_unlock(&pool->mutex);
+  for (i = 0; i < pool->nb_threads; i++)
+    pthread_join(pool->threads[i], NULL);
+
+  pthread_mutex_destroy(&pool->mutex);
+  pthread_cond_destroy(&pool->cond);
+  pthread_cond_destroy(&pool->idle);
+  av_free(pool->threads);
+  av_free(pool);
+}
+
+int demux_start(player_t *player) {
+  demux_pool_t *pool = player->demux_pool;
+  pthread_attr_t attr;
+  int ret;
+
+  if (player->demux_running)
+    return SUCCESS;
+
+  player->demux_quit = 0;
+  player->demux_error = 0;
+  player->demux_errors = 0;
+  player->demux_retry_us = DEMUX_RETRY_US;
+
+  if (pool) {
+    pthread_mutex_lock(&pool->mutex);
+    atomic_store(&player->demux_parked, 0);
+    pool_enqueue(pool, player);
+    pthread_mutex_unlock(&pool->mutex);
+    player->demux_running = TRUE;
+    return SUCCESS;
+  }
+
+  pthread_attr_init(&attr);
+  thread_config_init_attr(&player->thread_config, &attr);
+  ret = pthread_create(&player->demux_thread, &attr, (void *) demux_thread,
+                       player);
+  pthread_attr_destroy(&attr);
+
+  if (ret != SUCCESS) {
+    log_error("demux_start::failed to start thread: %s", strerror(ret));
+    return FAILURE;
+  }
+  player->demux_running = TRUE;
+  return SUCCESS;
+}
+
+void demux_room(player_t *player) {
+  demux_pool_t *pool = player->demux_pool;
+  PacketQueue *q = &player->audioq;
+  int resume;
+
+  if (!pool || !atomic_load(&player->demux_parked))
+    return;
+
+  pthread_mutex_lock(&q->mutex);
+  if ((resume = !demux_queue_full(player)))
+    atomic_store(&player->demux_parked, 0);
+  pthread_mutex_unlock(&q->mutex);
+
+  //demux_stop() runs on this thread too, it cannot have come in between
+  if (resume) {
+    pthread_mutex_lock(&pool->mutex);
+    if (!player->demux_quit && !player->demux_queued)
+      pool_enqueue(pool, player);
+    pthread_mutex_unlock(&pool->mutex);
+  }
+}
+
+void demux_stop(player_t *player) {
+  demux_pool_t *pool = player->demux_pool;
+  PacketQueue *q = &player->audioq;
+
+  if (!player->demux_running)
+    return;
+
+  //also interrupts a blocking read, see decode_interrupt_cb()
+  pthread_mutex_lock(&q->mutex);
+  player->demux_quit = 1;
+  pthread_cond_broadcast(&q->space);
+  pthread_mutex_unlock(&q->mutex);
+
+  if (pool) {
+    pthread_mutex_lock(&pool->mutex);
+    if (player->demux_queued)
+      pool_unqueue(pool, player);
+    while (player->demux_busy)
+      pthread_cond_wait(&pool->idle, &pool->mutex);
+    atomic_store(&player->demux_parked, 0);
+    pthread_mutex_unlock(&pool->mutex);
+  } else {
+    pthread_join(player->demux_thread, NULL);
+  }
+  player->demux_running = FALSE;
+  player->demux_quit = 0;
+}
+
+int demux_wait(player_t *player) {
+  PacketQueue *q = &player->audioq;
+  int ready;
+
+  atomic_store(&player->demux_wake, 1);
+
+  //anything queued before the flag was set would not have woken us
+  pthread_mutex_lock(&q->mutex);
+  ready = player->eof
+          || (player->jitter.buffering ? demux_queue_full(player) : q->nb_packets > 0);
+  pthread_mutex_unlock(&q->mutex);
+
+  if (ready) {
+    atomic_store(&player->demux_wake, 0);
+    return FALSE;
+  }
+  return TRUE;
+}
+
+void demux_woken(player_t *player) {
+  uint64_t count;
+  if (read(player->demux_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+    log_error("demux_woken::read failed: %s", strerror(errno));
+}
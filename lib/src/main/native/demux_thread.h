@@ -0,0 +1,44 @@
+#ifndef _DEMUX_THREAD_H_
+#define _DEMUX_THREAD_H_
+
+#include "audioplayer.h"
+
+/* without the jitter buffer the demuxer reads at most this far ahead */
+#define AUDIOQ_MAX_DURATION_MS 2000
+
+/* queue a packet of the audio stream for the decoder, recording its arrival
+ * in the jitter buffer. Wakes the player thread if it is waiting for data */
+int demux_queue_packet(player_t *player, AVPacket *packet);
+
+/* the read ahead limit has been reached, call with audioq.mutex held */
+int demux_queue_full(player_t *player);
+
+/* a bounded pool of threads reading ahead for the players of an engine, one
+ * packet per player and turn, so a prepare or a seek never creates a thread */
+typedef struct demux_pool_t demux_pool_t;
+
+demux_pool_t *demux_pool_create(int threads, const ap_thread_config_t *config);
+
+//every player must have been stopped with demux_stop()
+void demux_pool_free(demux_pool_t *pool);
+
+/* start reading packets into player->audioq, in player->demux_pool if it has
+ * one, on a thread of its own otherwise */
+int demux_start(player_t *player);
+
+/* packets have been taken out of audioq, called by the thread running the
+ * player. Reschedules a pool player that was waiting for room */
+void demux_room(player_t *player);
+
+/* interrupt and join the demux thread, nothing reads from player->ic once
+ * this returns. Does nothing if it is not running */
+void demux_stop(player_t *player);
+
+/* the player thread found nothing to decode: returns TRUE if it should block
+ * until demux_fd is signalled, FALSE if data arrived in the meantime */
+int demux_wait(player_t *player);
+
+/* clear the wakeup once demux_fd has been signalled */
+void demux_woken(player_t *player);
+
+#endif //_DEMUX_THREAD_H_
@@ -0,0 +1,184 @@
+#include "audioplayer.h"
+#include "dispatcher.h"
+#include "logging.h"
+
+/*
+ * Delivers player events on one thread so a slow listener never holds up a
+ * player thread or an engine worker.
+ *
+ * Players with queued events are linked into a FIFO of pending players.
+ * Each wakeup drains every pending player's event_queue_t as one batch. The
+ * dispatcher is the only consumer of the queues of its players, so the
+ * events of a player are delivered in the order they were queued.
+ */
+
+struct ap_dispatcher_t {
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+
+  player_t *pending_head, *pending_tail;
+  player_t *delivering;
+  int quit;
+
+  void (*thread_init)(void);
+
+  ap_dispatcher_stats_t stats;
+  int64_t total_latency;
+};
+
+static int queued_events(player_t *list) {
+  int depth = 0;
+  for (; list; list = list->dispatch_next)
+    depth += event_queue_depth(&list->events);
+  return depth;
+}
+
+static void deliver(ap_dispatcher_t *d, player_t *player) {
+  queued_event_t e;
+  int64_t latency, total = 0, max = 0, n = 0;
+
+  while (event_queue_get(&player->events, &e)) {
+    latency = jitter_buffer_now() - e.time;
+    total += latency;
+    if (latency > max)
+      max = latency;
+    n++;
+    if (player->callbacks.on_event)
+      player->callbacks.on_event(player, e.event, e.arg1, e.arg2);
+  }
+
+  pthread_mutex_lock(&d->mutex);
+  d->stats.events += n;
+  d->total_latency += total;
+  if (max > d->stats.max_latency_us)
+    d->stats.max_latency_us = (int) max;
+  pthread_mutex_unlock(&d->mutex);
+}
+
+//call with d->mutex held
+static player_t *pop_pending(ap_dispatcher_t *d) {
+  player_t *player = d->pending_head;
+  if (player) {
+    d->pending_head = player->dispatch_next;
+    if (!d->pending_head)
+      d->pending_tail = NULL;
+    player->dispatch_next = NULL;
+    player->dispatch_queued = 0;
+  }
+  return player;
+}
+
+static void *dispatcher_thread(ap_dispatcher_t *d) {
+  player_t *player;
+  int depth;
+
+  log_debug("[%"PRIXPTR"] dispatcher_thread()", (intptr_t) pthread_self());
+
+  if (d->thread_init)
+    d->thread_init();
+
+  pthread_mutex_lock(&d->mutex);
+  for (;;) {
+    while (!d->pending_head && !d->quit)
+      pthread_cond_wait(&d->cond, &d->mutex);
+    if (!d->pending_head)
+      break;
+
+    //everything pending now, and anything queued meanwhile, is one batch
+    depth = queued_events(d->pending_head);
+    if (depth > d->stats.max_queue_depth)
+      d->stats.max_queue_depth = depth;
+    d->stats.batches++;
+
+    while ((player = pop_pending(d))) {
+      d->delivering = player;
+      pthread_mutex_unlock(&d->mutex);
+      deliver(d, player);
+      pthread_mutex_lock(&d->mutex);
+      d->delivering = NULL;
+      pthread_cond_broadcast(&d->cond);
+    }
+  }
+  pthread_mutex_unlock(&d->mutex);
+
+  log_debug("[%"PRIXPTR"] dispatcher_thread::done", (intptr_t) pthread_self());
+  return NULL;
+}
+
+ap_dispatcher_t *ap_dispatcher_create(void (*thread_init)(void)) {
+  ap_dispatcher_t *d;
+  int ret;
+
+  log_info("ap_dispatcher_create()");
+
+  d = av_mallocz(sizeof(ap_dispatcher_t));
+  if (!d)
+    return NULL;
+
+  pthread_mutex_init(&d->mutex, NULL);
+  pthread_cond_init(&d->cond, NULL);
+  d->thread_init = thread_init;
+
+  if ((ret = pthread_create(&d->thread, NULL, (void *) dispatcher_thread, d))
+      != SUCCESS) {
+    log_error("ap_dispatcher_create::failed to start thread: %s",
+              strerror(ret));
+    pthread_mutex_destroy(&d->mutex);
+    pthread_cond_destroy(&d->cond);
+    av_free(d);
+    return NULL;
+  }
+  return d;
+}
+
+void ap_dispatcher_delete(ap_dispatcher_t *d) {
+  if (!d)
+    return;
+
+  log_info("ap_dispatcher_delete()");
+
+  pthread_mutex_lock(&d->mutex);
+  d->quit = 1;
+  pthread_cond_broadcast(&d->cond);
+  pthread_mutex_unlock(&d->mutex);
+
+  pthread_join(d->thread, NULL);
+
+  pthread_mutex_destroy(&d->mutex);
+  pthread_cond_destroy(&d->cond);
+  av_free(d);
+}
+
+void ap_dispatcher_get_stats(ap_dispatcher_t *d, ap_dispatcher_stats_t *stats) {
+  pthread_mutex_lock(&d->mutex);
+  *stats = d->stats;
+  stats->queue_depth = queued_events(d->pending_head);
+  if (d->delivering)
+    stats->queue_depth += event_queue_depth(&d->delivering->events);
+  if (d->stats.events)
+    stats->avg_latency_us = (int) (d->total_latency / d->stats.events);
+  pthread_mutex_unlock(&d->mutex);
+}
+
+void dispatcher_notify(ap_dispatcher_t *d, player_t *player) {
+  pthread_mutex_lock(&d->mutex);
+  if (!player->dispatch_queued) {
+    player->dispatch_queued = 1;
+    player->dispatch_next = NULL;
+    if (d->pending_tail)
+      d->pending_tail->dispatch_next = player;
+    else
+      d->pending_head = player;
+    d->pending_tail = player;
+    pthread_cond_signal(&d->cond);
+  }
+  pthread_mutex_unlock(&d->mutex);
+}
+
+void dispatcher_remove_player(ap_dispatcher_t *d, player_t *player) {
+  pthread_mutex_lock(&d->mutex);
+  while (player->dispatch_queued || d->delivering == player)
+    pthread_cond_wait(&d->cond, &d->mutex);
+  pthread_mutex_unlock(&d->mutex);
+}
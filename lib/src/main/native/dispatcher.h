@@ -0,0 +1,12 @@
+#ifndef _DISPATCHER_H_
+#define _DISPATCHER_H_
+
+#include "audioplayer.h"
+
+//the player has queued events, called by the thread running the player
+void dispatcher_notify(ap_dispatcher_t *dispatcher, player_t *player);
+
+//wait until every event of the player has been delivered
+void dispatcher_remove_player(ap_dispatcher_t *dispatcher, player_t *player);
+
+#endif //_DISPATCHER_H_
@@ -0,0 +1,617 @@
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <fcntl.h>
+#include "audioplayer.h"
+#include "player_thread.h"
+#include "demux_thread.h"
+#include "engine.h"
+#include "thread_config.h"
+#include "logging.h"
+
+/*
+ * Runs any number of players on a small fixed pool of worker threads.
+ *
+ * All command pipes (and sink fds, see ap_set_sink_fd()) are registered
+ * EPOLLONESHOT in one epoll set shared by the workers, so a wakeup is only
+ * delivered to one worker. Started players without a sink fd wait in a FIFO
+ * run queue and are stepped one packet at a time, round robin. A player is
+ * only ever run by one worker at a time, commands arriving while it is busy
+ * are handled by that worker before it lets go.
+ *
+ * Nothing a worker runs waits for the network. A prepare hands the open to
+ * the threads of source_open.c and the worker moves on, the eventfd of the
+ * open brings the player back once it is done. Commands that arrive in the
+ * meantime are held back and handled after it, as a player thread would,
+ * except that a reset or exit cuts the open short. Started players read
+ * through the engine's demux pool, see demux_thread.c, a few threads shared
+ * by all of them, and wait for their demux eventfd in the epoll set when it
+ * has nothing for them.
+ */
+
+#define ENGINE_MAX_SLOTS (1 << 16)
+
+typedef enum {
+  SOURCE_PIPE, SOURCE_SINK, SOURCE_WAKEUP, SOURCE_QUIT, SOURCE_DEMUX,
+  SOURCE_OPEN
+} source_type_t;
+
+typedef struct engine_node_t {
+  player_t *player;
+  int slot;
+  uint64_t generation;
+
+  int busy;
+  int cmd_pending;
+  int queued;
+  int pipe_armed;
+  int sink_armed;
+  int sink_fd; /* registered sink fd or -1 */
+  int demux_armed;
+  int demux_pending;
+  int open_fd; /* registered fd of the open a prepare waits for or -1 */
+  int open_ready;
+  int exited;
+
+  //commands that arrived while a prepare waited for its source
+  player_cmd_t *deferred;
+  int nb_deferred;
+
+  struct engine_node_t *next_run;
+} engine_node_t;
+
+struct ap_engine_t {
+  int efd;
+  //eventfd semaphore, one count per queued player
+  int wakeup_fd;
+  //never read, wakes every worker once written
+  int quit_fd;
+
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+
+  engine_node_t **slots;
+  int nb_slots;
+  int nb_players;
+  uint64_t next_generation;
+
+  engine_node_t *run_head, *run_tail;
+
+  pthread_t *threads;
+  int nb_threads;
+  ap_thread_config_t thread_config;
+
+  //reads ahead for every player, as many threads as there are workers
+  demux_pool_t *demux_pool;
+};
+
+/* epoll data is (generation, slot, type) so stale events for a deleted player
+ * are recognised instead of dereferenced */
+static uint64_t make_data(engine_node_t *node, source_type_t type) {
+  return (node->generation << 19) | ((uint64_t) node->slot << 3) | type;
+}
+
+static engine_node_t *lookup(ap_engine_t *engine, uint64_t data) {
+  int slot = (int) ((data >> 3) & (ENGINE_MAX_SLOTS - 1));
+  engine_node_t *node;
+
+  if (slot >= engine->nb_slots)
+    return NULL;
+  node = engine->slots[slot];
+  if (!node || node->generation != data >> 19)
+    return NULL;
+  return node;
+}
+
+static int arm(ap_engine_t *engine, engine_node_t *node, int fd,
+               source_type_t type, int op) {
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = (type == SOURCE_SINK ? EPOLLOUT : EPOLLIN) | EPOLLONESHOT;
+  event.data.u64 = make_data(node, type);
+  if (epoll_ctl(engine->efd, op, fd, &event) < 0) {
+    log_error("engine::epoll_ctl failed fd:%d: %s", fd, strerror(errno));
+    return FAILURE;
+  }
+  return SUCCESS;
+}
+
+//call with engine->mutex held
+static void enqueue(ap_engine_t *engine, engine_node_t *node) {
+  uint64_t one = 1;
+  node->queued = 1;
+  node->next_run = NULL;
+  if (engine->run_tail)
+    engine->run_tail->next_run = node;
+  else
+    engine->run_head = node;
+  engine->run_tail = node;
+  if (write(engine->wakeup_fd, &one, sizeof(one)) < 0)
+    log_error("engine::wakeup failed: %s", strerror(errno));
+}
+
+//call with engine->mutex held
+static engine_node_t *dequeue(ap_engine_t *engine) {
+  engine_node_t *node = engine->run_head;
+  if (node) {
+    engine->run_head = node->next_run;
+    if (!engine->run_head)
+      engine->run_tail = NULL;
+    node->queued = 0;
+  }
+  return node;
+}
+
+//call with engine->mutex held
+static void unqueue(ap_engine_t *engine, engine_node_t *node) {
+  engine_node_t **p, *prev = NULL;
+  for (p = &engine->run_head; *p; prev = *p, p = &(*p)->next_run) {
+    if (*p == node) {
+      *p = node->next_run;
+      if (engine->run_tail == node)
+        engine->run_tail = prev;
+      break;
+    }
+  }
+  node->queued = 0;
+}
+
+static int defer(engine_node_t *node, player_cmd_t msg) {
+  player_cmd_t *deferred = av_realloc_array(node->deferred,
+                                            node->nb_deferred + 1,
+                                            sizeof(player_cmd_t));
+  if (!deferred)
+    return AVERROR(ENOMEM);
+  node->deferred = deferred;
+  node->deferred[node->nb_deferred++] = msg;
+  return SUCCESS;
+}
+
+//call with engine->mutex held
+static int register_open(ap_engine_t *engine, engine_node_t *node) {
+  node->open_fd = player_opening_fd(node->player);
+  if (arm(engine, node, node->open_fd, SOURCE_OPEN, EPOLL_CTL_ADD) < 0) {
+    node->open_fd = -1;
+    return FAILURE;
+  }
+  return SUCCESS;
+}
+
+static void unregister_open(ap_engine_t *engine, engine_node_t *node) {
+  if (node->open_fd >= 0)
+    epoll_ctl(engine->efd, EPOLL_CTL_DEL, node->open_fd, NULL);
+  node->open_fd = -1;
+}
+
+/* the open registered has finished. Its fd number may be that of an open a
+ * reset cut short, whose event can still be delivered after it */
+static int open_finished(engine_node_t *node) {
+  uint64_t count;
+  return node->open_fd >= 0
+         && read(node->open_fd, &count, sizeof(count)) == sizeof(count);
+}
+
+static int run_command(ap_engine_t *engine, engine_node_t *node,
+                       player_cmd_t msg);
+
+/* finish the prepare waiting for its source, then handle the commands held
+ * back meanwhile. Returns TRUE if the player exited */
+static int finish_open(ap_engine_t *engine, engine_node_t *node) {
+  player_cmd_t *deferred = node->deferred;
+  int i, n = node->nb_deferred, exited = FALSE;
+
+  unregister_open(engine, node);
+  player_open_done(node->player);
+  player_dispatch_events(node->player);
+
+  //a deferred prepare may wait for a source again and defer the rest
+  node->deferred = NULL;
+  node->nb_deferred = 0;
+  for (i = 0; i < n && !exited; i++)
+    exited = run_command(engine, node, deferred[i]);
+  av_free(deferred);
+  return exited;
+}
+
+/* handle msg, or hold it back while a prepare waits for its source. Returns
+ * TRUE if the player exited */
+static int run_command(ap_engine_t *engine, engine_node_t *node,
+                       player_cmd_t msg) {
+  player_t *player = node->player;
+  int deferred;
+
+  if (player->opening) {
+    deferred = defer(node, msg) == SUCCESS;
+    if (deferred && msg.cmd != CMD_RESET && msg.cmd != CMD_EXIT)
+      return FALSE;
+    //interrupts the open like it does source_open_wait() on a player thread
+    if (finish_open(engine, node))
+      return TRUE;
+    if (deferred)
+      return FALSE;
+  }
+
+  if (player_handle_cmd(player, msg)) {
+    epoll_ctl(engine->efd, EPOLL_CTL_DEL, player->pipe[0], NULL);
+    epoll_ctl(engine->efd, EPOLL_CTL_DEL, player->demux_fd, NULL);
+    if (node->sink_fd >= 0)
+      epoll_ctl(engine->efd, EPOLL_CTL_DEL, node->sink_fd, NULL);
+    unregister_open(engine, node);
+    player_loop_cleanup(player);
+    player_dispatch_events(player);
+    return TRUE;
+  }
+  player_dispatch_events(player);
+  return FALSE;
+}
+
+/* handle every queued command, returns TRUE if the player exited */
+static int run_commands(ap_engine_t *engine, engine_node_t *node) {
+  player_t *player = node->player;
+  player_cmd_t msg;
+
+  while (read(player->pipe[0], &msg, sizeof(msg)) == sizeof(msg)) {
+    if (run_command(engine, node, msg))
+      return TRUE;
+  }
+  return FALSE;
+}
+
+//the demux thread has queued packets, call as the owner of a busy node
+static void demux_ready(player_t *player) {
+  demux_woken(player);
+  if (player->state == STATE_STARTED)
+    player->epoll_timeout = 0;
+}
+
+/* let go of a busy node, rescheduling it as needed.
+ * call with engine->mutex held */
+static void release_node(ap_engine_t *engine, engine_node_t *node) {
+  player_t *player = node->player;
+
+  while (!node->exited) {
+    int open_ready = node->open_ready, blocking, exited;
+    //a prepare started waiting for its source. If the open cannot be waited
+    //for in epoll it is waited for here, like on a player thread
+    blocking = player->opening && node->open_fd < 0
+               && register_open(engine, node) < 0;
+    if (!blocking && !open_ready && !node->cmd_pending)
+      break;
+
+    if (!blocking && open_ready)
+      node->open_ready = 0;
+    else if (!blocking)
+      node->cmd_pending = 0;
+    pthread_mutex_unlock(&engine->mutex);
+    if (blocking)
+      exited = finish_open(engine, node);
+    else if (open_ready)
+      exited = open_finished(node) && finish_open(engine, node);
+    else
+      exited = run_commands(engine, node);
+    pthread_mutex_lock(&engine->mutex);
+    node->exited = exited;
+  }
+
+  if (node->demux_pending && !node->exited) {
+    node->demux_pending = 0;
+    demux_ready(player);
+  }
+
+  if (node->exited) {
+    unqueue(engine, node);
+    node->busy = 0;
+    pthread_cond_broadcast(&engine->cond);
+    return;
+  }
+
+  if (!node->pipe_armed)
+    node->pipe_armed = arm(engine, node, player->pipe[0], SOURCE_PIPE,
+                           EPOLL_CTL_MOD) == SUCCESS;
+
+  if (player->state == STATE_STARTED) {
+    //waiting for the demux thread, see wait_for_demux()
+    if (player->epoll_timeout < 0 && player->demux_running) {
+      if (!node->demux_armed)
+        node->demux_armed = arm(engine, node, player->demux_fd, SOURCE_DEMUX,
+                                EPOLL_CTL_MOD) == SUCCESS;
+    //rendering players are not paced by their sink
+    } else if (player->sink_fd >= 0 && !player->render) {
+      if (node->sink_fd != player->sink_fd) {
+        if (node->sink_fd >= 0)
+          epoll_ctl(engine->efd, EPOLL_CTL_DEL, node->sink_fd, NULL);
+        node->sink_fd = player->sink_fd;
+        node->sink_armed = arm(engine, node, node->sink_fd, SOURCE_SINK,
+                               EPOLL_CTL_ADD) == SUCCESS;
+      } else if (!node->sink_armed) {
+        node->sink_armed = arm(engine, node, node->sink_fd, SOURCE_SINK,
+                               EPOLL_CTL_MOD) == SUCCESS;
+      }
+    } else if (!node->queued) {
+      enqueue(engine, node);
+    }
+  }
+  node->busy = 0;
+}
+
+static void *engine_worker(ap_engine_t *engine) {
+  struct epoll_event event;
+  engine_node_t *node;
+  uint64_t count;
+  int n, demux;
+
+  log_debug("[%"PRIXPTR"] engine_worker()", (intptr_t) pthread_self());
+
+  thread_config_apply(&engine->thread_config);
+
+  for (;;) {
+    n = epoll_wait(engine->efd, &event, 1, -1);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      log_error("engine_worker::epoll_wait failed: %s", strerror(errno));
+      break;
+    }
+    if (n == 0)
+      continue;
+
+    source_type_t type = (source_type_t) (event.data.u64 & 7);
+
+    if (type == SOURCE_QUIT)
+      break;
+
+    if (type == SOURCE_WAKEUP) {
+      //another worker may have taken the count already
+      if (read(engine->wakeup_fd, &count, sizeof(count)) != sizeof(count))
+        continue;
+      pthread_mutex_lock(&engine->mutex);
+      node = dequeue(engine);
+    } else {
+      pthread_mutex_lock(&engine->mutex);
+      node = lookup(engine, event.data.u64);
+      if (node && !node->exited) {
+        if (type == SOURCE_PIPE) {
+          node->pipe_armed = 0;
+          node->cmd_pending = 1;
+        } else if (type == SOURCE_DEMUX) {
+          node->demux_armed = 0;
+          node->demux_pending = 1;
+        } else if (type == SOURCE_OPEN) {
+          node->open_ready = 1;
+        } else {
+          node->sink_armed = 0;
+        }
+      }
+    }
+
+    //a busy node is released by the worker running it
+    if (!node || node->exited || node->busy) {
+      pthread_mutex_unlock(&engine->mutex);
+      continue;
+    }
+
+    node->busy = 1;
+    //pending commands and opens are handled by release_node()
+    if (!node->cmd_pending && !node->open_ready) {
+      demux = node->demux_pending;
+      node->demux_pending = 0;
+      pthread_mutex_unlock(&engine->mutex);
+      if (demux)
+        demux_ready(node->player);
+      player_step(node->player);
+      player_dispatch_events(node->player);
+      pthread_mutex_lock(&engine->mutex);
+    }
+    release_node(engine, node);
+    pthread_mutex_unlock(&engine->mutex);
+  }
+
+  log_debug("[%"PRIXPTR"] engine_worker::done", (intptr_t) pthread_self());
+  return NULL;
+}
+
+static int add_fd(ap_engine_t *engine, int fd, source_type_t type) {
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN;
+  event.data.u64 = type;
+  return epoll_ctl(engine->efd, EPOLL_CTL_ADD, fd, &event);
+}
+
+ap_engine_t *ap_engine_create(int threads) {
+  ap_engine_t *engine;
+  pthread_attr_t attr;
+  int i, ret;
+
+  log_info("ap_engine_create() threads: %d", threads);
+
+  if (threads <= 0)
+    threads = 2;
+
+  engine = av_mallocz(sizeof(ap_engine_t));
+  if (!engine)
+    return NULL;
+
+  pthread_mutex_init(&engine->mutex, NULL);
+  pthread_cond_init(&engine->cond, NULL);
+  engine->next_generation = 1;
+
+  engine->efd = epoll_create1(EPOLL_CLOEXEC);
+  engine->wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_SEMAPHORE | EFD_CLOEXEC);
+  engine->quit_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+  if (engine->efd < 0 || engine->wakeup_fd < 0 || engine->quit_fd < 0
+      || add_fd(engine, engine->wakeup_fd, SOURCE_WAKEUP) < 0
+      || add_fd(engine, engine->quit_fd, SOURCE_QUIT) < 0) {
+    log_error("ap_engine_create::failed: %s", strerror(errno));
+    ap_engine_delete(engine);
+    return NULL;
+  }
+
+  engine->threads = av_mallocz_array(threads, sizeof(pthread_t));
+  if (!engine->threads) {
+    ap_engine_delete(engine);
+    return NULL;
+  }
+
+  ap_get_thread_config(&engine->thread_config);
+  if (!(engine->demux_pool = demux_pool_create(threads,
+                                               &engine->thread_config))) {
+    ap_engine_delete(engine);
+    return NULL;
+  }
+
+  pthread_attr_init(&attr);
+  thread_config_init_attr(&engine->thread_config, &attr);
+
+  for (i = 0; i < threads; i++) {
+    if ((ret = pthread_create(&engine->threads[i], &attr, (void *) engine_worker,
+                              engine)) != SUCCESS) {
+      log_error("ap_engine_create::failed to start worker: %s", strerror(ret));
+      pthread_attr_destroy(&attr);
+      ap_engine_delete(engine);
+      return NULL;
+    }
+    engine->nb_threads++;
+  }
+  pthread_attr_destroy(&attr);
+
+  return engine;
+}
+
+void ap_engine_delete(ap_engine_t *engine) {
+  uint64_t one = 1;
+  int i;
+
+  if (!engine)
+    return;
+
+  log_info("ap_engine_delete()");
+
+  if (engine->nb_players)
+    log_error("ap_engine_delete::%d players have not been deleted",
+              engine->nb_players);
+
+  if (engine->quit_fd >= 0 && write(engine->quit_fd, &one, sizeof(one)) < 0)
+    log_error("ap_engine_delete::quit failed: %s", strerror(errno));
+
+  for (i = 0; i < engine->nb_threads; i++)
+    pthread_join(engine->threads[i], NULL);
+  demux_pool_free(engine->demux_pool);
+
+  if (engine->efd >= 0)
+    close(engine->efd);
+  if (engine->wakeup_fd >= 0)
+    close(engine->wakeup_fd);
+  if (engine->quit_fd >= 0)
+    close(engine->quit_fd);
+
+  pthread_mutex_destroy(&engine->mutex);
+  pthread_cond_destroy(&engine->cond);
+  av_freep(&engine->threads);
+  av_freep(&engine->slots);
+  av_free(engine);
+}
+
+static void close_demux_fd(player_t *player) {
+  if (player->demux_fd >= 0)
+    close(player->demux_fd);
+  player->demux_fd = -1;
+}
+
+/* on failure the player's resources have been released, only the player_t
+ * itself is left to free */
+int engine_add_player(ap_engine_t *engine, player_t *player) {
+  engine_node_t *node;
+  int slot, ret;
+
+  node = av_mallocz(sizeof(engine_node_t));
+  if (!node)
+    return AVERROR(ENOMEM);
+  node->player = player;
+  node->sink_fd = -1;
+  node->open_fd = -1;
+  player->demux_pool = engine->demux_pool;
+
+  //signalled by the demux thread, closed by engine_remove_player()
+  player->demux_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (player->demux_fd < 0 || (ret = player_loop_init(player)) < 0) {
+    if (player->demux_fd < 0)
+      ret = AVERROR(errno);
+    player_loop_cleanup(player);
+    close_demux_fd(player);
+    av_free(node);
+    return ret;
+  }
+  player_dispatch_events(player);
+
+  pthread_mutex_lock(&engine->mutex);
+
+  for (slot = 0; slot < engine->nb_slots && engine->slots[slot]; slot++);
+
+  if (slot == engine->nb_slots) {
+    int nb = engine->nb_slots ? engine->nb_slots * 2 : 16;
+    engine_node_t **slots;
+    if (nb > ENGINE_MAX_SLOTS
+        || !(slots = av_realloc_array(engine->slots, nb, sizeof(*slots)))) {
+      pthread_mutex_unlock(&engine->mutex);
+      player_loop_cleanup(player);
+      close_demux_fd(player);
+      av_free(node);
+      return AVERROR(ENOMEM);
+    }
+    memset(slots + engine->nb_slots, 0,
+           (nb - engine->nb_slots) * sizeof(*slots));
+    engine->slots = slots;
+    engine->nb_slots = nb;
+  }
+
+  node->slot = slot;
+  node->generation = engine->next_generation++;
+  engine->slots[slot] = node;
+  engine->nb_players++;
+
+  player->engine = engine;
+  player->engine_node = node;
+
+  node->pipe_armed = arm(engine, node, player->pipe[0], SOURCE_PIPE,
+                         EPOLL_CTL_ADD) == SUCCESS;
+  node->demux_armed = node->pipe_armed
+                      && arm(engine, node, player->demux_fd, SOURCE_DEMUX,
+                             EPOLL_CTL_ADD) == SUCCESS;
+  if (!node->demux_armed) {
+    if (node->pipe_armed)
+      epoll_ctl(engine->efd, EPOLL_CTL_DEL, player->pipe[0], NULL);
+    node->pipe_armed = 0;
+    engine->slots[slot] = NULL;
+    engine->nb_players--;
+  }
+  pthread_mutex_unlock(&engine->mutex);
+
+  if (!node->pipe_armed) {
+    player_loop_cleanup(player);
+    close_demux_fd(player);
+    player->engine = NULL;
+    player->demux_pool = NULL;
+    player->engine_node = NULL;
+    av_free(node);
+    return FAILURE;
+  }
+  return SUCCESS;
+}
+
+void engine_remove_player(ap_engine_t *engine, player_t *player) {
+  engine_node_t *node = player->engine_node;
+
+  pthread_mutex_lock(&engine->mutex);
+  while (!node->exited || node->busy)
+    pthread_cond_wait(&engine->cond, &engine->mutex);
+
+  engine->slots[node->slot] = NULL;
+  engine->nb_players--;
+  pthread_mutex_unlock(&engine->mutex);
+
+  player->engine_node = NULL;
+  close_demux_fd(player);
+  av_free(node->deferred);
+  av_free(node);
+}
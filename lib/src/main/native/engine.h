@@ -0,0 +1,12 @@
+#ifndef _ENGINE_H_
+#define _ENGINE_H_
+
+#include "audioplayer.h"
+
+//runs player_loop_init() and registers the player's command pipe
+int engine_add_player(ap_engine_t *engine, player_t *player);
+
+//wait for the engine to handle the CMD_EXIT sent by ap_delete()
+void engine_remove_player(ap_engine_t *engine, player_t *player);
+
+#endif //_ENGINE_H_
@@ -0,0 +1,265 @@
+#include "audioplayer.h"
+#include <time.h>
+#include "eq.h"
+#include "pcm.h"
+#include "logging.h"
+
+/*
+ * Equalizer of up to AP_EQ_MAX_BANDS peaking biquads in cascade, with the
+ * coefficients of the Audio EQ Cookbook. Each band filters the whole of a
+ * segment before the next one does, so its cost can be timed on its own. The
+ * recursion runs along time, so what is filtered in parallel are the
+ * channels of a frame, in the lanes of a NEON or SSE vector.
+ *
+ * New settings are handed over through player_t.eq_next without a lock. A
+ * band that changes moves to its new coefficients in EQ_RAMP_STEPS steps of
+ * EQ_BLOCK frames, which does not click. Every set on the way is stable: a1
+ * and a2 of a stable biquad lie inside a triangle, and so does the line
+ * between any two points of it.
+ */
+
+#define EQ_BLOCK 64
+#define EQ_RAMP_STEPS 16
+//state below this is flushed, denormals are slow on some cpus
+#define EQ_DENORMAL 1e-15f
+//a flat band is skipped once what it still rings is below this
+#define EQ_SILENT 1e-6f
+
+static int64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void peaking(const ap_eq_band_t *band, int sample_rate, eq_coeffs_t *c) {
+  double a = pow(10, band->gain_db / 40);
+  double w0 = 2 * M_PI * av_clipd(band->freq_hz, 10, 0.45 * sample_rate)
+              / sample_rate;
+  double alpha = sin(w0) / (2 * FFMAX(band->q, 0.1));
+  double a0 = 1 + alpha / a;
+
+  c->b0 = (float) ((1 + alpha * a) / a0);
+  c->b1 = c->a1 = (float) (-2 * cos(w0) / a0);
+  c->b2 = (float) ((1 - alpha * a) / a0);
+  c->a2 = (float) ((1 - alpha / a) / a0);
+}
+
+static void set_band(eq_t *eq, eq_filter_t *f, const ap_eq_band_t *band,
+                     int ramp) {
+  f->band = *band;
+  if (!eq->sample_rate)
+    return;
+
+  peaking(band, eq->sample_rate, &f->target);
+  if (!ramp) {
+    f->coeffs = f->target;
+    f->ramp = 0;
+    f->flat = band->gain_db == 0;
+    memset(f->z1, 0, sizeof(f->z1));
+    memset(f->z2, 0, sizeof(f->z2));
+    return;
+  }
+
+  f->step.b0 = (f->target.b0 - f->coeffs.b0) / EQ_RAMP_STEPS;
+  f->step.b1 = (f->target.b1 - f->coeffs.b1) / EQ_RAMP_STEPS;
+  f->step.b2 = (f->target.b2 - f->coeffs.b2) / EQ_RAMP_STEPS;
+  f->step.a1 = (f->target.a1 - f->coeffs.a1) / EQ_RAMP_STEPS;
+  f->step.a2 = (f->target.a2 - f->coeffs.a2) / EQ_RAMP_STEPS;
+  f->ramp = EQ_RAMP_STEPS;
+  f->flat = FALSE;
+}
+
+void eq_init(eq_t *eq) {
+  int i;
+
+  memset(eq, 0, sizeof(*eq));
+  atomic_init(&eq->nb_bands, 0);
+  for (i = 0; i < AP_EQ_MAX_BANDS; i++) {
+    eq->filters[i].flat = TRUE;
+    atomic_init(&eq->band_ns[i], 0);
+  }
+  atomic_init(&eq->frames, 0);
+}
+
+void eq_configure(eq_t *eq, int channels, int sample_rate) {
+  int i;
+
+  eq->channels = channels;
+  eq->sample_rate = sample_rate;
+  for (i = 0; i < AP_EQ_MAX_BANDS; i++)
+    set_band(eq, &eq->filters[i], &eq->filters[i].band, FALSE);
+}
+
+void eq_update(eq_t *eq, const eq_settings_t *settings) {
+  eq_filter_t *f;
+  ap_eq_band_t band;
+  int i;
+
+  log_debug("eq_update() bands: %d", settings->nb_bands);
+  for (i = 0; i < AP_EQ_MAX_BANDS; i++) {
+    f = &eq->filters[i];
+    if (i < settings->nb_bands) {
+      band = settings->bands[i];
+    } else {
+      //bands no longer used fade out where they are
+      band = f->band;
+      band.gain_db = 0;
+    }
+    if (memcmp(&band, &f->band, sizeof(band)) || f->ramp)
+      set_band(eq, f, &band, TRUE);
+  }
+  atomic_store(&eq->nb_bands, settings->nb_bands);
+}
+
+int eq_bypassed(eq_t *eq) {
+  int i;
+
+  for (i = 0; i < AP_EQ_MAX_BANDS; i++)
+    if (!eq->filters[i].flat)
+      return FALSE;
+  return TRUE;
+}
+
+static void filter_mono(eq_filter_t *f, float *pcm, int frames) {
+  const eq_coeffs_t *c = &f->coeffs;
+  float z1 = f->z1[0], z2 = f->z2[0], x, y;
+  int i;
+
+  for (i = 0; i < frames; i++) {
+    x = pcm[i];
+    y = c->b0 * x + z1;
+    z1 = c->b1 * x - c->a1 * y + z2;
+    z2 = c->b2 * x - c->a2 * y;
+    pcm[i] = y;
+  }
+  f->z1[0] = z1;
+  f->z2[0] = z2;
+}
+
+//both channels of a frame at once
+static void filter_stereo(eq_filter_t *f, float *pcm, int frames) {
+  const eq_coeffs_t *c = &f->coeffs;
+  int i;
+
+#if defined(AP_NEON)
+  float32x2_t b0 = vdup_n_f32(c->b0), b1 = vdup_n_f32(c->b1),
+      b2 = vdup_n_f32(c->b2), a1 = vdup_n_f32(c->a1), a2 = vdup_n_f32(c->a2);
+  float32x2_t z1 = vld1_f32(f->z1), z2 = vld1_f32(f->z2), x, y;
+
+  for (i = 0; i < frames; i++) {
+    x = vld1_f32(pcm + 2 * i);
+    y = vmla_f32(z1, b0, x);
+    z1 = vmls_f32(vmla_f32(z2, b1, x), a1, y);
+    z2 = vmls_f32(vmul_f32(b2, x), a2, y);
+    vst1_f32(pcm + 2 * i, y);
+  }
+  vst1_f32(f->z1, z1);
+  vst1_f32(f->z2, z2);
+#elif defined(AP_SSE2)
+  __m128 b0 = _mm_set1_ps(c->b0), b1 = _mm_set1_ps(c->b1),
+      b2 = _mm_set1_ps(c->b2), a1 = _mm_set1_ps(c->a1), a2 = _mm_set1_ps(c->a2);
+  __m128 z1 = _mm_setr_ps(f->z1[0], f->z1[1], 0, 0);
+  __m128 z2 = _mm_setr_ps(f->z2[0], f->z2[1], 0, 0);
+  __m128 x, y;
+
+  //the two low lanes hold the channels
+  for (i = 0; i < frames; i++) {
+    x = _mm_loadl_pi(_mm_setzero_ps(), (const __m64 *) (pcm + 2 * i));
+    y = _mm_add_ps(_mm_mul_ps(b0, x), z1);
+    z1 = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(b1, x), z2), _mm_mul_ps(a1, y));
+    z2 = _mm_sub_ps(_mm_mul_ps(b2, x), _mm_mul_ps(a2, y));
+    _mm_storel_pi((__m64 *) (pcm + 2 * i), y);
+  }
+  _mm_storel_pi((__m64 *) f->z1, z1);
+  _mm_storel_pi((__m64 *) f->z2, z2);
+#else
+  float z1[2] = {f->z1[0], f->z1[1]}, z2[2] = {f->z2[0], f->z2[1]}, x, y;
+  int ch;
+
+  for (i = 0; i < frames; i++) {
+    for (ch = 0; ch < 2; ch++) {
+      x = pcm[2 * i + ch];
+      y = c->b0 * x + z1[ch];
+      z1[ch] = c->b1 * x - c->a1 * y + z2[ch];
+      z2[ch] = c->b2 * x - c->a2 * y;
+      pcm[2 * i + ch] = y;
+    }
+  }
+  memcpy(f->z1, z1, sizeof(z1));
+  memcpy(f->z2, z2, sizeof(z2));
+#endif
+}
+
+static void run_filter(eq_t *eq, eq_filter_t *f, float *pcm, int frames) {
+  float ringing = 0;
+  int n, ch;
+
+  while (frames > 0) {
+    n = f->ramp ? FFMIN(frames, EQ_BLOCK) : frames;
+    if (f->ramp && --f->ramp) {
+      f->coeffs.b0 += f->step.b0;
+      f->coeffs.b1 += f->step.b1;
+      f->coeffs.b2 += f->step.b2;
+      f->coeffs.a1 += f->step.a1;
+      f->coeffs.a2 += f->step.a2;
+    } else if (!f->ramp) {
+      f->coeffs = f->target;
+    }
+    if (eq->channels == 2)
+      filter_stereo(f, pcm, n);
+    else
+      filter_mono(f, pcm, n);
+    pcm += n * eq->channels;
+    frames -= n;
+  }
+
+  for (ch = 0; ch < eq->channels; ch++) {
+    if (fabsf(f->z1[ch]) < EQ_DENORMAL)
+      f->z1[ch] = 0;
+    if (fabsf(f->z2[ch]) < EQ_DENORMAL)
+      f->z2[ch] = 0;
+    ringing += fabsf(f->z1[ch]) + fabsf(f->z2[ch]);
+  }
+  //what the band held from before it went flat has died away
+  if (!f->ramp && f->band.gain_db == 0 && ringing < EQ_SILENT) {
+    f->flat = TRUE;
+    memset(f->z1, 0, sizeof(f->z1));
+    memset(f->z2, 0, sizeof(f->z2));
+  }
+}
+
+void eq_process_float(eq_t *eq, float *pcm, int frames) {
+  int64_t start;
+  int i;
+
+  for (i = 0; i < AP_EQ_MAX_BANDS; i++) {
+    if (eq->filters[i].flat)
+      continue;
+    start = now_ns();
+    run_filter(eq, &eq->filters[i], pcm, frames);
+    atomic_fetch_add_explicit(&eq->band_ns[i], now_ns() - start,
+                              memory_order_relaxed);
+  }
+  atomic_fetch_add_explicit(&eq->frames, frames, memory_order_relaxed);
+}
+
+void eq_process_s16(eq_t *eq, int16_t *pcm, int frames) {
+  int n;
+
+  while (frames > 0) {
+    n = FFMIN(frames, EQ_SEGMENT);
+    pcm_s16_to_float(eq->segment, pcm, n * eq->channels);
+    eq_process_float(eq, eq->segment, n);
+    pcm_float_to_s16(pcm, eq->segment, n * eq->channels);
+    pcm += n * eq->channels;
+    frames -= n;
+  }
+}
+
+void eq_reset_costs(eq_t *eq) {
+  int i;
+
+  for (i = 0; i < AP_EQ_MAX_BANDS; i++)
+    atomic_store(&eq->band_ns[i], 0);
+  atomic_store(&eq->frames, 0);
+}
@@ -0,0 +1,79 @@
+#ifndef _EQ_H_
+#define _EQ_H_
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+//most bands of ap_set_eq()
+#define AP_EQ_MAX_BANDS 10
+
+//frames converted to float and filtered at a time
+#define EQ_SEGMENT 1024
+
+//one band of ap_set_eq(), a peaking filter
+typedef struct ap_eq_band_t {
+  double freq_hz;
+  double gain_db;
+  double q;
+} ap_eq_band_t;
+
+//see ap_set_eq(), handed to the thread running the player
+typedef struct eq_settings_t {
+  int nb_bands;
+  ap_eq_band_t bands[AP_EQ_MAX_BANDS];
+} eq_settings_t;
+
+//normalized biquad, a0 is 1
+typedef struct eq_coeffs_t {
+  float b0, b1, b2, a1, a2;
+} eq_coeffs_t;
+
+typedef struct eq_filter_t {
+  ap_eq_band_t band;
+  eq_coeffs_t coeffs;
+  eq_coeffs_t target;
+  //added to coeffs each block while ramp is left
+  eq_coeffs_t step;
+  int ramp;
+  //0 dB and not ramping, the band is skipped
+  int flat;
+  //transposed direct form II state of each channel
+  float z1[2];
+  float z2[2];
+} eq_filter_t;
+
+/* the equalizer of the output, a cascade of biquads, only used by the
+ * thread running the player. The costs are read by ap_get_stats() */
+typedef struct eq_t {
+  int sample_rate;
+  int channels;
+  //read by ap_get_stats()
+  atomic_int nb_bands;
+  eq_filter_t filters[AP_EQ_MAX_BANDS];
+  //S16 output is filtered as float
+  float segment[EQ_SEGMENT * 2];
+
+  //processor time of each band and the frames filtered since the last reset
+  atomic_llong band_ns[AP_EQ_MAX_BANDS];
+  atomic_llong frames;
+} eq_t;
+
+void eq_init(eq_t *eq);
+
+//for output of channels, 1 or 2, at sample_rate. Drops the filter state
+void eq_configure(eq_t *eq, int channels, int sample_rate);
+
+//move the bands to settings, changed bands ramp over about 20ms
+void eq_update(eq_t *eq, const eq_settings_t *settings);
+
+//no band is filtering
+int eq_bypassed(eq_t *eq);
+
+//filter frames of interleaved S16 or float pcm in place
+void eq_process_s16(eq_t *eq, int16_t *pcm, int frames);
+void eq_process_float(eq_t *eq, float *pcm, int frames);
+
+//the cost counters start again
+void eq_reset_costs(eq_t *eq);
+
+#endif //_EQ_H_
@@ -0,0 +1,111 @@
+#include "audioplayer.h"
+#include "event_queue.h"
+#include "jitter_buffer.h"
+#include "logging.h"
+
+/*
+ * Once an event has gone to the overflow list every later one follows it
+ * there until the consumer has emptied it, and the consumer only takes from
+ * the list once the ring is empty, so events are delivered in order.
+ */
+
+void event_queue_init(event_queue_t *q) {
+  atomic_init(&q->head, 0);
+  atomic_init(&q->tail, 0);
+  atomic_init(&q->overflowed, 0);
+  pthread_mutex_init(&q->mutex, NULL);
+  q->first = q->last = NULL;
+}
+
+void event_queue_free(event_queue_t *q) {
+  overflow_event_t *e, *next;
+
+  for (e = q->first; e; e = next) {
+    next = e->next;
+    av_free(e);
+  }
+  q->first = q->last = NULL;
+  pthread_mutex_destroy(&q->mutex);
+}
+
+//append to the overflow list if it is not empty or full is set
+static int put_overflow(event_queue_t *q, const queued_event_t *event,
+                        int full) {
+  overflow_event_t *e;
+  int ret = FAILURE;
+
+  pthread_mutex_lock(&q->mutex);
+  if (q->first || full) {
+    if ((e = av_malloc(sizeof(overflow_event_t)))) {
+      e->event = *event;
+      e->next = NULL;
+      if (q->last)
+        q->last->next = e;
+      else
+        q->first = e;
+      q->last = e;
+      atomic_fetch_add_explicit(&q->overflowed, 1, memory_order_relaxed);
+      ret = SUCCESS;
+    } else {
+      log_error("event_queue_put::cannot queue event %d", event->event);
+      ret = AVERROR(ENOMEM);
+    }
+  }
+  pthread_mutex_unlock(&q->mutex);
+  return ret;
+}
+
+int event_queue_put(event_queue_t *q, int event, int arg1, int arg2) {
+  unsigned tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+  unsigned head = atomic_load_explicit(&q->head, memory_order_acquire);
+  queued_event_t queued = {event, arg1, arg2, jitter_buffer_now()};
+  int ret;
+
+  //behind events already in the list
+  if (atomic_load_explicit(&q->overflowed, memory_order_relaxed)
+      && (ret = put_overflow(q, &queued, FALSE)) != FAILURE)
+    return ret < 0 ? FAILURE : SUCCESS;
+
+  if (tail - head >= EVENT_QUEUE_SIZE) {
+    log_debug("event_queue_put::queue full, event %d waits in the overflow",
+              event);
+    return put_overflow(q, &queued, TRUE) < 0 ? FAILURE : SUCCESS;
+  }
+
+  q->events[tail & (EVENT_QUEUE_SIZE - 1)] = queued;
+  atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+  return SUCCESS;
+}
+
+int event_queue_depth(event_queue_t *q) {
+  return (int) (atomic_load_explicit(&q->tail, memory_order_acquire)
+                - atomic_load_explicit(&q->head, memory_order_acquire)
+                + atomic_load_explicit(&q->overflowed, memory_order_relaxed));
+}
+
+int event_queue_get(event_queue_t *q, queued_event_t *event) {
+  unsigned head = atomic_load_explicit(&q->head, memory_order_relaxed);
+  unsigned tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+  overflow_event_t *e;
+
+  if (head != tail) {
+    *event = q->events[head & (EVENT_QUEUE_SIZE - 1)];
+    atomic_store_explicit(&q->head, head + 1, memory_order_release);
+    return 1;
+  }
+  if (!atomic_load_explicit(&q->overflowed, memory_order_relaxed))
+    return 0;
+
+  pthread_mutex_lock(&q->mutex);
+  if ((e = q->first)) {
+    if (!(q->first = e->next))
+      q->last = NULL;
+    atomic_fetch_sub_explicit(&q->overflowed, 1, memory_order_relaxed);
+  }
+  pthread_mutex_unlock(&q->mutex);
+  if (!e)
+    return 0;
+  *event = e->event;
+  av_free(e);
+  return 1;
+}
@@ -0,0 +1,52 @@
+#ifndef _EVENT_QUEUE_H_
+#define _EVENT_QUEUE_H_
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+//must be a power of 2
+#define EVENT_QUEUE_SIZE 64
+
+typedef struct {
+  int event;
+  int arg1;
+  int arg2;
+  int64_t time; /* CLOCK_MONOTONIC us when queued */
+} queued_event_t;
+
+typedef struct overflow_event_t {
+  queued_event_t event;
+  struct overflow_event_t *next;
+} overflow_event_t;
+
+/* lock free ring of player events with a single producer, the thread running
+ * the player, and a single consumer that delivers them to the callbacks.
+ * Events that do not fit while the consumer is behind wait in a list under
+ * a mutex, so a state change is never lost */
+typedef struct {
+  queued_event_t events[EVENT_QUEUE_SIZE];
+  atomic_uint head; /* next to be read */
+  atomic_uint tail; /* next to be written */
+  //events in the overflow list, taken after the ring
+  atomic_uint overflowed;
+  pthread_mutex_t mutex;
+  overflow_event_t *first;
+  overflow_event_t *last;
+} event_queue_t;
+
+void event_queue_init(event_queue_t *q);
+
+//drops the events still queued
+void event_queue_free(event_queue_t *q);
+
+//returns FAILURE only if the ring is full and the event cannot be allocated
+int event_queue_put(event_queue_t *q, int event, int arg1, int arg2);
+
+//number of events waiting, an estimate unless called by the consumer
+int event_queue_depth(event_queue_t *q);
+
+//returns 1 if an event was taken, 0 if the queue is empty
+int event_queue_get(event_queue_t *q, queued_event_t *event);
+
+#endif //_EVENT_QUEUE_H_
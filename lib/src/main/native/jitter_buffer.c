@@ -0,0 +1,77 @@
+#include <math.h>
+#include <time.h>
+#include <inttypes.h>
+#include "audioplayer.h"
+#include "logging.h"
+
+//how many times the arrival jitter is kept in the buffer
+#define JITTER_DEPTH_FACTOR 4
+//time constant of the underrun boost decay
+#define JITTER_BOOST_DECAY_US (60 * 1000000LL)
+
+int64_t jitter_buffer_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void update_target(jitter_buffer_t *jb) {
+  int64_t target = jb->min_target + (int64_t) (JITTER_DEPTH_FACTOR * jb->jitter)
+                   + jb->boost;
+  if (target > jb->max_target)
+    target = jb->max_target;
+  jb->target = target;
+}
+
+void jitter_buffer_init(jitter_buffer_t *jb, int min_ms, int max_ms) {
+  memset(jb, 0, sizeof(jitter_buffer_t));
+  jb->enabled = min_ms > 0;
+  jb->min_target = (int64_t) min_ms * 1000;
+  jb->max_target = (int64_t) (max_ms > min_ms ? max_ms : min_ms) * 1000;
+  jitter_buffer_reset(jb, TRUE);
+}
+
+void jitter_buffer_reset(jitter_buffer_t *jb, int clear_stats) {
+  jb->buffering = jb->enabled;
+  jb->started = 0;
+  jb->last_arrival = 0;
+  jb->last_media_time = 0;
+  jb->buffering_since = jitter_buffer_now();
+  if (clear_stats) {
+    jb->jitter = 0;
+    jb->boost = 0;
+    jb->underruns = 0;
+    jb->underrun_time = 0;
+  }
+  update_target(jb);
+}
+
+void jitter_buffer_arrival(jitter_buffer_t *jb, int64_t now, int64_t media_time) {
+  if (jb->last_arrival) {
+    int64_t d = (now - jb->last_arrival) - (media_time - jb->last_media_time);
+    jb->jitter += (fabs((double) d) - jb->jitter) / 16.0;
+    jb->boost -= jb->boost * (now - jb->last_arrival) / JITTER_BOOST_DECAY_US;
+    update_target(jb);
+  }
+  jb->last_arrival = now;
+  jb->last_media_time = media_time;
+}
+
+void jitter_buffer_underrun(jitter_buffer_t *jb, int64_t now) {
+  jb->buffering = TRUE;
+  jb->buffering_since = now;
+  jb->underruns++;
+  jb->boost += jb->target / 2;
+  update_target(jb);
+  log_info("jitter_buffer_underrun() count:%d new target:%"PRId64"ms",
+           jb->underruns, jb->target / 1000);
+}
+
+int64_t jitter_buffer_end(jitter_buffer_t *jb, int64_t now) {
+  int64_t elapsed = now - jb->buffering_since;
+  if (jb->started)
+    jb->underrun_time += elapsed;
+  jb->started = TRUE;
+  jb->buffering = FALSE;
+  return elapsed;
+}
@@ -0,0 +1,49 @@
+#ifndef _JITTER_BUFFER_H_
+#define _JITTER_BUFFER_H_
+
+#include <stdint.h>
+
+#define JITTER_DEFAULT_MIN_MS 1000
+#define JITTER_DEFAULT_MAX_MS 10000
+
+/* duration based buffer state for the packets between the network and the
+ * decoder. All times are in microseconds */
+typedef struct jitter_buffer_t {
+  int enabled;
+  int buffering; /* refilling, nothing is decoded until the target is reached */
+  int started; /* the first fill has completed */
+
+  int64_t min_target;
+  int64_t max_target;
+  int64_t target;
+
+  /* smoothed packet arrival jitter, see RFC 3550 section 6.4.1 */
+  double jitter;
+  /* extra depth added after each underrun, decays while playback is smooth */
+  int64_t boost;
+
+  int64_t last_arrival;
+  int64_t last_media_time;
+
+  int64_t buffering_since;
+  int underruns;
+  int64_t underrun_time;
+} jitter_buffer_t;
+
+void jitter_buffer_init(jitter_buffer_t *jb, int min_ms, int max_ms);
+
+//call when a new source is prepared or after a seek
+void jitter_buffer_reset(jitter_buffer_t *jb, int clear_stats);
+
+//record the arrival of a packet with the given media time
+void jitter_buffer_arrival(jitter_buffer_t *jb, int64_t now, int64_t media_time);
+
+//the decoder found the buffer empty
+void jitter_buffer_underrun(jitter_buffer_t *jb, int64_t now);
+
+//buffering has finished, returns the time spent buffering
+int64_t jitter_buffer_end(jitter_buffer_t *jb, int64_t now);
+
+int64_t jitter_buffer_now();
+
+#endif //_JITTER_BUFFER_H_
@@ -0,0 +1,315 @@
+#include "audioplayer.h"
+#include <math.h>
+#include "logging.h"
+
+/*
+ * EBU R128 / ITU-R BS.1770 loudness scanner. Files are decoded to packed
+ * float by ap_decode_files(), the same stream_component_open() and
+ * audio_decode_frame() path as playback, on a pool of threads.
+ *
+ * Each channel goes through the two K-weighting biquads. The summed mean
+ * square of every 100 ms is kept, the integrated loudness is gated over 400 ms
+ * blocks overlapping by 75% and the loudness range over 3 s windows. The true
+ * peak is the largest sample of the signal oversampled 4x by a windowed sinc.
+ *
+ * ap_decode_files() downmixes to mono or stereo like playback does, so every
+ * channel weighs 1: multichannel files are measured as the downmix is heard,
+ * without the BS.1770 surround and LFE weights.
+ */
+
+#define LOUDNESS_MAX_CHANNELS 8
+#define LOUDNESS_ABSOLUTE_GATE -70.0
+//below the ungated loudness, integrated and range
+#define LOUDNESS_RELATIVE_GATE -10.0
+#define RANGE_RELATIVE_GATE -20.0
+//100 ms sub-blocks per gating block and per short-term window
+#define BLOCK_SUBBLOCKS 4
+#define SHORT_TERM_SUBBLOCKS 30
+
+#define TRUE_PEAK_FACTOR 4
+#define TRUE_PEAK_TAPS 12
+
+typedef struct biquad_t {
+  double b[3];
+  double a[3];
+} biquad_t;
+
+typedef struct loudness_state_t {
+  int sample_rate;
+  int channels;
+  biquad_t shelf;
+  biquad_t highpass;
+  //filter memory, direct form II, per channel
+  double shelf_z[LOUDNESS_MAX_CHANNELS][2];
+  double highpass_z[LOUDNESS_MAX_CHANNELS][2];
+
+  //the sub-block being filled
+  double sum[LOUDNESS_MAX_CHANNELS];
+  int fill;
+  int subblock_frames;
+  //summed mean square of each finished sub-block
+  double *energy;
+  int nb_energy;
+  int max_energy;
+
+  //true peak interpolation history, twice over so it reads contiguously
+  float history[LOUDNESS_MAX_CHANNELS][TRUE_PEAK_TAPS * 2];
+  int history_pos;
+  double peak;
+} loudness_state_t;
+
+//the polyphase interpolation filter, TRUE_PEAK_FACTOR phases
+static float true_peak_fir[TRUE_PEAK_FACTOR][TRUE_PEAK_TAPS];
+static pthread_once_t fir_once = PTHREAD_ONCE_INIT;
+
+static void init_true_peak_fir() {
+  const int length = TRUE_PEAK_FACTOR * TRUE_PEAK_TAPS;
+  double h[TRUE_PEAK_FACTOR * TRUE_PEAK_TAPS], sum, x;
+  int n, p, k;
+
+  //sinc at the original rate, Hann windowed
+  for (n = 0; n < length; n++) {
+    x = (n - (length - 1) / 2.0) / TRUE_PEAK_FACTOR;
+    h[n] = (x == 0 ? 1 : sin(M_PI * x) / (M_PI * x))
+           * (0.5 - 0.5 * cos(2 * M_PI * (n + 0.5) / length));
+  }
+  //each phase on its own passes DC unchanged
+  for (p = 0; p < TRUE_PEAK_FACTOR; p++) {
+    for (k = 0, sum = 0; k < TRUE_PEAK_TAPS; k++)
+      sum += h[p + k * TRUE_PEAK_FACTOR];
+    for (k = 0; k < TRUE_PEAK_TAPS; k++)
+      true_peak_fir[p][k] = (float) (h[p + k * TRUE_PEAK_FACTOR] / sum);
+  }
+}
+
+/* the K-weighting filters of BS.1770 for sample_rate, as libebur128 derives
+ * them from the 48 kHz reference */
+static void init_filters(loudness_state_t *s, int sample_rate, int channels) {
+  double f0, gain, q, k, vh, vb, a0;
+
+  f0 = 1681.974450955533;
+  gain = 3.999843853973347;
+  q = 0.7071752369554196;
+  k = tan(M_PI * f0 / sample_rate);
+  vh = pow(10.0, gain / 20.0);
+  vb = pow(vh, 0.4996667741545416);
+  a0 = 1.0 + k / q + k * k;
+  s->shelf.b[0] = (vh + vb * k / q + k * k) / a0;
+  s->shelf.b[1] = 2.0 * (k * k - vh) / a0;
+  s->shelf.b[2] = (vh - vb * k / q + k * k) / a0;
+  s->shelf.a[1] = 2.0 * (k * k - 1.0) / a0;
+  s->shelf.a[2] = (1.0 - k / q + k * k) / a0;
+
+  f0 = 38.13547087602444;
+  q = 0.5003270373238773;
+  k = tan(M_PI * f0 / sample_rate);
+  a0 = 1.0 + k / q + k * k;
+  s->highpass.b[0] = 1.0;
+  s->highpass.b[1] = -2.0;
+  s->highpass.b[2] = 1.0;
+  s->highpass.a[1] = 2.0 * (k * k - 1.0) / a0;
+  s->highpass.a[2] = (1.0 - k / q + k * k) / a0;
+
+  memset(s->shelf_z, 0, sizeof(s->shelf_z));
+  memset(s->highpass_z, 0, sizeof(s->highpass_z));
+  memset(s->sum, 0, sizeof(s->sum));
+  memset(s->history, 0, sizeof(s->history));
+  s->history_pos = 0;
+  s->fill = 0;
+  s->subblock_frames = sample_rate / 10;
+  s->sample_rate = sample_rate;
+  s->channels = channels;
+}
+
+static inline double biquad(const biquad_t *f, double z[2], double x) {
+  double w = x - f->a[1] * z[0] - f->a[2] * z[1];
+  double y = f->b[0] * w + f->b[1] * z[0] + f->b[2] * z[1];
+  z[1] = z[0];
+  z[0] = w;
+  return y;
+}
+
+static int end_subblock(loudness_state_t *s) {
+  double *energy, e = 0;
+  int c;
+
+  if (s->nb_energy == s->max_energy) {
+    s->max_energy = FFMAX(256, s->max_energy * 2);
+    if (!(energy = av_realloc_array(s->energy, s->max_energy, sizeof(double))))
+      return AVERROR(ENOMEM);
+    s->energy = energy;
+  }
+  for (c = 0; c < s->channels; c++) {
+    e += s->sum[c] / s->subblock_frames;
+    s->sum[c] = 0;
+  }
+  s->energy[s->nb_energy++] = e;
+  s->fill = 0;
+  return SUCCESS;
+}
+
+static void true_peak(loudness_state_t *s, const float *frame) {
+  const float *x;
+  float y;
+  int c, p, k, pos = s->history_pos;
+
+  for (c = 0; c < s->channels; c++) {
+    s->history[c][pos] = s->history[c][pos + TRUE_PEAK_TAPS] = frame[c];
+    //newest sample last
+    x = &s->history[c][pos + 1];
+    for (p = 0; p < TRUE_PEAK_FACTOR; p++) {
+      for (k = 0, y = 0; k < TRUE_PEAK_TAPS; k++)
+        y += true_peak_fir[p][k] * x[TRUE_PEAK_TAPS - 1 - k];
+      if (fabsf(y) > s->peak)
+        s->peak = fabsf(y);
+    }
+  }
+  s->history_pos = (pos + 1) % TRUE_PEAK_TAPS;
+}
+
+static int loudness_sink(void *opaque, int index, int sample_rate,
+                         int channels, const char *data, int len) {
+  loudness_state_t *s = (loudness_state_t *) opaque + index;
+  const float *frame = (const float *) data;
+  int frames = len / (channels * sizeof(float)), i, c, ret;
+  double y;
+
+  if (channels > LOUDNESS_MAX_CHANNELS) {
+    log_error("loudness::%d channels are not supported", channels);
+    return AVERROR(EINVAL);
+  }
+  if (sample_rate != s->sample_rate || channels != s->channels)
+    init_filters(s, sample_rate, channels);
+
+  for (i = 0; i < frames; i++, frame += channels) {
+    for (c = 0; c < channels; c++) {
+      y = biquad(&s->highpass, s->highpass_z[c],
+                 biquad(&s->shelf, s->shelf_z[c], frame[c]));
+      s->sum[c] += y * y;
+    }
+    true_peak(s, frame);
+    if (++s->fill == s->subblock_frames && (ret = end_subblock(s)) < 0)
+      return ret;
+  }
+  return SUCCESS;
+}
+
+static double to_lufs(double energy) {
+  return energy > 0 ? -0.691 + 10 * log10(energy) : -INFINITY;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+  double x = *(const double *) a, y = *(const double *) b;
+  return x < y ? -1 : x > y;
+}
+
+/* mean energy of the windows of length sub-blocks, one every sub-block, above
+ * the absolute gate and gate, the number of them in *count */
+static double gated_energy(loudness_state_t *s, int length, double gate,
+                           int *count) {
+  double window, sum = 0;
+  int i, j, n = 0;
+
+  for (i = length - 1; i < s->nb_energy; i++) {
+    for (j = i - length + 1, window = 0; j <= i; j++)
+      window += s->energy[j];
+    window /= length;
+    if (to_lufs(window) > LOUDNESS_ABSOLUTE_GATE && to_lufs(window) > gate) {
+      sum += window;
+      n++;
+    }
+  }
+  *count = n;
+  return n ? sum / n : 0;
+}
+
+static int loudness_range(loudness_state_t *s, double *range) {
+  double gate, window, *values;
+  int i, j, n, count;
+
+  *range = 0;
+  gate = to_lufs(gated_energy(s, SHORT_TERM_SUBBLOCKS, -INFINITY, &count))
+         + RANGE_RELATIVE_GATE;
+  if (!count)
+    return SUCCESS;
+  if (!(values = av_malloc_array(count, sizeof(double))))
+    return AVERROR(ENOMEM);
+
+  for (i = SHORT_TERM_SUBBLOCKS - 1, n = 0; i < s->nb_energy; i++) {
+    for (j = i - SHORT_TERM_SUBBLOCKS + 1, window = 0; j <= i; j++)
+      window += s->energy[j];
+    window = to_lufs(window / SHORT_TERM_SUBBLOCKS);
+    if (window > LOUDNESS_ABSOLUTE_GATE && window > gate && n < count)
+      values[n++] = window;
+  }
+  if (n) {
+    qsort(values, n, sizeof(double), compare_doubles);
+    *range = values[(int) lround((n - 1) * 0.95)]
+             - values[(int) lround((n - 1) * 0.10)];
+  }
+  av_free(values);
+  return SUCCESS;
+}
+
+static int finish(loudness_state_t *s, ap_loudness_t *loudness) {
+  double gate;
+  int count;
+
+  gate = to_lufs(gated_energy(s, BLOCK_SUBBLOCKS, -INFINITY, &count))
+         + LOUDNESS_RELATIVE_GATE;
+  loudness->integrated_lufs = count
+      ? to_lufs(gated_energy(s, BLOCK_SUBBLOCKS, gate, &count)) : -INFINITY;
+  loudness->true_peak_dbtp = s->peak > 0 ? 20 * log10(s->peak) : -INFINITY;
+  return loudness_range(s, &loudness->range_lu);
+}
+
+int ap_scan_loudness(const char **urls, int nb_urls, ap_loudness_t *loudness,
+                     int threads, int *results) {
+  loudness_state_t *states;
+  int *status;
+  int i, ret;
+
+  if (nb_urls <= 0)
+    return FAILURE;
+  log_info("ap_scan_loudness() files: %d", nb_urls);
+  pthread_once(&fir_once, init_true_peak_fir);
+
+  states = av_mallocz_array(nb_urls, sizeof(loudness_state_t));
+  status = av_malloc_array(nb_urls, sizeof(int));
+  if (!states || !status) {
+    av_free(states);
+    av_free(status);
+    return AVERROR(ENOMEM);
+  }
+
+  ret = ap_decode_files(urls, nb_urls, AV_SAMPLE_FMT_FLT, loudness_sink, states,
+                        threads, status);
+
+  for (i = 0; i < nb_urls; i++) {
+    if (status[i] >= 0 && (status[i] = finish(&states[i], &loudness[i])) < 0)
+      ret = FAILURE;
+    if (status[i] < 0) {
+      loudness[i].integrated_lufs = -INFINITY;
+      loudness[i].range_lu = 0;
+      loudness[i].true_peak_dbtp = -INFINITY;
+    }
+    if (results)
+      results[i] = status[i];
+    av_free(states[i].energy);
+  }
+  av_free(states);
+  av_free(status);
+  return ret;
+}
+
+double ap_normalization_gain(const ap_loudness_t *loudness, double target_lufs) {
+  double gain;
+
+  if (!isfinite(loudness->integrated_lufs))
+    return 0;
+  gain = target_lufs - loudness->integrated_lufs;
+  //never push the true peak over the ceiling
+  if (isfinite(loudness->true_peak_dbtp))
+    gain = FFMIN(gain, AP_TRUE_PEAK_CEILING_DB - loudness->true_peak_dbtp);
+  return gain;
+}
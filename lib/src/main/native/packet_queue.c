@@ -0,0 +1,129 @@
+#include "audioplayer.h"
+#include "packet_queue.h"
+#include "logging.h"
+
+void packet_queue_init(PacketQueue *q) {
+  memset(q, 0, sizeof(PacketQueue));
+  pthread_mutex_init(&q->mutex, NULL);
+  pthread_cond_init(&q->cond, NULL);
+  pthread_cond_init(&q->space, NULL);
+}
+
+void packet_queue_flush(PacketQueue *q) {
+  AVPacketList *pkt, *pkt1;
+
+  pthread_mutex_lock(&q->mutex);
+  for (pkt = q->first_pkt; pkt != NULL; pkt = pkt1) {
+    pkt1 = pkt->next;
+    av_packet_unref(&pkt->pkt);
+    pkt->next = q->free_pkts;
+    q->free_pkts = pkt;
+  }
+  q->last_pkt = NULL;
+  q->first_pkt = NULL;
+  q->nb_packets = 0;
+  q->size = 0;
+  q->duration = 0;
+  pthread_cond_broadcast(&q->space);
+  pthread_mutex_unlock(&q->mutex);
+}
+
+void packet_queue_set_time_base(PacketQueue *q, AVRational time_base) {
+  pthread_mutex_lock(&q->mutex);
+  q->time_base = time_base;
+  pthread_mutex_unlock(&q->mutex);
+}
+
+void packet_queue_end(PacketQueue *q) {
+  AVPacketList *pkt, *pkt1;
+
+  packet_queue_flush(q);
+  for (pkt = q->free_pkts; pkt != NULL; pkt = pkt1) {
+    pkt1 = pkt->next;
+    av_free(pkt);
+  }
+  q->free_pkts = NULL;
+  pthread_mutex_destroy(&q->mutex);
+  pthread_cond_destroy(&q->cond);
+  pthread_cond_destroy(&q->space);
+}
+
+int packet_queue_put(PacketQueue *q, AVPacket *pkt) {
+  AVPacketList *pkt1;
+
+  pthread_mutex_lock(&q->mutex);
+
+  if ((pkt1 = q->free_pkts)) {
+    q->free_pkts = pkt1->next;
+  } else {
+    AP_COUNT_OWN_ALLOC();
+    pkt1 = av_malloc(sizeof(AVPacketList));
+    if (!pkt1) {
+      pthread_mutex_unlock(&q->mutex);
+      return AVERROR(ENOMEM);
+    }
+  }
+
+  av_init_packet(&pkt1->pkt);
+  av_packet_move_ref(&pkt1->pkt, pkt);
+  pkt1->next = NULL;
+
+  if (!q->last_pkt)
+    q->first_pkt = pkt1;
+  else
+    q->last_pkt->next = pkt1;
+  q->last_pkt = pkt1;
+  q->nb_packets++;
+  q->size += pkt1->pkt.size + sizeof(*pkt1);
+  q->duration += pkt1->pkt.duration;
+
+  pthread_cond_signal(&q->cond);
+
+  pthread_mutex_unlock(&q->mutex);
+  return 0;
+}
+
+void packet_queue_abort(PacketQueue *q) {
+  pthread_mutex_lock(&q->mutex);
+  q->abort_request = 1;
+  pthread_cond_signal(&q->cond);
+  pthread_cond_broadcast(&q->space);
+  pthread_mutex_unlock(&q->mutex);
+}
+
+int packet_queue_get(PacketQueue *q, AVPacket *pkt, int block) {
+  AVPacketList *pkt1;
+  int ret;
+
+  pthread_mutex_lock(&q->mutex);
+
+  for (;;) {
+    if (q->abort_request) {
+      ret = -1;
+      break;
+    }
+
+    pkt1 = q->first_pkt;
+    if (pkt1) {
+      q->first_pkt = pkt1->next;
+      if (!q->first_pkt)
+        q->last_pkt = NULL;
+      q->nb_packets--;
+      q->size -= pkt1->pkt.size + sizeof(*pkt1);
+      q->duration -= pkt1->pkt.duration;
+      av_packet_move_ref(pkt, &pkt1->pkt);
+      pkt1->next = q->free_pkts;
+      q->free_pkts = pkt1;
+      pthread_cond_signal(&q->space);
+      ret = 1;
+      break;
+    } else if (!block) {
+      ret = 0;
+      break;
+    } else {
+      pthread_cond_wait(&q->cond, &q->mutex);
+    }
+  }
+  pthread_mutex_unlock(&q->mutex);
+  return ret;
+}
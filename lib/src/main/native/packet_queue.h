@@ -0,0 +1,42 @@
+#ifndef _PACKET_QUEUE_H_
+#define _PACKET_QUEUE_H_
+
+#include <pthread.h>
+#include <libavformat/avformat.h>
+
+//fifo of demuxed packets, see avplay.c
+typedef struct PacketQueue {
+  AVPacketList *first_pkt, *last_pkt;
+  /* nodes kept for reuse so a queue in steady state does not allocate */
+  AVPacketList *free_pkts;
+  int nb_packets;
+  int size; /* in bytes */
+  int64_t duration; /* sum of the packet durations, in stream time base */
+  /* of the stream queued, num 0 while there is none */
+  AVRational time_base;
+  int abort_request;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  /* signalled when packets are taken out, for a producer waiting for room */
+  pthread_cond_t space;
+} PacketQueue;
+
+void packet_queue_init(PacketQueue *q);
+
+void packet_queue_flush(PacketQueue *q);
+
+/* the stream the packets come from, so duration can be read without it */
+void packet_queue_set_time_base(PacketQueue *q, AVRational time_base);
+
+//also frees the nodes kept for reuse
+void packet_queue_end(PacketQueue *q);
+
+//takes ownership of the packet's data, pkt is reset on return
+int packet_queue_put(PacketQueue *q, AVPacket *pkt);
+
+/* return < 0 if aborted, 0 if no packet and > 0 if packet.  */
+int packet_queue_get(PacketQueue *q, AVPacket *pkt, int block);
+
+void packet_queue_abort(PacketQueue *q);
+
+#endif //_PACKET_QUEUE_H_
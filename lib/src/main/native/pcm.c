@@ -0,0 +1,73 @@
+#include "audioplayer.h"
+#include "pcm.h"
+
+void pcm_s16_to_float(float *out, const int16_t *in, int n) {
+  const float scale = 1.0f / 32768;
+  int i = 0;
+
+#if defined(AP_NEON)
+  int16x8_t v;
+  for (; i + 8 <= n; i += 8) {
+    v = vld1q_s16(in + i);
+    vst1q_f32(out + i, vmulq_n_f32(
+        vcvtq_f32_s32(vmovl_s16(vget_low_s16(v))), scale));
+    vst1q_f32(out + i + 4, vmulq_n_f32(
+        vcvtq_f32_s32(vmovl_s16(vget_high_s16(v))), scale));
+  }
+#elif defined(AP_SSE2)
+  __m128 vscale = _mm_set1_ps(scale);
+  __m128i v;
+  for (; i + 8 <= n; i += 8) {
+    v = _mm_loadu_si128((const __m128i *) (in + i));
+    //the samples to the high halves, shifted down with their sign
+    _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(
+        _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16)), vscale));
+    _mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(
+        _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16)), vscale));
+  }
+#endif
+  for (; i < n; i++)
+    out[i] = in[i] * scale;
+}
+
+#if defined(AP_NEON)
+/* 4 floats scaled to S16 and rounded to nearest like lrintf(). ARMv7 only
+ * converts toward zero: half a step with the sign of the sample is added
+ * first, which rounds halves away from zero instead of to even */
+static inline int16x4_t neon_float_to_s16(float32x4_t v) {
+  v = vmulq_n_f32(v, 32768);
+#if defined(__aarch64__)
+  return vqmovn_s32(vcvtnq_s32_f32(v));
+#else
+  uint32x4_t sign = vandq_u32(vreinterpretq_u32_f32(v), vdupq_n_u32(0x80000000));
+  float32x4_t half = vreinterpretq_f32_u32(
+      vorrq_u32(vreinterpretq_u32_f32(vdupq_n_f32(0.5f)), sign));
+  return vqmovn_s32(vcvtq_s32_f32(vaddq_f32(v, half)));
+#endif
+}
+#endif
+
+void pcm_float_to_s16(int16_t *out, const float *in, int n) {
+  int i = 0;
+
+#if defined(AP_NEON)
+  for (; i + 8 <= n; i += 8) {
+    vst1q_s16(out + i, vcombine_s16(neon_float_to_s16(vld1q_f32(in + i)),
+                                    neon_float_to_s16(vld1q_f32(in + i + 4))));
+  }
+#elif defined(AP_SSE2)
+  __m128 vscale = _mm_set1_ps(32768), vmin = _mm_set1_ps(-32768),
+      vmax = _mm_set1_ps(32767);
+  __m128 lo, hi;
+  for (; i + 8 <= n; i += 8) {
+    lo = _mm_max_ps(_mm_min_ps(_mm_mul_ps(_mm_loadu_ps(in + i), vscale), vmax),
+                    vmin);
+    hi = _mm_max_ps(_mm_min_ps(_mm_mul_ps(_mm_loadu_ps(in + i + 4), vscale),
+                               vmax), vmin);
+    _mm_storeu_si128((__m128i *) (out + i),
+                     _mm_packs_epi32(_mm_cvtps_epi32(lo), _mm_cvtps_epi32(hi)));
+  }
+#endif
+  for (; i < n; i++)
+    out[i] = av_clip_int16(lrintf(in[i] * 32768));
+}
@@ -0,0 +1,22 @@
+#ifndef _PCM_H_
+#define _PCM_H_
+
+#include <stdint.h>
+
+/* the SIMD extension of the per sample loops of the player. Targets with
+ * neither, armeabi-v7a built without NEON, use the scalar loops */
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define AP_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define AP_SSE2
+#endif
+
+//n samples of S16 to floats from -1 to 1
+void pcm_s16_to_float(float *out, const int16_t *in, int n);
+
+//n samples of float to S16, saturating
+void pcm_float_to_s16(int16_t *out, const float *in, int n);
+
+#endif //_PCM_H_
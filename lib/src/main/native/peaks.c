@@ -0,0 +1,262 @@
+#include "audioplayer.h"
+#include <math.h>
+#include "cache.h"
+#include "logging.h"
+
+/*
+ * Waveform overviews. Files are decoded at full speed by ap_decode_files()
+ * to packed float and summarized in blocks of PEAKS_BLOCK_FRAMES frames as
+ * they arrive, so the length does not need to be known up front. The blocks
+ * are folded into the buckets asked for at the end.
+ *
+ * The blocks of local files are cached, see cache.h, so any number of buckets
+ * can be served from the cache without decoding again.
+ */
+
+#define PEAKS_BLOCK_FRAMES 1024
+
+//the cache entry, followed by the blocks
+typedef struct peaks_entry_t {
+  int64_t frames;
+  int32_t block_frames;
+  int32_t nb_blocks;
+} peaks_entry_t;
+
+typedef struct peaks_file_t {
+  const char *url;
+  cache_key_t key;
+  int cacheable;
+
+  ap_peak_t *blocks;
+  int nb_blocks;
+  int max_blocks;
+  int64_t frames;
+
+  //the block being filled
+  float min;
+  float max;
+  double sum_sq;
+  int fill;
+  int channels;
+} peaks_file_t;
+
+static int peaks_cache_read(peaks_file_t *f) {
+  peaks_entry_t *entry;
+  int size;
+
+  if (!f->cacheable || !(entry = cache_read(&f->key, "peaks", &size)))
+    return FAILURE;
+
+  if (size < sizeof(*entry) || entry->block_frames != PEAKS_BLOCK_FRAMES
+      || entry->nb_blocks < 0
+      || size != sizeof(*entry) + entry->nb_blocks * sizeof(ap_peak_t)
+      || !(f->blocks = av_malloc_array(FFMAX(entry->nb_blocks, 1),
+                                       sizeof(ap_peak_t)))) {
+    av_free(entry);
+    return FAILURE;
+  }
+  memcpy(f->blocks, entry + 1, entry->nb_blocks * sizeof(ap_peak_t));
+  f->nb_blocks = f->max_blocks = entry->nb_blocks;
+  f->frames = entry->frames;
+  av_free(entry);
+  return SUCCESS;
+}
+
+static void peaks_cache_write(peaks_file_t *f) {
+  peaks_entry_t *entry;
+  int size = sizeof(*entry) + f->nb_blocks * sizeof(ap_peak_t);
+
+  if (!f->cacheable || !(entry = av_malloc(size)))
+    return;
+  entry->frames = f->frames;
+  entry->block_frames = PEAKS_BLOCK_FRAMES;
+  entry->nb_blocks = f->nb_blocks;
+  memcpy(entry + 1, f->blocks, f->nb_blocks * sizeof(ap_peak_t));
+  cache_write(&f->key, "peaks", entry, size);
+  av_free(entry);
+}
+
+/* min, max and sum of squares of n samples in one pass. Four independent
+ * accumulators so the compiler can keep them in vector lanes */
+static void summarize(const float *s, int n, float *min, float *max,
+                      double *sum_sq) {
+  float mn[4] = {*min, *min, *min, *min}, mx[4] = {*max, *max, *max, *max};
+  float sq[4] = {0, 0, 0, 0};
+  int i, j;
+
+  for (i = 0; i + 4 <= n; i += 4) {
+    for (j = 0; j < 4; j++) {
+      mn[j] = s[i + j] < mn[j] ? s[i + j] : mn[j];
+      mx[j] = s[i + j] > mx[j] ? s[i + j] : mx[j];
+      sq[j] += s[i + j] * s[i + j];
+    }
+  }
+  for (; i < n; i++) {
+    mn[0] = s[i] < mn[0] ? s[i] : mn[0];
+    mx[0] = s[i] > mx[0] ? s[i] : mx[0];
+    sq[0] += s[i] * s[i];
+  }
+  *min = FFMIN(FFMIN(mn[0], mn[1]), FFMIN(mn[2], mn[3]));
+  *max = FFMAX(FFMAX(mx[0], mx[1]), FFMAX(mx[2], mx[3]));
+  *sum_sq += (double) sq[0] + sq[1] + sq[2] + sq[3];
+}
+
+static void start_block(peaks_file_t *f) {
+  f->min = INFINITY;
+  f->max = -INFINITY;
+  f->sum_sq = 0;
+  f->fill = 0;
+}
+
+static int end_block(peaks_file_t *f, int channels) {
+  ap_peak_t *blocks;
+
+  if (f->nb_blocks == f->max_blocks) {
+    f->max_blocks = FFMAX(64, f->max_blocks * 2);
+    if (!(blocks = av_realloc_array(f->blocks, f->max_blocks, sizeof(ap_peak_t))))
+      return AVERROR(ENOMEM);
+    f->blocks = blocks;
+  }
+  f->blocks[f->nb_blocks].min = f->min;
+  f->blocks[f->nb_blocks].max = f->max;
+  f->blocks[f->nb_blocks].rms = (float) sqrt(f->sum_sq / ((double) f->fill * channels));
+  f->nb_blocks++;
+  start_block(f);
+  return SUCCESS;
+}
+
+static int peaks_sink(void *opaque, int index, int sample_rate, int channels,
+                      const char *data, int len) {
+  peaks_file_t *f = (peaks_file_t *) opaque + index;
+  const float *s = (const float *) data;
+  int frames = len / (channels * sizeof(float)), n, ret;
+
+  f->frames += frames;
+  while (frames > 0) {
+    n = FFMIN(frames, PEAKS_BLOCK_FRAMES - f->fill);
+    summarize(s, n * channels, &f->min, &f->max, &f->sum_sq);
+    f->fill += n;
+    s += n * channels;
+    frames -= n;
+    if (f->fill == PEAKS_BLOCK_FRAMES && (ret = end_block(f, channels)) < 0)
+      return ret;
+  }
+  f->channels = channels;
+  return SUCCESS;
+}
+
+/* fold the blocks of f into buckets equal parts. A bucket narrower than a
+ * block repeats it */
+static void fold(peaks_file_t *f, int buckets, ap_peak_t *peaks) {
+  int64_t frames, block_frames;
+  double sum_sq;
+  int b, i, start, end;
+
+  for (b = 0; b < buckets; b++) {
+    if (!f->nb_blocks) {
+      memset(&peaks[b], 0, sizeof(ap_peak_t));
+      continue;
+    }
+    start = (int) ((int64_t) b * f->nb_blocks / buckets);
+    end = FFMAX(start + 1, (int) ((int64_t) (b + 1) * f->nb_blocks / buckets));
+
+    peaks[b].min = f->blocks[start].min;
+    peaks[b].max = f->blocks[start].max;
+    sum_sq = 0;
+    frames = 0;
+    for (i = start; i < end; i++) {
+      //only the last block can be short
+      block_frames = i < f->nb_blocks - 1 ? PEAKS_BLOCK_FRAMES
+          : f->frames - (int64_t) (f->nb_blocks - 1) * PEAKS_BLOCK_FRAMES;
+      peaks[b].min = FFMIN(peaks[b].min, f->blocks[i].min);
+      peaks[b].max = FFMAX(peaks[b].max, f->blocks[i].max);
+      sum_sq += (double) f->blocks[i].rms * f->blocks[i].rms * block_frames;
+      frames += block_frames;
+    }
+    peaks[b].rms = frames > 0 ? (float) sqrt(sum_sq / frames) : 0;
+  }
+}
+
+int ap_compute_peaks_files(const char **urls, int nb_urls, int buckets,
+                           ap_peak_t **peaks, int threads, int *results) {
+  peaks_file_t *files;
+  const char **misses;
+  int *miss_index, *miss_results;
+  int i, nb_misses = 0, ret = SUCCESS;
+
+  if (nb_urls <= 0 || buckets <= 0)
+    return FAILURE;
+
+  files = av_mallocz_array(nb_urls, sizeof(peaks_file_t));
+  misses = av_malloc_array(nb_urls, sizeof(char *));
+  miss_index = av_malloc_array(nb_urls, sizeof(int));
+  miss_results = av_malloc_array(nb_urls, sizeof(int));
+  if (!files || !misses || !miss_index || !miss_results) {
+    ret = AVERROR(ENOMEM);
+    goto end;
+  }
+
+  for (i = 0; i < nb_urls; i++) {
+    files[i].url = urls[i];
+    files[i].cacheable = cache_key(urls[i], &files[i].key) == SUCCESS;
+    if (peaks_cache_read(&files[i]) == SUCCESS) {
+      log_debug("ap_compute_peaks::cached %s", urls[i]);
+      if (results)
+        results[i] = SUCCESS;
+      continue;
+    }
+    start_block(&files[i]);
+    misses[nb_misses] = urls[i];
+    miss_index[nb_misses++] = i;
+  }
+
+  if (nb_misses) {
+    //the sink is indexed by miss, files are reordered to match
+    peaks_file_t *decoded = av_mallocz_array(nb_misses, sizeof(peaks_file_t));
+    if (!decoded) {
+      ret = AVERROR(ENOMEM);
+      goto end;
+    }
+    for (i = 0; i < nb_misses; i++)
+      decoded[i] = files[miss_index[i]];
+
+    if (ap_decode_files(misses, nb_misses, AV_SAMPLE_FMT_FLT, peaks_sink,
+                        decoded, threads, miss_results) < 0)
+      ret = FAILURE;
+
+    for (i = 0; i < nb_misses; i++) {
+      peaks_file_t *f = &decoded[i];
+      //the rest of the file is a short last block
+      if (miss_results[i] >= 0 && f->fill && end_block(f, f->channels) < 0)
+        miss_results[i] = AVERROR(ENOMEM);
+      if (miss_results[i] >= 0)
+        peaks_cache_write(f);
+      files[miss_index[i]] = *f;
+      if (results)
+        results[miss_index[i]] = miss_results[i];
+    }
+    av_free(decoded);
+  }
+
+  for (i = 0; i < nb_urls; i++)
+    fold(&files[i], buckets, peaks[i]);
+
+  end:
+  if (files) {
+    for (i = 0; i < nb_urls; i++)
+      av_free(files[i].blocks);
+  }
+  av_free(files);
+  av_free(misses);
+  av_free(miss_index);
+  av_free(miss_results);
+  return ret;
+}
+
+int ap_compute_peaks(const char *url, int buckets, ap_peak_t *peaks) {
+  int result = FAILURE;
+  log_info("ap_compute_peaks() %s buckets: %d", url, buckets);
+  if (ap_compute_peaks_files(&url, 1, buckets, &peaks, 1, &result) < 0)
+    return result < 0 ? result : FAILURE;
+  return result;
+}
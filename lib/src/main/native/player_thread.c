@@ -2,12 +2,26 @@
 
 #include "audioplayer.h"
 #include <libavutil/opt.h>
+#include <libavutil/avstring.h>
 #include <sys/epoll.h>
 #include "logging.h"
-
+#include "preload.h"
+#include "player_thread.h"
+#include "dispatcher.h"
+#include "thread_config.h"
+#include "buffer_pool.h"
+#include "demux_thread.h"
+#include "source_open.h"
+#include "analyzer.h"
+#include "cover_art.h"
+#include <sys/eventfd.h>
+
+/* interrupts any blocking ffmpeg call made for the player once a later
+ * command has cancelled the current one, see ap_send_cmd() */
 static int decode_interrupt_cb(player_t *player) {
   //log_trace("decode_interrupt returning %d", player && player->abort_call);
-  return player && player->abort_call;
+  return player && (player->abort_call || player->demux_quit
+                    || atomic_load(&player->io_generation) != player->io_token);
 }
 
 //see audiostream.c
@@ -24,31 +38,24 @@ static enum AVDiscard skip_loop_filter = AVDISCARD_DEFAULT;
 static int error_concealment = 3;
 //  "don't limit the input buffer size (useful with realtime streams)"
 
-static int st_index[AVMEDIA_TYPE_NB] = {0};
-//wait indefinitely
-static int epoll_timeout = -1;
-
-static int eof = 0;
-static AVAudioResampleContext *avr = NULL;
-static AVFrame *frame = NULL;
-static AVPacket pkt;
-static uint8_t *audio_buf = NULL;
 
 static int wanted_stream[AVMEDIA_TYPE_NB] = {[AVMEDIA_TYPE_AUDIO] = -1,
     [AVMEDIA_TYPE_VIDEO] = -1, [AVMEDIA_TYPE_SUBTITLE] = -1,};
 
 extern const char *ap_get_cmd_name(audio_cmd_t cmd);
 
-static int change_state(player_t *player, audio_state_t state) {
-  int ret = -1;
-  log_trace("[%"
-                PRIXPTR
-                "] change_state() %s", (intptr_t) pthread_self(),
-            ap_get_state_name(state));
-  BEGIN_LOCK(player);
-  audio_state_t old_state = player->state;
+//steps of a rendering player between polls for commands
+#define RENDER_STEPS 32
+
+/* packets queued during prepare are returned before reading further */
+static int read_packet(player_t *player, AVPacket *packet) {
+  if (packet_queue_get(&player->audioq, packet, 0) > 0)
+    return 0;
+  return av_read_frame(player->ic, packet);
+}
 
-  if ((state == STATE_IDLE || state == STATE_ERROR || state == STATE_END)
+static int is_valid_transition(audio_state_t old_state, audio_state_t state) {
+  return (state == STATE_IDLE || state == STATE_ERROR || state == STATE_END)
       || (old_state == STATE_IDLE && state == STATE_INITIALIZED)
 
       || (old_state == STATE_INITIALIZED
@@ -70,37 +77,135 @@ static int change_state(player_t *player, audio_state_t state) {
           && (state == STATE_STOPPED || state == STATE_STARTED))
 
       || (old_state == STATE_STOPPED
-          && (state == STATE_PREPARING || state == STATE_PREPARED))
+          && (state == STATE_PREPARING || state == STATE_PREPARED));
+}
+
+/* the state is only written here, by the thread running the player, and is
+ * read without locking. The change is delivered later by
+ * player_dispatch_events() so no callback runs from inside a command */
+static int change_state(player_t *player, audio_state_t state) {
+  log_trace("[%"
+                PRIXPTR
+                "] change_state() %s", (intptr_t) pthread_self(),
+            ap_get_state_name(state));
+  audio_state_t old_state = atomic_load(&player->state);
 
-      ) {
-    ret = SUCCESS;
-  }
-
-  if (ret == SUCCESS) {
-    player->state = state;
-    log_trace("[%"
-                  PRIXPTR
-                  "] change_state::signaling state change to %s",
-              (intptr_t) pthread_self(), ap_get_state_name(state));
-
-    if (player->callbacks.on_event) {
-      log_trace(
-          "[%"
-          PRIXPTR
-          "] change_state::calling state change callback",
-          (intptr_t) pthread_self());
-      player->callbacks.on_event(player, EVENT_STATE_CHANGE, old_state,
-                                 state);
+  do {
+    if (!is_valid_transition(old_state, state)) {
+      log_error("invalid state change: %s -> %s",
+                ap_get_state_name(old_state), ap_get_state_name(state));
+      return FAILURE;
+    }
+  } while (!atomic_compare_exchange_weak(&player->state, &old_state, state));
+
+  if ((old_state == STATE_STARTED) != (state == STATE_STARTED)) {
+    //rendered audio runs ahead of the wall clock, never interpolate it
+    if (!player->render)
+      clock_snapshot_set_running(&player->clock, state == STATE_STARTED);
+    if (state == STATE_STARTED) {
+      atomic_store(&player->started_at, jitter_buffer_now());
+    } else {
+      atomic_fetch_add(&player->started_us,
+                       jitter_buffer_now() - atomic_load(&player->started_at));
+      atomic_store(&player->started_at, 0);
     }
-  } else {
-    log_error("invalid state change: %s -> %s",
-              ap_get_state_name(old_state), ap_get_state_name(state));
   }
 
-  END_LOCK(player);
-  log_trace("change_state::finished with state: %s",
-            ap_get_state_name(player->state));
-  return ret;
+  log_trace("[%"
+                PRIXPTR
+                "] change_state::queueing state change to %s",
+            (intptr_t) pthread_self(), ap_get_state_name(state));
+  AP_EVENT(player, EVENT_STATE_CHANGE, old_state, state);
+  return SUCCESS;
+}
+
+void player_dispatch_events(player_t *player) {
+  queued_event_t e;
+
+  if (player->callbacks.dispatcher) {
+    if (event_queue_depth(&player->events))
+      dispatcher_notify(player->callbacks.dispatcher, player);
+    return;
+  }
+
+  while (event_queue_get(&player->events, &e)) {
+    if (player->callbacks.on_event)
+      player->callbacks.on_event(player, e.event, e.arg1, e.arg2);
+  }
+}
+
+/* read ahead until the first packet of the audio stream is queued */
+static int read_probe_packets(player_t *player, int stream_index) {
+  AVPacket probe_pkt;
+  int ret, i;
+
+  for (i = 0; i < 64; i++) {
+    if (player->abort_call)
+      return FAILURE;
+    av_init_packet(&probe_pkt);
+    if ((ret = av_read_frame(player->ic, &probe_pkt)) < 0)
+      return ret;
+    if (probe_pkt.stream_index != stream_index) {
+      av_packet_unref(&probe_pkt);
+      continue;
+    }
+    return packet_queue_put(&player->audioq, &probe_pkt);
+  }
+  return AVERROR_STREAM_NOT_FOUND;
+}
+
+/* decode the first queued packet to find the output parameters. The decoder is
+ * flushed afterwards and the packet stays queued so it is played as well */
+static int probe_first_frame(player_t *player, AVCodecContext *avctx) {
+  AVPacket probe_pkt;
+  AVFrame *probe_frame;
+  int got_frame = 0, ret;
+
+  if (!player->audioq.first_pkt)
+    return AVERROR(EAGAIN);
+
+  if (!(probe_frame = buffer_pool_get_frame(&player->pool)))
+    return AVERROR(ENOMEM);
+
+  av_init_packet(&probe_pkt);
+  if ((ret = av_packet_ref(&probe_pkt, &player->audioq.first_pkt->pkt)) == 0) {
+    ret = avcodec_decode_audio4(avctx, probe_frame, &got_frame, &probe_pkt);
+    av_packet_unref(&probe_pkt);
+  }
+  buffer_pool_put_frame(&player->pool, &probe_frame);
+  avcodec_flush_buffers(avctx);
+
+  if (ret < 0)
+    return ret;
+  return got_frame ? SUCCESS : AVERROR_INVALIDDATA;
+}
+
+static int prepare_output(player_t *player, AVCodecContext *avctx) {
+  player->sdl_sample_rate = avctx->sample_rate;
+  atomic_store(&player->stats_sample_rate, avctx->sample_rate);
+
+  if (avctx->channels == 1)
+    player->sdl_channel_layout = AV_CH_LAYOUT_MONO;
+  else
+    player->sdl_channel_layout = AV_CH_LAYOUT_STEREO;
+
+  player->sdl_channels = av_get_channel_layout_nb_channels(
+      player->sdl_channel_layout);
+
+  log_info("prepare_output() rate:%d channels:%d", player->sdl_sample_rate,
+           player->sdl_channels);
+
+  if (player->callbacks.on_prepare(player, player->output_sample_fmt,
+                                   player->sdl_sample_rate,
+                                   player->sdl_channels) < 0) {
+    log_error("on_prepare() failed");
+    return AVERROR_UNKNOWN;
+  }
+  player->sdl_sample_fmt = player->output_sample_fmt;
+  stretch_configure(&player->stretch, player->sdl_sample_fmt,
+                    player->sdl_channels, player->sdl_sample_rate);
+  eq_configure(&player->eq, player->sdl_channels, player->sdl_sample_rate);
+  return SUCCESS;
 }
 
 /* open a given stream. Return 0 if OK */
@@ -109,6 +214,8 @@ static int stream_component_open(player_t *player, int stream_index) {
   AVCodecContext *avctx;
   AVCodec *codec;
   int ret = 0;
+  int old_sample_rate = player->sdl_sample_rate;
+  uint64_t old_channel_layout = player->sdl_channel_layout;
 
   log_error("stream_component_open()");
 
@@ -140,8 +247,14 @@ static int stream_component_open(player_t *player, int stream_index) {
     return FAILURE;
   /* prepare audio output */
   if (avctx->codec_type == AVMEDIA_TYPE_AUDIO) {
-    player->sdl_sample_rate = avctx->sample_rate;
-    log_info("avctx->sample_rate is %d",player->sdl_sample_rate);
+    if (player->provisional_params
+        && (!avctx->sample_rate || !avctx->channels)) {
+      log_debug("stream_component_open::decoding first packet for parameters");
+      if ((ret = probe_first_frame(player, avctx)) < 0) {
+        ap_print_error("probe_first_frame() failed", ret);
+        goto end;
+      }
+    }
 
     if (!avctx->channel_layout)
       avctx->channel_layout = av_get_default_channel_layout(
@@ -153,40 +266,37 @@ static int stream_component_open(player_t *player, int stream_index) {
       goto end;
     }
 
-    if (avctx->channels == 1)
-      player->sdl_channel_layout = AV_CH_LAYOUT_MONO;
-    else
-      player->sdl_channel_layout = AV_CH_LAYOUT_STEREO;
-
-    player->sdl_channels = av_get_channel_layout_nb_channels(
-        player->sdl_channel_layout);
-
-    int sampleRate = player->sdl_sample_rate;
-    int channelFormat = player->sdl_channels;
-
-    if (player->callbacks.on_prepare(player, AV_SAMPLE_FMT_S16, sampleRate,
-                                     channelFormat) < 0) {
-      log_error("on_prepare() failed");
-      ret = AVERROR_UNKNOWN;
+    if ((ret = prepare_output(player, avctx)) < 0)
       goto end;
-    }
 
-    player->sdl_sample_fmt = AV_SAMPLE_FMT_S16;
-    player->resample_sample_fmt = player->sdl_sample_fmt;
-    player->resample_channel_layout = avctx->channel_layout;
-    player->resample_sample_rate = player->sdl_sample_rate;
-    log_trace("stream_component_open::resample_sample_rate: %d",
-              player->sdl_sample_rate);
+    if (player->avr && player->sdl_sample_rate == old_sample_rate
+        && player->sdl_channel_layout == old_channel_layout) {
+      //same output as the last track, the resampler is reconfigured by
+      //audio_decode_frame() only if the input format differs as well
+      log_trace("stream_component_open::reusing the resampler");
+    } else {
+      player->resample_sample_fmt = player->sdl_sample_fmt;
+      player->resample_channel_layout = avctx->channel_layout;
+      player->resample_sample_rate = player->sdl_sample_rate;
+      log_trace("stream_component_open::resample_sample_rate: %d",
+                player->sdl_sample_rate);
+      if (player->avr) {
+        //reopened for the new output by the first frame
+        avresample_close(player->avr);
+        player->resample_sample_rate = 0;
+      }
+    }
   }
 
   ic->streams[stream_index]->discard = AVDISCARD_DEFAULT;
 
   player->audio_stream = stream_index;
   player->audio_st = ic->streams[stream_index];
+  packet_queue_set_time_base(&player->audioq, player->audio_st->time_base);
   player->audio_buf_size = 0;
   player->audio_buf_index = 0;
 
-  memset(&pkt, 0, sizeof(pkt));
+  memset(&player->pkt, 0, sizeof(player->pkt));
 
   end:
 
@@ -199,54 +309,235 @@ void stream_component_close(player_t *player, int stream_index) {
 
   BEGIN_LOCK(player);
 
-  av_packet_unref(&pkt);
+  av_packet_unref(&player->pkt);
 
-  if (avr) {
-    avresample_free(&avr);
+  if (player->avr) {
+    avresample_close(player->avr);
+    player->resample_sample_rate = 0;
   }
 
-  if (audio_buf) {
-    av_freep(&audio_buf);
-  }
-
-  av_frame_free(&frame);
+  buffer_pool_put_frame(&player->pool, &player->frame);
 
   player->audio_st->discard = AVDISCARD_ALL;
 
   avcodec_close(player->audio_st->codec);
-  avformat_close_input(&player->ic);
+  source_close(&player->ic);
 
   END_LOCK(player);
   log_trace("stream_component_close::done");
 }
 
-/* decode one audio frame and returns its uncompressed size */
+/* take the settings of the last ap_set_eq() and equalize the output in
+ * place, see eq.c */
+static void apply_eq(player_t *player, uint8_t *buf, int data_size) {
+  eq_settings_t *settings;
+  int frames = data_size / (player->sdl_channels
+                            * av_get_bytes_per_sample(player->sdl_sample_fmt));
+
+  if (atomic_load_explicit(&player->eq_next, memory_order_relaxed)
+      && (settings = atomic_exchange(&player->eq_next, NULL))) {
+    eq_update(&player->eq, settings);
+    av_free(settings);
+  }
+  if (eq_bypassed(&player->eq))
+    return;
+
+  if (player->sdl_sample_fmt == AV_SAMPLE_FMT_S16)
+    eq_process_s16(&player->eq, (int16_t *) buf, frames);
+  else if (player->sdl_sample_fmt == AV_SAMPLE_FMT_FLT)
+    eq_process_float(&player->eq, (float *) buf, frames);
+}
+
+/* scale the output in place by player->gain_q16, saturating */
+static void apply_gain(player_t *player, uint8_t *buf, int data_size) {
+  int gain = atomic_load_explicit(&player->gain_q16, memory_order_relaxed);
+  int i, n;
+
+  if (gain == AP_GAIN_UNITY)
+    return;
+
+  if (player->sdl_sample_fmt == AV_SAMPLE_FMT_S16) {
+    int16_t *s = (int16_t *) buf;
+    for (i = 0, n = data_size / 2; i < n; i++)
+      s[i] = av_clip_int16((int) (((int64_t) s[i] * gain) >> 16));
+  } else if (player->sdl_sample_fmt == AV_SAMPLE_FMT_FLT) {
+    float *s = (float *) buf, g = (float) gain / AP_GAIN_UNITY;
+    for (i = 0, n = data_size / 4; i < n; i++)
+      s[i] *= g;
+  }
+}
+
+/* hand pcm to on_play and advance the audio clock, pts is in the stream time
+ * base. tempo is the content played per frame of pcm, see stretch.c */
+static int output_chunk(player_t *player, uint8_t *buf, int data_size,
+                        int64_t pts, double tempo) {
+  /* if no pts, then compute it */
+  /*pts = player->audio_clock;
+   *pts_ptr = pts;*/
+  ap_analyzer_t *analyzer;
+  int n = player->sdl_channels
+          * av_get_bytes_per_sample(player->sdl_sample_fmt);
+  player->audio_clock += (double) data_size * tempo
+                         / (double) (n * player->sdl_sample_rate);
+
+  if (pts != AV_NOPTS_VALUE) {
+    player->audio_clock = av_q2d(player->audio_st->time_base) * pts;
+  }
+  if (player->abort_call)
+    return FAILURE;
+  apply_eq(player, buf, data_size);
+  apply_gain(player, buf, data_size);
+  player->callbacks.on_play(player, (char *) buf, data_size);
+  if ((analyzer = atomic_load_explicit(&player->analyzer, memory_order_acquire))
+      && player->sdl_sample_fmt == AV_SAMPLE_FMT_S16)
+    analyzer_write(analyzer, buf, data_size, player->sdl_channels,
+                   player->sdl_sample_rate);
+  clock_snapshot_update(&player->clock,
+                        (int64_t) (player->audio_clock * 1000000),
+                        data_size / n, player->sdl_sample_rate,
+                        (int) (tempo * AP_TEMPO_UNITY + 0.5));
+  atomic_fetch_add_explicit(&player->played_us,
+                            (int64_t) (data_size / n * tempo * 1000000
+                                       / player->sdl_sample_rate),
+                            memory_order_relaxed);
+  return SUCCESS;
+}
+
+static int output_stretched(player_t *player, uint8_t *buf, int frames,
+                            int64_t content_us, double tempo) {
+  player->audio_clock = (double) content_us / AV_TIME_BASE;
+  return output_chunk(player, buf, frames * player->sdl_channels
+                                   * av_get_bytes_per_sample(player->sdl_sample_fmt),
+                      AV_NOPTS_VALUE, tempo);
+}
+
+/* output_chunk() pcm at the tempo of ap_set_tempo(), see stretch.c. Going
+ * back to normal speed drains the stretch first and then bypasses it */
+static int play_stretched(player_t *player, uint8_t *buf, int data_size,
+                          int64_t pts) {
+  time_stretch_t *s = &player->stretch;
+  int tempo_q16 = atomic_load_explicit(&player->tempo_q16,
+                                       memory_order_relaxed);
+  int frame_size = player->sdl_channels
+                   * av_get_bytes_per_sample(player->sdl_sample_fmt);
+  int frames = data_size / frame_size, n;
+  int64_t pts_us, content_us;
+  uint8_t *out;
+
+  if (s->active && tempo_q16 == AP_TEMPO_UNITY
+      && (n = stretch_drain(s, &out, &content_us)) > 0
+      && output_stretched(player, out, n, content_us, 1.0) < 0)
+    return FAILURE;
+  if (!s->active && (tempo_q16 == AP_TEMPO_UNITY || !stretch_supported(s)))
+    return output_chunk(player, buf, data_size, pts, 1.0);
+
+  if (pts != AV_NOPTS_VALUE)
+    pts_us = av_rescale_q(pts, player->audio_st->time_base, AV_TIME_BASE_Q);
+  else
+    pts_us = s->active ? AV_NOPTS_VALUE
+                       : (int64_t) (player->audio_clock * 1000000);
+
+  while (frames > 0) {
+    if ((n = stretch_write(s, buf, frames, pts_us)) < 0)
+      return output_chunk(player, buf, frames * frame_size, pts, 1.0);
+    buf += n * frame_size;
+    frames -= n;
+    pts_us = AV_NOPTS_VALUE;
+    while ((n = stretch_read(s, (double) tempo_q16 / AP_TEMPO_UNITY, &out,
+                             &content_us)) > 0) {
+      if (output_stretched(player, out, n, content_us, s->tempo) < 0)
+        return FAILURE;
+    }
+  }
+  return SUCCESS;
+}
+
+/* what the stretch holds at the end of the track */
+static void drain_stretch(player_t *player) {
+  int64_t content_us;
+  uint8_t *out;
+  int n;
+
+  if ((n = stretch_drain(&player->stretch, &out, &content_us)) > 0)
+    output_stretched(player, out, n, content_us, 1.0);
+}
+
+/* frames of digital silence in place of silent frames that were held back */
+static int play_silence(player_t *player, int64_t frames) {
+  int frame_size = player->sdl_channels
+                   * av_get_bytes_per_sample(player->sdl_sample_fmt);
+  int n;
+
+  while (frames > 0) {
+    n = (int) FFMIN(frames, SDL_AUDIO_BUFFER_SIZE / frame_size);
+    //the equalizer rings into the buffer it is handed
+    memset(player->silence_buf, 0, n * frame_size);
+    if (play_stretched(player, player->silence_buf, n * frame_size,
+                       AV_NOPTS_VALUE) < 0)
+      return FAILURE;
+    frames -= n;
+  }
+  return SUCCESS;
+}
+
+/* play_stretched() what silence trimming leaves of the pcm, see silence.c.
+ * Trimmed frames advance the audio clock as if they had been played */
+static int play_output(player_t *player, uint8_t *buf, int data_size,
+                       int64_t pts) {
+  silence_chunk_t chunk;
+  int frame_size = player->sdl_channels * sizeof(int16_t);
+  int64_t pos_us;
+
+  if (!player->silence.settings.enabled
+      || player->sdl_sample_fmt != AV_SAMPLE_FMT_S16)
+    return play_stretched(player, buf, data_size, pts);
+
+  pos_us = pts != AV_NOPTS_VALUE
+           ? av_rescale_q(pts, player->audio_st->time_base, AV_TIME_BASE_Q)
+           : (int64_t) (player->audio_clock * 1000000);
+  silence_trim_chunk(&player->silence, (int16_t *) buf, data_size / frame_size,
+                     pos_us, &chunk);
+
+  if (play_silence(player, chunk.pad) < 0)
+    return FAILURE;
+  player->audio_clock += (double) chunk.skip / player->sdl_sample_rate;
+  if (chunk.play)
+    return play_stretched(player, buf + chunk.skip * frame_size,
+                          chunk.play * frame_size, pts);
+  if (chunk.skip && pts != AV_NOPTS_VALUE)
+    player->audio_clock = av_q2d(player->audio_st->time_base) * pts;
+  return SUCCESS;
+}
+
+/* decode the current packet, all of its frames, and return their
+ * uncompressed size. While draining only one frame is decoded per call */
 static int audio_decode_frame(player_t *player) {
   /*AVPacket *pkt_temp = &player->audio_pkt_temp;
    */
 
 //log_info("audio_decode_frame()");
   AVCodecContext *dec = player->audio_st->codec;
-  int n, len1, data_size, got_frame;
+  int len1, data_size, got_frame, total = 0;
 
   for (;;) {
     /* NOTE: the audio packet can contain several frames */
 
     //log_debug("top_loop");usleep(100000);
-    while (pkt.size > 0) {
+    while (player->pkt.size > 0 || player->draining) {
       int resample_changed, audio_resample;
 
-      if (!frame) {
-        if (!(frame = av_frame_alloc()))
+      if (!player->frame) {
+        if (!(player->frame = buffer_pool_get_frame(&player->pool)))
           return AVERROR(ENOMEM);
       }
       if (player->abort_call)
         return FAILURE;
-      len1 = avcodec_decode_audio4(dec, frame, &got_frame, &pkt);
+      len1 = avcodec_decode_audio4(dec, player->frame, &got_frame, &player->pkt);
       if (len1 < 0) {
         /* if error, we skip the frame */
         ap_print_error("avcodec_decode_audio4()", len1);
-        pkt.size = 0;
+        player->pkt.size = 0;
+        len1 = 0;
 
       } else {
         //log_trace("avcodec_decode_audio4 returned %d",len1);
@@ -255,8 +546,8 @@ static int audio_decode_frame(player_t *player) {
       if (player->audio_st->event_flags)
         log_trace("read something: %d", player->audio_st->event_flags);
 
-      pkt.data += len1;
-      pkt.size -= len1;
+      player->pkt.data += len1;
+      player->pkt.size -= len1;
 
       if (!got_frame) {
         /* stop sending empty packets if the decoder is finished */
@@ -265,53 +556,66 @@ static int audio_decode_frame(player_t *player) {
          return 0;
          }
          */
-        return 0;
+        if (len1 > 0 && player->pkt.size > 0)
+          continue;
+        return total;
 
       }
       data_size = av_samples_get_buffer_size(NULL, dec->channels,
-                                             frame->nb_samples, frame->format, 1);
+                                             player->frame->nb_samples, player->frame->format, 1);
+
+      if (player->provisional_params
+          && (player->frame->sample_rate != player->sdl_sample_rate
+              || (dec->channels == 1) != (player->sdl_channels == 1))) {
+        log_info("audio_decode_frame::output parameters changed");
+        if (prepare_output(player, dec) < 0)
+          return AVERROR_UNKNOWN;
+        //force the resampler to be reconfigured for the new output
+        player->resample_sample_rate = 0;
+      }
 
-      audio_resample = frame->format != player->sdl_sample_fmt
-                       || frame->channel_layout != player->sdl_channel_layout
-                       || frame->sample_rate != player->sdl_sample_rate;
+      audio_resample = player->frame->format != player->sdl_sample_fmt
+                       || player->frame->channel_layout != player->sdl_channel_layout
+                       || player->frame->sample_rate != player->sdl_sample_rate;
 
-      resample_changed = frame->format != player->resample_sample_fmt
-                         || frame->channel_layout != player->resample_channel_layout
-                         || frame->sample_rate != player->resample_sample_rate;
+      resample_changed = player->frame->format != player->resample_sample_fmt
+                         || player->frame->channel_layout != player->resample_channel_layout
+                         || player->frame->sample_rate != player->resample_sample_rate;
 
-      if ((!avr && audio_resample) || resample_changed) {
+      if ((!player->avr && audio_resample) || resample_changed) {
         int ret;
-        if (avr)
-          avresample_close(avr);
+        if (player->avr)
+          avresample_close(player->avr);
         else if (audio_resample) {
-          avr = avresample_alloc_context();
-          if (!avr) {
+          AP_COUNT_OWN_ALLOC();
+          player->avr = avresample_alloc_context();
+          if (!player->avr) {
             fprintf(stderr,
                     "error allocating AVAudioResampleContext\n");
             break;
           }
         }
         if (audio_resample) {
-          av_opt_set_int(avr, "in_channel_layout",
-                         frame->channel_layout, 0);
-          av_opt_set_int(avr, "in_sample_fmt", frame->format, 0);
-          av_opt_set_int(avr, "in_sample_rate", frame->sample_rate,
+          av_opt_set_int(player->avr, "in_channel_layout",
+                         player->frame->channel_layout, 0);
+          av_opt_set_int(player->avr, "in_sample_fmt", player->frame->format, 0);
+          av_opt_set_int(player->avr, "in_sample_rate", player->frame->sample_rate,
                          0);
-          av_opt_set_int(avr, "out_channel_layout",
+          av_opt_set_int(player->avr, "out_channel_layout",
                          player->sdl_channel_layout, 0);
-          av_opt_set_int(avr, "out_sample_fmt",
+          av_opt_set_int(player->avr, "out_sample_fmt",
                          player->sdl_sample_fmt, 0);
-          av_opt_set_int(avr, "out_sample_rate",
+          av_opt_set_int(player->avr, "out_sample_rate",
                          player->sdl_sample_rate, 0);
 
-          if ((ret = avresample_open(avr)) < 0) {
+          if ((ret = avresample_open(player->avr)) < 0) {
             fprintf(stderr, "error initializing libavresample\n");
             break;
           }
         }
-        player->resample_sample_fmt = frame->format;
-        player->resample_channel_layout = frame->channel_layout;
-        player->resample_sample_rate = frame->sample_rate;
+        player->resample_sample_fmt = player->frame->format;
+        player->resample_channel_layout = player->frame->channel_layout;
+        player->resample_sample_rate = player->frame->sample_rate;
       }
 
       uint8_t *play_buf = NULL;
@@ -320,19 +624,18 @@ static int audio_decode_frame(player_t *player) {
         void *tmp_out;
         int out_samples, out_size, out_linesize;
         int osize = av_get_bytes_per_sample(player->sdl_sample_fmt);
-        int nb_samples = frame->nb_samples;
+        int nb_samples = player->frame->nb_samples;
 
         out_size = av_samples_get_buffer_size(&out_linesize,
                                               player->sdl_channels, nb_samples,
                                               player->sdl_sample_fmt, 0);
-        tmp_out = av_realloc(audio_buf, out_size);
+        tmp_out = buffer_pool_get_output(&player->pool, out_size);
         if (!tmp_out)
           return AVERROR(ENOMEM);
-        audio_buf = tmp_out;
-        play_buf = audio_buf;
-        out_samples = avresample_convert(avr, &play_buf, out_linesize,
-                                         nb_samples, frame->data, frame->linesize[0],
-                                         frame->nb_samples);
+        play_buf = tmp_out;
+        out_samples = avresample_convert(player->avr, &play_buf, out_linesize,
+                                         nb_samples, player->frame->data, player->frame->linesize[0],
+                                         player->frame->nb_samples);
         if (out_samples < 0) {
           ap_print_error("avresample_convert() failed", out_samples);
           break;
@@ -340,24 +643,14 @@ static int audio_decode_frame(player_t *player) {
         data_size = out_samples * osize * player->sdl_channels;
 
       } else {
-        play_buf = frame->data[0];
+        play_buf = player->frame->data[0];
       }
 
-      /* if no pts, then compute it */
-      /*pts = player->audio_clock;
-       *pts_ptr = pts;*/
-      n = player->sdl_channels
-          * av_get_bytes_per_sample(player->sdl_sample_fmt);
-      player->audio_clock += (double) data_size
-                             / (double) (n * player->sdl_sample_rate);
-
-      if (pkt.pts != AV_NOPTS_VALUE) {
-        player->audio_clock = av_q2d(player->audio_st->time_base)
-                              * pkt.pts;
-      }
-      if (player->abort_call)
+      if (play_output(player, play_buf, data_size, player->pkt.pts) < 0)
         return FAILURE;
-      player->callbacks.on_play(player, (char *) play_buf, data_size);
+      //the following frames of the packet continue from this one
+      player->pkt.pts = AV_NOPTS_VALUE;
+      total += data_size;
 
 #ifdef DEBUG
       {
@@ -368,71 +661,374 @@ static int audio_decode_frame(player_t *player) {
         last_clock = player->audio_clock;
       }
 #endif
-      return data_size;
+      if (player->draining || player->pkt.size <= 0)
+        return total;
     }
 
     /* free the current packet */
-    if (pkt.data)
-      av_packet_unref(&pkt);
-    memset(&pkt, 0, sizeof(pkt));
+    if (player->pkt.data)
+      av_packet_unref(&player->pkt);
+    memset(&player->pkt, 0, sizeof(player->pkt));
 
     if (player->state == STATE_PAUSED) {
       log_trace("audio_decode_frame::exiting");
       return -1;
     }
 
-    /* if update the audio clock with the pts */
-    if (pkt.pts != AV_NOPTS_VALUE) {
-      player->audio_clock = av_q2d(player->audio_st->time_base) * pkt.pts;
-    }
+    //the packet was dropped after an error, nothing is left to decode
+    return total;
   }
 
   return 0;
 }
 
-static int cmd_prepare(player_t *player) {
-  log_info("cmd_prepare(): %s in state: %s", player->url, ap_get_state_name(player->state));
+static int is_eof(player_t *player, int read_ret) {
+  return read_ret == AVERROR_EOF
+         || (player->ic->pb && player->ic->pb->eof_reached);
+}
+
+/* play what the resampler still holds: samples that did not fit the output
+ * buffer and those delayed by rate conversion */
+static void drain_resampler(player_t *player) {
+  int nb_samples, out_samples, out_size, out_linesize;
+  uint8_t *out;
+
+  if (!player->avr || !avresample_is_open(player->avr))
+    return;
+
+  nb_samples = avresample_available(player->avr)
+               + avresample_get_delay(player->avr);
+  if (nb_samples <= 0)
+    return;
+
+  out_size = av_samples_get_buffer_size(&out_linesize, player->sdl_channels,
+                                        nb_samples, player->sdl_sample_fmt, 0);
+  if (!(out = buffer_pool_get_output(&player->pool, out_size)))
+    return;
+
+  out_samples = avresample_convert(player->avr, &out, out_linesize, nb_samples,
+                                   NULL, 0, 0);
+  if (out_samples < 0) {
+    ap_print_error("drain_resampler::avresample_convert() failed", out_samples);
+    return;
+  }
+  log_trace("drain_resampler::%d samples", out_samples);
+  if (out_samples > 0)
+    play_output(player, out, out_samples * player->sdl_channels
+                             * av_get_bytes_per_sample(player->sdl_sample_fmt),
+                AV_NOPTS_VALUE);
+}
+
+/* decode one of the frames the decoder holds back, returns > 0 while there
+ * may be more. Once the decoder is exhausted the resampler is flushed */
+static int drain_decoder(player_t *player) {
+  int ret;
+
+  if (player->audio_stream < 0)
+    return 0;
+
+  if (player->audio_st->codec->codec->capabilities & CODEC_CAP_DELAY) {
+    av_init_packet(&player->pkt);
+    player->pkt.data = NULL;
+    player->pkt.size = 0;
+    player->pkt.stream_index = player->audio_stream;
+
+    player->draining = 1;
+    ret = audio_decode_frame(player);
+    if (ret > 0 && !player->abort_call)
+      return 1;
+  }
+
+  player->draining = 0;
+  drain_resampler(player);
+  return 0;
+}
+
+static void finish_stream(player_t *player) {
+  if (player->eof)
+    seek_index_finish(&player->seek_index, player->url);
+
+  //a pause at the very end that was too short to trim
+  if (player->silence.settings.enabled)
+    play_silence(player, silence_trim_finish(&player->silence, player->url));
+  drain_stretch(player);
+
+  if (player->looping) {
+    player->eof = 0;
+    ap_seek(player, 0, 0);
+    return;
+  }
+
+  change_state(player, STATE_COMPLETED);
+  player->epoll_timeout = -1;
+}
+
+/* every packet has been decoded: drain the decoder, one frame per step so
+ * commands are still handled, and the resampler, then loop or complete */
+static void end_of_stream(player_t *player) {
+  log_trace("player_thread::eof");
+
+  if (drain_decoder(player))
+    return;
+
+  finish_stream(player);
+}
+
+/* the demux thread gave up on a read error: what was queued has been played,
+ * the stream cannot go on */
+static void demux_failed(player_t *player) {
+  ap_print_error("player_thread::stream failed", player->demux_error);
+  change_state(player, STATE_ERROR);
+  player->epoll_timeout = -1;
+}
+
+/* duration of the packets waiting in the jitter buffer in microseconds */
+static int64_t buffered_time(player_t *player) {
+  return av_rescale_q(player->audioq.duration, player->audio_st->time_base,
+                      AV_TIME_BASE_Q);
+}
+
+static void notify_buffering(player_t *player) {
+  if (player->jitter.enabled && player->jitter.buffering)
+    AP_EVENT(player, EVENT_BUFFERING_START, player->jitter.started, 0);
+}
+
+/* read ahead until the jitter buffer reaches its target depth. While buffering
+ * only one packet is read per loop so commands are still handled promptly */
+static void fill_jitter_buffer(player_t *player) {
+  jitter_buffer_t *jb = &player->jitter;
+  AVPacket packet;
   int i, ret;
-  if (change_state(player, STATE_PREPARING) != SUCCESS) {
-    log_error("cmd_prepare::failed to change to preparing");
-    return FAILURE;
+
+  for (i = 0; i < 2 && !player->eof && !player->abort_call; i++) {
+    if (!jb->buffering && buffered_time(player) >= jb->target)
+      break;
+
+    av_init_packet(&packet);
+    ret = av_read_frame(player->ic, &packet);
+    if (ret < 0) {
+      if (is_eof(player, ret)) {
+        log_trace("fill_jitter_buffer::eof == 1");
+        player->eof = 1;
+      } else {
+        ap_print_error("fill_jitter_buffer::av_read_frame failed", ret);
+      }
+      break;
+    }
+
+    if (packet.stream_index != player->audio_stream) {
+      av_packet_unref(&packet);
+      continue;
+    }
+
+    demux_queue_packet(player, &packet);
+
+    if (jb->buffering)
+      break;
   }
+}
 
-  log_debug("cmd_prepare::1");
+/* the demux thread has nothing for us yet, block until it signals demux_fd */
+static void wait_for_demux(player_t *player) {
+  if (player->demux_running && demux_wait(player))
+    player->epoll_timeout = -1;
+}
 
-  if (player->ic) {
-    log_trace("cmd_prepare::avformat_close_input(&player->ic);");
-    avformat_close_input(&player->ic);
+/* decode from the jitter buffer, switching to buffering when it runs dry.
+ * The jitter buffer is shared with the demux thread under audioq.mutex */
+static void play_buffered(player_t *player) {
+  jitter_buffer_t *jb = &player->jitter;
+  PacketQueue *q = &player->audioq;
+  int64_t elapsed, buffered;
+  int eof;
+
+  if (!player->demux_running)
+    fill_jitter_buffer(player);
+
+  //read before the queue so a final packet is never missed
+  eof = player->eof;
+
+  pthread_mutex_lock(&q->mutex);
+  if (jb->buffering) {
+    buffered = buffered_time(player);
+    if (!eof && buffered < jb->target
+        && !(player->demux_running && demux_queue_full(player))) {
+      pthread_mutex_unlock(&q->mutex);
+      wait_for_demux(player);
+      return;
+    }
+    elapsed = jitter_buffer_end(jb, jitter_buffer_now());
+    pthread_mutex_unlock(&q->mutex);
+    log_debug("play_buffered::buffered %"PRId64"ms in %"PRId64"ms",
+              buffered / 1000, elapsed / 1000);
+    AP_EVENT(player, EVENT_BUFFERING_END, (int) (elapsed / 1000), 0);
+  } else {
+    pthread_mutex_unlock(&q->mutex);
   }
 
-  //AVDictionary *options = NULL;
-  //av_dict_set(&options, "user-agent", "This is my user-agent!", 0);
+  if (packet_queue_get(q, &player->pkt, 0) <= 0) {
+    if (eof && player->demux_error) {
+      demux_failed(player);
+    } else if (eof) {
+      end_of_stream(player);
+    } else {
+      pthread_mutex_lock(&q->mutex);
+      jitter_buffer_underrun(jb, jitter_buffer_now());
+      pthread_mutex_unlock(&q->mutex);
+      notify_buffering(player);
+      wait_for_demux(player);
+    }
+    return;
+  }
+  demux_room(player);
+
+  audio_decode_frame(player);
+  av_packet_unref(&player->pkt);
+}
+
+/* decode packets queued by the demux thread */
+static void play_demuxed(player_t *player) {
+  int eof = player->eof;
+
+  if (packet_queue_get(&player->audioq, &player->pkt, 0) <= 0) {
+    if (eof && player->demux_error)
+      demux_failed(player);
+    else if (eof)
+      end_of_stream(player);
+    else
+      wait_for_demux(player);
+    return;
+  }
+  demux_room(player);
+
+  audio_decode_frame(player);
+  av_packet_unref(&player->pkt);
+}
+
+static void update_duration(player_t *player, int64_t duration) {
+  log_debug("update_duration::%"PRId64"ms", duration / 1000);
+  atomic_store(&player->duration_us, duration);
+  AP_EVENT(player, EVENT_DURATION_UPDATED, (int) (duration / 1000), 0);
+}
 
+//called on the scan thread
+static void scan_done(player_t *player) {
+  ap_send_cmd(player, CMD_SCAN_DONE);
+}
 
-  log_debug("cmd_prepare::avformat_open_input() %s", player->url);
-  //ret = avformat_open_input(&player->ic, player->url, NULL, &options);
-  ret = avformat_open_input(&player->ic, player->url, NULL, NULL);
-  log_debug("cmd_prepare:avformat_open_input returned");
+/* scan the track in the background if the seek index or the exact duration
+ * needs it and the cache does not have it. Only a seekable source of known
+ * size is scanned: a second download of a stream costs as much as the first,
+ * and a live one would be read for as long as it plays */
+static void start_scan(player_t *player, int mode) {
+  AVIOContext *pb = player->ic->pb;
+  int index = (mode & AP_SEEK_INDEX_SCAN) && !player->seek_index.complete;
+  int exact = player->exact_duration;
+  int64_t duration;
+
+  if (exact && scan_cached_duration(player->url, &duration) == SUCCESS) {
+    update_duration(player, duration);
+    exact = FALSE;
+  }
+  if ((index || exact)
+      && !(pb && (pb->seekable & AVIO_SEEKABLE_NORMAL) && avio_size(pb) > 0)) {
+    log_debug("start_scan::%s is not a seekable file, not scanned",
+              player->url);
+    return;
+  }
+  if (index || exact)
+    scan_start(&player->scan, player->url, player->audio_st,
+               index ? player->seek_index.spacing : 0,
+               (void *) scan_done, player);
+}
 
-  //av_dict_free(&options);
+/* start trimming the silence of the track, if enabled, and seek past its
+ * leading silence if a previous play has cached where it ends */
+static void start_silence_trim(player_t *player) {
+  silence_trim_t *s = &player->silence;
+  silence_settings_t settings;
+  int64_t lead_us;
+  int ret;
 
+  BEGIN_LOCK(player);
+  settings = player->silence_next;
+  END_LOCK(player);
+  silence_trim_start(s, &settings, player->sdl_sample_rate,
+                     player->sdl_channels);
+
+  if (!settings.enabled
+      || silence_trim_cached(s, player->url, &lead_us) < 0 || lead_us <= 0)
+    return;
+
+  ret = avformat_seek_file(player->ic, -1, INT64_MIN, lead_us, lead_us, 0);
   if (ret < 0) {
-    ap_print_error("cmd_prepare::avformat_open_input failed: ", ret);
-    return FAILURE;
+    ap_print_error("start_silence_trim::avformat_seek_file() failed", ret);
+    return;
   }
+  log_debug("start_silence_trim::cached, starting at %"PRId64"ms",
+            lead_us / 1000);
+  //what was read and decoded while opening is from before the seek
+  packet_queue_flush(&player->audioq);
+  if (player->audio_st && avcodec_is_open(player->audio_st->codec))
+    avcodec_flush_buffers(player->audio_st->codec);
+  player->audio_clock = (double) lead_us / AV_TIME_BASE;
+  seek_index_seeked(&player->seek_index);
+  //the silence left before the keyframe is trimmed whatever its length
+  s->lead_frames = s->min_frames;
+}
 
+/* start opening player->url, or racing its mirrors, on other threads so a
+ * reset does not wait for the network. NULL if no thread could be started */
+static source_open_t *start_open(player_t *player) {
+  const char *url = player->url;
+  source_open_t *job;
 
-  player->ic->interrupt_callback.opaque = player;
-  player->ic->interrupt_callback.callback = (void *) decode_interrupt_cb;
+  log_debug("cmd_prepare::opening %s", player->url);
+  if (player->ic)
+    source_close(&player->ic);
+  //players without sources, see decode_file(), open url alone
+  BEGIN_LOCK(player);
+  job = player->nb_sources
+      ? source_open_start((const char **) player->sources, player->nb_sources,
+                          player->early_start)
+      : source_open_start(&url, 1, player->early_start);
+  END_LOCK(player);
+  return job;
+}
+
+/* take the source opened by job, or the preloaded one if job is NULL, and
+ * open the decoder of its audio stream */
+static int open_source(player_t *player, source_open_t *job) {
+  AVIOInterruptCB interrupt = {(void *) decode_interrupt_cb, player};
+  int preloaded = !job;
+  int i, ret, index = 0;
+
+  player->provisional_params = FALSE;
+
+  if (!preloaded) {
+    ret = source_open_wait(job, &interrupt, &player->ic, &index,
+                           &player->provisional_params);
+    if (ret < 0) {
+      ap_print_error("cmd_prepare::open failed", ret);
+      return FAILURE;
+    }
+    BEGIN_LOCK(player);
+    if (index < player->nb_sources)
+      av_strlcpy(player->url, player->sources[index], sizeof(player->url));
+    END_LOCK(player);
+    if (player->nb_sources > 1)
+      log_info("cmd_prepare::mirror %d won: %s", index, player->url);
+  }
+
+  source_take_over(player->ic, &interrupt);
 
   if (genpts)
     player->ic->flags |= AVFMT_FLAG_GENPTS;
-  log_debug("cmd_prepare::avformat_find_stream_info()");
-  ret = avformat_find_stream_info(player->ic, NULL);
 
-  if (ret < 0) {
-    ap_print_error("cmd_prepare::avformat_find_stream_info failed", ret);
-    return FAILURE;
+  if (preloaded) {
+    log_debug("cmd_prepare::preloaded, stream info already found");
+  } else if (player->provisional_params) {
+    log_debug("cmd_prepare::early start, skipped avformat_find_stream_info()");
   }
 
   if (player->ic->pb)
@@ -443,15 +1039,24 @@ static int cmd_prepare(player_t *player) {
   for (i = 0; i < player->ic->nb_streams; i++)
     player->ic->streams[i]->discard = AVDISCARD_ALL;
 
-  st_index[AVMEDIA_TYPE_AUDIO] = av_find_best_stream(player->ic,
+  player->st_index[AVMEDIA_TYPE_AUDIO] = av_find_best_stream(player->ic,
                                                      AVMEDIA_TYPE_AUDIO,
                                                      wanted_stream[AVMEDIA_TYPE_AUDIO],
-                                                     st_index[AVMEDIA_TYPE_VIDEO],
+                                                     player->st_index[AVMEDIA_TYPE_VIDEO],
                                                      NULL, 0);
 
+  if (player->provisional_params && player->st_index[AVMEDIA_TYPE_AUDIO] >= 0) {
+    player->ic->streams[player->st_index[AVMEDIA_TYPE_AUDIO]]->discard =
+        AVDISCARD_DEFAULT;
+    if ((ret = read_probe_packets(player, player->st_index[AVMEDIA_TYPE_AUDIO])) < 0) {
+      ap_print_error("cmd_prepare::read_probe_packets failed", ret);
+      return FAILURE;
+    }
+  }
+
   /* open the streams */
-  if (st_index[AVMEDIA_TYPE_AUDIO] >= 0) {
-    stream_component_open(player, st_index[AVMEDIA_TYPE_AUDIO]);
+  if (player->st_index[AVMEDIA_TYPE_AUDIO] >= 0) {
+    stream_component_open(player, player->st_index[AVMEDIA_TYPE_AUDIO]);
   }
 
   if (player->audio_stream < 0) {
@@ -460,7 +1065,102 @@ static int cmd_prepare(player_t *player) {
   }
 
   log_debug("cmd_prepare:: stream opened .. reading metadata..");
+  return SUCCESS;
+}
+
+//replace the cover art of the track, NULL ic to drop it
+static void set_cover_art(player_t *player, AVFormatContext *ic) {
+  ap_cover_art_t art;
+
+  if (!ic || cover_art_find(ic, &art) < 0)
+    memset(&art, 0, sizeof(art));
+  BEGIN_LOCK(player);
+  FFSWAP(ap_cover_art_t, player->cover_art, art);
+  END_LOCK(player);
+  ap_cover_art_free(&art);
+}
+
+static int abandon_interrupt_cb(void *opaque) {
+  return TRUE;
+}
 
+//drop the open a prepare is waiting for, closing the source if it is open
+static void abandon_open(player_t *player) {
+  AVIOInterruptCB interrupt = {(void *) abandon_interrupt_cb, NULL};
+  AVFormatContext *ic = NULL;
+  int index, provisional;
+
+  if (!player->opening)
+    return;
+  source_open_wait(player->opening, &interrupt, &ic, &index, &provisional);
+  player->opening = NULL;
+  if (ic)
+    source_close(&ic);
+}
+
+static int prepare_source(player_t *player, source_open_t *job);
+
+static int cmd_prepare(player_t *player) {
+  log_info("cmd_prepare(): %s in state: %s", player->url, ap_get_state_name(player->state));
+  source_open_t *job = NULL;
+  int preloaded = FALSE;
+
+  abandon_open(player);
+  demux_stop(player);
+  scan_stop(&player->scan);
+  atomic_store(&player->duration_us, 0);
+  set_cover_art(player, NULL);
+
+  if (player->ic) {
+    log_trace("cmd_prepare::source_close(&player->ic);");
+    source_close(&player->ic);
+  }
+
+  //a finished preload goes straight to STATE_PREPARED
+  if (player->preload
+      && (player->state == STATE_INITIALIZED || player->state == STATE_STOPPED)) {
+    log_debug("cmd_prepare::claiming preloaded source");
+    AVIOInterruptCB interrupt = {(void *) decode_interrupt_cb, player};
+    preloaded = preload_claim(player->preload, &player->ic, &player->audioq,
+                              &interrupt) == SUCCESS;
+    ap_preload_release(player->preload);
+    player->preload = NULL;
+  }
+
+  if (!preloaded && change_state(player, STATE_PREPARING) != SUCCESS) {
+    log_error("cmd_prepare::failed to change to preparing");
+    return FAILURE;
+  }
+
+  log_debug("cmd_prepare::1");
+
+  BEGIN_LOCK(player);
+  player->render = player->render_next;
+  END_LOCK(player);
+  atomic_store(&player->played_us, 0);
+  atomic_store(&player->started_us, 0);
+  eq_reset_costs(&player->eq);
+
+  if (!preloaded) {
+    if (!(job = start_open(player)))
+      return FAILURE;
+    //an engine worker moves on and finishes when the open is done
+    if (player->engine && source_open_fd(job) >= 0) {
+      player->opening = job;
+      return SUCCESS;
+    }
+  }
+  return prepare_source(player, job);
+}
+
+/* the rest of cmd_prepare() once the source is open, or preloaded if job is
+ * NULL */
+static int prepare_source(player_t *player, source_open_t *job) {
+  int ret, mode;
+
+  if ((ret = open_source(player, job)) < 0)
+    return FAILURE;
+  set_cover_art(player, player->ic);
 
 /*  av_dump_format(player->ic, 0, player->url, 0);
   AVDictionaryEntry *entry = NULL;
@@ -468,8 +1168,44 @@ static int cmd_prepare(player_t *player) {
                               AV_DICT_IGNORE_SUFFIX))) {
     log_debug("metadata:\t%s:%s", entry->key, entry->value);
   }*/
+  BEGIN_LOCK(player);
+  mode = player->seek_index_next;
+  player->exact_duration = player->exact_duration_next;
+  END_LOCK(player);
+  seek_index_open(&player->seek_index, player->url, player->ic,
+                  player->audio_st, mode);
+  seek_index_install(&player->seek_index, player->audio_st);
+  start_scan(player, mode);
+
+  start_silence_trim(player);
+
+  //nothing to smooth out when rendering
+  jitter_buffer_init(&player->jitter, player->render ? 0 : player->jitter_min_ms,
+                     player->jitter_max_ms);
+
   log_debug("changing to STATE_PREPARED...");
-  return change_state(player, STATE_PREPARED);
+  if ((ret = change_state(player, STATE_PREPARED)) != SUCCESS)
+    return ret;
+
+  //engine players read in the engine's demux pool, so a slow network never
+  //blocks a worker
+  player->demux_paused = FALSE;
+  demux_start(player);
+  return SUCCESS;
+}
+
+int player_opening_fd(player_t *player) {
+  return player->opening ? source_open_fd(player->opening) : -1;
+}
+
+void player_open_done(player_t *player) {
+  source_open_t *job = player->opening;
+
+  if (!job)
+    return;
+  player->opening = NULL;
+  //fails at once with AVERROR_EXIT if a reset has been sent since
+  prepare_source(player, job);
 }
 
 static int cmd_reset(player_t *player) {
@@ -482,31 +1218,44 @@ static int cmd_reset(player_t *player) {
   if (player->state != STATE_END)
     change_state(player, STATE_IDLE);
 
+  abandon_open(player);
+  demux_stop(player);
+  scan_stop(&player->scan);
+  seek_index_close(&player->seek_index);
+  set_cover_art(player, NULL);
+
+  player->audio_clock = 0;
+  clock_snapshot_update(&player->clock, 0, 0, 0, AP_TEMPO_UNITY);
+  stretch_reset(&player->stretch);
+
   if (player->audio_st && player->audio_st->codec) {
     log_trace("avcodec_close(player->audio_st->codec)");
     avcodec_close(player->audio_st->codec);
   }
 
-  if (avr) {
-    log_trace("cmd_reset::avresample_free()");
-    avresample_free(&avr);
-    avr = NULL;
-  }
+  //the resampler and the buffers are kept for the next track
+  buffer_pool_put_frame(&player->pool, &player->frame);
+  if (player->avr && avresample_is_open(player->avr))
+    avresample_read(player->avr, NULL, avresample_available(player->avr));
 
-  if (frame) {
-    log_trace("cmd_reset::av_frame_free()");
-    av_frame_free(&frame);
-    frame = NULL;
+  packet_queue_flush(&player->audioq);
+  jitter_buffer_init(&player->jitter, 0, 0);
+
+  if (player->preload) {
+    ap_preload_release(player->preload);
+    player->preload = NULL;
   }
 
+  packet_queue_set_time_base(&player->audioq, (AVRational) {0, 1});
   if (player->ic) {
-    log_trace("cmd_reset::avformat_close_input(&player->ic)");
-    avformat_close_input(&player->ic);
+    log_trace("cmd_reset::source_close(&player->ic)");
+    source_close(&player->ic);
   }
 
   player->audio_stream = -1;
   player->audio_st = NULL;
-  epoll_timeout = -1;
+  player->epoll_timeout = -1;
+  player->draining = 0;
 
   player->abort_call = 0;
 
@@ -518,9 +1267,12 @@ static int cmd_pause(player_t *player) {
   log_info("cmd_pause(): %s", player->url);
   int ret = FAILURE;
   if (player->state == STATE_STARTED) {
-    log_trace("ret = av_read_pause(player->ic)");
-    ret = av_read_pause(player->ic);
-    epoll_timeout = -1; //block when waiting for next event
+    //the demux thread pauses the stream itself
+    if (!player->demux_running) {
+      log_trace("ret = av_read_pause(player->ic)");
+      ret = av_read_pause(player->ic);
+    }
+    player->epoll_timeout = -1; //block when waiting for next event
     ret = change_state(player, STATE_PAUSED);
   }
   return ret;
@@ -538,26 +1290,27 @@ static int cmd_start(player_t *player) {
     return cmd_prepare(player);
   }
 
-  if (player->state == STATE_PAUSED) {
+  if (player->state == STATE_PAUSED && !player->demux_running) {
     log_trace("av_read_play(player->ic)");
     ret = av_read_play(player->ic);
   }
 
   if ((ret = change_state(player, STATE_STARTED)) == SUCCESS) {
-    epoll_timeout = 0; //dont block when waiting for events
+    player->epoll_timeout = 0; //dont block when waiting for events
+    notify_buffering(player);
   }
   return ret;
 }
 
 static int cmd_stop(player_t *player) {
   log_info("cmd_stop()");
-  epoll_timeout = -1; //block when waiting for events
+  player->epoll_timeout = -1; //block when waiting for events
   return change_state(player, STATE_STOPPED);
 }
 
 static int cmd_seek(player_t *player) {
   log_trace("cmd_seek()");
-  int ret = FAILURE;
+  int ret = FAILURE, demux_running;
   int64_t seek_target = player->seek_pos;
   int64_t seek_min =
       player->seek_rel > 0 ? seek_target - player->seek_rel + 2 :
@@ -568,31 +1321,85 @@ static int cmd_seek(player_t *player) {
 // FIXME the +-2 is due to rounding being not done in the correct direction in generation
 //      of the seek_pos/seek_rel variables
 
+  //restarted below, nothing may read from player->ic during the seek
+  demux_running = player->demux_running;
+  demux_stop(player);
+
+  //points indexed since the last seek
+  seek_index_install(&player->seek_index, player->audio_st);
+
   log_trace("cmd_seek::avformat_seek_file()");
   ret = avformat_seek_file(player->ic, -1, seek_min, seek_target, seek_max,
                            player->seek_flags);
   player->seek_req = 0;
 
+  if (ret >= 0) {
+    player->eof = 0;
+    player->draining = 0;
+    packet_queue_flush(&player->audioq);
+    jitter_buffer_reset(&player->jitter, FALSE);
+    //drop what the decoder and the resampler hold from before the seek
+    if (player->audio_st && avcodec_is_open(player->audio_st->codec))
+      avcodec_flush_buffers(player->audio_st->codec);
+    if (player->avr && avresample_is_open(player->avr))
+      avresample_read(player->avr, NULL, avresample_available(player->avr));
+    player->audio_clock = (double) seek_target / AV_TIME_BASE;
+    clock_snapshot_update(&player->clock, seek_target, 0,
+                          player->sdl_sample_rate, AP_TEMPO_UNITY);
+    stretch_reset(&player->stretch);
+    silence_trim_seeked(&player->silence, seek_target);
+    seek_index_seeked(&player->seek_index);
+  }
+
   if (player->abort_call)
     return -1;
 
+  if (demux_running)
+    demux_start(player);
+
   if (ret < 0) {
     ap_print_error("cmd_seek::error in seek", ret);
-  } else if (player->callbacks.on_event) {
-    player->callbacks.on_event(player, EVENT_SEEK_COMPLETE, 0, 0);
+  } else {
+    AP_EVENT(player, EVENT_SEEK_COMPLETE, 0, 0);
+    if (player->state == STATE_STARTED)
+      notify_buffering(player);
   }
 
   return ret;
 }
 
+/* the background scan has finished, unless it was stopped since it sent
+ * this */
+static void cmd_scan_done(player_t *player) {
+  track_scan_t *scan = &player->scan;
+
+  if (!scan->running || !scan->done)
+    return;
+  if (scan->spacing > 0)
+    seek_index_complete(&player->seek_index, &scan->points);
+  if (player->exact_duration)
+    update_duration(player, scan->duration);
+  scan_stop(scan);
+}
+
 static int cmd_set_datasource(player_t *player) {
 
   log_info("cmd_set_datasource(): %s", player->url);
   if (player->state != STATE_IDLE) {
     log_error("cmd_set_datasource::invalid state: %s",
               ap_get_state_name(player->state));
+    BEGIN_LOCK(player);
+    ap_preload_release(player->next_preload);
+    player->next_preload = NULL;
+    END_LOCK(player);
     return FAILURE;
   }
+
+  BEGIN_LOCK(player);
+  player->preload = player->next_preload;
+  player->next_preload = NULL;
+  END_LOCK(player);
+
   return change_state(player, STATE_INITIALIZED);
 }
 
@@ -601,190 +1408,295 @@ static int cmd_test(player_t *player) {
   return SUCCESS;
 }
 
-/* this thread gets the stream from the disk or the network */
-int player_thread(player_t *player) {
-
-  log_debug("[%"
-                PRIXPTR
-                "] player_thread()", (intptr_t) pthread_self());
-
-  int ret, i;
-
-  const int MAX_EVENTS = 8;
-  struct epoll_event event;
-  struct epoll_event events[MAX_EVENTS];
-  int efd = 0;
-
-  memset(st_index, -1, sizeof(st_index));
-  memset(&events, 0, sizeof(events));
+int player_loop_init(player_t *player) {
+  memset(player->st_index, -1, sizeof(player->st_index));
   player->audio_stream = -1;
-  av_init_packet(&pkt);
+  player->epoll_timeout = -1; //wait indefinitely
+  av_init_packet(&player->pkt);
 
-  pkt.data = NULL;
-  pkt.size = 0;
+  player->pkt.data = NULL;
+  player->pkt.size = 0;
 
   AP_EVENT(player, EVENT_THREAD_START, 0, 0);
 
-  log_trace("player_thread::avformat_alloc_context()");
+  log_trace("player_loop_init::avformat_alloc_context()");
   player->ic = avformat_alloc_context();
   if (!player->ic) {
     av_log(NULL, AV_LOG_FATAL, "Could not allocate context.\n");
-    ret = AVERROR(ENOMEM);
-    return -1;
+    return AVERROR(ENOMEM);
   }
 
   player->ic->interrupt_callback.opaque = player;
   player->ic->interrupt_callback.callback = (void *) decode_interrupt_cb;
+  return SUCCESS;
+}
 
-  efd = epoll_create(MAX_EVENTS);
-  log_trace("efd: %d", efd);
+int player_handle_cmd(player_t *player, player_cmd_t msg) {
+  audio_cmd_t cmd = msg.cmd;
+  log_trace("player_thread::received cmd: %s in state: %s",
+            ap_get_cmd_name(cmd), ap_get_state_name(player->state));
+  //blocking calls made for this command are interrupted by a later reset
+  player->io_token = msg.generation;
+  switch (cmd) {
+    case CMD_PREPARE:
+      player->eof = 0;
+      player->draining = 0;
+      cmd_prepare(player);
+      break;
+    case CMD_START:
+      cmd_start(player);
+      break;
+    case CMD_PAUSE:
+      cmd_pause(player);
+      break;
+    case CMD_STOP:
+      cmd_stop(player);
+      break;
+    case CMD_SEEK:
+      cmd_seek(player);
+      break;
+    case CMD_RESET:
+      cmd_reset(player);
+      break;
+    case CMD_SET_DATASOURCE:
+      cmd_set_datasource(player);
+      break;
+    case CMD_SCAN_DONE:
+      cmd_scan_done(player);
+      break;
+    case CMD_EXIT:
+      return TRUE;
+    default:
+      log_error("player_thread::invalid command: %d", cmd);
+      break;
+  }
+  return FALSE;
+}
 
-  memset(&event, 0, sizeof(struct epoll_event));
-  event.events = EPOLLIN;
-  int pipe_fd = player->pipe[0];
-  event.data.fd = pipe_fd;
+void player_step(player_t *player) {
+  int ret;
 
-  if ((ret = epoll_ctl(efd, EPOLL_CTL_ADD, pipe_fd, &event)) < 0) {
-    log_error("epoll set insertion error: fd=%d0: %s", pipe_fd,
-              strerror(errno));
-    goto end;
+  if (player->state != STATE_STARTED)
+    return;
+
+  //the rest of the track is trailing silence
+  if (player->silence.ended && !player->silence.finished) {
+    finish_stream(player);
+    return;
   }
 
-  log_trace("player_thread::starting loop");
-  int quit = 0;
+  if (player->draining) {
+    if (!drain_decoder(player))
+      finish_stream(player);
+    return;
+  }
 
-  while (!quit) {
-    int nfds = epoll_wait(efd, events, MAX_EVENTS, epoll_timeout);
+  if (player->jitter.enabled) {
+    play_buffered(player);
+    return;
+  }
 
-    if (nfds < 0) {
-      log_error("nfds < 0");
-      break;
-    }
+  if (player->demux_running) {
+    play_demuxed(player);
+    return;
+  }
 
-    for (i = 0; i < nfds; i++) {
-      if (events[i].data.fd == pipe_fd) {
-        int cmd = 0;
-        ret = read(pipe_fd, &cmd, sizeof(cmd));
-        log_trace("player_thread::received cmd: %s in state: %s",
-                  ap_get_cmd_name(cmd), ap_get_state_name(player->state));
-        switch (cmd) {
-          case CMD_PREPARE:
-            eof = 0;
-            cmd_prepare(player);
-            break;
-          case CMD_START:
-            cmd_start(player);
-            break;
-          case CMD_PAUSE:
-            cmd_pause(player);
-            break;
-          case CMD_STOP:
-            cmd_stop(player);
-            break;
-          case CMD_SEEK:
-            cmd_seek(player);
-            break;
-          case CMD_RESET:
-            cmd_reset(player);
-            break;
-          case CMD_SET_DATASOURCE:
-            cmd_set_datasource(player);
-            break;
-          case CMD_EXIT:
-            quit = 1;
-            continue;
-          default:
-            log_error("player_thread::invalid command: %d", cmd);
-            break;
-        }
-      }
+  //log_trace("player_thread::av_read_frame()");
+  ret = read_packet(player, &player->pkt);
+
+  if (ret < 0) {
+    ap_print_error("player_thread::av_read_frame failed", ret);
+    if (is_eof(player, ret)) {
+      log_trace("player_thread::eof == 1");
+      player->eof = 1;
+      end_of_stream(player);
     }
+    return;
+  }
 
-    if (player->state != STATE_STARTED)
-      continue;
+  if (player->pkt.stream_index == player->audio_stream) {
+    seek_index_add(&player->seek_index, &player->pkt);
+    audio_decode_frame(player);
+  }
+
+  av_packet_unref(&player->pkt);
+}
 
-    //log_trace("player_thread::av_read_frame()");
-    ret = av_read_frame(player->ic, &pkt);
+int player_decode(player_t *player) {
+  int ret;
 
+  source_open_t *job;
+
+  if ((ret = player_loop_init(player)) < 0)
+    return ret;
+  if (!(job = start_open(player)))
+    return FAILURE;
+  if ((ret = open_source(player, job)) < 0)
+    return ret;
+
+  while (!player->abort_call) {
+    ret = read_packet(player, &player->pkt);
     if (ret < 0) {
-      ap_print_error("player_thread::av_read_frame failed", ret);
-      if (ret == AVERROR_EOF
-          || (player->ic->pb && player->ic->pb->eof_reached)) {
-        log_trace("player_thread::eof == 1");
-        eof = 1;
-
-        if (player->looping) {
-          eof = 0;
-          ap_seek(player, 0, 0);
-          continue;
-        }
-      } else {
+      if (ret == AVERROR(EAGAIN))
         continue;
+      if (is_eof(player, ret)) {
+        player->eof = 1;
+        ret = SUCCESS;
+      } else {
+        ap_print_error("player_decode::av_read_frame failed", ret);
       }
+      break;
     }
 
-    if (eof) {
-      log_trace("player_thread::eof");
-      if (player->audio_stream >= 0
-          && (player->audio_st->codec->codec->capabilities
-              & CODEC_CAP_DELAY)) {
-        av_init_packet(&pkt);
-        pkt.data = NULL;
-        pkt.size = 0;
-        pkt.stream_index = player->audio_stream;
-      }
-      change_state(player, STATE_COMPLETED);
-      epoll_timeout = -1;
-      continue;
-    }
-
-    if (pkt.stream_index == player->audio_stream) {
+    if (player->pkt.stream_index == player->audio_stream)
       audio_decode_frame(player);
-    }
-
-    av_packet_unref(&pkt);
 
+    av_packet_unref(&player->pkt);
   }
-  ret = SUCCESS;
-  end:
-  log_info("read_loop::finished  state: %s eof: %d  ret: %d looping: %d",
-           ap_get_state_name(player->state), eof, ret, player->looping);
+
+  if (player->eof)
+    while (drain_decoder(player));
+
+  return player->abort_call ? AVERROR_EXIT : ret;
+}
+
+void player_loop_cleanup(player_t *player) {
+  log_info("read_loop::finished  state: %s eof: %d looping: %d",
+           ap_get_state_name(player->state), player->eof, player->looping);
 
   change_state(player, STATE_END);
 
+  abandon_open(player);
+  demux_stop(player);
+  scan_stop(&player->scan);
+
   if (player->audio_st && player->audio_st->codec) {
     avcodec_close(player->audio_st->codec);
   }
 
-  if (audio_buf) {
-    log_warn("read_loop::av_freep(&audio_buf);");
-    av_freep(&audio_buf);
-  }
-
-  if (avr) {
+  if (player->avr) {
     log_warn("read_loop::avresample_free()");
-    avresample_free(&avr);
+    avresample_free(&player->avr);
   }
 
-  av_packet_unref(&pkt);
+  av_packet_unref(&player->pkt);
 
-  if (frame) {
+  if (player->frame) {
     log_warn("read_loop::av_frame_free()");
-    av_frame_free(&frame);
+    av_frame_free(&player->frame);
   }
+  buffer_pool_free(&player->pool);
 
   if (player->ic) {
-    log_warn("avformat_close_input(&player->ic)");
-    avformat_close_input(&player->ic);
+    log_warn("source_close(&player->ic)");
+    source_close(&player->ic);
   }
 
+  if (player->preload)
+    ap_preload_release(player->preload);
+  if (player->next_preload)
+    ap_preload_release(player->next_preload);
+
+  packet_queue_end(&player->audioq);
+  seek_index_free(&player->seek_index);
+  ap_cover_art_free(&player->cover_art);
+  stretch_free(&player->stretch);
+
   pthread_mutex_destroy(&player->mutex);
 
   close(player->pipe[0]);
   close(player->pipe[1]);
 
   log_warn("read_loop::done");
+}
+
+/* this thread gets the stream from the disk or the network */
+int player_thread(player_t *player) {
+
+  log_debug("[%"
+                PRIXPTR
+                "] player_thread()", (intptr_t) pthread_self());
+
+  thread_config_apply(&player->thread_config);
+
+  int ret, i, steps;
+
+  const int MAX_EVENTS = 8;
+  struct epoll_event event;
+  struct epoll_event events[MAX_EVENTS];
+  int efd = 0;
+
+  memset(&events, 0, sizeof(events));
+
+  if ((ret = player_loop_init(player)) < 0)
+    goto end;
+
+  efd = epoll_create(MAX_EVENTS);
+  log_trace("efd: %d", efd);
+
+  memset(&event, 0, sizeof(struct epoll_event));
+  event.events = EPOLLIN;
+  int pipe_fd = player->pipe[0];
+  event.data.fd = pipe_fd;
+
+  if ((ret = epoll_ctl(efd, EPOLL_CTL_ADD, pipe_fd, &event)) < 0) {
+    log_error("epoll set insertion error: fd=%d0: %s", pipe_fd,
+              strerror(errno));
+    goto end;
+  }
+
+  //signalled by the demux thread when it has queued packets
+  player->demux_fd = eventfd(0, EFD_NONBLOCK);
+  event.data.fd = player->demux_fd;
+  if (player->demux_fd < 0
+      || (ret = epoll_ctl(efd, EPOLL_CTL_ADD, player->demux_fd, &event)) < 0) {
+    log_error("player_thread::demux eventfd failed: %s", strerror(errno));
+    goto end;
+  }
+
+  log_trace("player_thread::starting loop");
+  int quit = 0;
+
+  while (!quit) {
+    //the mutex is never held here
+    player_dispatch_events(player);
+
+    int nfds = epoll_wait(efd, events, MAX_EVENTS, player->epoll_timeout);
+
+    if (nfds < 0) {
+      log_error("nfds < 0");
+      break;
+    }
+
+    for (i = 0; i < nfds && !quit; i++) {
+      if (events[i].data.fd == pipe_fd) {
+        player_cmd_t msg;
+        if (read(pipe_fd, &msg, sizeof(msg)) == sizeof(msg))
+          quit = player_handle_cmd(player, msg);
+      } else if (events[i].data.fd == player->demux_fd) {
+        demux_woken(player);
+        if (player->state == STATE_STARTED)
+          player->epoll_timeout = 0;
+      }
+    }
+
+    //rendering decodes a batch between polls for commands
+    steps = player->render ? RENDER_STEPS : 1;
+    for (i = 0; i < steps && !quit; i++) {
+      player_step(player);
+      if (player->epoll_timeout != 0)
+        break;
+    }
+  }
+  ret = SUCCESS;
+  end:
+  if (efd > 0)
+    close(efd);
+
+  player_loop_cleanup(player);
+  if (player->demux_fd >= 0)
+    close(player->demux_fd);
+  player_dispatch_events(player);
   pthread_exit(0);
   return ret;
 }
-
@@ -0,0 +1,43 @@
+#ifndef _PLAYER_THREAD_H_
+#define _PLAYER_THREAD_H_
+
+#include "audioplayer.h"
+
+/* the player loop split up so it can be run by a dedicated thread
+ * (player_thread) or by the workers of an engine */
+
+int player_loop_init(player_t *player);
+
+//returns TRUE when the player should exit
+int player_handle_cmd(player_t *player, player_cmd_t msg);
+
+//read and decode the next packet if the player is started
+void player_step(player_t *player);
+
+/* engine players only: an eventfd readable once the source a prepare is
+ * waiting for is open, -1 if no prepare is waiting */
+int player_opening_fd(player_t *player);
+
+//finish the prepare waiting for player_opening_fd()
+void player_open_done(player_t *player);
+
+void player_loop_cleanup(player_t *player);
+
+//allocate a player without anything to run it
+player_t *alloc_player(player_callbacks_t callbacks);
+
+//write cmd to the command pipe of the player, from any thread
+int ap_send_cmd(player_t *player, audio_cmd_t cmd);
+
+//decode player->url to the end on the calling thread, calling on_play as fast
+//as frames are decoded. No commands, state changes or pacing. Stops with
+//AVERROR_EXIT once abort_call is set. Call player_loop_cleanup() afterwards
+int player_decode(player_t *player);
+
+//deliver the queued events to on_event, or hand them to the player's
+//dispatcher. Call without holding player->mutex
+void player_dispatch_events(player_t *player);
+
+int player_thread(player_t *player);
+
+#endif //_PLAYER_THREAD_H_
@@ -0,0 +1,303 @@
+#include <time.h>
+#include "libavutil/avstring.h"
+#include "preload.h"
+#include "source_open.h"
+#include "logging.h"
+
+typedef enum {
+  PRELOAD_OPENING,
+  PRELOAD_READY,
+  PRELOAD_FAILED,
+  PRELOAD_CLAIMED,
+  PRELOAD_EVICTED
+} preload_state_t;
+
+struct ap_preload_t {
+  char url[1024];
+  preload_state_t state;
+  //handles held by callers, the pool itself holds none
+  int refs;
+  int abort;
+  //interrupts the open and the reads of ic, NULL once it is claimed
+  source_interrupt_t *si;
+  int thread_running;
+  int64_t last_requested;
+
+  AVFormatContext *ic;
+  PacketQueue packets;
+
+  struct ap_preload_t *next;
+};
+
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_cond = PTHREAD_COND_INITIALIZER;
+static ap_preload_t *pool = NULL;
+
+static int max_sources = 4;
+static int max_buffer_ms = 5000;
+
+static int64_t now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* holds an open context or is about to, counts against max_sources */
+static int is_live(ap_preload_t *e) {
+  return (e->state == PRELOAD_OPENING && !e->abort) || e->state == PRELOAD_READY;
+}
+
+//call with pool_mutex held
+static void release_resources(ap_preload_t *e) {
+  source_close(&e->ic);
+  packet_queue_flush(&e->packets);
+}
+
+//call with pool_mutex held
+static void maybe_free(ap_preload_t *e) {
+  ap_preload_t **p;
+
+  if (e->refs > 0 || e->thread_running)
+    return;
+
+  for (p = &pool; *p; p = &(*p)->next) {
+    if (*p == e) {
+      *p = e->next;
+      break;
+    }
+  }
+  release_resources(e);
+  packet_queue_end(&e->packets);
+  if (e->si)
+    source_interrupt_unref(e->si);
+  av_free(e);
+}
+
+//call with pool_mutex held
+static void evict(ap_preload_t *e) {
+  log_debug("preload::evicting %s", e->url);
+  e->abort = 1;
+  //a claimed context is the player's, only an open or a buffering is stopped
+  if (e->si)
+    source_interrupt_cancel(e->si);
+  if (e->state == PRELOAD_READY) {
+    release_resources(e);
+    e->state = PRELOAD_EVICTED;
+  }
+}
+
+//call with pool_mutex held
+static void evict_least_recently_requested() {
+  ap_preload_t *e, *oldest;
+  int live;
+
+  for (;;) {
+    live = 0;
+    oldest = NULL;
+    for (e = pool; e; e = e->next) {
+      if (!is_live(e))
+        continue;
+      live++;
+      if (!oldest || e->last_requested < oldest->last_requested)
+        oldest = e;
+    }
+    if (live < max_sources || !oldest)
+      return;
+    evict(oldest);
+  }
+}
+
+static int buffer_packets(ap_preload_t *e, AVFormatContext *ic, int stream_index) {
+  AVStream *st = ic->streams[stream_index];
+  int64_t limit = av_rescale_q(max_buffer_ms, (AVRational) {1, 1000},
+                               st->time_base);
+  AVPacket pkt;
+  int ret = 0;
+
+  while (!e->abort && e->packets.duration < limit
+         && e->packets.size < PRELOAD_MAX_BYTES) {
+    av_init_packet(&pkt);
+    if ((ret = av_read_frame(ic, &pkt)) < 0)
+      break;
+    if (pkt.stream_index != stream_index) {
+      av_packet_unref(&pkt);
+      continue;
+    }
+    packet_queue_put(&e->packets, &pkt);
+  }
+
+  if (ic->pb)
+    ic->pb->eof_reached = 0;
+  return ret == AVERROR_EOF ? 0 : ret;
+}
+
+static void *preload_thread(void *arg) {
+  ap_preload_t *e = arg;
+  AVFormatContext *ic = NULL;
+  int i, ret, stream_index = -1;
+
+  log_debug("preload_thread() %s", e->url);
+
+  if ((ret = source_open_input(&ic, e->url, e->si)) < 0)
+    goto end;
+
+  if ((ret = avformat_find_stream_info(ic, NULL)) < 0)
+    goto end;
+
+  stream_index = av_find_best_stream(ic, AVMEDIA_TYPE_AUDIO, -1, -1, NULL, 0);
+  if (stream_index < 0) {
+    ret = stream_index;
+    goto end;
+  }
+
+  for (i = 0; i < ic->nb_streams; i++)
+    ic->streams[i]->discard = i == stream_index ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+
+  ret = buffer_packets(e, ic, stream_index);
+
+  end:
+  if (ret < 0 && !e->abort)
+    ap_print_error("preload_thread failed", ret);
+
+  pthread_mutex_lock(&pool_mutex);
+  if (ret < 0 || e->abort) {
+    source_close(&ic);
+    packet_queue_flush(&e->packets);
+    e->state = e->abort ? PRELOAD_EVICTED : PRELOAD_FAILED;
+  } else {
+    e->ic = ic;
+    e->state = PRELOAD_READY;
+    log_debug("preload_thread::%s ready with %d packets", e->url,
+              e->packets.nb_packets);
+  }
+  e->thread_running = 0;
+  pthread_cond_broadcast(&pool_cond);
+  maybe_free(e);
+  pthread_mutex_unlock(&pool_mutex);
+  return NULL;
+}
+
+ap_preload_t *ap_preload(const char *url) {
+  ap_preload_t *e;
+  pthread_attr_t attr;
+  int ret;
+
+  log_info("ap_preload() %s", url);
+
+  pthread_mutex_lock(&pool_mutex);
+
+  for (e = pool; e; e = e->next) {
+    if (is_live(e) && !strcmp(e->url, url)) {
+      e->refs++;
+      e->last_requested = now_ms();
+      pthread_mutex_unlock(&pool_mutex);
+      return e;
+    }
+  }
+
+  evict_least_recently_requested();
+
+  e = av_mallocz(sizeof(ap_preload_t));
+  if (!e) {
+    pthread_mutex_unlock(&pool_mutex);
+    return NULL;
+  }
+  av_strlcpy(e->url, url, sizeof(e->url));
+  packet_queue_init(&e->packets);
+  e->state = PRELOAD_OPENING;
+  e->refs = 1;
+  e->last_requested = now_ms();
+  e->thread_running = 1;
+
+  pthread_t thread;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  if (!(e->si = source_interrupt_alloc())) {
+    e->thread_running = 0;
+    e->state = PRELOAD_FAILED;
+  } else if ((ret = pthread_create(&thread, &attr, preload_thread, e)) != SUCCESS) {
+    log_error("ap_preload::failed to start thread: %s", strerror(ret));
+    e->thread_running = 0;
+    e->state = PRELOAD_FAILED;
+  }
+  pthread_attr_destroy(&attr);
+
+  e->next = pool;
+  pool = e;
+
+  pthread_mutex_unlock(&pool_mutex);
+  return e;
+}
+
+void ap_preload_release(ap_preload_t *e) {
+  if (!e)
+    return;
+  pthread_mutex_lock(&pool_mutex);
+  if (--e->refs == 0)
+    evict(e);
+  maybe_free(e);
+  pthread_mutex_unlock(&pool_mutex);
+}
+
+void ap_preload_set_limits(int sources, int buffer_ms) {
+  pthread_mutex_lock(&pool_mutex);
+  max_sources = sources > 0 ? sources : 1;
+  max_buffer_ms = buffer_ms;
+  evict_least_recently_requested();
+  pthread_mutex_unlock(&pool_mutex);
+}
+
+const char *preload_get_url(ap_preload_t *e) {
+  return e->url;
+}
+
+int preload_claim(ap_preload_t *e, AVFormatContext **ic, PacketQueue *q,
+                  AVIOInterruptCB *interrupt) {
+  AVPacket pkt;
+  int ret = FAILURE;
+
+  pthread_mutex_lock(&pool_mutex);
+  e->last_requested = now_ms();
+
+  while (e->state == PRELOAD_OPENING && !interrupt->callback(interrupt->opaque)) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += SOURCE_OPEN_POLL_MS * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(&pool_cond, &pool_mutex, &deadline);
+  }
+
+  if (e->state == PRELOAD_READY) {
+    *ic = e->ic;
+    e->ic = NULL;
+    while (packet_queue_get(&e->packets, &pkt, 0) > 0)
+      packet_queue_put(q, &pkt);
+    e->state = PRELOAD_CLAIMED;
+    //the context keeps its own reference, eviction must not cancel it now
+    source_interrupt_unref(e->si);
+    e->si = NULL;
+    ret = SUCCESS;
+  }
+
+  pthread_mutex_unlock(&pool_mutex);
+  return ret;
+}
+
+void preload_shutdown() {
+  ap_preload_t *e;
+  pthread_mutex_lock(&pool_mutex);
+  for (e = pool; e; e = e->next)
+    evict(e);
+  for (;;) {
+    int running = 0;
+    for (e = pool; e; e = e->next)
+      running |= e->thread_running;
+    if (!running)
+      break;
+    pthread_cond_wait(&pool_cond, &pool_mutex);
+  }
+  pthread_mutex_unlock(&pool_mutex);
+}
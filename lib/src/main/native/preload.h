@@ -0,0 +1,21 @@
+#ifndef _PRELOAD_H_
+#define _PRELOAD_H_
+
+#include "audioplayer.h"
+
+//packets buffered per source, in addition to the time limit
+#define PRELOAD_MAX_BYTES (1024 * 1024)
+
+/* take over the opened context and buffered packets of a finished preload,
+ * waiting for it if it is still opening. Close the context with
+ * source_close() and interrupt it with source_take_over(). Returns FAILURE if
+ * the preload failed, was evicted or interrupt fired while waiting */
+int preload_claim(ap_preload_t *preload, AVFormatContext **ic, PacketQueue *q,
+                  AVIOInterruptCB *interrupt);
+
+const char *preload_get_url(ap_preload_t *preload);
+
+//evict everything and wait for the background threads to finish
+void preload_shutdown();
+
+#endif //_PRELOAD_H_
@@ -0,0 +1,161 @@
+#include "audioplayer.h"
+#include <libavutil/avstring.h>
+#include "cover_art.h"
+#include "logging.h"
+
+/*
+ * Stream info and tags for library scanning, without a player: no thread,
+ * state machine or decoder. Only the container is opened, its format found
+ * from PROBE_SIZE bytes. avformat_find_stream_info(), which reads packets and
+ * opens decoders, is only called, limited to PROBE_SIZE bytes and
+ * PROBE_ANALYZE_US, for formats whose header does not give the sample rate,
+ * channels and duration, e.g. mp3 without a Xing header. The cover art is
+ * read with the header, see cover_art.c.
+ *
+ * ap_probe_files() hands the files out one at a time to a pool of workers
+ * like ap_decode_files(). Each worker has one file open at a time, so no more
+ * than AP_PROBE_MAX_OPEN files are open at once.
+ */
+
+#define PROBE_SIZE (64 * 1024)
+#define PROBE_ANALYZE_US 500000
+
+typedef struct probe_pool_t {
+  const char **urls;
+  int nb_urls;
+  ap_probe_info_t *infos;
+  int *results;
+  atomic_int next;
+  atomic_int failed;
+} probe_pool_t;
+
+static int has_stream_info(AVFormatContext *ic, AVStream *st) {
+  return st->codecpar->sample_rate > 0 && st->codecpar->channels > 0
+         && (ic->duration > 0 || st->duration > 0);
+}
+
+static void fill_info(AVFormatContext *ic, AVStream *st, ap_probe_info_t *info) {
+  int64_t size;
+
+  if (ic->duration > 0 && ic->duration != AV_NOPTS_VALUE)
+    info->duration_us = ic->duration;
+  else if (st->duration > 0 && st->duration != AV_NOPTS_VALUE)
+    info->duration_us = av_rescale_q(st->duration, st->time_base,
+                                     AV_TIME_BASE_Q);
+
+  info->bit_rate = ic->bit_rate > 0 ? ic->bit_rate : st->codecpar->bit_rate;
+  //the container only knows it after avformat_find_stream_info()
+  if (info->bit_rate <= 0 && info->duration_us > 0 && ic->pb
+      && (size = avio_size(ic->pb)) > 0)
+    info->bit_rate = av_rescale(size, 8 * AV_TIME_BASE, info->duration_us);
+
+  info->sample_rate = st->codecpar->sample_rate;
+  info->channels = st->codecpar->channels;
+  av_strlcpy(info->codec, avcodec_get_name(st->codecpar->codec_id),
+             sizeof(info->codec));
+
+  //vorbis comments are stream tags, id3 and mp4 tags container ones
+  av_dict_copy(&info->tags, ic->metadata, 0);
+  av_dict_copy(&info->tags, st->metadata, AV_DICT_DONT_OVERWRITE);
+
+  cover_art_find(ic, &info->cover_art);
+}
+
+int ap_probe(const char *url, ap_probe_info_t *info) {
+  AVFormatContext *ic;
+  int ret, index;
+
+  memset(info, 0, sizeof(*info));
+  if (!(ic = avformat_alloc_context()))
+    return AVERROR(ENOMEM);
+  ic->format_probesize = PROBE_SIZE;
+  ic->probesize = PROBE_SIZE;
+  ic->max_analyze_duration = PROBE_ANALYZE_US;
+
+  if ((ret = avformat_open_input(&ic, url, NULL, NULL)) < 0) {
+    log_debug("ap_probe::cannot open %s", url);
+    return ret;
+  }
+
+  index = av_find_best_stream(ic, AVMEDIA_TYPE_AUDIO, -1, -1, NULL, 0);
+  if (index < 0 || !has_stream_info(ic, ic->streams[index])) {
+    if ((ret = avformat_find_stream_info(ic, NULL)) < 0)
+      goto end;
+    index = av_find_best_stream(ic, AVMEDIA_TYPE_AUDIO, -1, -1, NULL, 0);
+  }
+  if (index < 0) {
+    ret = index;
+    goto end;
+  }
+
+  fill_info(ic, ic->streams[index], info);
+  ret = SUCCESS;
+
+  end:
+  avformat_close_input(&ic);
+  return ret;
+}
+
+void ap_probe_free(ap_probe_info_t *info) {
+  av_dict_free(&info->tags);
+  ap_cover_art_free(&info->cover_art);
+}
+
+static void *probe_worker(probe_pool_t *pool) {
+  int i, ret;
+
+  while ((i = atomic_fetch_add(&pool->next, 1)) < pool->nb_urls) {
+    ret = ap_probe(pool->urls[i], &pool->infos[i]);
+    if (pool->results)
+      pool->results[i] = ret;
+    if (ret < 0)
+      atomic_fetch_add(&pool->failed, 1);
+  }
+  return NULL;
+}
+
+int ap_probe_files(const char **urls, int nb_urls, ap_probe_info_t *infos,
+                   int threads, int *results) {
+  probe_pool_t pool;
+  pthread_t *workers;
+  int i, ret, started = 0;
+
+  if (threads <= 0)
+    threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+  threads = FFMIN(threads, FFMIN(nb_urls, AP_PROBE_MAX_OPEN));
+  if (threads <= 0)
+    threads = 1;
+
+  log_info("ap_probe_files() files: %d threads: %d", nb_urls, threads);
+
+  memset(&pool, 0, sizeof(pool));
+  pool.urls = urls;
+  pool.nb_urls = nb_urls;
+  pool.infos = infos;
+  pool.results = results;
+  atomic_init(&pool.next, 0);
+  atomic_init(&pool.failed, 0);
+
+  workers = av_malloc_array(threads, sizeof(pthread_t));
+  if (!workers)
+    return FAILURE;
+
+  for (i = 0; i < threads; i++) {
+    if ((ret = pthread_create(&workers[started], NULL, (void *) probe_worker,
+                              &pool)) != SUCCESS) {
+      log_error("ap_probe_files::failed to start worker: %s", strerror(ret));
+      break;
+    }
+    started++;
+  }
+
+  //without any worker the files are probed here
+  if (!started)
+    probe_worker(&pool);
+
+  for (i = 0; i < started; i++)
+    pthread_join(workers[i], NULL);
+  av_free(workers);
+
+  return pool.failed ? FAILURE : SUCCESS;
+}
@@ -0,0 +1,138 @@
+#include "audioplayer.h"
+#include <libavutil/time.h>
+#include "scan.h"
+#include "cache.h"
+#include "logging.h"
+
+/*
+ * Background scan of a track. The file is demuxed from a context of its own,
+ * which only parses packet headers (for mp3 the frame headers through the
+ * parser), nothing is decoded. For VBR mp3 without a header that records the
+ * length, ic->duration is an estimate from the bitrate of the first frames;
+ * the packets add up to the exact duration.
+ *
+ * The results are left in the scan for the thread running the player, which
+ * is told through on_done, as the player's events have a single producer.
+ */
+
+static int scan_interrupt_cb(track_scan_t *scan) {
+  return scan->quit;
+}
+
+static void cache_duration(const char *url, int64_t duration) {
+  cache_key_t key;
+  if (cache_key(url, &key) == SUCCESS)
+    cache_write(&key, "duration", &duration, sizeof(duration));
+}
+
+int scan_cached_duration(const char *url, int64_t *duration) {
+  cache_key_t key;
+  int64_t *cached;
+  int size, ret = FAILURE;
+
+  if (cache_key(url, &key) < 0
+      || !(cached = cache_read(&key, "duration", &size)))
+    return FAILURE;
+  if (size == sizeof(*duration)) {
+    *duration = *cached;
+    ret = SUCCESS;
+  }
+  av_free(cached);
+  return ret;
+}
+
+static void *scan_thread(track_scan_t *scan) {
+  AVFormatContext *ic;
+  AVPacket packet;
+  int64_t start = av_gettime_relative(), first = AV_NOPTS_VALUE, end = 0, pts;
+  int ret;
+
+  log_debug("[%"PRIXPTR"] scan_thread() %s", (intptr_t) pthread_self(),
+            scan->url);
+
+  if (!(ic = avformat_alloc_context()))
+    return NULL;
+  ic->interrupt_callback.callback = (void *) scan_interrupt_cb;
+  ic->interrupt_callback.opaque = scan;
+  if ((ret = avformat_open_input(&ic, scan->url, NULL, NULL)) < 0) {
+    ap_print_error("scan_thread::avformat_open_input() failed", ret);
+    return NULL;
+  }
+
+  while (!scan->quit) {
+    av_init_packet(&packet);
+    if ((ret = av_read_frame(ic, &packet)) < 0)
+      break;
+    if (packet.stream_index == scan->stream) {
+      pts = packet.pts != AV_NOPTS_VALUE ? packet.pts : packet.dts;
+      if (pts != AV_NOPTS_VALUE) {
+        if (first == AV_NOPTS_VALUE)
+          first = pts;
+        end = FFMAX(end, pts + packet.duration);
+      }
+      if (scan->spacing > 0)
+        ret = seek_points_offer(&scan->points, scan->spacing, &packet);
+    }
+    av_packet_unref(&packet);
+    if (ret < 0)
+      break;
+  }
+
+  if (!scan->quit && first != AV_NOPTS_VALUE
+      && (ret == AVERROR_EOF || (ic->pb && ic->pb->eof_reached))) {
+    scan->duration = av_rescale_q(end - first, scan->time_base, AV_TIME_BASE_Q);
+    log_debug("scan_thread::%"PRId64"ms, %d seek points in %"PRId64"ms",
+              scan->duration / 1000, scan->points.nb_points,
+              (av_gettime_relative() - start) / 1000);
+    cache_duration(scan->url, scan->duration);
+    if (scan->spacing > 0)
+      seek_points_cache(scan->url, scan->time_base, scan->spacing,
+                        &scan->points);
+    scan->done = TRUE;
+    scan->on_done(scan->opaque);
+  }
+
+  avformat_close_input(&ic);
+  return NULL;
+}
+
+int scan_start(track_scan_t *scan, const char *url, AVStream *st,
+               int64_t spacing, void (*on_done)(void *opaque), void *opaque) {
+  pthread_attr_t attr;
+  int ret;
+
+  scan_stop(scan);
+  if (!(scan->url = av_strdup(url)))
+    return AVERROR(ENOMEM);
+  scan->stream = st->index;
+  scan->time_base = st->time_base;
+  scan->spacing = spacing;
+  scan->on_done = on_done;
+  scan->opaque = opaque;
+  scan->quit = 0;
+  scan->done = FALSE;
+  scan->duration = 0;
+
+  pthread_attr_init(&attr);
+  ret = pthread_create(&scan->thread, &attr, (void *) scan_thread, scan);
+  pthread_attr_destroy(&attr);
+  if (ret != SUCCESS) {
+    log_error("scan_start::failed to start thread: %s", strerror(ret));
+    av_freep(&scan->url);
+    return FAILURE;
+  }
+  scan->running = TRUE;
+  return SUCCESS;
+}
+
+void scan_stop(track_scan_t *scan) {
+  if (!scan->running)
+    return;
+  scan->quit = 1;
+  pthread_join(scan->thread, NULL);
+  scan->running = FALSE;
+  scan->done = FALSE;
+  av_freep(&scan->url);
+  av_freep(&scan->points.points);
+  scan->points.nb_points = scan->points.max_points = 0;
+}
@@ -0,0 +1,44 @@
+#ifndef _SCAN_H_
+#define _SCAN_H_
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <libavformat/avformat.h>
+#include "seek_index.h"
+
+/* reads every packet of the audio stream of a track ahead of playback, on a
+ * thread of its own, for its exact duration and its seek points. Only the
+ * thread running the player starts and stops it */
+typedef struct track_scan_t {
+  char *url;
+  int stream;
+  AVRational time_base;
+  //between seek points in the stream time base, 0 for none
+  int64_t spacing;
+
+  pthread_t thread;
+  int running;
+  atomic_int quit;
+  //called on the scan thread once the results are ready
+  void (*on_done)(void *opaque);
+  void *opaque;
+
+  //the results, only read once done is set
+  atomic_int done;
+  //in microseconds
+  int64_t duration;
+  seek_points_t points;
+} track_scan_t;
+
+/* scan stream st of url, recording seek points spacing apart if spacing > 0.
+ * The duration and the points of a complete scan are cached for url */
+int scan_start(track_scan_t *scan, const char *url, AVStream *st,
+               int64_t spacing, void (*on_done)(void *opaque), void *opaque);
+
+//stop the scan and release its results
+void scan_stop(track_scan_t *scan);
+
+//the duration of url in microseconds found by an earlier scan
+int scan_cached_duration(const char *url, int64_t *duration);
+
+#endif //_SCAN_H_
@@ -0,0 +1,206 @@
+#include "audioplayer.h"
+#include "seek_index.h"
+#include "cache.h"
+#include "logging.h"
+
+/*
+ * Seek index for sources whose seeks are slow or inexact: VBR mp3 without a
+ * TOC is seeked by bitrate, ogg by bisecting with many reads. A point, the pts
+ * and byte offset of a packet, is recorded every SEEK_INDEX_SPACING_MS while
+ * packets are read from the start of the track, by playback or by a scan, see
+ * scan.c. Points are handed to the demuxer with av_add_index_entry(), so
+ * avformat_seek_file() turns a seek into a single byte seek to the point
+ * before the target.
+ *
+ * Once the whole track is indexed the points are cached, see cache.h, and the
+ * next open of the file starts with them.
+ */
+
+//the cache entry, followed by the points
+typedef struct seek_entry_t {
+  int32_t num;
+  int32_t den;
+  int64_t spacing;
+  int32_t nb_points;
+  int32_t reserved;
+} seek_entry_t;
+
+static int points_add(seek_points_t *p, int64_t pts, int64_t pos) {
+  seek_point_t *points;
+
+  if (p->nb_points == p->max_points) {
+    p->max_points = FFMAX(256, p->max_points * 2);
+    if (!(points = av_realloc_array(p->points, p->max_points,
+                                    sizeof(seek_point_t))))
+      return AVERROR(ENOMEM);
+    p->points = points;
+  }
+  p->points[p->nb_points].pts = pts;
+  p->points[p->nb_points].pos = pos;
+  p->nb_points++;
+  return SUCCESS;
+}
+
+int seek_points_offer(seek_points_t *p, int64_t spacing, const AVPacket *packet) {
+  int64_t pts = packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts;
+
+  if (pts == AV_NOPTS_VALUE || packet->pos < 0
+      || (p->nb_points && pts < p->points[p->nb_points - 1].pts + spacing))
+    return SUCCESS;
+  return points_add(p, pts, packet->pos);
+}
+
+void seek_points_cache(const char *url, AVRational time_base, int64_t spacing,
+                       const seek_points_t *p) {
+  seek_entry_t *entry;
+  cache_key_t key;
+  int size = sizeof(*entry) + p->nb_points * sizeof(seek_point_t);
+
+  if (cache_key(url, &key) < 0 || !(entry = av_malloc(size)))
+    return;
+  entry->num = time_base.num;
+  entry->den = time_base.den;
+  entry->spacing = spacing;
+  entry->nb_points = p->nb_points;
+  entry->reserved = 0;
+  memcpy(entry + 1, p->points, p->nb_points * sizeof(seek_point_t));
+  cache_write(&key, "seek", entry, size);
+  av_free(entry);
+}
+
+static int load_points(seek_index_t *idx, const char *url) {
+  seek_entry_t *entry;
+  cache_key_t key;
+  int size, ret = FAILURE;
+
+  if (cache_key(url, &key) < 0 || !(entry = cache_read(&key, "seek", &size)))
+    return FAILURE;
+
+  if (size >= sizeof(*entry) && entry->num == idx->time_base.num
+      && entry->den == idx->time_base.den && entry->nb_points >= 0
+      && size == sizeof(*entry) + entry->nb_points * sizeof(seek_point_t)
+      && (idx->index.points = av_malloc_array(FFMAX(entry->nb_points, 1),
+                                              sizeof(seek_point_t)))) {
+    memcpy(idx->index.points, entry + 1,
+           entry->nb_points * sizeof(seek_point_t));
+    idx->index.nb_points = idx->index.max_points = entry->nb_points;
+    ret = SUCCESS;
+  }
+  av_free(entry);
+  return ret;
+}
+
+void seek_index_init(seek_index_t *idx) {
+  memset(idx, 0, sizeof(*idx));
+  pthread_mutex_init(&idx->mutex, NULL);
+}
+
+void seek_index_free(seek_index_t *idx) {
+  av_freep(&idx->index.points);
+  pthread_mutex_destroy(&idx->mutex);
+}
+
+void seek_index_open(seek_index_t *idx, const char *url, AVFormatContext *ic,
+                     AVStream *st, int mode) {
+  int64_t max_points;
+
+  seek_index_close(idx);
+  pthread_mutex_lock(&idx->mutex);
+  idx->mode = mode;
+  idx->index.nb_points = 0;
+  idx->installed = 0;
+  idx->covered = AV_NOPTS_VALUE;
+  idx->contiguous = TRUE;
+  idx->complete = FALSE;
+  idx->time_base = st->time_base;
+  idx->spacing = av_rescale_q(SEEK_INDEX_SPACING_MS * 1000, AV_TIME_BASE_Q,
+                              st->time_base);
+  if (!mode) {
+    pthread_mutex_unlock(&idx->mutex);
+    return;
+  }
+
+  av_freep(&idx->index.points);
+  idx->index.max_points = 0;
+  if (load_points(idx, url) == SUCCESS) {
+    log_debug("seek_index::cached %d points", idx->index.nb_points);
+    idx->complete = TRUE;
+  } else if (ic->duration > 0) {
+    //allocated up front so playback does not allocate
+    max_points = ic->duration / 1000 / SEEK_INDEX_SPACING_MS + 64;
+    if (max_points < INT_MAX / sizeof(seek_point_t)
+        && (idx->index.points = av_malloc_array((int) max_points,
+                                                sizeof(seek_point_t))))
+      idx->index.max_points = (int) max_points;
+  }
+  pthread_mutex_unlock(&idx->mutex);
+}
+
+void seek_index_close(seek_index_t *idx) {
+  idx->mode = 0;
+}
+
+void seek_index_complete(seek_index_t *idx, seek_points_t *points) {
+  if (!idx->mode)
+    return;
+
+  pthread_mutex_lock(&idx->mutex);
+  if (!idx->complete) {
+    FFSWAP(seek_points_t, idx->index, *points);
+    idx->installed = 0;
+    idx->complete = TRUE;
+  }
+  pthread_mutex_unlock(&idx->mutex);
+}
+
+void seek_index_add(seek_index_t *idx, const AVPacket *packet) {
+  int64_t pts = packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts;
+
+  if (!idx->mode || idx->complete || pts == AV_NOPTS_VALUE)
+    return;
+
+  pthread_mutex_lock(&idx->mutex);
+  //back inside the run read from the start, reading on extends it
+  if (!idx->contiguous && idx->covered != AV_NOPTS_VALUE && pts <= idx->covered)
+    idx->contiguous = TRUE;
+  if (idx->contiguous && !idx->complete
+      && (idx->covered == AV_NOPTS_VALUE || pts > idx->covered)) {
+    idx->covered = pts;
+    if (seek_points_offer(&idx->index, idx->spacing, packet) < 0)
+      idx->contiguous = FALSE;
+  }
+  pthread_mutex_unlock(&idx->mutex);
+}
+
+void seek_index_seeked(seek_index_t *idx) {
+  pthread_mutex_lock(&idx->mutex);
+  idx->contiguous = FALSE;
+  pthread_mutex_unlock(&idx->mutex);
+}
+
+void seek_index_finish(seek_index_t *idx, const char *url) {
+  if (!idx->mode)
+    return;
+
+  pthread_mutex_lock(&idx->mutex);
+  if (idx->contiguous && !idx->complete) {
+    log_debug("seek_index::indexed %d points", idx->index.nb_points);
+    idx->complete = TRUE;
+    seek_points_cache(url, idx->time_base, idx->spacing, &idx->index);
+  }
+  pthread_mutex_unlock(&idx->mutex);
+}
+
+void seek_index_install(seek_index_t *idx, AVStream *st) {
+  seek_point_t *p;
+
+  if (!idx->mode)
+    return;
+
+  pthread_mutex_lock(&idx->mutex);
+  for (; idx->installed < idx->index.nb_points; idx->installed++) {
+    p = &idx->index.points[idx->installed];
+    av_add_index_entry(st, p->pos, p->pts, 0, 0, AVINDEX_KEYFRAME);
+  }
+  pthread_mutex_unlock(&idx->mutex);
+}
@@ -0,0 +1,83 @@
+#ifndef _SEEK_INDEX_H_
+#define _SEEK_INDEX_H_
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <libavformat/avformat.h>
+
+//a point is recorded at most this often
+#define SEEK_INDEX_SPACING_MS 250
+
+typedef struct seek_point_t {
+  //in the stream time base
+  int64_t pts;
+  //byte offset of the packet
+  int64_t pos;
+} seek_point_t;
+
+typedef struct seek_points_t {
+  seek_point_t *points;
+  int nb_points;
+  int max_points;
+} seek_points_t;
+
+/* byte offsets of the audio stream of the track being played, see
+ * ap_set_seek_index(). Points are added by whichever thread reads packets and
+ * handed to the demuxer by the thread running the player while nothing reads */
+typedef struct seek_index_t {
+  int mode;
+  AVRational time_base;
+  int64_t spacing;
+
+  //guards the points against the thread reading packets
+  pthread_mutex_t mutex;
+  seek_points_t index;
+  //points already added to the index of the stream
+  int installed;
+  //pts of the last packet of the run read from the start of the track
+  int64_t covered;
+  //the packets being read continue that run
+  int contiguous;
+  //every point of the track is known
+  atomic_int complete;
+} seek_index_t;
+
+//add packet to p if it is spacing or more after the last point
+int seek_points_offer(seek_points_t *p, int64_t spacing, const AVPacket *packet);
+
+//cache the points of the whole of url
+void seek_points_cache(const char *url, AVRational time_base, int64_t spacing,
+                       const seek_points_t *p);
+
+//once, when the player is allocated
+void seek_index_init(seek_index_t *idx);
+
+//release the points
+void seek_index_free(seek_index_t *idx);
+
+/* start indexing st of ic, opened from url, with a mode of ap_set_seek_index().
+ * The points come from the cache if url has been indexed before */
+void seek_index_open(seek_index_t *idx, const char *url, AVFormatContext *ic,
+                     AVStream *st, int mode);
+
+//stop indexing the track, the points are kept until the next open
+void seek_index_close(seek_index_t *idx);
+
+//the points of the whole track, found by a scan. Takes them over from points
+void seek_index_complete(seek_index_t *idx, seek_points_t *points);
+
+//a packet of the stream has been read
+void seek_index_add(seek_index_t *idx, const AVPacket *packet);
+
+//the next packet read does not follow the last one
+void seek_index_seeked(seek_index_t *idx);
+
+/* the last packet of the track has been read. If it was read all the way from
+ * the start the index is complete and cached for url */
+void seek_index_finish(seek_index_t *idx, const char *url);
+
+/* add the points found since the last call to the index of st, so the demuxer
+ * seeks straight to them. Only while nothing reads from the stream */
+void seek_index_install(seek_index_t *idx, AVStream *st);
+
+#endif //_SEEK_INDEX_H_
@@ -0,0 +1,192 @@
+#include "audioplayer.h"
+#include <math.h>
+#include "silence.h"
+#include "cache.h"
+#include "logging.h"
+
+/*
+ * Leading and trailing silence trimming. Only counts of frames are held back,
+ * never the audio itself: a frame is silent when every sample of it is at or
+ * below the threshold, so a run of them that turns out too short to trim is
+ * played as digital silence without audible difference.
+ *
+ * What a complete play found is cached per file. The next play seeks past the
+ * leading silence instead of decoding it, and ends where the trailing silence
+ * starts instead of holding it back.
+ */
+
+//the cache entry
+typedef struct silence_entry_t {
+  double threshold_db;
+  int32_t min_ms;
+  int32_t trim_end;
+  int64_t lead_us;
+  //-1 if there was no trailing silence to trim
+  int64_t end_us;
+} silence_entry_t;
+
+void silence_trim_start(silence_trim_t *s, const silence_settings_t *settings,
+                        int sample_rate, int channels) {
+  memset(s, 0, sizeof(*s));
+  s->settings = *settings;
+  s->threshold = (int) (32768 * pow(10, settings->threshold_db / 20));
+  s->min_frames = (int64_t) settings->min_ms * sample_rate / 1000;
+  s->sample_rate = sample_rate;
+  s->channels = channels;
+  s->lead_end_us = -1;
+  s->cached_end_us = -1;
+}
+
+void silence_trim_seeked(silence_trim_t *s, int64_t pos_us) {
+  //played again from the start the track is trimmed, and cached, again
+  s->seeked = pos_us > 0;
+  s->sound = pos_us > 0;
+  s->ended = 0;
+  s->finished = 0;
+  s->lead_frames = 0;
+  s->held_frames = 0;
+  s->lead_end_us = -1;
+}
+
+static int is_silent(const int16_t *frame, int channels, int threshold) {
+  int c;
+  for (c = 0; c < channels; c++) {
+    if (abs(frame[c]) > threshold)
+      return FALSE;
+  }
+  return TRUE;
+}
+
+static int first_audible(silence_trim_t *s, const int16_t *pcm, int frames) {
+  int i;
+  for (i = 0; i < frames; i++) {
+    if (!is_silent(pcm + i * s->channels, s->channels, s->threshold))
+      break;
+  }
+  return i;
+}
+
+static int last_audible(silence_trim_t *s, const int16_t *pcm, int frames) {
+  int i;
+  for (i = frames - 1; i >= 0; i--) {
+    if (!is_silent(pcm + i * s->channels, s->channels, s->threshold))
+      break;
+  }
+  return i;
+}
+
+static int64_t frames_to_us(silence_trim_t *s, int64_t frames) {
+  return frames * 1000000 / s->sample_rate;
+}
+
+void silence_trim_chunk(silence_trim_t *s, const int16_t *pcm, int frames,
+                        int64_t pos_us, silence_chunk_t *chunk) {
+  int64_t left;
+  int first, last;
+
+  chunk->pad = 0;
+  chunk->skip = 0;
+  chunk->play = 0;
+  if (s->ended || s->finished)
+    return;
+
+  //the cache knows where the trailing silence starts
+  if (s->cached_end_us >= 0) {
+    left = (s->cached_end_us - pos_us) * s->sample_rate / 1000000;
+    if (left < frames) {
+      s->ended = 1;
+      frames = (int) FFMAX(left, 0);
+    }
+  }
+
+  if (!s->sound) {
+    if ((first = first_audible(s, pcm, frames)) == frames) {
+      s->lead_frames += frames;
+      chunk->skip = frames;
+      return;
+    }
+    s->sound = 1;
+    s->lead_end_us = pos_us + frames_to_us(s, first);
+    if (s->lead_frames + first < s->min_frames) {
+      //too short to trim after all
+      chunk->pad = s->lead_frames;
+      s->lead_frames = 0;
+    } else {
+      s->lead_frames += first;
+      chunk->skip = first;
+      log_debug("silence::trimmed %"PRId64" ms at the start",
+                frames_to_us(s, s->lead_frames) / 1000);
+    }
+  }
+  chunk->play = frames - chunk->skip;
+
+  if (!s->settings.trim_end || s->cached_end_us >= 0)
+    return;
+
+  last = last_audible(s, pcm + chunk->skip * s->channels, chunk->play);
+  if (last < 0) {
+    if (!s->held_frames)
+      s->held_from_us = pos_us + frames_to_us(s, chunk->skip);
+    s->held_frames += chunk->play;
+    chunk->play = 0;
+    return;
+  }
+  //the held run was a pause, not the end
+  chunk->pad += s->held_frames;
+  s->held_frames = chunk->play - (last + 1);
+  if (s->held_frames)
+    s->held_from_us = pos_us + frames_to_us(s, chunk->skip + last + 1);
+  chunk->play = last + 1;
+}
+
+int64_t silence_trim_finish(silence_trim_t *s, const char *url) {
+  silence_entry_t entry;
+  cache_key_t key;
+  int64_t pad = 0;
+
+  if (s->finished)
+    return 0;
+  s->finished = 1;
+  entry.end_us = -1;
+  if (s->held_frames >= s->min_frames) {
+    log_debug("silence::trimmed %"PRId64" ms at the end",
+              frames_to_us(s, s->held_frames) / 1000);
+    entry.end_us = s->held_from_us;
+  } else {
+    pad = s->held_frames;
+  }
+  s->held_frames = 0;
+
+  if (s->seeked || s->cached || !s->sound || cache_key(url, &key) < 0)
+    return pad;
+
+  entry.threshold_db = s->settings.threshold_db;
+  entry.min_ms = s->settings.min_ms;
+  entry.trim_end = s->settings.trim_end;
+  entry.lead_us = s->lead_frames ? s->lead_end_us : 0;
+  cache_write(&key, "silence", &entry, sizeof(entry));
+  return pad;
+}
+
+int silence_trim_cached(silence_trim_t *s, const char *url, int64_t *lead_us) {
+  silence_entry_t *entry;
+  cache_key_t key;
+  int size, ret = FAILURE;
+
+  if (cache_key(url, &key) < 0
+      || !(entry = cache_read(&key, "silence", &size)))
+    return FAILURE;
+
+  if (size == sizeof(*entry)
+      && entry->threshold_db == s->settings.threshold_db
+      && entry->min_ms == s->settings.min_ms
+      && entry->trim_end == s->settings.trim_end) {
+    *lead_us = entry->lead_us;
+    if (s->settings.trim_end)
+      s->cached_end_us = entry->end_us;
+    s->cached = 1;
+    ret = SUCCESS;
+  }
+  av_free(entry);
+  return ret;
+}
@@ -0,0 +1,78 @@
+#ifndef _SILENCE_H_
+#define _SILENCE_H_
+
+#include <stdint.h>
+
+//see ap_set_silence_trim()
+typedef struct silence_settings_t {
+  int enabled;
+  //samples at or below this level are silent
+  double threshold_db;
+  //shorter runs of silence are played
+  int min_ms;
+  //end the track where its trailing silence starts
+  int trim_end;
+} silence_settings_t;
+
+/* leading and trailing silence of the track being played, only used by the
+ * thread running the player. Silent frames are not played until it is known
+ * whether the run they are part of is long enough to trim: a run that turns
+ * out shorter than min_ms is played as digital silence instead */
+typedef struct silence_trim_t {
+  silence_settings_t settings;
+  int threshold;
+  int64_t min_frames;
+  int sample_rate;
+  int channels;
+
+  //an audible frame has been played
+  int sound;
+  //the track was seeked, what was found does not describe the file
+  int seeked;
+  //the rest of the track is trailing silence, and silence_trim_finish() has
+  //been called
+  int ended;
+  int finished;
+  //silent frames dropped before the first audible one
+  int64_t lead_frames;
+  //silent frames since the last audible one, not played yet
+  int64_t held_frames;
+  //media time of the first audible frame and of the start of the held run
+  int64_t lead_end_us;
+  int64_t held_from_us;
+  //where the trailing silence starts according to the cache, or -1
+  int64_t cached_end_us;
+  int cached;
+} silence_trim_t;
+
+/* what to play of a chunk of frames, in this order. Frames after skip + play
+ * are held back */
+typedef struct silence_chunk_t {
+  //frames of digital silence
+  int64_t pad;
+  //frames of the chunk to drop, then to play
+  int skip;
+  int play;
+} silence_chunk_t;
+
+//start a track of s16 PCM
+void silence_trim_start(silence_trim_t *s, const silence_settings_t *settings,
+                        int sample_rate, int channels);
+
+//playback continues from elsewhere in the track, from the start if pos_us <= 0
+void silence_trim_seeked(silence_trim_t *s, int64_t pos_us);
+
+//split a chunk of frames starting at pos_us
+void silence_trim_chunk(silence_trim_t *s, const int16_t *pcm, int frames,
+                        int64_t pos_us, silence_chunk_t *chunk);
+
+/* the track has ended, returns the frames of held silence that must still be
+ * played. The result is cached for url unless the track was seeked */
+int64_t silence_trim_finish(silence_trim_t *s, const char *url);
+
+/* where a previous play of url found the leading silence to end, 0 if there
+ * was none to trim. Sets up the cached end of the trailing silence.
+ * FAILURE if url is not cached with the current settings */
+int silence_trim_cached(silence_trim_t *s, const char *url, int64_t *lead_us);
+
+#endif //_SILENCE_H_
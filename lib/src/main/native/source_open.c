@@ -0,0 +1,342 @@
+#include <sys/eventfd.h>
+#include "audioplayer.h"
+#include <libavutil/avstring.h>
+#include "source_open.h"
+#include "logging.h"
+
+/*
+ * Opens a source off the player thread so a player waiting for a slow or
+ * unresponsive server can be cancelled within SOURCE_OPEN_POLL_MS, instead
+ * of within ffmpeg's own network polling interval.
+ *
+ * Mirrors of a source are raced: every url is opened on a thread of its own
+ * and the first with a decodable audio stream wins. The others are then
+ * cancelled through their own source_interrupt_t and close whatever they
+ * opened themselves. The winner's is never cancelled by the race: it goes on
+ * with the context to the player, and from source_take_over() checks the
+ * player's interrupt, with its reset generation, instead.
+ *
+ * The job is shared by the waiting player and the opening threads, whichever
+ * releases it last frees it. Its eventfd is signalled once it is done, so an
+ * engine worker can wait for it in epoll instead of in source_open_wait().
+ */
+
+struct source_interrupt_t {
+  atomic_int refs;
+  atomic_int cancelled;
+  //the interrupt of the player that took the context over, see
+  //source_take_over()
+  AVIOInterruptCB owner;
+};
+
+typedef struct source_worker_t {
+  struct source_open_t *job;
+  int index;
+  source_interrupt_t *si;
+} source_worker_t;
+
+struct source_open_t {
+  char *urls[AP_MAX_SOURCES];
+  int nb_urls;
+  int early_start;
+  source_worker_t workers[AP_MAX_SOURCES];
+
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  int refs;
+  int pending;
+  int done;
+  //signalled when done is set, -1 if it could not be created
+  int done_fd;
+
+  AVFormatContext *ic;
+  int index;
+  int provisional;
+  int ret;
+};
+
+static const char *early_start_formats[] = {"aac", "mp3", "ogg", NULL};
+
+int source_can_start_early(AVFormatContext *ic) {
+  const char **name;
+  for (name = early_start_formats; *name; name++) {
+    if (av_match_name(*name, ic->iformat->name))
+      return TRUE;
+  }
+  return FALSE;
+}
+
+static int source_interrupt_cb(source_interrupt_t *si) {
+  return atomic_load(&si->cancelled)
+         || (si->owner.callback && si->owner.callback(si->owner.opaque));
+}
+
+source_interrupt_t *source_interrupt_alloc() {
+  source_interrupt_t *si = av_mallocz(sizeof(source_interrupt_t));
+
+  if (si) {
+    atomic_init(&si->refs, 1);
+    atomic_init(&si->cancelled, 0);
+  }
+  return si;
+}
+
+void source_interrupt_unref(source_interrupt_t *si) {
+  if (atomic_fetch_sub(&si->refs, 1) == 1)
+    av_free(si);
+}
+
+void source_interrupt_cancel(source_interrupt_t *si) {
+  atomic_store(&si->cancelled, 1);
+}
+
+void source_take_over(AVFormatContext *ic, const AVIOInterruptCB *interrupt) {
+  source_interrupt_t *si = ic->opaque;
+
+  //a context the player allocated itself is not open yet
+  if (si)
+    si->owner = *interrupt;
+  else
+    ic->interrupt_callback = *interrupt;
+}
+
+int source_open_input(AVFormatContext **ic, const char *url,
+                      source_interrupt_t *si) {
+  int ret;
+
+  if (!(*ic = avformat_alloc_context()))
+    return AVERROR(ENOMEM);
+  (*ic)->interrupt_callback.callback = (void *) source_interrupt_cb;
+  (*ic)->interrupt_callback.opaque = si;
+
+  //frees *ic on failure
+  if ((ret = avformat_open_input(ic, url, NULL, NULL)) < 0)
+    return ret;
+
+  atomic_fetch_add(&si->refs, 1);
+  (*ic)->opaque = si;
+  return SUCCESS;
+}
+
+void source_close(AVFormatContext **ic) {
+  source_interrupt_t *si;
+
+  if (!*ic)
+    return;
+  si = (*ic)->opaque;
+  avformat_close_input(ic);
+  if (si)
+    source_interrupt_unref(si);
+}
+
+//call with job->mutex held
+static void job_cancel(source_open_t *job, int except) {
+  int i;
+
+  for (i = 0; i < job->nb_urls; i++) {
+    if (i != except && job->workers[i].si)
+      source_interrupt_cancel(job->workers[i].si);
+  }
+}
+
+//call with job->mutex held, returns the references left
+static int job_unref(source_open_t *job, int refs) {
+  return job->refs -= refs;
+}
+
+static void job_free(source_open_t *job) {
+  int i;
+
+  source_close(&job->ic);
+  for (i = 0; i < job->nb_urls; i++) {
+    av_free(job->urls[i]);
+    if (job->workers[i].si)
+      source_interrupt_unref(job->workers[i].si);
+  }
+  if (job->done_fd >= 0)
+    close(job->done_fd);
+  pthread_mutex_destroy(&job->mutex);
+  pthread_cond_destroy(&job->cond);
+  av_free(job);
+}
+
+static void job_release(source_open_t *job) {
+  int refs;
+
+  pthread_mutex_lock(&job->mutex);
+  refs = job_unref(job, 1);
+  pthread_mutex_unlock(&job->mutex);
+
+  if (!refs)
+    job_free(job);
+}
+
+//call with job->mutex held
+static void set_done(source_open_t *job) {
+  uint64_t one = 1;
+
+  job->done = 1;
+  pthread_cond_signal(&job->cond);
+  if (job->done_fd >= 0 && write(job->done_fd, &one, sizeof(one)) < 0)
+    log_error("source_open::signal failed: %s", strerror(errno));
+}
+
+//call with job->mutex held
+static void worker_done(source_open_t *job) {
+  if (--job->pending == 0 && !job->done)
+    set_done(job);
+}
+
+/* open and probe one url, SUCCESS if it has an audio stream ffmpeg decodes */
+static int open_url(source_open_t *job, source_worker_t *worker,
+                    AVFormatContext **ic, int *provisional) {
+  const char *url = job->urls[worker->index];
+  AVCodec *codec = NULL;
+  int ret;
+
+  if ((ret = source_open_input(ic, url, worker->si)) < 0) {
+    ap_print_error("source_open::avformat_open_input failed", ret);
+    return ret;
+  }
+
+  *provisional = job->early_start && source_can_start_early(*ic);
+  if (!*provisional && (ret = avformat_find_stream_info(*ic, NULL)) < 0) {
+    ap_print_error("source_open::avformat_find_stream_info failed", ret);
+    return ret;
+  }
+
+  if ((ret = av_find_best_stream(*ic, AVMEDIA_TYPE_AUDIO, -1, -1, &codec, 0)) < 0
+      || !codec) {
+    log_error("source_open::%s: no decodable audio stream", url);
+    return ret < 0 ? ret : AVERROR_DECODER_NOT_FOUND;
+  }
+  return SUCCESS;
+}
+
+static void *source_open_thread(source_worker_t *worker) {
+  source_open_t *job = worker->job;
+  const char *url = job->urls[worker->index];
+  AVFormatContext *ic = NULL;
+  int ret, provisional = FALSE, refs;
+
+  log_debug("source_open_thread() %s", url);
+
+  ret = open_url(job, worker, &ic, &provisional);
+
+  pthread_mutex_lock(&job->mutex);
+  if (ret >= 0 && !job->done) {
+    log_debug("source_open_thread::%s won", url);
+    job->ic = ic;
+    ic = NULL;
+    job->index = worker->index;
+    job->provisional = provisional;
+    //interrupt the mirrors still opening
+    job_cancel(job, worker->index);
+    set_done(job);
+  } else if (ret < 0) {
+    job->ret = ret;
+  }
+  worker_done(job);
+  refs = job_unref(job, 1);
+  pthread_mutex_unlock(&job->mutex);
+
+  source_close(&ic);
+  if (!refs)
+    job_free(job);
+  return NULL;
+}
+
+source_open_t *source_open_start(const char **urls, int nb_urls,
+                                 int early_start) {
+  source_open_t *job;
+  pthread_attr_t attr;
+  pthread_t thread;
+  int i, ret, started = 0, refs;
+
+  if (nb_urls <= 0 || !(job = av_mallocz(sizeof(source_open_t))))
+    return NULL;
+
+  job->nb_urls = FFMIN(nb_urls, AP_MAX_SOURCES);
+  for (i = 0; i < job->nb_urls; i++) {
+    job->urls[i] = av_strdup(urls[i]);
+    job->workers[i].job = job;
+    job->workers[i].index = i;
+    job->workers[i].si = source_interrupt_alloc();
+  }
+  job->early_start = early_start;
+  job->index = -1;
+  job->ret = AVERROR(ENOMEM);
+  job->done_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  pthread_mutex_init(&job->mutex, NULL);
+  pthread_cond_init(&job->cond, NULL);
+
+  //the threads only touch the counts with the mutex held
+  pthread_mutex_lock(&job->mutex);
+  job->refs = job->nb_urls + 1;
+  job->pending = job->nb_urls;
+
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  for (i = 0; i < job->nb_urls; i++) {
+    ret = ENOMEM;
+    if (!job->urls[i] || !job->workers[i].si
+        || (ret = pthread_create(&thread, &attr, (void *) source_open_thread,
+                                 &job->workers[i])) != SUCCESS) {
+      log_error("source_open_start::failed to start %d: %s", i, strerror(ret));
+      job_unref(job, 1);
+      worker_done(job);
+      continue;
+    }
+    started++;
+  }
+  pthread_attr_destroy(&attr);
+
+  if (!started) {
+    refs = job_unref(job, 1);
+    pthread_mutex_unlock(&job->mutex);
+    if (!refs)
+      job_free(job);
+    return NULL;
+  }
+  pthread_mutex_unlock(&job->mutex);
+  return job;
+}
+
+int source_open_fd(source_open_t *job) {
+  return job->done_fd;
+}
+
+int source_open_wait(source_open_t *job, AVIOInterruptCB *interrupt,
+                     AVFormatContext **ic, int *index, int *provisional) {
+  struct timespec deadline;
+  int ret;
+
+  pthread_mutex_lock(&job->mutex);
+  while (!job->done && !interrupt->callback(interrupt->opaque)) {
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += SOURCE_OPEN_POLL_MS * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(&job->cond, &job->mutex, &deadline);
+  }
+
+  if (job->ic) {
+    ret = SUCCESS;
+    *ic = job->ic;
+    *index = job->index;
+    *provisional = job->provisional;
+    job->ic = NULL;
+  } else if (job->done) {
+    ret = job->ret;
+  } else {
+    log_debug("source_open_wait::cancelled");
+    job_cancel(job, -1);
+    ret = AVERROR_EXIT;
+  }
+  pthread_mutex_unlock(&job->mutex);
+
+  job_release(job);
+  return ret;
+}
@@ -0,0 +1,59 @@
+#ifndef _SOURCE_OPEN_H_
+#define _SOURCE_OPEN_H_
+
+#include "audioplayer.h"
+
+//how often a waiting player checks whether it has been cancelled
+#define SOURCE_OPEN_POLL_MS 10
+
+typedef struct source_open_t source_open_t;
+
+/* the interrupt state of a context opened off the player thread. The protocol
+ * under the context keeps its own copy of the interrupt callback for as long
+ * as the context is open, so the state is reference counted and the context
+ * holds a reference, as its opaque, until source_close() */
+typedef struct source_interrupt_t source_interrupt_t;
+
+source_interrupt_t *source_interrupt_alloc();
+
+void source_interrupt_unref(source_interrupt_t *si);
+
+//interrupt everything the context of si does from now on
+void source_interrupt_cancel(source_interrupt_t *si);
+
+/* the player taking ic over: its reads are interrupted by interrupt from now
+ * on, so a reset or a quit reaches them. Call before anything reads from ic
+ * on another thread */
+void source_take_over(AVFormatContext *ic, const AVIOInterruptCB *interrupt);
+
+/* avformat_open_input() of a new context interrupted through si. On success
+ * *ic holds a reference to si */
+int source_open_input(AVFormatContext **ic, const char *url,
+                      source_interrupt_t *si);
+
+//avformat_close_input() of any context, releasing its interrupt state
+void source_close(AVFormatContext **ic);
+
+/* open each of urls, up to AP_MAX_SOURCES, on a thread of its own:
+ * avformat_open_input() and, unless early start is set and applies to the
+ * format, avformat_find_stream_info(). The first with a decodable audio stream
+ * wins and the rest are cancelled. Returns NULL if no thread could be started */
+source_open_t *source_open_start(const char **urls, int nb_urls,
+                                 int early_start);
+
+/* readable once the open has finished and source_open_wait() would not
+ * block, -1 if it cannot be waited for this way. Closed with the job */
+int source_open_fd(source_open_t *job);
+
+/* wait for an open to finish and release it. On success *ic is the opened
+ * context, *index the url it was opened from and *provisional is set if the
+ * stream info was skipped, close it with source_close(). If every url failed
+ * the last error is returned. If interrupt fires first the open is abandoned,
+ * its threads close whatever they opened, and AVERROR_EXIT is returned */
+int source_open_wait(source_open_t *job, AVIOInterruptCB *interrupt,
+                     AVFormatContext **ic, int *index, int *provisional);
+
+//the first packet of these formats carries the full codec parameters
+int source_can_start_early(AVFormatContext *ic);
+
+#endif //_SOURCE_OPEN_H_
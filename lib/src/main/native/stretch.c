@@ -0,0 +1,300 @@
+#include "audioplayer.h"
+#include <float.h>
+#include "stretch.h"
+#include "pcm.h"
+#include "logging.h"
+
+/*
+ * Time-stretch by WSOLA, waveform similarity overlap-add. The input is cut
+ * into sequences of STRETCH_SEQUENCE_MS, each crossfaded over
+ * STRETCH_OVERLAP_MS into the end of the one before. Every sequence adds its
+ * length less the overlap to the output while the input moves on by tempo
+ * times that. Within STRETCH_SEEK_MS of where the input has got to, the
+ * sequence starts where it best matches the end of the last one, by
+ * normalized cross-correlation, so the crossfade does not cancel out the
+ * waveform. The lengths are those that suit speech, the content most often
+ * sped up.
+ *
+ * Channels are stretched together as interleaved floats so they stay in
+ * phase. The correlation and the crossfade, with the S16 conversions of
+ * pcm.c all the per sample work, use NEON or SSE2 where the target has
+ * them.
+ */
+
+#define STRETCH_SEQUENCE_MS 40
+#define STRETCH_OVERLAP_MS 8
+#define STRETCH_SEEK_MS 15
+//the search tries every STRETCH_SEEK_STEP frames, then around the best one
+#define STRETCH_SEEK_STEP 4
+
+#if defined(AP_NEON)
+static inline float sum_f32x4(float32x4_t v) {
+  float32x2_t s = vadd_f32(vget_low_f32(v), vget_high_f32(v));
+  return vget_lane_f32(vpadd_f32(s, s), 0);
+}
+#elif defined(AP_SSE2)
+static inline float sum_ps(__m128 v) {
+  v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+  v = _mm_add_ss(v, _mm_shuffle_ps(v, v, 1));
+  return _mm_cvtss_f32(v);
+}
+#endif
+
+/* the dot product of a and b of n samples, and that of b with itself into
+ * energy */
+static float correlate(const float *a, const float *b, int n, float *energy) {
+  float ab = 0, bb = 0;
+  int i = 0;
+
+#if defined(AP_NEON)
+  float32x4_t vab = vdupq_n_f32(0), vbb = vdupq_n_f32(0), vb;
+  for (; i + 4 <= n; i += 4) {
+    vb = vld1q_f32(b + i);
+    vab = vmlaq_f32(vab, vld1q_f32(a + i), vb);
+    vbb = vmlaq_f32(vbb, vb, vb);
+  }
+  ab = sum_f32x4(vab);
+  bb = sum_f32x4(vbb);
+#elif defined(AP_SSE2)
+  __m128 vab = _mm_setzero_ps(), vbb = _mm_setzero_ps(), vb;
+  for (; i + 4 <= n; i += 4) {
+    vb = _mm_loadu_ps(b + i);
+    vab = _mm_add_ps(vab, _mm_mul_ps(_mm_loadu_ps(a + i), vb));
+    vbb = _mm_add_ps(vbb, _mm_mul_ps(vb, vb));
+  }
+  ab = sum_ps(vab);
+  bb = sum_ps(vbb);
+#endif
+  for (; i < n; i++) {
+    ab += a[i] * b[i];
+    bb += b[i] * b[i];
+  }
+  *energy = bb;
+  return ab;
+}
+
+//out = a + (b - a) * ramp, n samples
+static void crossfade(float *out, const float *a, const float *b,
+                      const float *ramp, int n) {
+  int i = 0;
+
+#if defined(AP_NEON)
+  float32x4_t va;
+  for (; i + 4 <= n; i += 4) {
+    va = vld1q_f32(a + i);
+    vst1q_f32(out + i, vmlaq_f32(va, vsubq_f32(vld1q_f32(b + i), va),
+                                 vld1q_f32(ramp + i)));
+  }
+#elif defined(AP_SSE2)
+  __m128 va;
+  for (; i + 4 <= n; i += 4) {
+    va = _mm_loadu_ps(a + i);
+    _mm_storeu_ps(out + i, _mm_add_ps(va, _mm_mul_ps(
+        _mm_sub_ps(_mm_loadu_ps(b + i), va), _mm_loadu_ps(ramp + i))));
+  }
+#endif
+  for (; i < n; i++)
+    out[i] = a[i] + (b[i] - a[i]) * ramp[i];
+}
+
+static void free_buffers(time_stretch_t *s) {
+  av_freep(&s->in);
+  av_freep(&s->mid);
+  av_freep(&s->ramp);
+  av_freep(&s->out);
+  av_freep(&s->out_s16);
+}
+
+static int alloc_buffers(time_stretch_t *s) {
+  int i, c, ch = s->channels;
+
+  AP_COUNT_OWN_ALLOC();
+  s->in = av_malloc_array(s->in_max * ch, sizeof(float));
+  s->mid = av_malloc_array(s->overlap * ch, sizeof(float));
+  s->ramp = av_malloc_array(s->overlap * ch, sizeof(float));
+  s->out = av_malloc_array(s->out_max * ch, sizeof(float));
+  if (s->fmt == AV_SAMPLE_FMT_S16)
+    s->out_s16 = av_malloc_array(s->out_max * ch, sizeof(int16_t));
+  if (!s->in || !s->mid || !s->ramp || !s->out
+      || (s->fmt == AV_SAMPLE_FMT_S16 && !s->out_s16)) {
+    free_buffers(s);
+    return AVERROR(ENOMEM);
+  }
+
+  for (i = 0; i < s->overlap; i++)
+    for (c = 0; c < ch; c++)
+      s->ramp[i * ch + c] = (float) i / s->overlap;
+  return SUCCESS;
+}
+
+void stretch_configure(time_stretch_t *s, enum AVSampleFormat fmt,
+                       int channels, int sample_rate) {
+  int hop;
+
+  stretch_reset(s);
+  if (s->fmt == fmt && s->channels == channels && s->sample_rate == sample_rate)
+    return;
+
+  free_buffers(s);
+  s->fmt = fmt;
+  s->channels = channels;
+  s->sample_rate = sample_rate;
+  s->sequence = sample_rate * STRETCH_SEQUENCE_MS / 1000;
+  s->overlap = sample_rate * STRETCH_OVERLAP_MS / 1000;
+  s->seek = sample_rate * STRETCH_SEEK_MS / 1000;
+  hop = s->sequence - s->overlap;
+  //room for the most a sequence needs, and as much again for stretch_write()
+  s->in_max = 2 * FFMAX(s->seek + s->sequence,
+                        (int) ceil(AP_TEMPO_MAX * hop) + 1);
+  s->out_max = s->in_max + s->overlap;
+}
+
+void stretch_free(time_stretch_t *s) {
+  free_buffers(s);
+}
+
+void stretch_reset(time_stretch_t *s) {
+  s->in_frames = 0;
+  s->skip_frac = 0;
+  s->primed = FALSE;
+  s->active = FALSE;
+  s->tempo = 1.0;
+}
+
+int stretch_supported(time_stretch_t *s) {
+  return (s->fmt == AV_SAMPLE_FMT_S16 || s->fmt == AV_SAMPLE_FMT_FLT)
+         && s->channels > 0 && s->overlap > 0;
+}
+
+static int64_t start_time(time_stretch_t *s) {
+  return s->anchor_us + av_rescale(s->anchor_frames, AV_TIME_BASE,
+                                   s->sample_rate);
+}
+
+static void consume(time_stretch_t *s, int frames) {
+  int ch = s->channels;
+
+  frames = FFMIN(frames, s->in_frames);
+  memmove(s->in, s->in + frames * ch,
+          (s->in_frames - frames) * ch * sizeof(float));
+  s->in_frames -= frames;
+  s->anchor_frames += frames;
+}
+
+/* where, in the first range frames of the input, a sequence best continues
+ * the last one */
+static int best_offset(time_stretch_t *s, int range) {
+  int n = s->overlap * s->channels, i, from, to, best = 0;
+  float corr, energy, best_corr = -FLT_MAX;
+
+  for (i = 0; i < range; i += STRETCH_SEEK_STEP) {
+    corr = correlate(s->mid, s->in + i * s->channels, n, &energy);
+    corr /= sqrtf(energy + FLT_EPSILON);
+    if (corr > best_corr) {
+      best_corr = corr;
+      best = i;
+    }
+  }
+
+  from = FFMAX(best - STRETCH_SEEK_STEP + 1, 0);
+  to = FFMIN(best + STRETCH_SEEK_STEP, range);
+  for (i = from; i < to; i++) {
+    if (i == best)
+      continue;
+    corr = correlate(s->mid, s->in + i * s->channels, n, &energy);
+    corr /= sqrtf(energy + FLT_EPSILON);
+    if (corr > best_corr) {
+      best_corr = corr;
+      best = i;
+    }
+  }
+  return best;
+}
+
+static int output(time_stretch_t *s, int frames, uint8_t **out) {
+  if (s->fmt == AV_SAMPLE_FMT_S16) {
+    pcm_float_to_s16(s->out_s16, s->out, frames * s->channels);
+    *out = (uint8_t *) s->out_s16;
+  } else {
+    *out = (uint8_t *) s->out;
+  }
+  return frames;
+}
+
+int stretch_write(time_stretch_t *s, const uint8_t *pcm, int frames,
+                  int64_t pts_us) {
+  int n, ch = s->channels;
+
+  if (!s->in && alloc_buffers(s) < 0)
+    return AVERROR(ENOMEM);
+  s->active = TRUE;
+
+  if (pts_us != AV_NOPTS_VALUE) {
+    s->anchor_us = pts_us;
+    s->anchor_frames = -s->in_frames;
+  }
+
+  n = FFMIN(frames, s->in_max - s->in_frames);
+  if (s->fmt == AV_SAMPLE_FMT_S16)
+    pcm_s16_to_float(s->in + s->in_frames * ch, (const int16_t *) pcm, n * ch);
+  else
+    memcpy(s->in + s->in_frames * ch, pcm, n * ch * sizeof(float));
+  s->in_frames += n;
+  return n;
+}
+
+int stretch_read(time_stretch_t *s, double tempo, uint8_t **out,
+                 int64_t *content_us) {
+  int ch = s->channels, hop = s->sequence - s->overlap, offset = 0, skip;
+  double advance = tempo * hop + s->skip_frac;
+
+  skip = (int) advance;
+  if (!s->active || s->in_frames < FFMAX(s->seek + s->sequence, skip))
+    return 0;
+
+  *content_us = start_time(s);
+  if (!s->primed) {
+    //nothing to crossfade from yet
+    memcpy(s->out, s->in, hop * ch * sizeof(float));
+    s->primed = TRUE;
+  } else {
+    offset = best_offset(s, s->seek);
+    crossfade(s->out, s->mid, s->in + offset * ch, s->ramp, s->overlap * ch);
+    memcpy(s->out + s->overlap * ch, s->in + (offset + s->overlap) * ch,
+           (hop - s->overlap) * ch * sizeof(float));
+  }
+  memcpy(s->mid, s->in + (offset + hop) * ch, s->overlap * ch * sizeof(float));
+
+  s->skip_frac = advance - skip;
+  s->tempo = tempo;
+  consume(s, skip);
+  return output(s, hop, out);
+}
+
+int stretch_drain(time_stretch_t *s, uint8_t **out, int64_t *content_us) {
+  int ch = s->channels, offset, frames;
+
+  if (!s->active)
+    return 0;
+
+  *content_us = start_time(s);
+  if (!s->primed) {
+    memcpy(s->out, s->in, s->in_frames * ch * sizeof(float));
+    frames = s->in_frames;
+  } else if (s->in_frames >= s->overlap) {
+    offset = best_offset(s, FFMIN(s->seek, s->in_frames - s->overlap + 1));
+    frames = s->in_frames - offset;
+    crossfade(s->out, s->mid, s->in + offset * ch, s->ramp, s->overlap * ch);
+    memcpy(s->out + s->overlap * ch, s->in + (offset + s->overlap) * ch,
+           (frames - s->overlap) * ch * sizeof(float));
+  } else {
+    //too little left to crossfade into, the end of the track
+    memcpy(s->out, s->mid, s->overlap * ch * sizeof(float));
+    memcpy(s->out + s->overlap * ch, s->in, s->in_frames * ch * sizeof(float));
+    frames = s->overlap + s->in_frames;
+  }
+
+  s->anchor_frames += s->in_frames;
+  stretch_reset(s);
+  return output(s, frames, out);
+}
@@ -0,0 +1,74 @@
+#ifndef _STRETCH_H_
+#define _STRETCH_H_
+
+#include <stdint.h>
+#include <libavutil/samplefmt.h>
+
+/* tempo change of the output without changing its pitch, see stretch.c and
+ * ap_set_tempo(). Only used by the thread running the player. The buffers
+ * are allocated by the first stretch_write() and kept across tracks */
+typedef struct time_stretch_t {
+  enum AVSampleFormat fmt;
+  int channels;
+  int sample_rate;
+  //in frames
+  int sequence;
+  int overlap;
+  int seek;
+
+  //input not yet stretched, interleaved floats
+  float *in;
+  int in_frames;
+  int in_max;
+  //in[0] is anchor_frames after the frame at content time anchor_us
+  int64_t anchor_us;
+  int64_t anchor_frames;
+  //the end of the last sequence, crossfaded into the next one
+  float *mid;
+  //0 to 1 over the overlap, repeated for each channel
+  float *ramp;
+  float *out;
+  //out converted to S16
+  int16_t *out_s16;
+  int out_max;
+
+  //fraction of a frame the input has still to advance by
+  double skip_frac;
+  //a sequence has been output since the stretch started
+  int primed;
+  //the output goes through the stretch, until it is drained
+  int active;
+  //of the last sequence
+  double tempo;
+} time_stretch_t;
+
+/* stretch output in fmt, only AV_SAMPLE_FMT_S16 and AV_SAMPLE_FMT_FLT are
+ * supported. The buffers are kept if the format has not changed */
+void stretch_configure(time_stretch_t *s, enum AVSampleFormat fmt,
+                       int channels, int sample_rate);
+
+void stretch_free(time_stretch_t *s);
+
+//drop the input, the stretch is inactive until the next stretch_write()
+void stretch_reset(time_stretch_t *s);
+
+int stretch_supported(time_stretch_t *s);
+
+/* buffer up to frames of pcm, which starts at content time pts_us or follows
+ * the last input if AV_NOPTS_VALUE. Returns the frames taken, which may be
+ * fewer than given until stretch_read() has made room */
+int stretch_write(time_stretch_t *s, const uint8_t *pcm, int frames,
+                  int64_t pts_us);
+
+/* the next sequence stretched to tempo into *out, returns its frames or 0
+ * until enough input is buffered. content_us is the content time it starts
+ * at */
+int stretch_read(time_stretch_t *s, double tempo, uint8_t **out,
+                 int64_t *content_us);
+
+/* the input left unstretched, crossfaded from the last sequence, to go back
+ * to normal speed or end the track. Returns its frames, the stretch is
+ * inactive after */
+int stretch_drain(time_stretch_t *s, uint8_t **out, int64_t *content_us);
+
+#endif //_STRETCH_H_
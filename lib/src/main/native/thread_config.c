@@ -0,0 +1,43 @@
+#define _GNU_SOURCE
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include "thread_config.h"
+#include "logging.h"
+
+void thread_config_init_attr(const ap_thread_config_t *config,
+                             pthread_attr_t *attr) {
+  if (config->stack_size > 0
+      && pthread_attr_setstacksize(attr, config->stack_size) != 0)
+    log_warn("thread_config::invalid stack size: %zu", config->stack_size);
+}
+
+void thread_config_apply(const ap_thread_config_t *config) {
+  pid_t tid = (pid_t) syscall(SYS_gettid);
+  int cpu;
+
+  if (config->fifo) {
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = config->priority;
+    if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0)
+      log_warn("thread_config::SCHED_FIFO %d not permitted, using the default "
+                   "policy", config->priority);
+  } else if (config->priority
+             && setpriority(PRIO_PROCESS, tid, config->priority) != 0) {
+    log_warn("thread_config::setpriority(%d) failed: %s", config->priority,
+             strerror(errno));
+  }
+
+  if (config->cpu_mask) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (cpu = 0; cpu < 64; cpu++) {
+      if (config->cpu_mask & ((uint64_t) 1 << cpu))
+        CPU_SET(cpu, &set);
+    }
+    if (sched_setaffinity(tid, sizeof(set), &set) != 0)
+      log_warn("thread_config::sched_setaffinity(%"PRIx64") failed: %s",
+               config->cpu_mask, strerror(errno));
+  }
+}
@@ -0,0 +1,14 @@
+#ifndef _THREAD_CONFIG_H_
+#define _THREAD_CONFIG_H_
+
+#include "audioplayer.h"
+
+//set the stack size of a thread about to be created
+void thread_config_init_attr(const ap_thread_config_t *config,
+                             pthread_attr_t *attr);
+
+//apply the priority, scheduling policy and affinity to the calling thread.
+//failures are logged and otherwise ignored, the thread runs with defaults
+void thread_config_apply(const ap_thread_config_t *config);
+
+#endif //_THREAD_CONFIG_H_
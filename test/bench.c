@@ -0,0 +1,1658 @@
+#define _GNU_SOURCE
+
+#include <time.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <poll.h>
+#include <dirent.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "audioplayer.h"
+#include "logging.h"
+
+/*
+ * Headless benchmarks for the native player. No audio output is opened, the
+ * decoded PCM is discarded as soon as it is delivered.
+ *
+ * usage: andrudiobench <benchmark> [-n runs] [-nice n | -fifo prio] [-cpus mask] url
+ *
+ *  ttfs   time from creating a player to the first decoded sample, with and
+ *         without early start
+ *  engine resident memory of 100 idle players, create to first sample
+ *         latency, and the threads and memory of 20 players playing url, then
+ *         after each of them has seeked. With a thread per player and with a
+ *         shared engine, whose thread count must not grow with playback
+ *  rt     plays url to the end and fails if the library's own code allocates
+ *         after the first second of playback, with and without the jitter
+ *         buffer. ffmpeg's allocations, packets included, are not counted.
+ *         Needs a build with AP_DEBUG_ALLOC, see bench.sh
+ *  allocs own allocations per minute of playback of one player playing url
+ *         runs times, resetting it between tracks. Needs AP_DEBUG_ALLOC
+ *  decode offline decode throughput of ap_decode_files() with 1 to N threads,
+ *         N being the number of cores. Each pass decodes url runs * N times
+ *  length sample frames decoded from url by ap_decode_file() and by a player
+ *         in render mode. Fails unless both match -frames n, or the length
+ *         the container records, exactly. ogg vorbis records it exactly:
+ *         ./bench.sh length test.ogg
+ *  cancel time for reset and delete to cancel a prepare that is stuck on a
+ *         local http server that accepts connections but never responds.
+ *         Fails above CANCEL_LIMIT_MS. url is not used, pass anything
+ *  spectrum cost of the spectrum analyzer tap to the decoder, as the render
+ *         mode time of url with and without it, and the rate it publishes at
+ *         during real time playback. Fails below half SPECTRUM_RATE_HZ
+ *  peaks  ap_compute_peaks() of url decoded and then from the on-disk cache,
+ *         in a temporary directory. Fails unless both agree and the cached
+ *         one is at least PEAKS_CACHE_SPEEDUP times faster
+ *  loudness ap_scan_loudness() of url runs times on every core, then url
+ *         rendered at unity gain and normalized to LOUDNESS_TARGET_LUFS.
+ *         Fails unless the output level moves by the normalization gain
+ *  silence url rendered untrimmed, then with ap_set_silence_trim() of its
+ *         leading and trailing silence, decoded and from the on-disk cache.
+ *         Fails unless the cached play is within SILENCE_TOLERANCE_MS of the
+ *         decoded one
+ *  seek   latency of SEEK_COUNT seeks spread over url, a long VBR mp3 or ogg,
+ *         without a seek index and with the index ap_set_seek_index() scanned
+ *         and cached in a temporary directory. Fails unless the scan
+ *         completes within SCAN_TIMEOUT_S
+ *  duration ap_set_exact_duration() of url, a VBR mp3 without a header,
+ *         scanned and from the cache in a temporary directory, against the
+ *         estimate of the container. Fails unless both are within
+ *         DURATION_TOLERANCE_MS of the decoded length
+ *  probe  ap_probe() of url against a player prepared to its first sample
+ *         for the same stream info, runs times each, then ap_probe_files()
+ *         of url runs times on every core. Fails unless both agree on the
+ *         rate, channels, duration and cover art
+ *  tempo  url rendered at normal speed and with ap_set_tempo() of each of
+ *         TEMPOS, reporting the render time the time-stretch adds. Fails
+ *         unless the output is the length of the track over the tempo and
+ *         the audio clock ends at the length of the track, both within
+ *         TEMPO_TOLERANCE_MS
+ *  eq     url rendered without an equalizer and with ap_set_graphic_eq() of
+ *         alternating +6 and -6 dB, reporting the render time it adds and
+ *         the cost of each band from ap_get_stats(). Fails unless every band
+ *         reports a cost and together they cost less than EQ_COST_LIMIT_US
+ *         per second of audio
+ *  mirrors races ap_set_datasources() across local http mirrors of the file
+ *         url: one that never responds, a slow one, one that answers 404 at
+ *         once and a fast one. Fails unless the fast one plays and the silent
+ *         and slow ones are disconnected within MIRROR_CANCEL_MS of it
+ */
+
+static int runs = 5;
+//expected length for the length benchmark, 0 to use the container's
+static int64_t expected_frames;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+
+#define IDLE_PLAYERS 100
+#define PLAYING_PLAYERS 20
+//of playback before the playing players are measured
+#define PLAYING_SETTLE_US 2000000
+#define CANCEL_LIMIT_MS 50
+#define MIRROR_CANCEL_MS 500
+#define SPECTRUM_BANDS 32
+#define SPECTRUM_RATE_HZ 30
+#define PEAKS_BUCKETS 1000
+#define LOUDNESS_TARGET_LUFS -23.0
+//between the normalization gain and the measured change in level
+#define LOUDNESS_GAIN_TOLERANCE_DB 0.1
+#define PEAKS_CACHE_SPEEDUP 10
+#define SILENCE_THRESHOLD_DB -60.0
+#define SILENCE_MIN_MS 500
+#define SILENCE_TOLERANCE_MS 50
+#define SEEK_COUNT 20
+#define SCAN_TIMEOUT_S 60
+#define DURATION_TOLERANCE_MS 100
+#define TEMPO_TOLERANCE_MS 200
+#define EQ_COST_LIMIT_US 50000
+
+static int64_t first_sample_time;
+static int failed;
+static int completed;
+//ap_get_own_alloc_count() once a second has been played
+static int64_t steady_allocs = -1;
+//s16 sample frames handed to on_play
+static int64_t played_frames;
+//of the s16 samples handed to on_play, for the gain of the loudness benchmark
+static double played_sum_sq;
+static int play_channels = 2;
+//when the player last went to STATE_IDLE
+static int64_t idle_time;
+//set by EVENT_SEEK_COMPLETE
+static int64_t seek_time;
+//set by EVENT_DURATION_UPDATED
+static int64_t duration_time;
+static int updated_duration_ms;
+
+static int64_t now_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int on_prepare(player_t *player, int sampleFormat, int sampleRate,
+                      int channelFormat) {
+  log_debug("on_prepare() rate:%d channels:%d", sampleRate, channelFormat);
+  play_channels = channelFormat;
+  return 0;
+}
+
+static void on_play(player_t *player, char *data, int len) {
+  const int16_t *samples = (const int16_t *) data;
+  int i;
+
+  pthread_mutex_lock(&lock);
+  if (!first_sample_time) {
+    first_sample_time = now_us();
+    pthread_cond_signal(&cond);
+  }
+  if (steady_allocs < 0 && ap_get_audio_clock(player) >= 1.0)
+    steady_allocs = ap_get_own_alloc_count();
+  played_frames += len / (play_channels * 2);
+  for (i = 0; i < len / 2; i++)
+    played_sum_sq += (double) samples[i] * samples[i];
+  pthread_mutex_unlock(&lock);
+}
+
+static void on_event(player_t *player, audio_event_t event, int arg1, int arg2) {
+  if (event == EVENT_SEEK_COMPLETE) {
+    pthread_mutex_lock(&lock);
+    seek_time = now_us();
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&lock);
+  } else if (event == EVENT_DURATION_UPDATED) {
+    pthread_mutex_lock(&lock);
+    duration_time = now_us();
+    updated_duration_ms = arg1;
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&lock);
+  }
+  if (event != EVENT_STATE_CHANGE)
+    return;
+
+  if (arg2 == STATE_PREPARED) {
+    ap_start(player);
+  } else if (arg2 == STATE_IDLE) {
+    pthread_mutex_lock(&lock);
+    idle_time = now_us();
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&lock);
+  } else if (arg2 == STATE_ERROR) {
+    pthread_mutex_lock(&lock);
+    failed = 1;
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&lock);
+  } else if (arg2 == STATE_COMPLETED) {
+    pthread_mutex_lock(&lock);
+    completed = 1;
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&lock);
+  }
+}
+
+static player_t *create_player(ap_engine_t *engine) {
+  player_callbacks_t callbacks;
+  memset(&callbacks, 0, sizeof(player_callbacks_t));
+  callbacks.on_play = on_play;
+  callbacks.on_prepare = on_prepare;
+  callbacks.on_event = on_event;
+  return engine ? ap_create_in_engine(engine, callbacks) : ap_create(callbacks);
+}
+
+/* wait for the first sample, returns the time taken in us or -1 */
+static int64_t wait_first_sample(int64_t start, int timeout_ms) {
+  struct timespec deadline;
+  int64_t ret = -1;
+
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += timeout_ms / 1000;
+
+  pthread_mutex_lock(&lock);
+  while (!first_sample_time && !failed) {
+    if (pthread_cond_timedwait(&cond, &lock, &deadline) != 0)
+      break;
+  }
+  if (first_sample_time)
+    ret = first_sample_time - start;
+  first_sample_time = 0;
+  failed = 0;
+  pthread_mutex_unlock(&lock);
+  return ret;
+}
+
+/* resident set size in kB */
+static long rss_kb() {
+  long size = 0, resident = 0;
+  FILE *f = fopen("/proc/self/statm", "r");
+  if (!f)
+    return -1;
+  if (fscanf(f, "%ld %ld", &size, &resident) != 2)
+    resident = -1;
+  fclose(f);
+  return resident < 0 ? -1 : resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+/* threads of the process, -1 if unknown */
+static int thread_count() {
+  char line[128];
+  int threads = -1;
+  FILE *f = fopen("/proc/self/status", "r");
+  if (!f)
+    return -1;
+  while (fgets(line, sizeof(line), f)) {
+    if (sscanf(line, "Threads: %d", &threads) == 1)
+      break;
+  }
+  fclose(f);
+  return threads;
+}
+
+/* PLAYING_PLAYERS players playing url: the threads and memory they add while
+ * they play and once each of them has seeked, which restarts its reading */
+static int bench_playing(const char *url, ap_engine_t *engine,
+                         const char *mode) {
+  player_t *players[PLAYING_PLAYERS];
+  int threads = thread_count(), playing, seeked, i, ret = SUCCESS;
+  long rss = rss_kb();
+
+  memset(players, 0, sizeof(players));
+  for (i = 0; i < PLAYING_PLAYERS; i++) {
+    if (!(players[i] = create_player(engine))) {
+      log_error("engine: failed to create playing player %d", i);
+      ret = FAILURE;
+      goto end;
+    }
+    ap_set_datasource(players[i], url);
+    //started by on_event() once prepared
+    ap_prepare_async(players[i]);
+  }
+  usleep(PLAYING_SETTLE_US);
+  playing = thread_count() - threads;
+  printf("engine %-8s %8d threads %8ld kB  with %d players playing\n", mode,
+         playing, rss_kb() - rss, PLAYING_PLAYERS);
+
+  for (i = 0; i < PLAYING_PLAYERS; i++)
+    ap_seek(players[i], 0, 0);
+  usleep(PLAYING_SETTLE_US / 2);
+  seeked = thread_count() - threads;
+  printf("engine %-8s %8d threads after %d seeks\n", mode, seeked,
+         PLAYING_PLAYERS);
+  if (engine && seeked > playing) {
+    log_error("engine: seeking started %d threads", seeked - playing);
+    ret = FAILURE;
+  }
+
+  end:
+  for (i = 0; i < PLAYING_PLAYERS; i++)
+    ap_delete(players[i]);
+  return ret;
+}
+
+/* the time from creating a player to its first sample in us or -1 */
+static int64_t create_to_first_sample(const char *url, ap_engine_t *engine,
+                                      int early_start) {
+  int64_t start = now_us();
+  player_t *player = create_player(engine);
+  if (!player)
+    return -1;
+
+  ap_set_early_start(player, early_start);
+  ap_set_datasource(player, url);
+  ap_prepare_async(player);
+  int64_t elapsed = wait_first_sample(start, 30000);
+
+  ap_delete(player);
+  return elapsed;
+}
+
+static int bench_ttfs(const char *url) {
+  int early, i;
+  for (early = 0; early <= 1; early++) {
+    int64_t total = 0;
+    int ok = 0;
+    for (i = 0; i < runs; i++) {
+      int64_t us = create_to_first_sample(url, NULL, early);
+      if (us < 0) {
+        log_error("ttfs: run %d failed", i);
+        continue;
+      }
+      total += us;
+      ok++;
+    }
+    if (!ok)
+      return FAILURE;
+    printf("ttfs %-12s %8.2f ms  (%d runs)\n", early ? "early-start" : "default",
+           total / 1000.0 / ok, ok);
+  }
+  return SUCCESS;
+}
+
+static int bench_engine_mode(const char *url, int use_engine) {
+  const char *mode = use_engine ? "engine" : "threads";
+  player_t *players[IDLE_PLAYERS];
+  ap_engine_t *engine = NULL;
+  int64_t total = 0;
+  int i, ok = 0, ret = SUCCESS;
+
+  long rss = rss_kb();
+
+  if (use_engine && !(engine = ap_engine_create(0)))
+    return FAILURE;
+
+  memset(players, 0, sizeof(players));
+  for (i = 0; i < IDLE_PLAYERS; i++) {
+    if (!(players[i] = create_player(engine))) {
+      log_error("engine: failed to create player %d", i);
+      ret = FAILURE;
+      goto end;
+    }
+  }
+  //let the player threads start
+  usleep(200000);
+  printf("engine %-8s %8ld kB  rss of %d idle players\n", mode,
+         rss_kb() - rss, IDLE_PLAYERS);
+
+  for (i = 0; i < runs; i++) {
+    int64_t us = create_to_first_sample(url, engine, 0);
+    if (us < 0) {
+      log_error("engine: run %d failed", i);
+      continue;
+    }
+    total += us;
+    ok++;
+  }
+  if (ok)
+    printf("engine %-8s %8.2f ms  create to first sample (%d runs)\n", mode,
+           total / 1000.0 / ok, ok);
+  else
+    ret = FAILURE;
+
+  if (ret == SUCCESS)
+    ret = bench_playing(url, engine, mode);
+
+  end:
+  for (i = 0; i < IDLE_PLAYERS; i++)
+    ap_delete(players[i]);
+  ap_engine_delete(engine);
+  return ret;
+}
+
+static int bench_engine(const char *url) {
+  if (bench_engine_mode(url, 0) != SUCCESS)
+    return FAILURE;
+  return bench_engine_mode(url, 1);
+}
+
+/* play the current datasource of player to the end, returns the media time
+ * played in seconds or -1 */
+static double play_track(player_t *player) {
+  struct timespec deadline;
+  double played = -1;
+
+  ap_prepare_async(player);
+
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += 600;
+
+  pthread_mutex_lock(&lock);
+  while (!completed && !failed) {
+    if (pthread_cond_timedwait(&cond, &lock, &deadline) != 0)
+      break;
+  }
+  if (completed)
+    played = ap_get_audio_clock(player);
+  first_sample_time = 0;
+  failed = completed = 0;
+  pthread_mutex_unlock(&lock);
+  return played;
+}
+
+/* play url to the end, returns the allocations after the first second or -1 */
+static int64_t steady_state_allocs(const char *url, int jitter_buffer) {
+  int64_t ret = -1;
+  player_t *player = create_player(NULL);
+  if (!player)
+    return -1;
+
+  if (jitter_buffer)
+    ap_set_jitter_buffer(player, JITTER_DEFAULT_MIN_MS, JITTER_DEFAULT_MAX_MS);
+
+  steady_allocs = -1;
+  ap_set_datasource(player, url);
+  if (play_track(player) >= 0) {
+    if (steady_allocs >= 0)
+      ret = ap_get_own_alloc_count() - steady_allocs;
+    else
+      log_error("rt: less than a second was played");
+  }
+
+  ap_delete(player);
+  return ret;
+}
+
+static int bench_rt(const char *url) {
+  int jitter, ret = SUCCESS;
+
+  if (ap_get_own_alloc_count() < 0) {
+    log_error("rt: not built with AP_DEBUG_ALLOC");
+    return FAILURE;
+  }
+
+  for (jitter = 0; jitter <= 1; jitter++) {
+    int64_t allocs = steady_state_allocs(url, jitter);
+    if (allocs < 0)
+      return FAILURE;
+    printf("rt %-14s %8"PRId64" own allocations after the first second\n",
+           jitter ? "jitter-buffer" : "default", allocs);
+    if (allocs > 0)
+      ret = FAILURE;
+  }
+  return ret;
+}
+
+static int bench_allocs(const char *url) {
+  double played = 0, track;
+  int64_t allocs;
+  int i;
+
+  if (ap_get_own_alloc_count() < 0) {
+    log_error("allocs: not built with AP_DEBUG_ALLOC");
+    return FAILURE;
+  }
+
+  player_t *player = create_player(NULL);
+  if (!player)
+    return FAILURE;
+
+  allocs = ap_get_own_alloc_count();
+  for (i = 0; i < runs; i++) {
+    if (i > 0)
+      ap_reset(player);
+    ap_set_datasource(player, url);
+    if ((track = play_track(player)) < 0) {
+      log_error("allocs: track %d failed", i);
+      break;
+    }
+    played += track;
+  }
+  allocs = ap_get_own_alloc_count() - allocs;
+  ap_delete(player);
+
+  if (played <= 0)
+    return FAILURE;
+  printf("allocs %8"PRId64" own allocations in %.1f s, %.1f per minute (%d tracks)\n",
+         allocs, played, allocs * 60 / played, i);
+  return SUCCESS;
+}
+
+//microseconds of audio decoded by bench_decode()
+static atomic_llong decoded_us;
+
+static int decode_sink(void *opaque, int index, int sample_rate, int channels,
+                       const char *data, int len) {
+  atomic_fetch_add_explicit(&decoded_us, (int64_t) len * 1000000
+                                         / (sample_rate * channels * 2),
+                            memory_order_relaxed);
+  return 0;
+}
+
+static int bench_decode(const char *url) {
+  int cores = (int) sysconf(_SC_NPROCESSORS_ONLN);
+  int nb_files = runs * cores;
+  const char **urls;
+  double elapsed, audio, base = 0;
+  int64_t start;
+  int i, threads, ret = SUCCESS;
+
+  if (!(urls = av_malloc_array(nb_files, sizeof(char *))))
+    return FAILURE;
+  for (i = 0; i < nb_files; i++)
+    urls[i] = url;
+
+  printf("decode %d files per pass, %d cores\n", nb_files, cores);
+  for (threads = 1; threads <= cores && ret == SUCCESS; threads++) {
+    atomic_store(&decoded_us, 0);
+    start = now_us();
+    ret = ap_decode_files(urls, nb_files, AV_SAMPLE_FMT_S16, decode_sink, NULL,
+                          threads, NULL);
+    elapsed = (now_us() - start) / 1000000.0;
+    audio = atomic_load(&decoded_us) / 1000000.0;
+    if (threads == 1)
+      base = elapsed;
+    printf("decode threads %2d %7.2f s %7.1f files/s %8.1fx realtime "
+               "speedup %5.2f\n", threads, elapsed, nb_files / elapsed,
+           audio / elapsed, base / elapsed);
+  }
+
+  av_free(urls);
+  return ret;
+}
+
+static int length_sink(void *opaque, int index, int sample_rate, int channels,
+                       const char *data, int len) {
+  *(int64_t *) opaque += len / (channels * 2);
+  return 0;
+}
+
+/* the length of the audio stream of url in sample frames as recorded by the
+ * container, or -1 */
+static int64_t container_frames(const char *url) {
+  AVFormatContext *ic = NULL;
+  AVStream *st;
+  int64_t frames = -1;
+  int i;
+
+  if (avformat_open_input(&ic, url, NULL, NULL) < 0)
+    return -1;
+  if (avformat_find_stream_info(ic, NULL) >= 0
+      && (i = av_find_best_stream(ic, AVMEDIA_TYPE_AUDIO, -1, -1, NULL, 0)) >= 0) {
+    st = ic->streams[i];
+    if (st->duration != AV_NOPTS_VALUE && st->codec->sample_rate > 0)
+      frames = av_rescale_q(st->duration, st->time_base,
+                            (AVRational) {1, st->codec->sample_rate});
+  }
+  avformat_close_input(&ic);
+  return frames;
+}
+
+static int bench_length(const char *url) {
+  int64_t expected = expected_frames, decoded = 0, played;
+  int ret = SUCCESS;
+
+  if (expected <= 0 && (expected = container_frames(url)) < 0) {
+    log_error("length: no length recorded in %s, use -frames", url);
+    return FAILURE;
+  }
+
+  if (ap_decode_file(url, AV_SAMPLE_FMT_S16, length_sink, &decoded) < 0)
+    return FAILURE;
+  printf("length expected %10"PRId64" decoded %10"PRId64" %s\n", expected,
+         decoded, decoded == expected ? "ok" : "FAILED");
+  if (decoded != expected)
+    ret = FAILURE;
+
+  player_t *player = create_player(NULL);
+  if (!player)
+    return FAILURE;
+  ap_set_render_mode(player, 1);
+  ap_set_datasource(player, url);
+  played_frames = 0;
+  if (play_track(player) < 0) {
+    log_error("length: playback failed");
+    ret = FAILURE;
+  }
+  ap_delete(player);
+
+  played = played_frames;
+  printf("length expected %10"PRId64" played  %10"PRId64" %s\n", expected,
+         played, played == expected ? "ok" : "FAILED");
+  if (played != expected)
+    ret = FAILURE;
+  return ret;
+}
+
+static int silent_fd = -1;
+
+/* accept connections and never answer them */
+static void *silent_server(void *arg) {
+  int fds[64], nb_fds = 0, fd;
+
+  while ((fd = accept(silent_fd, NULL, NULL)) >= 0) {
+    if (nb_fds < 64)
+      fds[nb_fds++] = fd;
+    else
+      close(fd);
+  }
+  while (nb_fds > 0)
+    close(fds[--nb_fds]);
+  return NULL;
+}
+
+/* start silent_server() on a local port, returns the port or -1 */
+static int start_silent_server(pthread_t *thread) {
+  struct sockaddr_in addr;
+  socklen_t len = sizeof(addr);
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  if ((silent_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0
+      || bind(silent_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0
+      || listen(silent_fd, 16) < 0
+      || getsockname(silent_fd, (struct sockaddr *) &addr, &len) < 0
+      || pthread_create(thread, NULL, silent_server, NULL) != 0) {
+    log_error("cancel: local server failed: %s", strerror(errno));
+    return -1;
+  }
+  return ntohs(addr.sin_port);
+}
+
+/* time from ap_reset() to STATE_IDLE in us, or -1 */
+static int64_t reset_latency(player_t *player) {
+  struct timespec deadline;
+  int64_t start, ret = -1;
+
+  pthread_mutex_lock(&lock);
+  idle_time = 0;
+  pthread_mutex_unlock(&lock);
+
+  start = now_us();
+  ap_reset(player);
+
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += 30;
+  pthread_mutex_lock(&lock);
+  while (!idle_time) {
+    if (pthread_cond_timedwait(&cond, &lock, &deadline) != 0)
+      break;
+  }
+  if (idle_time)
+    ret = idle_time - start;
+  pthread_mutex_unlock(&lock);
+  return ret;
+}
+
+static int bench_cancel() {
+  char url[64];
+  pthread_t server;
+  int64_t latency, reset_max = 0, delete_max = 0, reset_total = 0,
+      delete_total = 0;
+  int i, port, ret = SUCCESS;
+
+  if ((port = start_silent_server(&server)) < 0)
+    return FAILURE;
+  snprintf(url, sizeof(url), "http://127.0.0.1:%d/stream", port);
+
+  for (i = 0; i < runs && ret == SUCCESS; i++) {
+    player_t *player = create_player(NULL);
+    if (!player) {
+      ret = FAILURE;
+      break;
+    }
+
+    //stuck in avformat_open_input() waiting for the response
+    ap_set_datasource(player, url);
+    ap_prepare_async(player);
+    usleep(200000);
+    if ((latency = reset_latency(player)) < 0) {
+      log_error("cancel: reset did not complete");
+      ap_delete(player);
+      ret = FAILURE;
+      break;
+    }
+    reset_total += latency;
+    reset_max = FFMAX(reset_max, latency);
+
+    //a new prepare gets stuck the same way and is cancelled by delete
+    ap_set_datasource(player, url);
+    ap_prepare_async(player);
+    usleep(200000);
+    int64_t start = now_us();
+    ap_delete(player);
+    latency = now_us() - start;
+    delete_total += latency;
+    delete_max = FFMAX(delete_max, latency);
+  }
+
+  shutdown(silent_fd, SHUT_RDWR);
+  close(silent_fd);
+  pthread_join(server, NULL);
+
+  if (ret != SUCCESS || i == 0)
+    return FAILURE;
+  printf("cancel reset  avg %6.1f ms max %6.1f ms\n",
+         reset_total / 1000.0 / i, reset_max / 1000.0);
+  printf("cancel delete avg %6.1f ms max %6.1f ms\n",
+         delete_total / 1000.0 / i, delete_max / 1000.0);
+  if (reset_max > CANCEL_LIMIT_MS * 1000 || delete_max > CANCEL_LIMIT_MS * 1000) {
+    log_error("cancel: over %d ms", CANCEL_LIMIT_MS);
+    return FAILURE;
+  }
+  return SUCCESS;
+}
+
+/* time to render url in us, with the analyzer running if analyze is set */
+static int64_t render_time(const char *url, int analyze) {
+  int64_t start, ret = -1;
+  player_t *player = create_player(NULL);
+  if (!player)
+    return -1;
+
+  ap_set_render_mode(player, 1);
+  if (analyze && !ap_start_analyzer(player, SPECTRUM_BANDS, SPECTRUM_RATE_HZ)) {
+    ap_delete(player);
+    return -1;
+  }
+  ap_set_datasource(player, url);
+  start = now_us();
+  if (play_track(player) >= 0)
+    ret = now_us() - start;
+  ap_delete(player);
+  return ret;
+}
+
+static int bench_spectrum(const char *url) {
+  ap_spectrum_t *spectrum;
+  int64_t plain = 0, tapped = 0, t;
+  unsigned updates;
+  float bands[AP_SPECTRUM_MAX_BANDS] = {0}, peak_db;
+  int i, n, peak;
+
+  for (i = 0; i < runs; i++) {
+    if ((t = render_time(url, 0)) < 0)
+      return FAILURE;
+    plain += t;
+    if ((t = render_time(url, 1)) < 0)
+      return FAILURE;
+    tapped += t;
+  }
+  printf("spectrum render %8.1f ms tapped %8.1f ms overhead %5.1f%%\n",
+         plain / 1000.0 / runs, tapped / 1000.0 / runs,
+         100.0 * (tapped - plain) / plain);
+
+  player_t *player = create_player(NULL);
+  if (!player)
+    return FAILURE;
+  if (!(spectrum = ap_start_analyzer(player, SPECTRUM_BANDS, SPECTRUM_RATE_HZ))) {
+    ap_delete(player);
+    return FAILURE;
+  }
+  ap_set_datasource(player, url);
+  ap_prepare_async(player);
+  if (wait_first_sample(now_us(), 10000) < 0) {
+    log_error("spectrum: no sample");
+    ap_delete(player);
+    return FAILURE;
+  }
+  t = now_us();
+  updates = atomic_load(&spectrum->seq) / 2;
+  sleep(2);
+  updates = atomic_load(&spectrum->seq) / 2 - updates;
+  t = now_us() - t;
+
+  n = ap_read_spectrum(player, bands, AP_SPECTRUM_MAX_BANDS);
+  //the spectrum goes with the player
+  ap_delete(player);
+
+  for (i = 1, peak = 0; i < n; i++) {
+    if (bands[i] > bands[peak])
+      peak = i;
+  }
+  peak_db = bands[peak];
+
+  printf("spectrum %5.1f updates/s, loudest band %d of %d at %.1f dBFS\n",
+         updates * 1000000.0 / t, peak, SPECTRUM_BANDS, peak_db);
+  if (updates * 1000000.0 / t < SPECTRUM_RATE_HZ / 2) {
+    log_error("spectrum: under %d updates/s", SPECTRUM_RATE_HZ / 2);
+    return FAILURE;
+  }
+  return SUCCESS;
+}
+
+static void clear_dir(const char *dir) {
+  char path[1100];
+  struct dirent *e;
+  DIR *d;
+
+  if (!(d = opendir(dir)))
+    return;
+  while ((e = readdir(d))) {
+    if (e->d_name[0] == '.')
+      continue;
+    snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+    unlink(path);
+  }
+  closedir(d);
+}
+
+static int bench_peaks(const char *url) {
+  ap_peak_t *cold, *warm;
+  char dir[] = "/tmp/andrudiobench.XXXXXX";
+  int64_t cold_us = 0, warm_us = 0, start;
+  int i, ret = SUCCESS;
+
+  if (!mkdtemp(dir)) {
+    log_error("peaks: %s", strerror(errno));
+    return FAILURE;
+  }
+  ap_set_cache_dir(dir);
+  cold = av_malloc_array(PEAKS_BUCKETS, sizeof(ap_peak_t));
+  warm = av_malloc_array(PEAKS_BUCKETS, sizeof(ap_peak_t));
+
+  for (i = 0; i < runs && ret == SUCCESS && cold && warm; i++) {
+    //drop the cache so the first call decodes
+    clear_dir(dir);
+
+    start = now_us();
+    if (ap_compute_peaks(url, PEAKS_BUCKETS, cold) < 0) {
+      ret = FAILURE;
+      break;
+    }
+    cold_us += now_us() - start;
+
+    start = now_us();
+    if (ap_compute_peaks(url, PEAKS_BUCKETS, warm) < 0) {
+      ret = FAILURE;
+      break;
+    }
+    warm_us += now_us() - start;
+
+    if (memcmp(cold, warm, PEAKS_BUCKETS * sizeof(ap_peak_t))) {
+      log_error("peaks: cached peaks differ");
+      ret = FAILURE;
+    }
+  }
+
+  if (ret == SUCCESS && cold && warm) {
+    printf("peaks decoded %8.2f ms cached %8.3f ms\n", cold_us / 1000.0 / runs,
+           warm_us / 1000.0 / runs);
+    if (warm_us * PEAKS_CACHE_SPEEDUP > cold_us) {
+      log_error("peaks: cache under %dx faster", PEAKS_CACHE_SPEEDUP);
+      ret = FAILURE;
+    }
+  } else {
+    ret = FAILURE;
+  }
+
+  ap_set_cache_dir(NULL);
+  clear_dir(dir);
+  rmdir(dir);
+  av_free(cold);
+  av_free(warm);
+  return ret;
+}
+
+/* mean square of the s16 output of url rendered with the gain of loudness
+ * normalized to target, unity gain if loudness is NULL. -1 on failure */
+static double rendered_power(const char *url, const ap_loudness_t *loudness) {
+  double ret = -1;
+  player_t *player = create_player(NULL);
+  if (!player)
+    return -1;
+
+  ap_set_render_mode(player, 1);
+  if (loudness)
+    ap_set_normalization(player, loudness, LOUDNESS_TARGET_LUFS);
+  ap_set_datasource(player, url);
+  played_frames = 0;
+  played_sum_sq = 0;
+  if (play_track(player) >= 0 && played_frames > 0)
+    ret = played_sum_sq / (played_frames * play_channels);
+  ap_delete(player);
+  return ret;
+}
+
+static int bench_loudness(const char *url) {
+  int cores = (int) sysconf(_SC_NPROCESSORS_ONLN);
+  int nb_files = runs * cores;
+  ap_loudness_t *loudness;
+  const char **urls;
+  double elapsed, gain, unity, normalized, measured;
+  int64_t start;
+  int i, ret;
+
+  urls = av_malloc_array(nb_files, sizeof(char *));
+  loudness = av_malloc_array(nb_files, sizeof(ap_loudness_t));
+  if (!urls || !loudness) {
+    av_free(urls);
+    av_free(loudness);
+    return FAILURE;
+  }
+  for (i = 0; i < nb_files; i++)
+    urls[i] = url;
+
+  start = now_us();
+  ret = ap_scan_loudness(urls, nb_files, loudness, 0, NULL);
+  elapsed = (now_us() - start) / 1000000.0;
+  if (ret == SUCCESS) {
+    printf("loudness %d files on %d cores %7.2f s %7.1f files/s\n", nb_files,
+           cores, elapsed, nb_files / elapsed);
+    printf("loudness integrated %6.2f LUFS range %5.2f LU true peak %6.2f dBTP\n",
+           loudness[0].integrated_lufs, loudness[0].range_lu,
+           loudness[0].true_peak_dbtp);
+  }
+
+  if (ret == SUCCESS) {
+    gain = ap_normalization_gain(&loudness[0], LOUDNESS_TARGET_LUFS);
+    unity = rendered_power(url, NULL);
+    normalized = rendered_power(url, &loudness[0]);
+    if (unity <= 0 || normalized <= 0) {
+      ret = FAILURE;
+    } else {
+      measured = 10 * log10(normalized / unity);
+      printf("loudness gain %6.2f dB measured %6.2f dB\n", gain, measured);
+      if (fabs(measured - gain) > LOUDNESS_GAIN_TOLERANCE_DB) {
+        log_error("loudness: gain off by more than %.1f dB",
+                  LOUDNESS_GAIN_TOLERANCE_DB);
+        ret = FAILURE;
+      }
+    }
+  }
+
+  av_free(urls);
+  av_free(loudness);
+  return ret;
+}
+
+/* milliseconds of url rendered, trimming its silence if trim, the render time
+ * in us into elapsed. -1 on failure */
+static int64_t trimmed_ms(const char *url, int trim, int64_t *elapsed) {
+  int64_t start, ret = -1;
+  int rate;
+  player_t *player = create_player(NULL);
+  if (!player)
+    return -1;
+
+  ap_set_render_mode(player, 1);
+  ap_set_silence_trim(player, trim, SILENCE_THRESHOLD_DB, SILENCE_MIN_MS, trim);
+  ap_set_datasource(player, url);
+  played_frames = 0;
+  start = now_us();
+  if (play_track(player) >= 0)
+    ret = played_frames;
+  *elapsed = now_us() - start;
+  rate = player->sdl_sample_rate;
+  ap_delete(player);
+  return ret < 0 ? -1 : ret * 1000 / rate;
+}
+
+static int bench_silence(const char *url) {
+  char dir[] = "/tmp/andrudiobench.XXXXXX";
+  int64_t full, cold, warm, full_us, cold_us, warm_us;
+  int ret = SUCCESS;
+
+  if (!mkdtemp(dir)) {
+    log_error("silence: %s", strerror(errno));
+    return FAILURE;
+  }
+  ap_set_cache_dir(dir);
+
+  if ((full = trimmed_ms(url, 0, &full_us)) < 0
+      || (cold = trimmed_ms(url, 1, &cold_us)) < 0
+      || (warm = trimmed_ms(url, 1, &warm_us)) < 0) {
+    ret = FAILURE;
+  } else {
+    printf("silence untrimmed %8"PRId64" ms in %8.1f ms\n", full,
+           full_us / 1000.0);
+    printf("silence trimmed   %8"PRId64" ms in %8.1f ms\n", cold,
+           cold_us / 1000.0);
+    printf("silence cached    %8"PRId64" ms in %8.1f ms\n", warm,
+           warm_us / 1000.0);
+    if (llabs(warm - cold) > SILENCE_TOLERANCE_MS) {
+      log_error("silence: cached play off by more than %d ms",
+                SILENCE_TOLERANCE_MS);
+      ret = FAILURE;
+    }
+  }
+
+  ap_set_cache_dir(NULL);
+  clear_dir(dir);
+  rmdir(dir);
+  return ret;
+}
+
+/* wait for the seek started at start to complete, returns the time taken in
+ * us or -1 */
+static int64_t wait_seek(int64_t start) {
+  struct timespec deadline;
+  int64_t ret = -1;
+
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += 10;
+
+  pthread_mutex_lock(&lock);
+  while (!seek_time && !failed) {
+    if (pthread_cond_timedwait(&cond, &lock, &deadline) != 0)
+      break;
+  }
+  if (seek_time)
+    ret = seek_time - start;
+  seek_time = 0;
+  pthread_mutex_unlock(&lock);
+  return ret;
+}
+
+/* play url with a seek index of mode and, if wait_index, wait for it to be
+ * complete. The mean and max seek latency in us go to mean and max */
+static int seek_latency(const char *url, int mode, int wait_index,
+                        int64_t *mean, int64_t *max) {
+  int64_t duration, t;
+  int i, ret = SUCCESS;
+  player_t *player = create_player(NULL);
+  if (!player)
+    return FAILURE;
+
+  ap_set_seek_index(player, mode);
+  ap_set_datasource(player, url);
+  ap_prepare_async(player);
+  if (wait_first_sample(now_us(), 10000) < 0
+      || (duration = ap_get_duration(player)) <= 0) {
+    log_error("seek: cannot play %s", url);
+    ap_delete(player);
+    return FAILURE;
+  }
+
+  for (i = 0; wait_index && !player->seek_index.complete; i++) {
+    if (i == SCAN_TIMEOUT_S * 10) {
+      log_error("seek: index not complete after %d s", SCAN_TIMEOUT_S);
+      ap_delete(player);
+      return FAILURE;
+    }
+    usleep(100000);
+  }
+
+  *mean = *max = 0;
+  for (i = 0; i < SEEK_COUNT && ret == SUCCESS; i++) {
+    //spread over the track, not in order so each seek jumps
+    t = now_us();
+    ap_seek(player, duration * 1000 * ((i * 7) % SEEK_COUNT) / SEEK_COUNT, 0);
+    if ((t = wait_seek(t)) < 0) {
+      log_error("seek: no seek complete");
+      ret = FAILURE;
+      break;
+    }
+    *mean += t;
+    *max = FFMAX(*max, t);
+  }
+  *mean /= SEEK_COUNT;
+  ap_delete(player);
+  return ret;
+}
+
+static int bench_seek(const char *url) {
+  char dir[] = "/tmp/andrudiobench.XXXXXX";
+  int64_t plain_mean, plain_max, scan_mean, scan_max, cached_mean, cached_max;
+  int ret;
+
+  if (!mkdtemp(dir)) {
+    log_error("seek: %s", strerror(errno));
+    return FAILURE;
+  }
+  ap_set_cache_dir(dir);
+
+  ret = seek_latency(url, 0, 0, &plain_mean, &plain_max);
+  if (ret == SUCCESS)
+    ret = seek_latency(url, AP_SEEK_INDEX_RECORD | AP_SEEK_INDEX_SCAN, 1,
+                       &scan_mean, &scan_max);
+  if (ret == SUCCESS)
+    ret = seek_latency(url, AP_SEEK_INDEX_RECORD, 0, &cached_mean, &cached_max);
+  if (ret == SUCCESS) {
+    printf("seek no index mean %8.2f ms max %8.2f ms\n", plain_mean / 1000.0,
+           plain_max / 1000.0);
+    printf("seek scanned   mean %8.2f ms max %8.2f ms\n", scan_mean / 1000.0,
+           scan_max / 1000.0);
+    printf("seek cached    mean %8.2f ms max %8.2f ms\n", cached_mean / 1000.0,
+           cached_max / 1000.0);
+  }
+
+  ap_set_cache_dir(NULL);
+  clear_dir(dir);
+  rmdir(dir);
+  return ret;
+}
+
+static int duration_sink(void *opaque, int index, int sample_rate, int channels,
+                         const char *data, int len) {
+  *(int64_t *) opaque += (int64_t) len / (channels * 2) * 1000000 / sample_rate;
+  return 0;
+}
+
+/* the duration of url in ms as estimated by the container, or -1 */
+static int64_t container_duration(const char *url) {
+  AVFormatContext *ic = NULL;
+  int64_t ms = -1;
+
+  if (avformat_open_input(&ic, url, NULL, NULL) < 0)
+    return -1;
+  if (avformat_find_stream_info(ic, NULL) >= 0 && ic->duration > 0)
+    ms = ic->duration / 1000;
+  avformat_close_input(&ic);
+  return ms;
+}
+
+/* prepare url with the exact duration, returns it in ms and the time from
+ * prepare to EVENT_DURATION_UPDATED in us into elapsed, or -1 */
+static int64_t exact_duration(const char *url, int64_t *elapsed) {
+  struct timespec deadline;
+  int64_t start, ret = -1;
+  player_t *player = create_player(NULL);
+  if (!player)
+    return -1;
+
+  ap_set_exact_duration(player, 1);
+  ap_set_datasource(player, url);
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += SCAN_TIMEOUT_S;
+  start = now_us();
+  ap_prepare_async(player);
+
+  pthread_mutex_lock(&lock);
+  while (!duration_time && !failed) {
+    if (pthread_cond_timedwait(&cond, &lock, &deadline) != 0)
+      break;
+  }
+  if (duration_time) {
+    ret = updated_duration_ms;
+    *elapsed = duration_time - start;
+  }
+  duration_time = 0;
+  failed = 0;
+  pthread_mutex_unlock(&lock);
+
+  ap_delete(player);
+  return ret;
+}
+
+static int bench_duration(const char *url) {
+  char dir[] = "/tmp/andrudiobench.XXXXXX";
+  int64_t decoded_us = 0, header, scanned, cached, scan_us, cached_us;
+  int ret = SUCCESS;
+
+  if (!mkdtemp(dir)) {
+    log_error("duration: %s", strerror(errno));
+    return FAILURE;
+  }
+  ap_set_cache_dir(dir);
+
+  header = container_duration(url);
+  if (ap_decode_file(url, AV_SAMPLE_FMT_S16, duration_sink, &decoded_us) < 0
+      || (scanned = exact_duration(url, &scan_us)) < 0
+      || (cached = exact_duration(url, &cached_us)) < 0) {
+    log_error("duration: cannot scan %s", url);
+    ret = FAILURE;
+  } else {
+    printf("duration container %8"PRId64" ms decoded %8"PRId64" ms\n", header,
+           decoded_us / 1000);
+    printf("duration scanned   %8"PRId64" ms in %8.1f ms\n", scanned,
+           scan_us / 1000.0);
+    printf("duration cached    %8"PRId64" ms in %8.1f ms\n", cached,
+           cached_us / 1000.0);
+    if (llabs(scanned - decoded_us / 1000) > DURATION_TOLERANCE_MS
+        || llabs(cached - decoded_us / 1000) > DURATION_TOLERANCE_MS) {
+      log_error("duration: off by more than %d ms", DURATION_TOLERANCE_MS);
+      ret = FAILURE;
+    }
+  }
+
+  ap_set_cache_dir(NULL);
+  clear_dir(dir);
+  rmdir(dir);
+  return ret;
+}
+
+static int bench_probe(const char *url) {
+  int cores = (int) sysconf(_SC_NPROCESSORS_ONLN);
+  int nb_files = runs * cores;
+  ap_probe_info_t info, *infos;
+  ap_cover_art_t art;
+  const char **urls;
+  player_t *player;
+  int64_t probe_us = 0, player_us = 0, start, duration_ms = 0;
+  double elapsed;
+  int i, ret = SUCCESS;
+
+  for (i = 0; i < runs && ret == SUCCESS; i++) {
+    start = now_us();
+    if (ap_probe(url, &info) < 0) {
+      log_error("probe: cannot probe %s", url);
+      return FAILURE;
+    }
+    probe_us += now_us() - start;
+    if (i < runs - 1)
+      ap_probe_free(&info);
+
+    //what a scan without ap_probe() does
+    start = now_us();
+    if (!(player = create_player(NULL))) {
+      ret = FAILURE;
+      break;
+    }
+    ap_set_datasource(player, url);
+    ap_prepare_async(player);
+    if (wait_first_sample(start, 10000) < 0) {
+      log_error("probe: player failed on %s", url);
+      ret = FAILURE;
+    }
+    duration_ms = ap_get_duration(player);
+    if (i < runs - 1 || ap_get_cover_art(player, &art) < 0)
+      memset(&art, 0, sizeof(art));
+    ap_delete(player);
+    player_us += now_us() - start;
+  }
+
+  if (ret == SUCCESS) {
+    printf("probe %s %d Hz %d channels %"PRId64" kbps %"PRId64" ms, %d tags\n",
+           info.codec, info.sample_rate, info.channels, info.bit_rate / 1000,
+           info.duration_us / 1000, av_dict_count(info.tags));
+    printf("probe ap_probe %8.2f ms player %8.2f ms per file\n",
+           probe_us / 1000.0 / runs, player_us / 1000.0 / runs);
+    if (info.sample_rate <= 0 || info.channels <= 0
+        || llabs(info.duration_us / 1000 - duration_ms) > DURATION_TOLERANCE_MS) {
+      log_error("probe: stream info differs from the player's");
+      ret = FAILURE;
+    }
+    //the player's outlives it
+    printf("probe cover art %s %d bytes\n", art.mime_type, art.size);
+    if (art.size != info.cover_art.size
+        || (art.size && memcmp(art.data, info.cover_art.data, art.size))) {
+      log_error("probe: cover art differs from the player's");
+      ret = FAILURE;
+    }
+    ap_cover_art_free(&art);
+  }
+  ap_probe_free(&info);
+  if (ret != SUCCESS)
+    return ret;
+
+  urls = av_malloc_array(nb_files, sizeof(char *));
+  infos = av_mallocz_array(nb_files, sizeof(ap_probe_info_t));
+  if (!urls || !infos) {
+    av_free(urls);
+    av_free(infos);
+    return FAILURE;
+  }
+  for (i = 0; i < nb_files; i++)
+    urls[i] = url;
+
+  start = now_us();
+  ret = ap_probe_files(urls, nb_files, infos, 0, NULL);
+  elapsed = (now_us() - start) / 1000000.0;
+  if (ret == SUCCESS)
+    printf("probe %d files on %d cores %7.3f s %8.1f files/s\n", nb_files,
+           cores, elapsed, nb_files / elapsed);
+
+  for (i = 0; i < nb_files; i++)
+    ap_probe_free(&infos[i]);
+  av_free(urls);
+  av_free(infos);
+  return ret;
+}
+
+static const double tempos[] = {0.5, 1.25, 1.5, 2.0, 3.0};
+
+/* render url at tempo, the output in ms into out_ms and the render time in us
+ * into elapsed. Returns the audio clock at the end in ms or -1 */
+static int64_t render_tempo(const char *url, double tempo, int64_t *out_ms,
+                            int64_t *elapsed) {
+  int64_t start, ret = -1;
+  double clock;
+  player_t *player = create_player(NULL);
+  if (!player)
+    return -1;
+
+  ap_set_render_mode(player, 1);
+  ap_set_tempo(player, tempo);
+  ap_set_datasource(player, url);
+  played_frames = 0;
+  start = now_us();
+  if ((clock = play_track(player)) >= 0) {
+    *elapsed = now_us() - start;
+    *out_ms = played_frames * 1000 / player->sdl_sample_rate;
+    ret = (int64_t) (clock * 1000);
+  }
+  ap_delete(player);
+  return ret;
+}
+
+static int bench_tempo(const char *url) {
+  int64_t length, out_ms, clock, unity_us, us;
+  int i, ret = SUCCESS;
+
+  if ((length = render_tempo(url, 1.0, &out_ms, &unity_us)) < 0) {
+    log_error("tempo: cannot render %s", url);
+    return FAILURE;
+  }
+  printf("tempo 1.00 %8"PRId64" ms rendered in %8.1f ms\n", out_ms,
+         unity_us / 1000.0);
+
+  for (i = 0; i < FF_ARRAY_ELEMS(tempos) && ret == SUCCESS; i++) {
+    if ((clock = render_tempo(url, tempos[i], &out_ms, &us)) < 0) {
+      ret = FAILURE;
+      break;
+    }
+    printf("tempo %.2f %8"PRId64" ms rendered in %8.1f ms, stretch %+7.2f ms "
+               "per second of track\n", tempos[i], out_ms, us / 1000.0,
+           (us - unity_us) / (double) length);
+    if (llabs(out_ms - (int64_t) (length / tempos[i])) > TEMPO_TOLERANCE_MS
+        || llabs(clock - length) > TEMPO_TOLERANCE_MS) {
+      log_error("tempo: %.2f output %"PRId64" ms clock %"PRId64" ms for %"
+                    PRId64" ms", tempos[i], out_ms, clock, length);
+      ret = FAILURE;
+    }
+  }
+  return ret;
+}
+
+/* render url, equalized with gains_db unless it is NULL, the render time in us
+ * into elapsed and the stats at the end into stats */
+static int render_eq(const char *url, const double *gains_db, int64_t *elapsed,
+                     ap_stats_t *stats) {
+  int64_t start;
+  int ret = FAILURE;
+  player_t *player = create_player(NULL);
+  if (!player)
+    return FAILURE;
+
+  ap_set_render_mode(player, 1);
+  if (gains_db)
+    ap_set_graphic_eq(player, gains_db);
+  ap_set_datasource(player, url);
+  start = now_us();
+  if (play_track(player) >= 0) {
+    *elapsed = now_us() - start;
+    ret = ap_get_stats(player, stats);
+  }
+  ap_delete(player);
+  return ret;
+}
+
+static int bench_eq(const char *url) {
+  double gains[AP_EQ_GRAPHIC_BANDS], total = 0;
+  ap_stats_t stats;
+  int64_t off_us, on_us;
+  int i, ret = SUCCESS;
+
+  for (i = 0; i < AP_EQ_GRAPHIC_BANDS; i++)
+    gains[i] = i % 2 ? -6 : 6;
+
+  if (render_eq(url, NULL, &off_us, &stats) < 0
+      || render_eq(url, gains, &on_us, &stats) < 0) {
+    log_error("eq: cannot render %s", url);
+    return FAILURE;
+  }
+  printf("eq off %8.1f ms, %d bands %8.1f ms\n", off_us / 1000.0,
+         stats.eq_bands, on_us / 1000.0);
+
+  for (i = 0; i < AP_EQ_GRAPHIC_BANDS; i++) {
+    printf("eq band %2d %8.1f Hz %7.1f us per second of audio\n", i,
+           31.25 * (1 << i), stats.eq_band_cost_us[i]);
+    if (stats.eq_band_cost_us[i] <= 0)
+      ret = FAILURE;
+    total += stats.eq_band_cost_us[i];
+  }
+  printf("eq total %7.1f us per second of audio\n", total);
+  if (stats.eq_bands != AP_EQ_GRAPHIC_BANDS || total >= EQ_COST_LIMIT_US) {
+    log_error("eq: %d bands cost %.1f us per second", stats.eq_bands, total);
+    ret = FAILURE;
+  }
+  return ret;
+}
+
+typedef struct mirror_t {
+  const char *name;
+  //before the response is sent, -1 to never send one
+  int delay_ms;
+  int status;
+  int fd;
+  int port;
+  pthread_t thread;
+  //connections the client closed while waiting for the response
+  atomic_int cancelled;
+} mirror_t;
+
+static char *mirror_data;
+static long mirror_size;
+
+static void mirror_respond(mirror_t *m, int fd) {
+  struct pollfd pfd = {fd, POLLIN, 0};
+  char buf[4096];
+  long sent;
+  int len;
+
+  //the request, then a client that gives up while waiting closes the socket
+  if (recv(fd, buf, sizeof(buf), 0) <= 0)
+    return;
+  if (poll(&pfd, 1, m->delay_ms < 0 ? 30000 : m->delay_ms) > 0
+      && recv(fd, buf, sizeof(buf), 0) <= 0) {
+    atomic_fetch_add(&m->cancelled, 1);
+    return;
+  }
+  if (m->delay_ms < 0)
+    return;
+
+  if (m->status != 200) {
+    len = snprintf(buf, sizeof(buf), "HTTP/1.0 %d Not Found\r\n"
+        "Content-Length: 0\r\n\r\n", m->status);
+    send(fd, buf, len, MSG_NOSIGNAL);
+    return;
+  }
+  len = snprintf(buf, sizeof(buf), "HTTP/1.0 200 OK\r\n"
+      "Content-Type: application/octet-stream\r\n"
+      "Content-Length: %ld\r\n\r\n", mirror_size);
+  if (send(fd, buf, len, MSG_NOSIGNAL) != len)
+    return;
+  //until the player is deleted and closes the connection
+  for (sent = 0; sent < mirror_size; sent += len) {
+    if ((len = send(fd, mirror_data + sent, FFMIN(65536, mirror_size - sent),
+                    MSG_NOSIGNAL)) <= 0)
+      break;
+  }
+}
+
+static void *mirror_server(mirror_t *m) {
+  int fd;
+  while ((fd = accept(m->fd, NULL, NULL)) >= 0) {
+    mirror_respond(m, fd);
+    close(fd);
+  }
+  return NULL;
+}
+
+static int start_mirror(mirror_t *m) {
+  struct sockaddr_in addr;
+  socklen_t len = sizeof(addr);
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  atomic_init(&m->cancelled, 0);
+
+  if ((m->fd = socket(AF_INET, SOCK_STREAM, 0)) < 0
+      || bind(m->fd, (struct sockaddr *) &addr, sizeof(addr)) < 0
+      || listen(m->fd, 16) < 0
+      || getsockname(m->fd, (struct sockaddr *) &addr, &len) < 0
+      || pthread_create(&m->thread, NULL, (void *) mirror_server, m) != 0) {
+    log_error("mirrors: local server failed: %s", strerror(errno));
+    return FAILURE;
+  }
+  m->port = ntohs(addr.sin_port);
+  return SUCCESS;
+}
+
+static int read_file(const char *path) {
+  FILE *f = fopen(path, "rb");
+  int ret = FAILURE;
+
+  if (!f) {
+    log_error("mirrors: %s: %s", path, strerror(errno));
+    return FAILURE;
+  }
+  if (!fseek(f, 0, SEEK_END) && (mirror_size = ftell(f)) > 0
+      && !fseek(f, 0, SEEK_SET) && (mirror_data = av_malloc(mirror_size))
+      && fread(mirror_data, 1, mirror_size, f) == (size_t) mirror_size)
+    ret = SUCCESS;
+  fclose(f);
+  return ret;
+}
+
+static int bench_mirrors(const char *path) {
+  mirror_t mirrors[] = {
+      {"silent", -1, 200},
+      {"slow", 2000, 200},
+      {"missing", 0, 404},
+      {"fast", 100, 200},
+  };
+  const int nb_mirrors = sizeof(mirrors) / sizeof(mirrors[0]);
+  const int fast = 3;
+  char urls[4][64];
+  const char *url_list[4];
+  int64_t latency, latency_total = 0, latency_max = 0, start;
+  int i, j, won = 0, ret = SUCCESS;
+
+  if (read_file(path) < 0)
+    return FAILURE;
+  for (i = 0; i < nb_mirrors; i++) {
+    if (start_mirror(&mirrors[i]) < 0)
+      return FAILURE;
+    snprintf(urls[i], sizeof(urls[i]), "http://127.0.0.1:%d/%s",
+             mirrors[i].port, mirrors[i].name);
+    url_list[i] = urls[i];
+  }
+
+  for (i = 0; i < runs && ret == SUCCESS; i++) {
+    player_t *player = create_player(NULL);
+    if (!player) {
+      ret = FAILURE;
+      break;
+    }
+
+    start = now_us();
+    ap_set_datasources(player, url_list, nb_mirrors);
+    ap_prepare_async(player);
+    if ((latency = wait_first_sample(start, 10000)) < 0) {
+      log_error("mirrors: no sample");
+      ret = FAILURE;
+    } else {
+      latency_total += latency;
+      latency_max = FFMAX(latency_max, latency);
+      if (!strcmp(player->url, urls[fast]))
+        won++;
+      else
+        log_error("mirrors: %s won", player->url);
+    }
+
+    //the losers were cancelled when the fast mirror won
+    for (j = 0; j < MIRROR_CANCEL_MS / 10; j++) {
+      if (mirrors[0].cancelled > i && mirrors[1].cancelled > i)
+        break;
+      usleep(10000);
+    }
+    if (mirrors[0].cancelled <= i || mirrors[1].cancelled <= i) {
+      log_error("mirrors: losers still connected after %d ms",
+                MIRROR_CANCEL_MS);
+      ret = FAILURE;
+    }
+    ap_delete(player);
+  }
+
+  for (j = 0; j < nb_mirrors; j++) {
+    shutdown(mirrors[j].fd, SHUT_RDWR);
+    close(mirrors[j].fd);
+    pthread_join(mirrors[j].thread, NULL);
+  }
+  av_freep(&mirror_data);
+
+  if (i == 0)
+    return FAILURE;
+  printf("mirrors first sample avg %6.1f ms max %6.1f ms, fast mirror won %d/%d\n",
+         latency_total / 1000.0 / i, latency_max / 1000.0, won, i);
+  printf("mirrors cancelled silent %d slow %d\n", (int) mirrors[0].cancelled,
+         (int) mirrors[1].cancelled);
+  return ret == SUCCESS && won == i ? SUCCESS : FAILURE;
+}
+
+static void usage() {
+  printf("usage: andrudiobench <benchmark> [-n runs] [-nice n | -fifo prio] "
+             "[-cpus mask] url\n");
+  printf("  ttfs\ttime to first sample\n");
+  printf("  engine\tplayer memory, latency and threads, threads vs engine\n");
+  printf("  rt\tno allocations of its own in steady state playback\n");
+  printf("  allocs\tallocations per minute over several tracks\n");
+  printf("  decode\toffline decode throughput on 1 to N cores\n");
+  printf("  length\tsample exact length, offline and rendered [-frames n]\n");
+  printf("  cancel\treset and delete latency during a stuck prepare\n");
+  printf("  spectrum\tanalyzer tap cost and update rate\n");
+  printf("  peaks\twaveform overview, decoded and cached\n");
+  printf("  loudness\tloudness scan throughput and normalization gain\n");
+  printf("  silence\tleading and trailing silence, decoded and cached\n");
+  printf("  seek\tseek latency without and with a seek index\n");
+  printf("  duration\texact duration by header scan, scanned and cached\n");
+  printf("  probe\tap_probe() against a player, and batch throughput\n");
+  printf("  tempo\ttime-stretch cost and output length per tempo\n");
+  printf("  eq\t10-band equalizer cost per band\n");
+  printf("  mirrors\tprepare racing local http mirrors of the file url\n");
+}
+
+int main(int argc, char **argv) {
+  const char *url = NULL;
+  const char *name;
+  ap_thread_config_t config;
+  int i, ret;
+
+  memset(&config, 0, sizeof(config));
+
+  if (argc < 3) {
+    usage();
+    return 1;
+  }
+
+  name = argv[1];
+  for (i = 2; i < argc; i++) {
+    if (!strcmp(argv[i], "-n") && i + 1 < argc)
+      runs = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-frames") && i + 1 < argc)
+      expected_frames = strtoll(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "-nice") && i + 1 < argc)
+      config.priority = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-fifo") && i + 1 < argc) {
+      config.fifo = 1;
+      config.priority = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "-cpus") && i + 1 < argc)
+      config.cpu_mask = strtoull(argv[++i], NULL, 0);
+    else
+      url = argv[i];
+  }
+
+  if (!url || runs <= 0) {
+    usage();
+    return 1;
+  }
+
+  ap_init();
+  ap_set_thread_config(&config);
+
+  if (!strcmp(name, "ttfs")) {
+    ret = bench_ttfs(url);
+  } else if (!strcmp(name, "engine")) {
+    ret = bench_engine(url);
+  } else if (!strcmp(name, "rt")) {
+    ret = bench_rt(url);
+  } else if (!strcmp(name, "allocs")) {
+    ret = bench_allocs(url);
+  } else if (!strcmp(name, "decode")) {
+    ret = bench_decode(url);
+  } else if (!strcmp(name, "length")) {
+    ret = bench_length(url);
+  } else if (!strcmp(name, "cancel")) {
+    ret = bench_cancel();
+  } else if (!strcmp(name, "spectrum")) {
+    ret = bench_spectrum(url);
+  } else if (!strcmp(name, "peaks")) {
+    ret = bench_peaks(url);
+  } else if (!strcmp(name, "loudness")) {
+    ret = bench_loudness(url);
+  } else if (!strcmp(name, "silence")) {
+    ret = bench_silence(url);
+  } else if (!strcmp(name, "seek")) {
+    ret = bench_seek(url);
+  } else if (!strcmp(name, "duration")) {
+    ret = bench_duration(url);
+  } else if (!strcmp(name, "probe")) {
+    ret = bench_probe(url);
+  } else if (!strcmp(name, "tempo")) {
+    ret = bench_tempo(url);
+  } else if (!strcmp(name, "eq")) {
+    ret = bench_eq(url);
+  } else if (!strcmp(name, "mirrors")) {
+    ret = bench_mirrors(url);
+  } else {
+    usage();
+    ret = FAILURE;
+  }
+
+  ap_uninit();
+  return ret == SUCCESS ? 0 : 1;
+}
@@ -0,0 +1,22 @@
+#!/bin/bash
+
+###########################################################################
+# Builds and runs the headless benchmarks in bench.c against the native
+# code of this library. No audio output is needed, ffmpeg needs to be
+# installed on your system.
+#
+# usage: ./bench.sh <benchmark> [-n runs] url
+###########################################################################
+
+
+cd `dirname $0`
+
+EXE=./andrudiobench
+SRC_DIR=../lib/src/main/native
+SOURCES=`ls ${SRC_DIR}/*.c | grep -v andrudio.c`
+
+gcc -g -O2 -DUSE_COLOR=1 -DAS_DEBUG_LEVEL=AS_DEBUG_LEVEL_WARN -DAP_DEBUG_ALLOC bench.c ${SOURCES} \
+  -I${SRC_DIR} -o $EXE \
+  -lz -lbz2 -lc -lm -lavutil -lavcodec -lavformat -lavresample -lpthread || exit 1
+
+$EXE "$@"
@@ -23,6 +23,7 @@ static ao_device *device = NULL;
 
 static int seek_minute = 1;
 static int seek_relative = 0;
+static int jitter_buffer = 0;
 
 static const char *url =
     "http://www.audiocheck.net/Audio/audiocheck.net_putyourhands.mp3";
@@ -92,6 +93,18 @@ static void on_event(player_t *player, audio_event_t event, int arg1, int arg2)
     case EVENT_SEEK_COMPLETE:
       break;
 
+    case EVENT_BUFFERING_START:
+      log_info("on_event::BUFFERING_START underrun: %d", arg1);
+      break;
+
+    case EVENT_BUFFERING_END:
+      log_info("on_event::BUFFERING_END after %dms", arg1);
+      break;
+
+    case EVENT_DURATION_UPDATED:
+      log_info("on_event::DURATION_UPDATED %dms", arg1);
+      break;
+
     case EVENT_STATE_CHANGE:
       log_trace("on_event::STATE_CHANGE() %s->%s",
                 ap_get_state_name(old_state), ap_get_state_name(state));
@@ -144,7 +157,14 @@ static void do_exit(void) {
 }
 
 static void print_status(player_t *player) {
+  ap_stats_t stats;
   log_debug("print_status() %s", ap_get_state_name(player->state));
+  if (player->jitter.enabled) {
+    ap_get_stats(player, &stats);
+    log_debug("buffered: %dms target: %dms jitter: %dms underruns: %d (%dms)",
+              stats.buffered_ms, stats.buffer_target_ms,
+              stats.arrival_jitter_ms, stats.underruns, stats.underrun_ms);
+  }
 }
 
 static void event_loop(player_t *player) {
@@ -275,6 +295,13 @@ static void event_loop(player_t *player) {
       case 'o':
         ap_seek(player, 60000, 0);
         break;
+      case 'j':
+        jitter_buffer = !jitter_buffer;
+        log_info("jitter buffer %s for the next track",
+                 jitter_buffer ? "enabled" : "disabled");
+        ap_set_jitter_buffer(player, jitter_buffer ? JITTER_DEFAULT_MIN_MS : 0,
+                             JITTER_DEFAULT_MAX_MS);
+        break;
       case 0x1b:
         read(STDIN_FILENO, &c, 1);
         if ((char) c == 0x5b) {
@@ -328,6 +355,7 @@ static void event_loop(player_t *player) {
         log_info("m:\tprint metadata");
         log_info("o:\tseek to one minute");
         log_info("l:\ttoggle loop mode");
+        log_info("j:\ttoggle the jitter buffer");
         log_info("right arrow:\tseek +10 seconds");
         log_info("left arrow:\tseek -10 seconds");
         log_info(
@@ -39,11 +39,12 @@ else
 fi
 
 SRC_DIR=../lib/src/main/native
+SOURCES=`ls ${SRC_DIR}/*.c | grep -v andrudio.c`
 
 
 
-gcc -g -O0 -DUSE_COLOR=1   $EXTRA_FLAGS main.c ${SRC_DIR}/player_thread.c \
-  ${SRC_DIR}/audioplayer.c  -I${SRC_DIR}  -o $EXE  \
+gcc -g -O0 -DUSE_COLOR=1   $EXTRA_FLAGS main.c ${SOURCES} \
+  -I${SRC_DIR}  -o $EXE  \
   -lz -lbz2 -lc -lm -lavutil  ${LDFLAGS} -lavcodec -lavformat -lavresample -lpthread || exit 1
 
 WRAPPER=""